@@ -55,8 +55,9 @@ void logSetCallback(logCallback callback);
 void logSetColorize(bool enabled);
 bool logColorized(void);
 
-// Adds a prefix to the head of all messages. The string must be valid until
-// logSetPrefix is called again with a NULL parameter.
+// Adds a prefix to the head of all messages logged by the calling thread. The
+// string must be valid until logSetPrefix is called again with a NULL
+// parameter.
 void logSetPrefix(const char* prefix);
 const char* logPrefix(void);
 
@@ -64,6 +65,12 @@ const char* logPrefix(void);
 void logSetThreshold(LogLevel level);
 LogLevel logThreshold(void);
 
+// Holds the log lock so that a multithreaded process can fork without another
+// thread owning it, which would deadlock the first print in the child. The
+// lock must be released by logRelease in both processes after the fork.
+void logHold(void);
+void logRelease(void);
+
 #define PASSES_LOG_THRESHOLD(x) ((x) >= ___logThreshold)
 
 // The logging system declares its print statements using macros. These macros
@@ -30,6 +30,7 @@
 // module, or if the code stops working in a new kernel version.
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "ip.h"
@@ -62,6 +63,13 @@ void netCleanup(void);
 // error. If an error occurs, the active namespace may no longer be valid.
 netContext* netOpenNamespace(const char* name, bool create, bool excl, int* err);
 
+// Creates a new anonymous namespace and switches to it. The namespace is not
+// visible to iproute2, and it is destroyed by the kernel once the context is
+// closed and no processes remain in it. Returns a context for the namespace on
+// success, or NULL on error. If err is not NULL, it is set to the error code on
+// error.
+netContext* netOpenPrivateNamespace(int* err);
+
 // Opens a namespace using existing storage space. If reusing is false, then the
 // space is completely initialized. If reusing is true, then the context must
 // have been previously created with netOpenNamespace and subsequently
@@ -72,6 +80,12 @@ int netOpenNamespaceInPlace(netContext* ctx, bool reusing, const char* name, boo
 // Invalidates a context so that its memory can be reused to create a new one.
 void netInvalidateContext(netContext* ctx);
 
+// Opens a file descriptor for a namespace without creating a context for it or
+// switching to it. The descriptor can be used with netCreateVethPairFd, and
+// must be closed by the caller. Returns the descriptor on success, or -1 on
+// error. If err is not NULL, it is set to the error code on error.
+int netOpenNamespaceFd(const char* name, int* err);
+
 // Frees resources associated with a context. This does not delete the
 // underlying namespace, or cause the active namespace to switch.
 void netCloseNamespace(netContext* ctx, bool inPlace);
@@ -102,6 +116,32 @@ int netEnumInterfaces(netIfCallback callback, netContext* ctx, void* userData);
 // new interfaces.
 int netCreateVethPair(const char* name1, const char* name2, netContext* ctx1, netContext* ctx2, const macAddr* addr1, const macAddr* addr2, int mtu, bool sync);
 
+// Same as netCreateVethPair, except that the namespace of the second endpoint
+// is given by a descriptor from netOpenNamespaceFd
+int netCreateVethPairFd(const char* name1, const char* name2, netContext* ctx1, int nsFd2, const macAddr* addr1, const macAddr* addr2, int mtu, bool sync);
+
+// Creates a point-to-point VXLAN interface in the namespace ctx. The tunnel's
+// UDP socket belongs to the namespace underlayCtx, where remoteAddr must be
+// reachable; this allows the interface to live in a private namespace while
+// its packets are carried by a physical network. localAddr may be 0 to let
+// the kernel choose the source address. Unknown destinations are sent to
+// remoteAddr and address learning is disabled. If addr is not NULL, it is used
+// as the MAC address of the interface. Returns 0 on success or an error code
+// otherwise.
+int netCreateVxlan(netContext* underlayCtx, netContext* ctx, const char* name, const macAddr* addr, int mtu, uint32_t vni, ip4Addr localAddr, ip4Addr remoteAddr, uint16_t port, bool sync);
+
+// Creates a VRF (virtual routing and forwarding) device. Packets received by
+// interfaces enslaved to the device (see netSetInterfaceMaster) are routed
+// using the given routing table, and the local and connected routes for their
+// addresses are placed in that table. Requires Linux 4.3 or later. Returns 0 on
+// success or an error code otherwise.
+int netCreateVrf(netContext* ctx, const char* name, uint32_t table, bool sync);
+
+// Enslaves an interface to a master device, such as a VRF device. If masterIdx
+// is 0, the interface is released from its current master. Returns 0 on
+// success or an error code otherwise.
+int netSetInterfaceMaster(netContext* ctx, int devIdx, int masterIdx, bool sync);
+
 // Returns the interface index for an interface. On error, returns -1 and sets
 // err (if provided) to the error code.
 int netGetInterfaceIndex(netContext* ctx, const char* name, int* err);
@@ -110,6 +150,11 @@ int netGetInterfaceIndex(netContext* ctx, const char* name, int* err);
 // error code otherwise.
 int netMoveInterface(netContext* srcCtx, const char* intfName, int devIdx, netContext* dstCtx, int* newIdx);
 
+// Deletes an interface. If the interface is one end of a virtual Ethernet pair,
+// then the other end is also deleted. Returns 0 on success or an error code
+// otherwise.
+int netDeleteInterface(netContext* ctx, int devIdx, bool sync);
+
 // Modifies an IPv4 address for an interface. Interfaces may have multiple
 // addresses. If remove is true then the address is deleted. Otherwise, it is
 // added. subnetBits specifies the prefix length of the subnet. Any of the
@@ -153,6 +198,23 @@ int netAddStaticArp(netContext* ctx, const char* intfName, ip4Addr ip, const mac
 // the entry was not found in the cache.
 int netGetRemoteMacAddr(netContext* ctx, const char* intfName, ip4Addr ip, macAddr* result);
 
+typedef struct {
+	const char* intfName; // Interface connected to the remote host
+	ip4Addr ip;
+	bool found;           // Set if the MAC address was discovered
+	macAddr mac;
+} netArpTarget;
+
+// Discovers the MAC addresses of several remote hosts at once. ARP requests for
+// all of the targets are broadcast through packet sockets on their interfaces,
+// and are repeated for unanswered targets until every target has replied or
+// timeoutMs milliseconds have elapsed. The addresses of targets that did not
+// reply are then retrieved from the ARP cache, if possible. The interfaces must
+// be in the namespace of the context, which must be the active namespace.
+// Returns 0 on success, even if some addresses were not found, or an error code
+// otherwise.
+int netDiscoverRemoteMacAddrs(netContext* ctx, netArpTarget targets[], size_t count, int timeoutMs);
+
 // Retrieves the MAC address associated with a local interface. Returns 0 on
 // success or an error code otherwise.
 int netGetLocalMacAddr(netContext* ctx, const char* name, macAddr* result);
@@ -176,15 +238,15 @@ int netSetMartians(bool allow);
 // error code otherwise.
 int netSetIPv6(bool enabled);
 
-// Gets the garbage collector thresholds for the system-wide ARP hash table.
-// Must be called within the init namespace. Returns 0 on success or an error
-// code otherwise.
-int netGetArpTableSize(int* thresh1, int* thresh2, int* thresh3);
+// Reads an integer kernel parameter, given its dotted sysctl name (e.g.,
+// "net.core.netdev_max_backlog"). System-wide parameters must be read within
+// the init namespace. Returns 0 on success, ENOENT if the kernel does not
+// provide the parameter, or another error code otherwise.
+int netGetSysctl(const char* name, uint64_t* value);
 
-// Sets the garbage collector thresholds for the system-wide ARP hash table.
-// Must be called within the init namespace. Returns 0 on success or an error
-// code otherwise.
-int netSetArpTableSize(int thresh1, int thresh2, int thresh3);
+// Writes an integer kernel parameter. The semantics are the same as for
+// netGetSysctl.
+int netSetSysctl(const char* name, uint64_t value);
 
 typedef enum {
 	TableMain,
@@ -216,8 +278,9 @@ typedef enum {
 // interface through which the packets should be sent. The target gateway must
 // be reachable when this command is executed. Moreover, the all bits in dstAddr
 // not covered by subnetBits should be set to 0. If gatewayAddr is 0, then no
-// gateway is used. Returns 0 on success or an error code otherwise.
-int netModifyRoute(netContext* ctx, bool remove, uint8_t table, RoutingScope scope, RoutingCreator creator, ip4Addr dstAddr, uint8_t subnetBits, ip4Addr gatewayAddr, int dstDevIdx, bool sync);
+// gateway is used. Tables with identifiers above 255 may be used (e.g., for VRF
+// devices). Returns 0 on success or an error code otherwise.
+int netModifyRoute(netContext* ctx, bool remove, uint32_t table, RoutingScope scope, RoutingCreator creator, ip4Addr dstAddr, uint8_t subnetBits, ip4Addr gatewayAddr, int dstDevIdx, bool sync);
 
 // Modifies a new rule in Linux's policy routing system. If remove is true then
 // the rule is deleted, otherwise it is added. The rule matches packets within
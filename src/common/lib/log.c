@@ -47,7 +47,7 @@ static logCallback logFunc;
 static FILE* logStream;
 static bool closeLog;
 static bool useColors;
-static const char* ___logPrefix;
+static __thread const char* ___logPrefix; // Each thread has its own prefix
 LogLevel ___logThreshold;
 
 void logSetStream(FILE* output) {
@@ -272,3 +272,11 @@ void ___lprintRaw(const char* str) {
 	logPrint(str);
 	g_mutex_unlock(&logLock);
 }
+
+void logHold(void) {
+	g_mutex_lock(&logLock);
+}
+
+void logRelease(void) {
+	g_mutex_unlock(&logLock);
+}
@@ -58,12 +58,14 @@
 #include <net/if_arp.h>
 #include <netinet/in.h>
 #include <netinet/if_ether.h>
+#include <poll.h>
 #include <sched.h>
 #include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "ip.h"
@@ -79,7 +81,7 @@
 #include "net.inl"
 
 #define NET_NS_DIR        "/var/run/netns"
-#define CURRENT_NS_FILE   "/proc/self/ns/net"
+#define CURRENT_NS_FILE   "/proc/thread-self/ns/net" // Namespaces are per-thread
 #define INIT_NS_FILE      "/proc/1/ns/net"
 #define PSCHED_PARAM_FILE "/proc/net/psched"
 
@@ -87,12 +89,12 @@
 #define SYSCTL_MARTIANS         "/proc/sys/net/ipv4/conf/all/rp_filter"
 #define SYSCTL_MARTIANS_DEFAULT "/proc/sys/net/ipv4/conf/default/rp_filter"
 #define SYSCTL_DISABLE_IPV6     "/proc/sys/net/ipv6/conf/all/disable_ipv6"
-#define SYSCTL_ARP_GC_PREFIX    "/proc/sys/net/ipv4/neigh/default/gc_thresh"
 
 const int IP4_DEFAULT_MTU = ETH_DATA_LEN;
 
-static char namespacePrefix[PATH_MAX];
-static double pschedTicksPerMs = 1.0;
+// Each thread that uses the module calls netInit
+static __thread char namespacePrefix[PATH_MAX];
+static __thread double pschedTicksPerMs = 1.0;
 
 #if INTERFACE_BUF_LEN != IFNAMSIZ
 #error "Mismatch between internal interface name buffer length and the buffer length for this kernel."
@@ -292,6 +294,47 @@ abort:
 	return errno;
 }
 
+netContext* netOpenPrivateNamespace(int* err) {
+	int res = 0;
+	errno = 0;
+	if (unshare(CLONE_NEWNET) != 0) {
+		res = errno;
+		lprintf(LogError, "Failed to instantiate a new network namespace: %s\n", strerror(res));
+		goto abort;
+	}
+
+	errno = 0;
+	int nsFd = open(CURRENT_NS_FILE, O_RDONLY | O_CLOEXEC, 0);
+	if (nsFd == -1) {
+		res = errno;
+		lprintf(LogError, "Failed to open network namespace file '%s': %s\n", CURRENT_NS_FILE, strerror(res));
+		goto abort;
+	}
+
+	netContext* ctx = emalloc(sizeof(netContext));
+	res = nlNewContextInPlace(&ctx->nl);
+	if (res != 0) goto closeAbort;
+
+	int ioctlFd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0);
+	if (ioctlFd == -1) {
+		res = errno;
+		lprintf(LogError, "Failed to open ioctl socket: %s\n", strerror(res));
+		nlInvalidateContext(&ctx->nl);
+		goto closeAbort;
+	}
+
+	ctx->fd = nsFd;
+	ctx->ioctlFd = ioctlFd;
+	lprintf(LogDebug, "Opened private network namespace with context %p\n", ctx);
+	return ctx;
+closeAbort:
+	free(ctx);
+	close(nsFd);
+abort:
+	if (err != NULL) *err = res;
+	return NULL;
+}
+
 void netCloseNamespace(netContext* ctx, bool inPlace) {
 	netInvalidateContext(ctx);
 	if (!inPlace) free(ctx);
@@ -304,6 +347,23 @@ void netInvalidateContext(netContext* ctx) {
 	nlInvalidateContext(&ctx->nl);
 }
 
+int netOpenNamespaceFd(const char* name, int* err) {
+	char netNsPath[PATH_MAX];
+	int res = getNamespacePath(netNsPath, name);
+	if (res != 0) {
+		if (err != NULL) *err = res;
+		return -1;
+	}
+
+	errno = 0;
+	int fd = open(netNsPath, O_RDONLY | O_CLOEXEC, 0);
+	if (fd == -1) {
+		lprintf(LogError, "Failed to open network namespace file '%s': %s\n", netNsPath, strerror(errno));
+		if (err != NULL) *err = errno;
+	}
+	return fd;
+}
+
 int netDeleteNamespace(const char* name) {
 	char netNsPath[PATH_MAX];
 	int res = getNamespacePath(netNsPath, name);
@@ -577,10 +637,26 @@ cleanup:
 	return err;
 }
 
+int netDeleteInterface(netContext* ctx, int devIdx, bool sync) {
+	lprintf(LogDebug, "Deleting interface %d in namespace %p\n", devIdx, ctx);
+
+	nlContext* nl = &ctx->nl;
+	nlInitMessage(nl, RTM_DELLINK, (sync ? NLM_F_ACK : 0));
+
+	struct ifinfomsg ifi = { .ifi_family = AF_UNSPEC, .ifi_type = 0, .ifi_index = devIdx, .ifi_flags = 0, .ifi_change = 0 };
+	nlBufferAppend(nl, &ifi, sizeof(ifi));
+
+	return nlSendMessage(nl, sync, NULL, NULL);
+}
+
 int netCreateVethPair(const char* name1, const char* name2, netContext* ctx1, netContext* ctx2, const macAddr* addr1, const macAddr* addr2, int mtu, bool sync) {
+	return netCreateVethPairFd(name1, name2, ctx1, ctx2->fd, addr1, addr2, mtu, sync);
+}
+
+int netCreateVethPairFd(const char* name1, const char* name2, netContext* ctx1, int nsFd2, const macAddr* addr1, const macAddr* addr2, int mtu, bool sync) {
 	if (PASSES_LOG_THRESHOLD(LogDebug)) {
 		lprintHead(LogDebug);
-		lprintDirectf(LogDebug, "Creating virtual ethernet pair (%p:'%s', %p:'%s')", ctx1, name1, ctx2, name2);
+		lprintDirectf(LogDebug, "Creating virtual ethernet pair (%p:'%s', fd %d:'%s')", ctx1, name1, nsFd2, name2);
 		char mac[MAC_ADDR_BUFLEN];
 		if (addr1 != NULL) {
 			macAddrToString(addr1, mac);
@@ -654,7 +730,7 @@ int netCreateVethPair(const char* name1, const char* name2, netContext* ctx1, ne
 				nlPopAttr(nl);
 				nlPushAttr(nl, IFLA_NET_NS_FD);
 				{
-					nlBufferAppend(nl, &ctx2->fd, sizeof(ctx2->fd));
+					nlBufferAppend(nl, &nsFd2, sizeof(nsFd2));
 				}
 				nlPopAttr(nl);
 				if (addr2 != NULL) {
@@ -681,6 +757,154 @@ int netCreateVethPair(const char* name1, const char* name2, netContext* ctx1, ne
 	return nlSendMessage(nl, sync, NULL, NULL);
 }
 
+int netCreateVxlan(netContext* underlayCtx, netContext* ctx, const char* name, const macAddr* addr, int mtu, uint32_t vni, ip4Addr localAddr, ip4Addr remoteAddr, uint16_t port, bool sync) {
+	if (PASSES_LOG_THRESHOLD(LogDebug)) {
+		char localStr[IP4_ADDR_BUFLEN];
+		char remoteStr[IP4_ADDR_BUFLEN];
+		ip4AddrToString(localAddr, localStr);
+		ip4AddrToString(remoteAddr, remoteStr);
+		lprintf(LogDebug, "Creating VXLAN interface %p:'%s' with VNI %u from %s to %s:%u (underlay %p)\n", ctx, name, vni, localStr, remoteStr, port, underlayCtx);
+	}
+
+	// The kernel binds the tunnel socket in the namespace that receives the
+	// request, so we send it to the underlay and move the interface into ctx
+	nlContext* nl = &underlayCtx->nl;
+	nlInitMessage(nl, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL | (sync ? NLM_F_ACK : 0));
+
+	struct ifinfomsg ifi = { .ifi_family = AF_UNSPEC, .ifi_type = 0, .ifi_index = 0, .ifi_flags = 0, .ifi_change = UINT_MAX };
+	nlBufferAppend(nl, &ifi, sizeof(ifi));
+
+	nlPushAttr(nl, IFLA_IFNAME);
+	{
+		nlBufferAppend(nl, name, strlen(name) + 1);
+	}
+	nlPopAttr(nl);
+
+	nlPushAttr(nl, IFLA_NET_NS_FD);
+	{
+		nlBufferAppend(nl, &ctx->fd, sizeof(ctx->fd));
+	}
+	nlPopAttr(nl);
+
+	if (addr != NULL) {
+		nlPushAttr(nl, IFLA_ADDRESS);
+		{
+			nlBufferAppend(nl, addr->octets, MAC_ADDR_BYTES);
+		}
+		nlPopAttr(nl);
+	}
+
+	if (mtu > 0 && mtu != IP4_DEFAULT_MTU) {
+		uint32_t writeMtu = (uint32_t)mtu;
+		nlPushAttr(nl, IFLA_MTU);
+		{
+			nlBufferAppend(nl, &writeMtu, sizeof(writeMtu));
+		}
+		nlPopAttr(nl);
+	}
+
+	uint16_t portBe = htons(port);
+	uint8_t learning = 0;
+
+	nlPushAttr(nl, IFLA_LINKINFO);
+	{
+		nlPushAttr(nl, IFLA_INFO_KIND);
+		{
+			nlBufferAppend(nl, "vxlan", 5);
+		}
+		nlPopAttr(nl);
+		nlPushAttr(nl, IFLA_INFO_DATA);
+		{
+			nlPushAttr(nl, 1); // IFLA_VXLAN_ID
+			{
+				nlBufferAppend(nl, &vni, sizeof(vni));
+			}
+			nlPopAttr(nl);
+			nlPushAttr(nl, 2); // IFLA_VXLAN_GROUP (unicast remote endpoint)
+			{
+				nlBufferAppend(nl, &remoteAddr, sizeof(remoteAddr));
+			}
+			nlPopAttr(nl);
+			if (localAddr != 0) {
+				nlPushAttr(nl, 4); // IFLA_VXLAN_LOCAL
+				{
+					nlBufferAppend(nl, &localAddr, sizeof(localAddr));
+				}
+				nlPopAttr(nl);
+			}
+			nlPushAttr(nl, 7); // IFLA_VXLAN_LEARNING
+			{
+				nlBufferAppend(nl, &learning, sizeof(learning));
+			}
+			nlPopAttr(nl);
+			nlPushAttr(nl, 15); // IFLA_VXLAN_PORT
+			{
+				nlBufferAppend(nl, &portBe, sizeof(portBe));
+			}
+			nlPopAttr(nl);
+		}
+		nlPopAttr(nl);
+	}
+	nlPopAttr(nl);
+
+	return nlSendMessage(nl, sync, NULL, NULL);
+}
+
+int netCreateVrf(netContext* ctx, const char* name, uint32_t table, bool sync) {
+	lprintf(LogDebug, "Creating VRF device %p:'%s' for routing table %u\n", ctx, name, table);
+
+	nlContext* nl = &ctx->nl;
+	nlInitMessage(nl, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL | (sync ? NLM_F_ACK : 0));
+
+	struct ifinfomsg ifi = { .ifi_family = AF_UNSPEC, .ifi_type = 0, .ifi_index = 0, .ifi_flags = 0, .ifi_change = UINT_MAX };
+	nlBufferAppend(nl, &ifi, sizeof(ifi));
+
+	nlPushAttr(nl, IFLA_IFNAME);
+	{
+		nlBufferAppend(nl, name, strlen(name) + 1);
+	}
+	nlPopAttr(nl);
+
+	nlPushAttr(nl, IFLA_LINKINFO);
+	{
+		nlPushAttr(nl, IFLA_INFO_KIND);
+		{
+			nlBufferAppend(nl, "vrf", 3);
+		}
+		nlPopAttr(nl);
+		nlPushAttr(nl, IFLA_INFO_DATA);
+		{
+			nlPushAttr(nl, 1); // IFLA_VRF_TABLE
+			{
+				nlBufferAppend(nl, &table, sizeof(table));
+			}
+			nlPopAttr(nl);
+		}
+		nlPopAttr(nl);
+	}
+	nlPopAttr(nl);
+
+	return nlSendMessage(nl, sync, NULL, NULL);
+}
+
+int netSetInterfaceMaster(netContext* ctx, int devIdx, int masterIdx, bool sync) {
+	lprintf(LogDebug, "Setting master of interface %p:%d to %d\n", ctx, devIdx, masterIdx);
+
+	nlContext* nl = &ctx->nl;
+	nlInitMessage(nl, RTM_NEWLINK, (sync ? NLM_F_ACK : 0));
+
+	struct ifinfomsg ifi = { .ifi_family = AF_UNSPEC, .ifi_type = 0, .ifi_index = devIdx, .ifi_flags = 0, .ifi_change = 0 };
+	nlBufferAppend(nl, &ifi, sizeof(ifi));
+
+	nlPushAttr(nl, IFLA_MASTER);
+	{
+		nlBufferAppend(nl, &masterIdx, sizeof(masterIdx));
+	}
+	nlPopAttr(nl);
+
+	return nlSendMessage(nl, sync, NULL, NULL);
+}
+
 static void initIfReq(struct ifreq* ifr) {
 	// The kernel ignores unnecessary fields, so this is only useful for debug
 	// builds that are being profiled for pointers to unallocated data
@@ -1033,6 +1257,197 @@ int netGetLocalMacAddr(netContext* ctx, const char* name, macAddr* result) {
 	return 0;
 }
 
+// Interval between repeated ARP requests for targets that have not replied
+static const int ArpRetryMs = 250;
+
+// Packet socket for sending and receiving ARP messages on one interface
+typedef struct {
+	const char* intfName;
+	int fd;
+	int devIdx;
+	macAddr localMac;
+	ip4Addr localIp;
+} netArpSocket;
+
+static int64_t netMonotonicMs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int netOpenArpSocket(netContext* ctx, netArpSocket* sock) {
+	int err;
+	sock->devIdx = netGetInterfaceIndex(ctx, sock->intfName, &err);
+	if (sock->devIdx == -1) return err;
+	err = netGetLocalMacAddr(ctx, sock->intfName, &sock->localMac);
+	if (err != 0) return err;
+
+	// Without an address, the requests are sent as ARP probes (RFC 5227),
+	// which are still answered
+	struct ifreq ifr;
+	initIfReq(&ifr);
+	strncpy(ifr.ifr_name, sock->intfName, IFNAMSIZ);
+	ifr.ifr_name[IFNAMSIZ-1] = '\0';
+	sock->localIp = 0;
+	if (sendIoCtl(ctx, true, sock->intfName, SIOCGIFADDR, &ifr) == 0) {
+		struct sockaddr_in* addr = (struct sockaddr_in*)&ifr.ifr_addr;
+		sock->localIp = addr->sin_addr.s_addr;
+	}
+
+	errno = 0;
+	sock->fd = socket(AF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, htons(ETH_P_ARP));
+	if (sock->fd == -1) {
+		lprintf(LogError, "Failed to open ARP socket for interface '%s': %s\n", sock->intfName, strerror(errno));
+		return errno;
+	}
+	struct sockaddr_ll bindAddr = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_ARP),
+		.sll_ifindex = sock->devIdx,
+	};
+	errno = 0;
+	if (bind(sock->fd, (struct sockaddr*)&bindAddr, sizeof(bindAddr)) != 0) {
+		lprintf(LogError, "Failed to bind ARP socket to interface '%s': %s\n", sock->intfName, strerror(errno));
+		err = errno;
+		close(sock->fd);
+		sock->fd = -1;
+		return err;
+	}
+	return 0;
+}
+
+static void netSendArpRequest(const netArpSocket* sock, ip4Addr ip) {
+	struct ether_arp req;
+	req.arp_hrd = htons(ARPHRD_ETHER);
+	req.arp_pro = htons(ETHERTYPE_IP);
+	req.arp_hln = ETHER_ADDR_LEN;
+	req.arp_pln = sizeof(ip4Addr);
+	req.arp_op = htons(ARPOP_REQUEST);
+	memcpy(req.arp_sha, sock->localMac.octets, ETHER_ADDR_LEN);
+	memcpy(req.arp_spa, &sock->localIp, sizeof(ip4Addr));
+	memset(req.arp_tha, 0, ETHER_ADDR_LEN);
+	memcpy(req.arp_tpa, &ip, sizeof(ip4Addr));
+
+	struct sockaddr_ll dest = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_ARP),
+		.sll_ifindex = sock->devIdx,
+		.sll_halen = ETHER_ADDR_LEN,
+	};
+	memset(dest.sll_addr, 0xFF, ETHER_ADDR_LEN);
+
+	errno = 0;
+	if (sendto(sock->fd, &req, sizeof(req), 0, (struct sockaddr*)&dest, sizeof(dest)) == -1) {
+		// A lost request is simply repeated later
+		lprintf(LogDebug, "Failed to send ARP request on interface '%s': %s\n", sock->intfName, strerror(errno));
+	}
+}
+
+// Reads all of the ARP messages waiting in a socket and records the addresses
+// of any targets that replied. Returns the number of targets that were found.
+static size_t netReceiveArpReplies(const netArpSocket* sock, size_t sockIdx, netArpTarget targets[], const size_t targetSockets[], size_t count) {
+	size_t found = 0;
+	while (true) {
+		struct ether_arp reply;
+		ssize_t len = recv(sock->fd, &reply, sizeof(reply), 0);
+		if (len == -1) break;
+		if ((size_t)len < sizeof(reply)) continue;
+		if (ntohs(reply.arp_hrd) != ARPHRD_ETHER || ntohs(reply.arp_pro) != ETHERTYPE_IP || ntohs(reply.arp_op) != ARPOP_REPLY) continue;
+
+		ip4Addr senderIp;
+		memcpy(&senderIp, reply.arp_spa, sizeof(ip4Addr));
+		for (size_t i = 0; i < count; ++i) {
+			netArpTarget* target = &targets[i];
+			if (target->found || targetSockets[i] != sockIdx || target->ip != senderIp) continue;
+			memcpy(target->mac.octets, reply.arp_sha, MAC_ADDR_BYTES);
+			target->found = true;
+			++found;
+		}
+	}
+	return found;
+}
+
+int netDiscoverRemoteMacAddrs(netContext* ctx, netArpTarget targets[], size_t count, int timeoutMs) {
+	if (count == 0) return 0;
+
+	// Targets that share an interface share a socket. The number of targets
+	// is small, so we simply search linearly.
+	netArpSocket* socks = eamalloc(count, sizeof(netArpSocket), 0);
+	size_t* targetSockets = eamalloc(count, sizeof(size_t), 0);
+	size_t sockCount = 0;
+	size_t pending = 0;
+	for (size_t i = 0; i < count; ++i) {
+		targets[i].found = false;
+		size_t s;
+		for (s = 0; s < sockCount; ++s) {
+			if (strcmp(socks[s].intfName, targets[i].intfName) == 0) break;
+		}
+		if (s == sockCount) {
+			socks[s].intfName = targets[i].intfName;
+			if (netOpenArpSocket(ctx, &socks[s]) != 0) {
+				lprintf(LogWarning, "Cannot send ARP requests on interface '%s'; relying on the ARP cache instead\n", targets[i].intfName);
+				socks[s].fd = -1;
+			}
+			++sockCount;
+		}
+		targetSockets[i] = s;
+		if (socks[s].fd != -1) ++pending;
+	}
+
+	struct pollfd* fds = eamalloc(sockCount, sizeof(struct pollfd), 0);
+	for (size_t s = 0; s < sockCount; ++s) {
+		fds[s].fd = socks[s].fd; // Negative descriptors are ignored by poll
+		fds[s].events = POLLIN;
+	}
+
+	int err = 0;
+	int64_t now = netMonotonicMs();
+	int64_t deadline = now + timeoutMs;
+	int64_t nextSend = now;
+	while (pending > 0 && now < deadline) {
+		if (now >= nextSend) {
+			for (size_t i = 0; i < count; ++i) {
+				const netArpSocket* sock = &socks[targetSockets[i]];
+				if (!targets[i].found && sock->fd != -1) netSendArpRequest(sock, targets[i].ip);
+			}
+			nextSend = now + ArpRetryMs;
+		}
+
+		int64_t wait = (nextSend < deadline ? nextSend : deadline) - now;
+		errno = 0;
+		int ready = poll(fds, (nfds_t)sockCount, (int)wait);
+		if (ready == -1 && errno != EINTR) {
+			err = errno;
+			lprintf(LogError, "Failed to wait for ARP replies: %s\n", strerror(err));
+			break;
+		}
+		for (size_t s = 0; ready > 0 && s < sockCount; ++s) {
+			if (fds[s].revents & POLLIN) pending -= netReceiveArpReplies(&socks[s], s, targets, targetSockets, count);
+		}
+		now = netMonotonicMs();
+	}
+
+	for (size_t s = 0; s < sockCount; ++s) {
+		if (socks[s].fd != -1) close(socks[s].fd);
+	}
+	free(fds);
+	free(targetSockets);
+	free(socks);
+	if (err != 0) return err;
+
+	// The kernel may know about hosts that did not reply in time
+	for (size_t i = 0; i < count; ++i) {
+		if (targets[i].found) continue;
+		int res = netGetRemoteMacAddr(ctx, targets[i].intfName, targets[i].ip, &targets[i].mac);
+		if (res == 0) {
+			targets[i].found = true;
+		} else if (res != EAGAIN) {
+			return res;
+		}
+	}
+	return 0;
+}
+
 int netGetMtu(netContext* ctx, const char* name, int* result) {
 	struct ifreq ifr;
 	initIfReq(&ifr);
@@ -1092,30 +1507,26 @@ int netSetIPv6(bool enabled) {
 	return writeSysctlFmt(SYSCTL_DISABLE_IPV6, enabled ? "0" : "1");
 }
 
-int netGetArpTableSize(int* thresh1, int* thresh2, int* thresh3) {
-	int err;
-
-	err = readSysctlFmt(SYSCTL_ARP_GC_PREFIX "1", "%d", thresh1);
-	if (err != 0) return err;
-	err = readSysctlFmt(SYSCTL_ARP_GC_PREFIX "2", "%d", thresh2);
-	if (err != 0) return err;
-	err = readSysctlFmt(SYSCTL_ARP_GC_PREFIX "3", "%d", thresh3);
-	if (err != 0) return err;
-
-	return 0;
+// Converts a dotted sysctl name into its path in /proc/sys
+static bool sysctlPath(const char* name, char* path, size_t pathLen) {
+	int len = snprintf(path, pathLen, "/proc/sys/%s", name);
+	if (len < 0 || (size_t)len >= pathLen) return false;
+	for (char* c = path + strlen("/proc/sys/"); *c != '\0'; ++c) {
+		if (*c == '.') *c = '/';
+	}
+	return true;
 }
 
-int netSetArpTableSize(int thresh1, int thresh2, int thresh3) {
-	int err;
-
-	err = writeSysctlFmt(SYSCTL_ARP_GC_PREFIX "1", "%d", thresh1);
-	if (err != 0) return err;
-	err = writeSysctlFmt(SYSCTL_ARP_GC_PREFIX "2", "%d", thresh2);
-	if (err != 0) return err;
-	err = writeSysctlFmt(SYSCTL_ARP_GC_PREFIX "3", "%d", thresh3);
-	if (err != 0) return err;
+int netGetSysctl(const char* name, uint64_t* value) {
+	char path[PATH_MAX];
+	if (!sysctlPath(name, path, sizeof(path))) return ENAMETOOLONG;
+	return readSysctlFmt(path, "%" SCNu64, value);
+}
 
-	return 0;
+int netSetSysctl(const char* name, uint64_t value) {
+	char path[PATH_MAX];
+	if (!sysctlPath(name, path, sizeof(path))) return ENAMETOOLONG;
+	return writeSysctlFmt(path, "%" PRIu64, value);
 }
 
 uint8_t netGetTableId(RoutingTable table) {
@@ -1166,7 +1577,7 @@ static bool initRtMsg(struct rtmsg* rtm, unsigned char prefixLen, unsigned char
 	return getScopeId(scope, &rtm->rtm_scope);
 }
 
-int netModifyRoute(netContext* ctx, bool remove, uint8_t table, RoutingScope scope, RoutingCreator creator, ip4Addr dstAddr, uint8_t subnetBits, ip4Addr gatewayAddr, int dstDevIdx, bool sync) {
+int netModifyRoute(netContext* ctx, bool remove, uint32_t table, RoutingScope scope, RoutingCreator creator, ip4Addr dstAddr, uint8_t subnetBits, ip4Addr gatewayAddr, int dstDevIdx, bool sync) {
 	if (PASSES_LOG_THRESHOLD(LogDebug)) {
 		char dstIp[IP4_ADDR_BUFLEN];
 		char gatewayIp[IP4_ADDR_BUFLEN];
@@ -1175,8 +1586,11 @@ int netModifyRoute(netContext* ctx, bool remove, uint8_t table, RoutingScope sco
 		lprintf(LogDebug, "%s route for namespace %p table %u: %s/%u => interface %d via %sgateway %s\n", (remove ? "Removing" : "Adding"), ctx, table, dstIp, subnetBits, dstDevIdx, gatewayAddr == 0 ? "(disabled) " : "", gatewayIp);
 	}
 
+	// The header only has room for the original 8-bit table identifiers.
+	// Larger identifiers are given in a separate attribute.
+	bool wideTable = (table > UINT8_MAX);
 	struct rtmsg rtm;
-	if (!initRtMsg(&rtm, subnetBits, table, scope, creator)) return 1;
+	if (!initRtMsg(&rtm, subnetBits, (wideTable ? RT_TABLE_UNSPEC : (unsigned char)table), scope, creator)) return 1;
 
 	nlContext* nl = &ctx->nl;
 	if (remove) {
@@ -1187,6 +1601,14 @@ int netModifyRoute(netContext* ctx, bool remove, uint8_t table, RoutingScope sco
 
 	nlBufferAppend(nl, &rtm, sizeof(rtm));
 
+	if (wideTable) {
+		nlPushAttr(nl, RTA_TABLE);
+		{
+			nlBufferAppend(nl, &table, sizeof(table));
+		}
+		nlPopAttr(nl);
+	}
+
 	nlPushAttr(nl, RTA_DST);
 	{
 		nlBufferAppend(nl, &dstAddr, sizeof(dstAddr));
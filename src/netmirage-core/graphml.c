@@ -107,9 +107,10 @@ typedef struct {
 	size_t dataValueCap;		// Capacity of the data value buffer
 	GraphParserMode dataMode;	// Mode to return to after parsing the data
 
-	// Node and link objects used to pass to the callers
+	// Node and link objects used to pass to the callers. Node names are stored
+	// in the name table, as are link endpoints that refer to known nodes.
+	internTable* names;
 	GmlNode node;
-	xmlCharBuffer nodeId;
 	GmlLink link;
 	xmlCharBuffer linkSourceId;
 	xmlCharBuffer linkTargetId;
@@ -170,7 +171,8 @@ static void graphFatalError(GraphParserState* state, const char* fmt, ...) {
 	state->dead = true;
 }
 
-static void initGraphParserState(GraphParserState* state, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
+static void initGraphParserState(GraphParserState* state, internTable* names, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
+	state->names = names;
 	state->clientType = clientType;
 	state->weightKey = weightKey;
 	state->newNodeFunc = newNode;
@@ -181,7 +183,6 @@ static void initGraphParserState(GraphParserState* state, NewNodeFunc newNode, N
 	initXmlCharBuffer(&state->dataKey);
 	flexBufferInit((void**)&state->dataValue, &state->dataValueLen, &state->dataValueCap);
 	flexBufferGrow((void**)&state->dataValue, state->dataValueLen, &state->dataValueCap, DefaultXmlBufferLen, 1);
-	initXmlCharBuffer(&state->nodeId);
 	initXmlCharBuffer(&state->linkSourceId);
 	initXmlCharBuffer(&state->linkTargetId);
 	state->partialError = false;
@@ -195,7 +196,6 @@ static void initGraphParserState(GraphParserState* state, NewNodeFunc newNode, N
 static void cleanupGraphParserState(GraphParserState* state) {
 	freeXmlCharBuffer(&state->dataKey);
 	flexBufferFree((void**)&state->dataValue, &state->dataValueLen, &state->dataValueCap);
-	freeXmlCharBuffer(&state->nodeId);
 	freeXmlCharBuffer(&state->linkSourceId);
 	freeXmlCharBuffer(&state->linkTargetId);
 
@@ -210,6 +210,20 @@ static void cleanupGraphParserState(GraphParserState* state) {
 	FREE_ATTRIBS(edge);
 }
 
+// Finds the identifier for a link endpoint. Endpoints that do not refer to a
+// known node are copied into a buffer so that the caller can report them.
+static void resolveLinkEndpoint(GraphParserState* state, const xmlChar* name, xmlCharBuffer* buffer, nodeId* id, const char** nameOut) {
+	uint32_t found = internFind(state->names, (const char*)name);
+	if (found == INTERN_NONE) {
+		*id = INVALID_NODE_ID;
+		copyXmlStr(buffer, name);
+		*nameOut = (const char*)buffer->data;
+	} else {
+		*id = found;
+		*nameOut = internString(state->names, found);
+	}
+}
+
 static void graphStartElement(void* ctx, const xmlChar* name, const xmlChar** atts) {
 	GraphParserState* state = (GraphParserState*)ctx;
 	if (state->dead) return;
@@ -299,10 +313,12 @@ static void graphStartElement(void* ctx, const xmlChar* name, const xmlChar** at
 					id = att[1];
 				}
 			}
+			uint32_t nid = (id ? internAdd(state->names, (const char*)id, NULL) : INTERN_NONE);
 			if (!id) graphFatalError(state, "Topology contained a node without an identifier.\n");
+			else if (nid > MAX_NODE_ID) graphFatalError(state, "Topology contained too many nodes.\n");
 			else {
-				copyXmlStr(&state->nodeId, id);
-				state->node.name = (const char*)state->nodeId.data;
+				state->node.id = nid;
+				state->node.name = internString(state->names, nid);
 				state->node.t.client = (state->clientType != NULL ? false : true);
 				state->node.t.packetLoss = 0.0;
 				state->node.t.bandwidthUp = 0;
@@ -330,10 +346,8 @@ static void graphStartElement(void* ctx, const xmlChar* name, const xmlChar** at
 			else if (!target) graphFatalError(state, "Topology contained an edge that did not specify a target node.\n");
 			else if (!undirected) graphFatalError(state, "Topology contained a directed edge from '%s' to '%s'. Only undirected edges are supported.\n", source, target);
 			else {
-				copyXmlStr(&state->linkSourceId, source);
-				copyXmlStr(&state->linkTargetId, target);
-				state->link.sourceName = (const char*)state->linkSourceId.data;
-				state->link.targetName = (const char*)state->linkTargetId.data;
+				resolveLinkEndpoint(state, source, &state->linkSourceId, &state->link.sourceId, &state->link.sourceName);
+				resolveLinkEndpoint(state, target, &state->linkTargetId, &state->link.targetId, &state->link.targetName);
 				state->link.weight = INFINITY;
 				state->link.t.latency = 0.0;
 				state->link.t.packetLoss = 0.0;
@@ -482,10 +496,10 @@ static xmlSAXHandler graphHandlers = {
 	fatalError: &showXmlError,
 };
 
-int gmlParse(FILE* input, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
+int gmlParse(FILE* input, internTable* names, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
 #ifdef LIBXML_PUSH_ENABLED
 	GraphParserState state;
-	initGraphParserState(&state, newNode, newLink, userData, clientType, weightKey);
+	initGraphParserState(&state, names, newNode, newLink, userData, clientType, weightKey);
 	xmlParserCtxtPtr xmlContext = NULL;
 	int err = 0;
 
@@ -539,17 +553,17 @@ static int reportErrors(const GraphParserState* state, int libXmlResult) {
 	return 0;
 }
 
-int gmlParseFile(const char* filename, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
+int gmlParseFile(const char* filename, internTable* names, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
 	GraphParserState state;
-	initGraphParserState(&state, newNode, newLink, userData, clientType, weightKey);
+	initGraphParserState(&state, names, newNode, newLink, userData, clientType, weightKey);
 	int result = xmlSAXUserParseFile(&graphHandlers, &state, filename);
 	cleanupGraphParserState(&state);
 	return reportErrors(&state, result);
 }
 
-int gmlParseMemory(char* buffer, int size, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
+int gmlParseMemory(char* buffer, int size, internTable* names, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey) {
 	GraphParserState state;
-	initGraphParserState(&state, newNode, newLink, userData, clientType, weightKey);
+	initGraphParserState(&state, names, newNode, newLink, userData, clientType, weightKey);
 	int result = xmlSAXUserParseMemory(&graphHandlers, &state, buffer, size);
 	cleanupGraphParserState(&state);
 	return reportErrors(&state, result);
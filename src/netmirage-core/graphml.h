@@ -21,6 +21,7 @@
 
 #include <stdio.h>
 
+#include "intern.h"
 #include "topology.h"
 
 typedef struct {
@@ -28,6 +29,9 @@ typedef struct {
 	// encoding is undefined, and thus should not be shown to the user.
 	const char* name;
 
+	// Dense identifier assigned to the name by the caller's name table
+	nodeId id;
+
 	TopoNode t;
 } GmlNode;
 
@@ -36,6 +40,11 @@ typedef struct {
 	const char* sourceName;
 	const char* targetName;
 
+	// Identifiers of the endpoints in the caller's name table, or
+	// INVALID_NODE_ID if the endpoint has not yet appeared in a <node> element
+	nodeId sourceId;
+	nodeId targetId;
+
 	float weight;
 	TopoLink t;
 } GmlLink;
@@ -48,11 +57,16 @@ typedef int (*NewNodeFunc)(const GmlNode* node, void* userData);
 // for the duration of the call. Non-zero return values terminate parsing.
 typedef int (*NewLinkFunc)(const GmlLink* link, void* userData);
 
+// In the parsing functions, node names are added to the "names" table as
+// their <node> elements are encountered, and the index of a name in the table
+// is used as the node's identifier. The table may be shared between multiple
+// parses of the same file so that the identifiers remain stable.
+
 // Parses a GraphML file from a stream. Returns 0 for success.
-int gmlParse(FILE* input, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey);
+int gmlParse(FILE* input, internTable* names, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey);
 
 // Parses a GraphML file stored on the disk. Returns 0 for success.
-int gmlParseFile(const char* filename, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey);
+int gmlParseFile(const char* filename, internTable* names, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey);
 
 // Parses a GraphML file stored in memory. Returns 0 for success.
-int gmlParseMemory(char* buffer, int size, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey);
+int gmlParseMemory(char* buffer, int size, internTable* names, NewNodeFunc newNode, NewLinkFunc newLink, void* userData, const char* clientType, const char* weightKey);
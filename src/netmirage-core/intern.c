@@ -0,0 +1,173 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "intern.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+
+// Strings are stored contiguously in blocks of this size. Longer strings are
+// given blocks of their own.
+#define INTERN_BLOCK_SIZE (64 * 1024)
+
+// The open-addressing table is kept at most half full
+#define INTERN_MIN_SLOTS 64
+
+struct internTable {
+	// Storage for the string contents
+	char** blocks;
+	size_t blockCount;
+	size_t blockCap;
+	size_t blockUsed; // Bytes used in the last block
+	size_t blockLen;  // Size of the last block
+
+	// Per-identifier data. Hashes are cached to speed up comparisons and
+	// resizing.
+	const char** strings;
+	size_t stringCount;
+	size_t stringCap;
+	uint32_t* hashes;
+	size_t hashCount;
+	size_t hashCap;
+
+	// Linear probing table containing identifiers plus one (0 marks an empty
+	// slot). The number of slots is always a power of two.
+	uint32_t* slots;
+	size_t slotCount;
+};
+
+// FNV-1a hash. Also computes the length of the string.
+static uint32_t internHash(const char* str, size_t* len) {
+	uint32_t hash = 2166136261u;
+	const unsigned char* p = (const unsigned char*)str;
+	for (; *p != '\0'; ++p) {
+		hash ^= *p;
+		hash *= 16777619u;
+	}
+	*len = (size_t)(p - (const unsigned char*)str);
+	return hash;
+}
+
+internTable* internNew(void) {
+	internTable* table = emalloc(sizeof(internTable));
+	flexBufferInit((void**)&table->blocks, &table->blockCount, &table->blockCap);
+	table->blockUsed = 0;
+	table->blockLen = 0;
+	flexBufferInit((void**)&table->strings, &table->stringCount, &table->stringCap);
+	flexBufferInit((void**)&table->hashes, &table->hashCount, &table->hashCap);
+	table->slotCount = INTERN_MIN_SLOTS;
+	table->slots = eacalloc(table->slotCount, sizeof(uint32_t), 0);
+	return table;
+}
+
+void internFree(internTable* table) {
+	for (size_t i = 0; i < table->blockCount; ++i) free(table->blocks[i]);
+	flexBufferFree((void**)&table->blocks, &table->blockCount, &table->blockCap);
+	flexBufferFree((void**)&table->strings, &table->stringCount, &table->stringCap);
+	flexBufferFree((void**)&table->hashes, &table->hashCount, &table->hashCap);
+	free(table->slots);
+	free(table);
+}
+
+// Returns the slot containing the string, or the empty slot where it belongs
+static size_t internProbe(const internTable* table, const char* str, uint32_t hash) {
+	size_t mask = table->slotCount - 1;
+	size_t slot = hash & mask;
+	while (true) {
+		uint32_t entry = table->slots[slot];
+		if (entry == 0) return slot;
+		uint32_t id = entry - 1;
+		if (table->hashes[id] == hash && strcmp(table->strings[id], str) == 0) return slot;
+		slot = (slot + 1) & mask;
+	}
+}
+
+static void internGrowSlots(internTable* table) {
+	size_t slotCount = table->slotCount * 2;
+	uint32_t* slots = eacalloc(slotCount, sizeof(uint32_t), 0);
+	size_t mask = slotCount - 1;
+	for (size_t id = 0; id < table->stringCount; ++id) {
+		size_t slot = table->hashes[id] & mask;
+		while (slots[slot] != 0) slot = (slot + 1) & mask;
+		slots[slot] = (uint32_t)(id + 1);
+	}
+	free(table->slots);
+	table->slots = slots;
+	table->slotCount = slotCount;
+}
+
+// Copies a string (including the terminator) into the block storage
+static const char* internStore(internTable* table, const char* str, size_t len) {
+	size_t needed = len + 1;
+	if (table->blockCount == 0 || table->blockLen - table->blockUsed < needed) {
+		size_t blockLen = (needed > INTERN_BLOCK_SIZE ? needed : INTERN_BLOCK_SIZE);
+		char* block = emalloc(blockLen);
+		flexBufferGrow((void**)&table->blocks, table->blockCount, &table->blockCap, 1, sizeof(char*));
+		flexBufferAppend(table->blocks, &table->blockCount, &block, 1, sizeof(char*));
+		table->blockUsed = 0;
+		table->blockLen = blockLen;
+	}
+	char* copy = table->blocks[table->blockCount-1] + table->blockUsed;
+	memcpy(copy, str, needed);
+	table->blockUsed += needed;
+	return copy;
+}
+
+uint32_t internAdd(internTable* table, const char* str, bool* added) {
+	if (added != NULL) *added = false;
+	size_t len;
+	uint32_t hash = internHash(str, &len);
+	size_t slot = internProbe(table, str, hash);
+	if (table->slots[slot] != 0) return table->slots[slot] - 1;
+
+	if (table->stringCount >= INTERN_NONE - 1) return INTERN_NONE;
+	if ((table->stringCount + 1) * 2 > table->slotCount) {
+		internGrowSlots(table);
+		slot = internProbe(table, str, hash);
+	}
+
+	uint32_t id = (uint32_t)table->stringCount;
+	const char* copy = internStore(table, str, len);
+	flexBufferGrow((void**)&table->strings, table->stringCount, &table->stringCap, 1, sizeof(const char*));
+	flexBufferAppend(table->strings, &table->stringCount, &copy, 1, sizeof(const char*));
+	flexBufferGrow((void**)&table->hashes, table->hashCount, &table->hashCap, 1, sizeof(uint32_t));
+	flexBufferAppend(table->hashes, &table->hashCount, &hash, 1, sizeof(uint32_t));
+	table->slots[slot] = id + 1;
+	if (added != NULL) *added = true;
+	return id;
+}
+
+uint32_t internFind(const internTable* table, const char* str) {
+	size_t len;
+	uint32_t hash = internHash(str, &len);
+	uint32_t entry = table->slots[internProbe(table, str, hash)];
+	return (entry == 0 ? INTERN_NONE : entry - 1);
+}
+
+const char* internString(const internTable* table, uint32_t id) {
+	return table->strings[id];
+}
+
+uint32_t internCount(const internTable* table) {
+	return (uint32_t)table->stringCount;
+}
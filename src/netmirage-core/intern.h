@@ -0,0 +1,54 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#pragma once
+
+// This module provides a string interner. Each distinct string is assigned a
+// dense integer identifier, starting from 0, in the order in which it was first
+// added. The strings are copied into large shared blocks of memory, so adding
+// a string does not require a separate allocation, and the strings remain
+// valid until the table is freed.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct internTable internTable;
+
+// Returned by the lookup functions if a string is not present
+#define INTERN_NONE (UINT32_MAX)
+
+// Creates a new, empty table. Free it with internFree.
+internTable* internNew(void);
+
+// Releases all resources associated with a table, including the strings.
+void internFree(internTable* table);
+
+// Returns the identifier for a string, adding it to the table if it is not
+// already present. If "added" is not NULL, it is set to true if the string was
+// not previously present. Returns INTERN_NONE if the table is full.
+uint32_t internAdd(internTable* table, const char* str, bool* added);
+
+// Returns the identifier for a string, or INTERN_NONE if it is not present.
+uint32_t internFind(const internTable* table, const char* str);
+
+// Returns the string with a given identifier. The identifier must be valid.
+const char* internString(const internTable* table, uint32_t id);
+
+// Returns the number of strings in the table.
+uint32_t internCount(const internTable* table);
@@ -0,0 +1,85 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "latency.h"
+
+#include <stdint.h>
+
+// Values below LATENCY_SUB_BUCKETS have buckets of their own. Larger values
+// with the highest bit set at position "octave" are placed in one of the
+// LATENCY_SUB_BUCKETS buckets for that octave according to the bits below it.
+#define SUB_BITS 3
+#define FIRST_OCTAVE SUB_BITS
+
+static uint32_t bucketIndex(uint64_t value) {
+	if (value < LATENCY_SUB_BUCKETS) return (uint32_t)value;
+	uint32_t octave = 63 - (uint32_t)__builtin_clzll(value);
+	uint32_t sub = (uint32_t)(value >> (octave - SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1);
+	uint64_t index = (uint64_t)(octave - FIRST_OCTAVE + 1) * LATENCY_SUB_BUCKETS + sub;
+	return (index < LATENCY_BUCKETS ? (uint32_t)index : LATENCY_BUCKETS - 1);
+}
+
+// Returns the highest value that is placed in a bucket
+static uint64_t bucketMax(uint32_t index) {
+	if (index < LATENCY_SUB_BUCKETS) return index;
+	uint32_t octave = index / LATENCY_SUB_BUCKETS + FIRST_OCTAVE - 1;
+	uint64_t sub = index % LATENCY_SUB_BUCKETS;
+	uint64_t width = UINT64_C(1) << (octave - SUB_BITS);
+	return ((LATENCY_SUB_BUCKETS + sub) << (octave - SUB_BITS)) + width - 1;
+}
+
+void latencyRecord(latencyHistogram* hist, int64_t usecs) {
+	uint64_t value = (usecs > 0 ? (uint64_t)usecs : 0);
+	++hist->buckets[bucketIndex(value)];
+	++hist->count;
+	hist->sum += value;
+	if (value > hist->max) hist->max = value;
+}
+
+void latencyMerge(latencyHistogram* into, const latencyHistogram* from) {
+	if (from->count == 0) return;
+	for (uint32_t i = 0; i < LATENCY_BUCKETS; ++i) {
+		into->buckets[i] += from->buckets[i];
+	}
+	into->count += from->count;
+	into->sum += from->sum;
+	if (from->max > into->max) into->max = from->max;
+}
+
+uint64_t latencyPercentile(const latencyHistogram* hist, double fraction) {
+	if (hist->count == 0) return 0;
+	uint64_t rank = (uint64_t)(fraction * (double)hist->count + 0.5);
+	if (rank < 1) rank = 1;
+	if (rank > hist->count) rank = hist->count;
+
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < LATENCY_BUCKETS; ++i) {
+		seen += hist->buckets[i];
+		if (seen >= rank) {
+			uint64_t value = bucketMax(i);
+			return (value < hist->max ? value : hist->max);
+		}
+	}
+	return hist->max;
+}
+
+double latencyMean(const latencyHistogram* hist) {
+	if (hist->count == 0) return 0.0;
+	return (double)hist->sum / (double)hist->count;
+}
@@ -0,0 +1,55 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#pragma once
+
+// This module records distributions of durations in histograms with
+// logarithmic buckets, in the style of HdrHistogram. Each power of two is
+// divided into LATENCY_SUB_BUCKETS linear buckets, so recorded values keep
+// about 12% precision across the whole range while a histogram occupies a
+// fixed, small amount of memory. Histograms contain no pointers, so they can be
+// placed in memory shared between processes and merged by copying.
+
+#include <stdint.h>
+
+#define LATENCY_SUB_BUCKETS 8
+#define LATENCY_BUCKETS 256
+
+// Durations are recorded in microseconds. Values beyond the range of the
+// buckets (about 4.7 hours) are counted in the last bucket.
+typedef struct {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint32_t buckets[LATENCY_BUCKETS];
+} latencyHistogram;
+
+// Adds a duration to a histogram. Negative durations are recorded as 0.
+void latencyRecord(latencyHistogram* hist, int64_t usecs);
+
+// Adds all of the values recorded in "from" to "into"
+void latencyMerge(latencyHistogram* into, const latencyHistogram* from);
+
+// Returns the highest value that is equivalent (within the bucket precision)
+// to the value below which the given fraction (between 0 and 1) of the
+// recorded values fall. Returns 0 for an empty histogram.
+uint64_t latencyPercentile(const latencyHistogram* hist, double fraction);
+
+// Returns the mean of the recorded values, or 0 for an empty histogram
+double latencyMean(const latencyHistogram* hist);
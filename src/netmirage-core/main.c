@@ -35,6 +35,7 @@
 #include "mem.h"
 #include "setup.h"
 #include "version.h"
+#include "work.h"
 
 // TODO: normalize naming conventions for "client", "root", etc.
 // TODO: more specific error codes than 1
@@ -55,6 +56,26 @@ enum {
 	AcOvsDir = 256,
 	AcOvsSchema,
 	AcClientNode,
+	AcCompilePlan,
+	AcReplayPlan,
+	AcApply,
+	AcDryRun,
+	AcBufferEdges,
+	AcEdgeAssignment,
+	AcColocate,
+	AcResume,
+	AcProgress,
+	AcStatusFile,
+	AcPruneUnused,
+	AcCollapseChains,
+	AcVrfPack,
+	AcPartitionHosts,
+	AcPartition,
+	AcWorkers,
+	AcAdaptWorkers,
+	AcWorkerThreads,
+	AcOrderStats,
+	AcOrderStatsFile,
 } ArgCodes;
 
 // Divisors for GraphML bandwidths
@@ -65,8 +86,10 @@ static const float ModelNetDivisor = 1000.f; // Kb/s
 
 #define DEFAULT_OVS_DIR    "/tmp/netmirage"
 
+#define DEFAULT_PROGRESS_INTERVAL "10"
+
 // Adds an edge node based on strings, which may be NULL
-static bool addEdgeNode(const char* ipStr, const char* intfStr, const char* macStr, const char* vsubnetStr, const char* remoteDev, const char* remoteApps) {
+static bool addEdgeNode(const char* ipStr, const char* intfStr, const char* macStr, const char* vsubnetStr, const char* remoteDev, const char* remoteApps, const char* capacity, const char* partition) {
 	edgeNodeParams params;
 	if (!ip4GetAddr(ipStr, &params.ip)) return false;
 
@@ -97,6 +120,19 @@ static bool addEdgeNode(const char* ipStr, const char* intfStr, const char* macS
 	if (remoteApps != NULL) {
 		sscanf(remoteApps, "%" SCNu32, &params.remoteApps);
 	}
+	params.capacity = 0.0;
+	if (capacity != NULL) {
+		char* end;
+		params.capacity = strtod(capacity, &end);
+		if (*end != '\0' || params.capacity < 0.0) return false;
+	}
+	params.partition = 0;
+	if (partition != NULL) {
+		char* end;
+		unsigned long index = strtoul(partition, &end, 10);
+		if (*end != '\0' || index >= UINT32_MAX) return false;
+		params.partition = (uint32_t)index;
+	}
 	flexBufferGrow((void**)&args.params.edgeNodes, args.params.edgeNodeCount, &args.edgeNodeCap, 1, sizeof(edgeNodeParams));
 	flexBufferAppend(args.params.edgeNodes, &args.params.edgeNodeCount, &params, 1, sizeof(edgeNodeParams));
 	return true;
@@ -109,6 +145,74 @@ static error_t parseArg(int key, char* arg, struct argp_state* state, unsigned i
 	case 'f': args.params.srcFile = arg; break;
 	case AcOvsDir: args.params.ovsDir = arg; break;
 	case AcOvsSchema: args.params.ovsSchema = arg; break;
+	case AcCompilePlan: args.params.compilePlanFile = arg; break;
+	case AcReplayPlan: args.params.replayPlanFile = arg; break;
+	case AcApply: args.params.applyChanges = true; break;
+	case AcDryRun: args.params.dryRun = true; break;
+	case AcResume: args.params.resume = true; break;
+	case AcProgress: {
+		args.params.printProgress = true;
+		if (arg != NULL && arg[0] != '\0') {
+			char* end;
+			args.params.progressInterval = strtod(arg, &end);
+			if (*end != '\0' || !(args.params.progressInterval > 0.0)) {
+				fprintf(stderr, "Invalid progress reporting interval: '%s'\n", arg);
+				return EINVAL;
+			}
+		}
+		break;
+	}
+	case AcStatusFile: args.params.statusFile = arg; break;
+	case AcOrderStats: args.params.printOrderStats = true; break;
+	case AcOrderStatsFile: args.params.orderStatsFile = arg; break;
+	case AcPartitionHosts: {
+		uint32_t count = 1;
+		for (const char* c = arg; *c != '\0'; ++c) {
+			if (*c == ',') ++count;
+		}
+		free(args.params.partitionAddrs);
+		args.params.partitionAddrs = eamalloc(count, sizeof(ip4Addr), 0);
+		args.params.partitionCount = count;
+
+		bool valid = (count > 1);
+		char* addr = arg;
+		for (uint32_t i = 0; valid && i < count; ++i) {
+			char* sep = strchr(addr, ',');
+			if (sep != NULL) *sep = '\0';
+			valid = ip4GetAddr(addr, &args.params.partitionAddrs[i]);
+			if (sep != NULL) {
+				*sep = ',';
+				addr = sep + 1;
+			}
+		}
+		if (!valid) {
+			fprintf(stderr, "Invalid partition host addresses: '%s' (at least two IPv4 addresses are required)\n", arg);
+			return EINVAL;
+		}
+		break;
+	}
+	case AcPartition: {
+		char* end;
+		unsigned long index = strtoul(arg, &end, 10);
+		if (*end != '\0' || index >= UINT32_MAX) {
+			fprintf(stderr, "Invalid partition index: '%s'\n", arg);
+			return EINVAL;
+		}
+		args.params.partition = (uint32_t)index;
+		break;
+	}
+	case AcWorkers: {
+		char* end;
+		unsigned long workers = strtoul(arg, &end, 10);
+		if (*end != '\0' || workers == 0 || workers >= UINT32_MAX) {
+			fprintf(stderr, "Invalid number of workers: '%s'\n", arg);
+			return EINVAL;
+		}
+		args.params.workers = (uint32_t)workers;
+		break;
+	}
+	case AcAdaptWorkers: args.params.adaptiveWorkers = true; break;
+	case AcWorkerThreads: args.params.workerThreads = true; break;
 
 	case 'i': {
 		args.params.edgeNodeDefaults.intfSpecified = true;
@@ -139,6 +243,8 @@ static error_t parseArg(int key, char* arg, struct argp_state* state, unsigned i
 		char* vsubnet = NULL;
 		char* rdev = NULL;
 		char* rapps = NULL;
+		char* capacity = NULL;
+		char* partition = NULL;
 
 		char* optionSep = arg;
 		while (true) {
@@ -171,6 +277,10 @@ static error_t parseArg(int key, char* arg, struct argp_state* state, unsigned i
 				rdev = keyValSep+1;
 			} else if (strncmp(optionSep, "rapps", cmpLen) == 0) {
 				rapps = keyValSep+1;
+			} else if (strncmp(optionSep, "capacity", cmpLen) == 0) {
+				capacity = keyValSep+1;
+			} else if (strncmp(optionSep, "partition", cmpLen) == 0) {
+				partition = keyValSep+1;
 			} else {
 				*keyValSep = '\0';
 				fprintf(stderr, "Unknown option '%s' in edge node argument '%s'\n", optionSep, arg);
@@ -178,7 +288,7 @@ static error_t parseArg(int key, char* arg, struct argp_state* state, unsigned i
 			}
 		}
 
-		if (!addEdgeNode(ip, intf, mac, vsubnet, rdev, rapps)) {
+		if (!addEdgeNode(ip, intf, mac, vsubnet, rdev, rapps, capacity, partition)) {
 			fprintf(stderr, "Edge node argument '%s' was invalid\n", arg);
 			return EINVAL;
 		}
@@ -224,6 +334,31 @@ static error_t parseArg(int key, char* arg, struct argp_state* state, unsigned i
 	case 'w': args.gmlParams.weightKey = arg; break;
 	case AcClientNode: args.gmlParams.clientType = arg; break;
 	case '2': args.gmlParams.twoPass = true; break;
+	case AcBufferEdges: args.gmlParams.bufferEdges = true; break;
+	case AcEdgeAssignment: {
+		const char* options[] = {"sequential", "bandwidth", NULL};
+		EdgeAssignment strategies[] = {EdgeAssignSequential, EdgeAssignBandwidth};
+		long index = matchArg(arg, options);
+		if (index < 0) {
+			fprintf(stderr, "Unknown edge assignment strategy '%s'\n", arg);
+			return EINVAL;
+		}
+		args.gmlParams.edgeAssignment = strategies[index];
+		break;
+	}
+	case AcColocate: args.gmlParams.colocateClients = true; break;
+	case AcPruneUnused: args.gmlParams.pruneUnused = true; break;
+	case AcCollapseChains: args.gmlParams.collapseChains = true; break;
+	case AcVrfPack: {
+		char* end;
+		unsigned long size = strtoul(arg, &end, 10);
+		if (*end != '\0' || size < 1 || size > MAX_HOSTS_PER_PACK) {
+			fprintf(stderr, "Invalid number of hosts per shared namespace: '%s' (must be between 1 and %d)\n", arg, MAX_HOSTS_PER_PACK);
+			return EINVAL;
+		}
+		args.gmlParams.vrfPackSize = (uint32_t)size;
+		break;
+	}
 
 	default: return ARGP_ERR_UNKNOWN;
 	}
@@ -243,7 +378,9 @@ static bool readSetupEdges(GKeyFile* file) {
 			char* vsubnet = g_key_file_get_string(file, group, "vsubnet", NULL);
 			char* rdev = g_key_file_get_string(file, group, "rdev", NULL);
 			char* rapps = g_key_file_get_string(file, group, "rapps", NULL);
-			bool added = addEdgeNode(ip, intf, mac, vsubnet, rdev, rapps);
+			char* capacity = g_key_file_get_string(file, group, "capacity", NULL);
+			char* partition = g_key_file_get_string(file, group, "partition", NULL);
+			bool added = addEdgeNode(ip, intf, mac, vsubnet, rdev, rapps, capacity, partition);
 
 			g_free(ip);
 			g_free(intf);
@@ -251,6 +388,8 @@ static bool readSetupEdges(GKeyFile* file) {
 			g_free(vsubnet);
 			g_free(rdev);
 			g_free(rapps);
+			g_free(capacity);
+			g_free(partition);
 
 			if (!added) {
 				fprintf(stderr, "In setup file: invalid configuration for edge node '%s'\n", group);
@@ -286,7 +425,7 @@ int main(int argc, char** argv) {
 
 			{ "iface",        'i', "DEVNAME",                                                                  0, "Default interface connected to the edge nodes. Individual edge nodes can override this setting in the setup file or as part of the --edge-nodes argument.", 1 },
 			{ "vsubnet",      'n', "CIDR",                                                                     0, "The global subnet to which all virtual clients belong. By default, each edge node is given a fragment of this global subnet in which to spawn clients. Subnets for edge nodes can also be manually assigned rather than drawing them from this larger space. The default value is " DEFAULT_CLIENTS_SUBNET ".", 1 },
-			{ "edge-node",    'e', "IP[,iface=DEVNAME][,mac=MAC][,vsubnet=CIDR][,rdev=DEVNAME][,rapps=COUNT]", 0, "Adds an edge node to the configuration. The presence of an --edge-node argument causes all edge node configuration in the setup file to be ignored. The node's IPv4 address must be specified. If the optional \"iface\" portion is specified, it lists the interface connected to the edge node (if omitted, --iface is used). \"mac\" specifies the MAC address of the node (if omitted, it is found using ARP). \"vsubnet\" specifies the subnet, in CIDR notation, for clients in the edge node (if omitted, a subnet is assigned automatically from the --vsubnet range). \"rdev\" refers to the interface on the remote machine that is connected to this machine; this is only used when producing edge node commands using --edge-output. Similarly, \"rapps\" specifies the number of remote applications to configure in the edge node commands.", 1 },
+			{ "edge-node",    'e', "IP[,iface=DEVNAME][,mac=MAC][,vsubnet=CIDR][,rdev=DEVNAME][,rapps=COUNT][,capacity=MBITS][,partition=INDEX]", 0, "Adds an edge node to the configuration. The presence of an --edge-node argument causes all edge node configuration in the setup file to be ignored. The node's IPv4 address must be specified. If the optional \"iface\" portion is specified, it lists the interface connected to the edge node (if omitted, --iface is used). \"mac\" specifies the MAC address of the node (if omitted, it is found using ARP). \"vsubnet\" specifies the subnet, in CIDR notation, for clients in the edge node (if omitted, a subnet is assigned automatically from the --vsubnet range). \"rdev\" refers to the interface on the remote machine that is connected to this machine; this is only used when producing edge node commands using --edge-output. Similarly, \"rapps\" specifies the number of remote applications to configure in the edge node commands. \"capacity\" is the aggregate client bandwidth, in Mbit/s, that the edge node can sustain; it is used by --edge-assignment=bandwidth. \"partition\" is the index of the machine that the edge node is connected to when the network is split with --partition-hosts (default: 0); the interface and MAC address of edge nodes on other machines are not needed.", 1 },
 
 			{ "routing-ip",   'I', "IP",   0,                   "The IP address that edge nodes should use to communicate with the core. This value is only used for generating edge node commands with --edge-output.", 2 },
 			{ "edge-output",  'E', "FILE", 0,                   "If specified, commands for instantiating the edge nodes are written to the given file instead of stdout. These commands should be executed on the edge nodes to connect them with the core.", 2 },
@@ -301,6 +440,21 @@ int main(int argc, char** argv) {
 			{ "ovs-schema",   AcOvsSchema, "FILE",           0, "Path to the OVSDB schema definition for Open vSwitch (default: \"/usr/share/openvswitch/vswitch.ovsschema\").", 4 },
 
 			{ "mem",          'm', "MiB",    0, "Approximate maximum memory use, specified in MiB. The program may use more than this amount if needed.", 5 },
+			{ "workers",      AcWorkers,      "COUNT", 0,                   "Maximum number of workers that construct the network concurrently (default: one per processor, which is also the upper limit). Beyond a certain point, additional workers mostly contend on kernel locks and consume memory without speeding up construction.", 5 },
+			{ "adapt-workers", AcAdaptWorkers, NULL,   OPTION_ARG_OPTIONAL, "Tune the number of active workers (up to --workers) while each setup phase runs, based on the rate at which operations are completed. The rate is sampled without waiting for the workers. Virtual hosts stay with the worker that created them, so the count mostly affects phases that create hosts.", 5 },
+			{ "worker-threads", AcWorkerThreads, NULL, OPTION_ARG_OPTIONAL, "Run the workers as threads of the main process instead of as separate processes. Each thread switches network namespaces independently, and operations are handed to workers in memory rather than through pipes. Requires Linux 3.17 or later.", 5 },
+
+			{ "compile-plan", AcCompilePlan, "FILE", 0, "Instead of constructing the network, write the complete sequence of setup operations to FILE. The plan can later be executed with --replay-plan, which skips topology parsing and route planning. Edge node information is resolved while compiling. Existing networks are not modified.", 6 },
+			{ "replay-plan",  AcReplayPlan,  "FILE", 0, "Construct the network by executing a plan previously written with --compile-plan. The topology, edge node configuration, and GraphML options are ignored, and no edge node commands are written. Plans can only be replayed by the same build of the program.", 6 },
+			{ "apply",        AcApply,       NULL, OPTION_ARG_OPTIONAL, "Instead of reconstructing the network, update the running network so that it matches the topology. Only the hosts, links, and routes that changed are modified. The network must have been constructed from a topology by this program, and the set of client nodes must not change. The edge node configuration is ignored.", 6 },
+			{ "dry-run",      AcDryRun,      NULL, OPTION_ARG_OPTIONAL, "Process the topology and print the number of namespaces, links, routes, and switch flows that would be created, along with the expected memory use and setup duration. The duration is calibrated by briefly benchmarking network operations in temporary private namespaces. Existing networks and edge nodes are not modified.", 6 },
+			{ "resume",       AcResume,      NULL, OPTION_ARG_OPTIONAL, "Continue a network construction that was interrupted (e.g., because the process was killed) instead of starting over. Progress is recorded in a journal in the --ovs-dir directory. The hosts and links that were already created are verified, and construction continues from the last recorded checkpoint. The topology file, edge node configuration, and options must be the same as in the interrupted invocation. If no journal is found, the network is constructed from scratch.", 6 },
+			{ "progress",     AcProgress,    "SECS", OPTION_ARG_OPTIONAL, "While constructing the network, print the progress of each setup phase to stderr every SECS seconds (default: " DEFAULT_PROGRESS_INTERVAL "). Each report gives the number of completed and total steps in the phase, the current rate, and an estimate of the remaining time. Reports are printed regardless of --verbosity.", 7 },
+			{ "status-file",  AcStatusFile,  "FILE", 0, "While constructing the network, periodically replace FILE with a JSON object describing the progress of the current setup phase, so that it can be polled by other programs. The object contains the \"state\" (running, finished, or failed), \"phase\", \"completed\" and \"total\" steps, \"rate\" in steps per second, \"eta\" in seconds, \"phaseElapsed\" and \"elapsed\" seconds, and the Unix time when it was \"updated\". Unknown values are null. The file is updated at the --progress interval.", 7 },
+			{ "order-stats",  AcOrderStats,  NULL,   OPTION_ARG_OPTIONAL, "When the program finishes, print a table to stderr with the number of setup operations of each kind in every setup phase and their latencies (median, 99th percentile, and maximum). Latencies are divided into the time spent queued in the main process (including waiting for other operations that must finish first), waiting in the worker process behind earlier operations, executing, and, for queries, delivering the response.", 7 },
+			{ "order-stats-file", AcOrderStatsFile, "FILE", 0, "When the program finishes, write the statistics described for --order-stats to FILE as a JSON object. The object has a \"phases\" array whose entries give the \"phase\" name, its \"elapsed\" seconds, and an \"orders\" array with the \"count\" of each kind of \"order\" and its \"queue\", \"wait\", \"execution\", and \"response\" latencies. Each latency has a \"count\", \"mean\", \"p50\", \"p90\", \"p99\", \"p999\", and \"max\" in microseconds.", 7 },
+			{ "partition-hosts", AcPartitionHosts, "IP,IP[,...]", 0, "Split the network among several machines, each running its own instance of this program with the same topology file, edge node configuration, and options (apart from --partition). The addresses are the underlay IPv4 addresses of the machines, in partition order, and must be reachable from the namespace in which the program is started. Hosts are divided among the machines so that few routes cross between them, and links between machines are carried by VXLAN tunnels on UDP port 4789, which are shaped like any other link. The underlay MTU must be at least 50 bytes larger than the emulated MTU. To try this on one machine, run each instance in its own network namespace with a distinct --netns-prefix and --ovs-dir, and connect the namespaces with virtual Ethernet pairs. Hosts and links are created after the routes have been planned, and the network cannot be updated later with --apply.", 8 },
+			{ "partition",    AcPartition,   "INDEX", 0, "With --partition-hosts, the index of the machine that this instance constructs, starting at 0 (default: 0).", 8 },
 
 			// File-specific options get priorities [50 - 99]
 
@@ -310,7 +464,13 @@ int main(int argc, char** argv) {
 			{ "units",        'u',          "{shadow,modelnet,KiB,Kb}", 0,                   "Specifies the bandwidth units used in the input file. Shadow uses KiB/s (the default), whereas ModelNet uses Kbit/s." },
 			{ "weight",       'w',          "KEY",                      0,                   "Edge parameter to use for computing shortest paths for static routes. Must be a key used in the GraphML file (default: \"latency\")." },
 			{ "client-node",  AcClientNode, "TYPE",                     0,                   "Type of client nodes. Nodes in the GraphML file whose \"type\" attribute matches this value will be clients. If omitted, all nodes are clients." },
-			{ "two-pass",     '2',          NULL,                       OPTION_ARG_OPTIONAL, "This option must be specified if the GraphML file does not place all <node> tags before all <edge> tags. This option doubles the data retrieved from disk." },
+			{ "two-pass",     '2',          NULL,                       OPTION_ARG_OPTIONAL, "This option must be specified (unless --buffer-edges is used) if the GraphML file does not place all <node> tags before all <edge> tags. The edges are also counted during the first pass, so that kernel resources are sized for the real number of links rather than for the worst case. This option doubles the data retrieved from disk and cannot be used when reading from stdin." },
+			{ "buffer-edges", AcBufferEdges, NULL,                      OPTION_ARG_OPTIONAL, "Alternative to --two-pass that reads the GraphML file only once. Edges are held in a compact form until all nodes have been read, and are moved to a temporary file if they exceed a quarter of the --mem limit. Unlike --two-pass, this option works when reading from stdin. Like --two-pass, it sizes kernel resources for the real number of links. This option takes priority over --two-pass." },
+			{ "edge-assignment", AcEdgeAssignment, "{sequential,bandwidth}", 0,              "Strategy for distributing client nodes among edge nodes. \"sequential\" (the default) gives each edge node an equal number of clients in topology order. \"bandwidth\" balances the total upstream and downstream bandwidth of the clients in proportion to the edge node capacities. Edge nodes without a configured capacity are assumed to have the average capacity of the others." },
+			{ "colocate",     AcColocate,   NULL,                       OPTION_ARG_OPTIONAL, "With --edge-assignment=bandwidth, clients that share the same closest neighbor in the topology are placed on the same edge node when this does not exceed its fair share, so that traffic between nearby clients stays within one edge node." },
+			{ "prune-unused", AcPruneUnused, NULL,                      OPTION_ARG_OPTIONAL, "Only construct the hosts and links that are used by at least one route between two client nodes. Hosts and links are created after the routes have been planned rather than while the topology is read, and the number that were left out is reported. A pruned network cannot be updated later with --apply." },
+			{ "collapse-chains", AcCollapseChains, NULL,                OPTION_ARG_OPTIONAL, "Replace each chain of non-client nodes that have exactly two neighbors with a single link between the ends of the chain, so that packets do not cross a namespace at every hop. The link has the sum of the latencies, the combined packet loss and jitter, and the smallest queue length of the chain. Chains whose ends are already directly connected are left alone. A collapsed network cannot be updated later with --apply." },
+			{ "vrf-pack",     AcVrfPack,    "HOSTS",                    0,                   "Pack up to HOSTS non-client nodes into each network namespace, rather than giving every node its own namespace. Each packed node is a VRF device with its own routing table, which requires Linux 4.3 or later. This greatly reduces the number of namespaces for large topologies. Hosts and links are created after the routes have been planned. A packed network cannot be updated later with --apply." },
 			{ NULL },
 	};
 	struct argp_option defaultDoc[] = { { "\n These options provide program documentation:", 0, NULL, OPTION_DOC | OPTION_NO_USAGE }, { NULL } };
@@ -329,14 +489,36 @@ int main(int argc, char** argv) {
 	args.params.nsPrefix = "nm-";
 	args.params.ovsDir = DEFAULT_OVS_DIR;
 	args.params.softMemCap = 2LL * 1024LL * 1024LL * 1024LL;
+	args.params.workers = 0;
+	args.params.adaptiveWorkers = false;
+	args.params.workerThreads = false;
 	args.params.destroyOnly = false;
 	args.params.keepOldNetworks = false;
 	args.params.quiet = false;
 	args.params.rootIsInitNs = false;
+	args.params.compilePlanFile = NULL;
+	args.params.replayPlanFile = NULL;
+	args.params.applyChanges = false;
+	args.params.dryRun = false;
+	args.params.resume = false;
+	args.params.printProgress = false;
+	args.params.progressInterval = strtod(DEFAULT_PROGRESS_INTERVAL, NULL);
+	args.params.statusFile = NULL;
+	args.params.printOrderStats = false;
+	args.params.orderStatsFile = NULL;
+	args.params.partitionCount = 1;
+	args.params.partition = 0;
+	args.params.partitionAddrs = NULL;
 	ip4GetSubnet(DEFAULT_CLIENTS_SUBNET, &args.params.edgeNodeDefaults.globalVSubnet);
 	args.gmlParams.bandwidthDivisor = ShadowDivisor;
 	args.gmlParams.weightKey = "latency";
 	args.gmlParams.twoPass = false;
+	args.gmlParams.bufferEdges = false;
+	args.gmlParams.edgeAssignment = EdgeAssignSequential;
+	args.gmlParams.colocateClients = false;
+	args.gmlParams.pruneUnused = false;
+	args.gmlParams.collapseChains = false;
+	args.gmlParams.vrfPackSize = 0;
 
 	int err = 0;
 
@@ -345,16 +527,61 @@ int main(int argc, char** argv) {
 
 	lprintf(LogInfo, "Starting NetMirage Core %s\n", getVersion());
 
+	if (args.params.compilePlanFile != NULL && args.params.replayPlanFile != NULL) {
+		lprintln(LogError, "The --compile-plan and --replay-plan options cannot be used together");
+		err = 1;
+		goto cleanup;
+	}
+	if (args.params.applyChanges && (args.params.compilePlanFile != NULL || args.params.replayPlanFile != NULL || args.params.destroyOnly || args.params.keepOldNetworks)) {
+		lprintln(LogError, "The --apply option cannot be combined with --compile-plan, --replay-plan, --destroy, or --keep");
+		err = 1;
+		goto cleanup;
+	}
+	if (args.params.partition >= args.params.partitionCount) {
+		lprintf(LogError, "The --partition index %u is not less than the number of machines given by --partition-hosts (%u)\n", args.params.partition, args.params.partitionCount);
+		err = 1;
+		goto cleanup;
+	}
+	if (args.params.applyChanges && (args.gmlParams.pruneUnused || args.gmlParams.collapseChains || args.gmlParams.vrfPackSize > 0 || args.params.partitionCount > 1)) {
+		lprintln(LogError, "The --prune-unused, --collapse-chains, --vrf-pack, and --partition-hosts options cannot be combined with --apply");
+		err = 1;
+		goto cleanup;
+	}
+	if (args.params.dryRun && (args.params.compilePlanFile != NULL || args.params.replayPlanFile != NULL || args.params.applyChanges || args.params.destroyOnly)) {
+		lprintln(LogError, "The --dry-run option cannot be combined with --compile-plan, --replay-plan, --apply, or --destroy");
+		err = 1;
+		goto cleanup;
+	}
+
+	if (args.params.resume && (args.params.compilePlanFile != NULL || args.params.replayPlanFile != NULL || args.params.applyChanges || args.params.dryRun || args.params.destroyOnly)) {
+		lprintln(LogError, "The --resume option cannot be combined with --compile-plan, --replay-plan, --apply, --dry-run, or --destroy");
+		err = 1;
+		goto cleanup;
+	}
+
 	lprintln(LogInfo, "Loading edge node configuration");
-	err = setupConfigure(&args.params);
+	err = setupConfigure(&args.params, &args.gmlParams);
 	if (err != 0) goto cleanup;
 
 	if (!args.params.destroyOnly) {
 		lprintln(LogInfo, "Beginning network construction");
-		err = setupGraphML(&args.gmlParams);
+		if (args.params.replayPlanFile != NULL) {
+			err = setupReplayPlan();
+		} else if (args.params.applyChanges) {
+			err = setupApplyGraphML(&args.gmlParams);
+		} else {
+			err = setupGraphML(&args.gmlParams);
+		}
 	}
 
-	if (err != 0) {
+	if (err != 0 && args.params.compilePlanFile != NULL) {
+		lprintf(LogError, "A fatal error occurred while compiling the setup plan: code %d\n", err);
+	} else if (err != 0 && args.params.dryRun) {
+		lprintf(LogError, "A fatal error occurred during the dry run: code %d\n", err);
+	} else if (err != 0 && args.params.applyChanges) {
+		lprintf(LogError, "A fatal error occurred while applying topology changes: code %d\n", err);
+		lprintln(LogWarning, "The running network may have been partially updated. Reconstruct it without --apply to restore a consistent state.");
+	} else if (err != 0) {
 		lprintf(LogError, "A fatal error occurred: code %d\n", err);
 		lprintln(LogWarning, "Attempting to destroy partially-constructed network");
 		destroyNetwork();
@@ -372,6 +599,7 @@ cleanup:
 		}
 	}
 	flexBufferFree((void**)&args.params.edgeNodes, &args.params.edgeNodeCount, &args.edgeNodeCap);
+	free(args.params.partitionAddrs);
 	xmlCleanupParser();
 	appCleanup();
 
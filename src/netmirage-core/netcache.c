@@ -18,8 +18,8 @@
  * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
  *******************************************************************************/
 // This implementation stores a hash map from namespace identifiers (32-bit
-// ints) to nodes of a linked list. The linked list orders nodes based on their
-// creation time. Each node embeds a netContext. The oldest nodes are evicted
+// ints) to nodes of a doubly linked list. The linked list orders nodes based on
+// their creation time. Each node embeds a netContext. The oldest nodes are evicted
 // when the map runs out of space. The logic here is that, in our normal use
 // case, nodes are requested in relatively short "bursts". The cache helps, but
 // a more advanced eviction scheme would sacrifice cache coherence for little
@@ -45,6 +45,7 @@ typedef struct ncNode ncNode;
 struct ncNode {
 	gpointer key;
 	netContext ctx;
+	ncNode* older;
 	ncNode* newer;
 };
 
@@ -106,11 +107,14 @@ netContext* ncOpenNamespace(netCache* cache, nodeId id, const char* name, bool c
 	} else {
 		node = cache->oldest;
 		cache->oldest = node->newer;
+		if (cache->oldest == NULL) cache->newest = NULL;
+		else cache->oldest->older = NULL;
 		g_hash_table_remove(cache->map, node->key);
 		netInvalidateContext(&node->ctx);
 		reusing = true;
 	}
 	node->key = key;
+	node->older = cache->newest;
 	node->newer = NULL;
 
 	int res = netOpenNamespaceInPlace(&node->ctx, reusing, name, create, excl);
@@ -126,3 +130,18 @@ netContext* ncOpenNamespace(netCache* cache, nodeId id, const char* name, bool c
 	g_hash_table_insert(cache->map, key, node);
 	return &node->ctx;
 }
+
+void ncCloseNamespace(netCache* cache, nodeId id) {
+	gpointer key = ncMakeKey(id);
+	ncNode* node = g_hash_table_lookup(cache->map, key);
+	if (node == NULL) return;
+
+	g_hash_table_remove(cache->map, key);
+	if (node->older != NULL) node->older->newer = node->newer;
+	else cache->oldest = node->newer;
+	if (node->newer != NULL) node->newer->older = node->older;
+	else cache->newest = node->older;
+
+	netCloseNamespace(&node->ctx, true);
+	free(node);
+}
@@ -47,3 +47,9 @@ void ncFreeCache(netCache* cache);
 // same meaning as for netOpenNamespace. The active namespace for the process is
 // set to the given namespace.
 netContext* ncOpenNamespace(netCache* cache, nodeId id, const char* name, bool create, bool excl, int* err);
+
+// Closes the context for the namespace with the given identifier and discards
+// it from the cache, if it is present. This should be called before deleting
+// the namespace, since the cached context would otherwise keep it alive. The
+// active namespace for the process is not changed.
+void ncCloseNamespace(netCache* cache, nodeId id);
@@ -450,12 +450,12 @@ int ovsSetBridgeMtu(ovsContext* ctx, const char* bridge, int mtu) {
 	return err;
 }
 
-int ovsAddPort(ovsContext* ctx, const char* bridge, const char* intfName) {
+int ovsAddPort(ovsContext* ctx, const char* bridge, const char* intfName, bool mayExist) {
 	int err = switchContext(ctx);
 	if (err != 0) return err;
 
 	lprintf(LogDebug, "Adding interface '%s' to Open vSwitch bridge '%s' in context %p\n", intfName, bridge, ctx);
-	err = ovsCommand(ctx->directory, "ovs-vsctl", ctx->compatArgs, ctx->dbSocketConnArg, "add-port", bridge, intfName, NULL);
+	err = ovsCommand(ctx->directory, "ovs-vsctl", ctx->compatArgs, ctx->dbSocketConnArg, (mayExist ? "--may-exist" : ""), "add-port", bridge, intfName, NULL);
 	if (err != 0) return err;
 
 	return 0;
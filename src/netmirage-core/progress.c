@@ -0,0 +1,387 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#define _POSIX_C_SOURCE 200809L // Require POSIX.1-2008
+
+#include "progress.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "log.h"
+
+// Weight of the most recent interval when smoothing the completion rate
+static const double RateSmoothing = 0.3;
+
+#define DURATION_BUFLEN 32
+#define RATE_BUFLEN 32
+
+typedef enum {
+	StateRunning,
+	StateFinished,
+	StateFailed,
+} ProgressState;
+
+static const char* StateNames[] = { "running", "finished", "failed" };
+
+// Progress at a single point in time
+typedef struct {
+	const char* phase; // NULL if no phase has begun
+	ProgressState state;
+	uint64_t completed;
+	uint64_t total;     // 0 if unknown
+	double rate;        // Steps per second, or negative if unknown
+	double etaSecs;     // Negative if unknown
+	double phaseSecs;
+	double elapsedSecs;
+} progressReport;
+
+static struct {
+	bool enabled;
+	bool print;
+	gint64 intervalUsecs;
+	char* statusFile;
+	char* statusTempFile;
+	bool statusFailed; // Only the first failure to write the file is logged
+
+	GThread* thread;
+	GCond wake;
+	bool stopping;
+
+	// Held while a report is being produced, so that reports are written in
+	// the order in which they were sampled
+	GMutex outputLock;
+
+	// Protects the values below, which describe the current phase
+	GMutex lock;
+	gint64 startTime;
+	const char* phase;
+	gint64 phaseStart;
+	uint64_t completed;
+	uint64_t total;
+	progressCounterFunc counter;
+	void* counterData;
+
+	// The rate is measured between consecutive samples
+	gint64 sampleTime;
+	uint64_t sampleCompleted;
+	double rate;
+} progress;
+
+// Called with progress.lock held
+static void progressSample(progressReport* report) {
+	gint64 now = g_get_monotonic_time();
+
+	if (progress.counter != NULL) {
+		progress.completed = progress.counter(progress.counterData);
+	}
+	uint64_t completed = progress.completed;
+	if (progress.total > 0 && completed > progress.total) completed = progress.total;
+
+	if (now > progress.sampleTime && completed >= progress.sampleCompleted) {
+		double current = (double)(completed - progress.sampleCompleted) * G_USEC_PER_SEC / (double)(now - progress.sampleTime);
+		if (progress.rate < 0.0) {
+			progress.rate = current;
+		} else {
+			progress.rate = RateSmoothing * current + (1.0 - RateSmoothing) * progress.rate;
+		}
+		progress.sampleTime = now;
+		progress.sampleCompleted = completed;
+	}
+
+	report->phase = progress.phase;
+	report->state = StateRunning;
+	report->completed = completed;
+	report->total = progress.total;
+	report->rate = progress.rate;
+	report->etaSecs = -1.0;
+	if (progress.total > 0) {
+		if (completed == progress.total) {
+			report->etaSecs = 0.0;
+		} else if (progress.rate > 0.0) {
+			report->etaSecs = (double)(progress.total - completed) / progress.rate;
+		}
+	}
+	report->phaseSecs = (double)(now - progress.phaseStart) / G_USEC_PER_SEC;
+	report->elapsedSecs = (double)(now - progress.startTime) / G_USEC_PER_SEC;
+}
+
+static void progressFormatDuration(double secs, char* buf) {
+	uint64_t total = (uint64_t)(secs + 0.5);
+	uint64_t hours = total / 3600;
+	uint64_t mins = (total / 60) % 60;
+	uint64_t rem = total % 60;
+	if (hours > 0) {
+		snprintf(buf, DURATION_BUFLEN, "%" PRIu64 "h%02" PRIu64 "m%02" PRIu64 "s", hours, mins, rem);
+	} else if (mins > 0) {
+		snprintf(buf, DURATION_BUFLEN, "%" PRIu64 "m%02" PRIu64 "s", mins, rem);
+	} else {
+		snprintf(buf, DURATION_BUFLEN, "%" PRIu64 "s", rem);
+	}
+}
+
+static void progressPrint(const progressReport* report) {
+	char phaseTime[DURATION_BUFLEN];
+	progressFormatDuration(report->phaseSecs, phaseTime);
+	char rate[RATE_BUFLEN];
+	if (report->rate < 0.0) {
+		strcpy(rate, "measuring rate");
+	} else {
+		snprintf(rate, RATE_BUFLEN, "%.1f/s", report->rate);
+	}
+
+	// Progress lines share stderr with the log, so they are written while
+	// holding the log lock to keep them from interleaving with log messages
+	if (report->total == 0) {
+		logHold();
+		fprintf(stderr, "Progress: %s: %" PRIu64 " done, %s, %s elapsed\n", report->phase, report->completed, rate, phaseTime);
+		logRelease();
+		return;
+	}
+	char eta[DURATION_BUFLEN];
+	if (report->etaSecs < 0.0) {
+		strcpy(eta, "unknown");
+	} else {
+		progressFormatDuration(report->etaSecs, eta);
+	}
+	double percent = 100.0 * (double)report->completed / (double)report->total;
+	logHold();
+	fprintf(stderr, "Progress: %s: %" PRIu64 "/%" PRIu64 " (%.1f%%), %s, ETA %s, %s elapsed\n", report->phase, report->completed, report->total, percent, rate, eta, phaseTime);
+	logRelease();
+}
+
+// Replaces the status file with a JSON object describing the report. Phase
+// names are plain identifiers, so they do not need to be escaped.
+static void progressWriteStatus(const progressReport* report) {
+	if (progress.statusFile == NULL) return;
+
+	errno = 0;
+	FILE* file = fopen(progress.statusTempFile, "we");
+	if (file == NULL) goto fail;
+
+	fprintf(file, "{\"state\":\"%s\",", StateNames[report->state]);
+	if (report->phase == NULL) {
+		fprintf(file, "\"phase\":null,");
+	} else {
+		fprintf(file, "\"phase\":\"%s\",", report->phase);
+	}
+	fprintf(file, "\"completed\":%" PRIu64 ",", report->completed);
+	if (report->total == 0) {
+		fprintf(file, "\"total\":null,");
+	} else {
+		fprintf(file, "\"total\":%" PRIu64 ",", report->total);
+	}
+	if (report->rate < 0.0) {
+		fprintf(file, "\"rate\":null,");
+	} else {
+		fprintf(file, "\"rate\":%.3f,", report->rate);
+	}
+	if (report->etaSecs < 0.0) {
+		fprintf(file, "\"eta\":null,");
+	} else {
+		fprintf(file, "\"eta\":%.1f,", report->etaSecs);
+	}
+	gint64 updated = g_get_real_time() / G_USEC_PER_SEC;
+	fprintf(file, "\"phaseElapsed\":%.1f,\"elapsed\":%.1f,\"updated\":%" PRId64 "}\n", report->phaseSecs, report->elapsedSecs, (int64_t)updated);
+
+	bool writeErr = (ferror(file) != 0);
+	if (fclose(file) != 0 || writeErr) goto fail;
+	if (rename(progress.statusTempFile, progress.statusFile) != 0) goto fail;
+	return;
+fail:
+	if (!progress.statusFailed) {
+		lprintf(LogWarning, "Failed to update progress status file '%s': %s\n", progress.statusFile, strerror(errno));
+		progress.statusFailed = true;
+	}
+}
+
+// Samples the current phase and reports it. The status file is updated even if
+// print is false.
+static void progressReportPhase(bool print) {
+	g_mutex_lock(&progress.outputLock);
+	g_mutex_lock(&progress.lock);
+	bool running = (progress.phase != NULL);
+	progressReport report;
+	if (running) progressSample(&report);
+	g_mutex_unlock(&progress.lock);
+
+	if (running) {
+		if (print) progressPrint(&report);
+		progressWriteStatus(&report);
+	}
+	g_mutex_unlock(&progress.outputLock);
+}
+
+static gpointer progressThread(gpointer data) {
+	gint64 nextReport = g_get_monotonic_time() + progress.intervalUsecs;
+	g_mutex_lock(&progress.lock);
+	while (!progress.stopping) {
+		// Signals are only sent when stopping, but wakeups may be spurious
+		if (g_cond_wait_until(&progress.wake, &progress.lock, nextReport)) continue;
+
+		g_mutex_unlock(&progress.lock);
+		progressReportPhase(progress.print);
+		g_mutex_lock(&progress.lock);
+
+		gint64 now = g_get_monotonic_time();
+		nextReport += progress.intervalUsecs;
+		if (nextReport <= now) nextReport = now + progress.intervalUsecs;
+	}
+	g_mutex_unlock(&progress.lock);
+	return NULL;
+}
+
+int progressInit(double intervalSecs, bool print, const char* statusFile) {
+	if (intervalSecs <= 0.0) {
+		lprintf(LogError, "Invalid progress reporting interval: %f seconds\n", intervalSecs);
+		return 1;
+	}
+	progress.print = print;
+	progress.intervalUsecs = (gint64)(intervalSecs * G_USEC_PER_SEC);
+	progress.statusFile = NULL;
+	progress.statusTempFile = NULL;
+	progress.statusFailed = false;
+	if (statusFile != NULL) {
+		progress.statusFile = strdup(statusFile);
+		newSprintf(&progress.statusTempFile, "%s.tmp", statusFile);
+	}
+
+	progress.stopping = false;
+	progress.startTime = g_get_monotonic_time();
+	progress.phase = NULL;
+	progress.counter = NULL;
+	g_mutex_init(&progress.lock);
+	g_mutex_init(&progress.outputLock);
+	g_cond_init(&progress.wake);
+
+	GError* err = NULL;
+	progress.thread = g_thread_try_new("progress", &progressThread, NULL, &err);
+	if (progress.thread == NULL) {
+		lprintf(LogError, "Failed to create progress reporting thread: %s\n", err->message);
+		int code = err->code;
+		g_error_free(err);
+		g_mutex_clear(&progress.lock);
+		g_mutex_clear(&progress.outputLock);
+		g_cond_clear(&progress.wake);
+		free(progress.statusFile);
+		free(progress.statusTempFile);
+		return code;
+	}
+	progress.enabled = true;
+	return 0;
+}
+
+void progressCleanup(void) {
+	if (!progress.enabled) return;
+
+	g_mutex_lock(&progress.lock);
+	progress.stopping = true;
+	g_cond_signal(&progress.wake);
+	g_mutex_unlock(&progress.lock);
+	g_thread_join(progress.thread);
+
+	g_mutex_clear(&progress.lock);
+	g_mutex_clear(&progress.outputLock);
+	g_cond_clear(&progress.wake);
+	free(progress.statusFile);
+	free(progress.statusTempFile);
+	progress.enabled = false;
+}
+
+static void progressBeginPhase(const char* phase, uint64_t total, progressCounterFunc counter, void* userData) {
+	if (!progress.enabled) return;
+
+	uint64_t completed = (counter == NULL ? 0 : counter(userData));
+	gint64 now = g_get_monotonic_time();
+
+	g_mutex_lock(&progress.lock);
+	progress.phase = phase;
+	progress.phaseStart = now;
+	progress.completed = completed;
+	progress.total = total;
+	progress.counter = counter;
+	progress.counterData = userData;
+	progress.sampleTime = now;
+	progress.sampleCompleted = completed;
+	progress.rate = -1.0;
+	g_mutex_unlock(&progress.lock);
+
+	lprintf(LogDebug, "Beginning progress phase '%s'\n", phase);
+
+	// Pollers learn about the new phase immediately
+	progressReportPhase(false);
+}
+
+void progressBegin(const char* phase, uint64_t total) {
+	progressBeginPhase(phase, total, NULL, NULL);
+}
+
+void progressBeginCounter(const char* phase, uint64_t total, progressCounterFunc counter, void* userData) {
+	progressBeginPhase(phase, total, counter, userData);
+}
+
+void progressAdvance(uint64_t steps) {
+	if (!progress.enabled) return;
+	g_mutex_lock(&progress.lock);
+	progress.completed += steps;
+	g_mutex_unlock(&progress.lock);
+}
+
+void progressSetTotal(uint64_t total) {
+	if (!progress.enabled) return;
+	g_mutex_lock(&progress.lock);
+	progress.total = total;
+	g_mutex_unlock(&progress.lock);
+}
+
+void progressFinish(bool success) {
+	if (!progress.enabled) return;
+
+	g_mutex_lock(&progress.outputLock);
+	g_mutex_lock(&progress.lock);
+	progressReport report;
+	progressSample(&report);
+	report.state = (success ? StateFinished : StateFailed);
+	progress.phase = NULL;
+	progress.counter = NULL;
+	g_mutex_unlock(&progress.lock);
+
+	if (progress.print) {
+		char elapsed[DURATION_BUFLEN];
+		progressFormatDuration(report.elapsedSecs, elapsed);
+		logHold();
+		if (success) {
+			fprintf(stderr, "Progress: finished after %s\n", elapsed);
+		} else if (report.phase == NULL) {
+			fprintf(stderr, "Progress: failed after %s\n", elapsed);
+		} else {
+			fprintf(stderr, "Progress: failed during %s after %s\n", report.phase, elapsed);
+		}
+		logRelease();
+	}
+	progressWriteStatus(&report);
+	g_mutex_unlock(&progress.outputLock);
+}
@@ -0,0 +1,68 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#pragma once
+
+// This module reports the progress of long-running operations that are divided
+// into phases. While a phase is running, a background thread periodically
+// prints the number of completed steps, the rate at which steps are being
+// completed, and an estimate of the remaining time to stderr. The same values
+// can also be written to a status file in JSON format, which is replaced
+// atomically so that other programs can poll it. If reporting was not enabled
+// with progressInit, all of the functions do nothing.
+//
+// The functions must be called from a single thread. Counters supplied with
+// progressBeginCounter are polled from the reporting thread.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Starts reporting progress every intervalSecs seconds. If print is true, each
+// report is printed to stderr. If statusFile is not NULL, each report replaces
+// the contents of the file. Free resources with progressCleanup.
+int progressInit(double intervalSecs, bool print, const char* statusFile);
+
+// Stops reporting progress. It is safe to call this function even if
+// progressInit was never called.
+void progressCleanup(void);
+
+// Begins a new phase consisting of "total" steps, which are reported as they
+// are completed with progressAdvance. If total is 0, the number of steps is
+// unknown and no time estimate is given. The phase name is retained, so it
+// should be a string literal.
+void progressBegin(const char* phase, uint64_t total);
+
+// Returns the value of an external counter that increases as work is completed.
+typedef uint64_t (*progressCounterFunc)(void* userData);
+
+// Begins a new phase whose completed steps are given by a counter rather than
+// by calls to progressAdvance. Steps may already have been completed when the
+// phase begins. The function must be thread-safe, and it may be called with
+// userData until the next phase begins or progressFinish is called.
+void progressBeginCounter(const char* phase, uint64_t total, progressCounterFunc counter, void* userData);
+
+// Records that steps in the current phase have been completed.
+void progressAdvance(uint64_t steps);
+
+// Changes the total number of steps in the current phase once it is known.
+void progressSetTotal(uint64_t total);
+
+// Ends the current phase and reports the final state of the operation. If a
+// status file is used, it continues to show this state.
+void progressFinish(bool success);
@@ -134,6 +134,9 @@ struct routePlanner {
 
 	GMutex todoLock;
 	GCond finished;
+
+	GThread* planThread; // Non-NULL while an asynchronous plan is running
+	gint completedRounds; // Accessed atomically, since it may be polled
 };
 
 // These values were empirically selected with guidance from the literature
@@ -173,6 +176,8 @@ routePlanner* rpNewPlanner(nodeId nodeCount) {
 
 	routePlanner* planner = malloc(sizeof(routePlanner));
 	planner->nodeCount = nodeCount;
+	planner->planThread = NULL;
+	planner->completedRounds = 0;
 
 	nodeId cellCount;
 	emul32(nodeCount, nodeCount, &cellCount);
@@ -202,8 +207,14 @@ routePlanner* rpNewPlanner(nodeId nodeCount) {
 	return planner;
 }
 
+uint64_t rpEstimateMemory(nodeId nodeCount) {
+	uint64_t alignedCount = ((uint64_t)nodeCount + BlockSize - 1) / BlockSize * BlockSize;
+	return alignedCount * alignedCount * sizeof(edgeInfo);
+}
+
 void rpFreePlan(routePlanner* planner) {
 	lprintln(LogDebug, "Releasing route planner resources");
+	if (planner->planThread != NULL) rpWaitForRoutes(planner);
 	flexBufferFree((void**)&planner->units, NULL, &planner->unitsCap);
 	flexBufferFree((void**)&planner->pathBuffer, NULL, &planner->pathBufferCap);
 	free(planner->edges);
@@ -431,6 +442,7 @@ int rpPlanRoutes(routePlanner* planner) {
 	nodeId downBlock = blockRowSize; // Offset to (round+1, round)
 
 	nodeId remainingRounds = blocks - 1; // blocks - (round+1)
+	g_atomic_int_set(&planner->completedRounds, 0);
 
 	// The details of this loop, including the variables, their update order,
 	// and the sequence of instructions, has been highly optimized through
@@ -466,6 +478,8 @@ int rpPlanRoutes(routePlanner* planner) {
 		rightBlock += blockDiagonalSize;
 		downBlock += blockDiagonalSize;
 		--remainingRounds;
+
+		g_atomic_int_set(&planner->completedRounds, (gint)round + 1);
 	}
 
 	if (!singleThreaded) {
@@ -475,3 +489,40 @@ int rpPlanRoutes(routePlanner* planner) {
 	}
 	return 0;
 }
+
+static gpointer rpPlanThread(gpointer data) {
+	routePlanner* planner = data;
+	return GINT_TO_POINTER(rpPlanRoutes(planner));
+}
+
+int rpPlanRoutesAsync(routePlanner* planner) {
+	if (planner->planThread != NULL) {
+		lprintln(LogError, "BUG: started planning routes while a previous plan was still in progress");
+		return 1;
+	}
+	GError* err = NULL;
+	planner->planThread = g_thread_try_new("route-planner", &rpPlanThread, planner, &err);
+	if (planner->planThread == NULL) {
+		lprintf(LogError, "Failed to create route planning thread: %s\n", err->message);
+		int code = err->code;
+		g_error_free(err);
+		return code;
+	}
+	return 0;
+}
+
+void rpGetProgress(routePlanner* planner, uint64_t* completedRounds, uint64_t* totalRounds) {
+	gint rounds = g_atomic_int_get(&planner->completedRounds);
+	*completedRounds = (uint64_t)rounds;
+	*totalRounds = planner->nodeCount / BlockSize;
+}
+
+int rpWaitForRoutes(routePlanner* planner) {
+	if (planner->planThread == NULL) {
+		lprintln(LogError, "BUG: waited for route planning that was never started");
+		return 1;
+	}
+	gpointer res = g_thread_join(planner->planThread);
+	planner->planThread = NULL;
+	return GPOINTER_TO_INT(res);
+}
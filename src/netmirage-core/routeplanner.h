@@ -23,6 +23,7 @@
 // static routing for a network graph.
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "topology.h"
 
@@ -32,6 +33,10 @@ typedef struct routePlanner routePlanner;
 // graph are untraversable. Returns NULL if an error occurred.
 routePlanner* rpNewPlanner(nodeId nodeCount);
 
+// Returns the number of bytes that a planner for nodeCount nodes allocates for
+// its adjacency matrix, which dominates its memory use.
+uint64_t rpEstimateMemory(nodeId nodeCount);
+
 // Releases all resources associated with a route planner.
 void rpFreePlan(routePlanner* planner);
 
@@ -44,6 +49,22 @@ void rpSetWeight(routePlanner* planner, nodeId from, nodeId to, float weight);
 // otherwise.
 int rpPlanRoutes(routePlanner* planner);
 
+// Begins planning routes (as with rpPlanRoutes) in a background thread and
+// returns immediately. The caller may perform unrelated work in the meantime,
+// but must not access the planner until rpWaitForRoutes returns. Every call to
+// this function must be paired with a call to rpWaitForRoutes. Returns 0 on
+// success or an error code otherwise.
+int rpPlanRoutesAsync(routePlanner* planner);
+
+// Retrieves the number of rounds of the planning algorithm that have been
+// completed, along with the total number of rounds. This may be called from any
+// thread while routes are being planned asynchronously.
+void rpGetProgress(routePlanner* planner, uint64_t* completedRounds, uint64_t* totalRounds);
+
+// Waits for a planning operation started by rpPlanRoutesAsync to finish.
+// Returns the result of the planning operation.
+int rpWaitForRoutes(routePlanner* planner);
+
 // Finds the shortest route from a starting node to an ending node. Must be
 // called after rpPlanRoutes. If no path exists, the function returns false.
 // Otherwise, it returns true, "path" points to an array of node indices
@@ -0,0 +1,82 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#include "scaling.h"
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Static ARP entries are added for both ends of every link, and each client has
+// additional entries for its connection to the root. A few extras are
+// permitted in case they are needed for other purposes.
+static const uint64_t ArpEntriesPerLink = 2;
+static const uint64_t ArpEntriesPerClient = 3;
+static const uint64_t ArpEntriesExtra = 100;
+
+// Each worker keeps a namespace file and a netlink socket open for every
+// namespace that it has recently modified
+static const uint64_t FilesPerOpenNamespace = 2;
+static const uint64_t FilesExtra = 4096;
+
+// Connection tracking state is only kept if the netfilter modules are loaded.
+// We expect clients to maintain a moderate number of concurrent flows.
+static const uint64_t TrackedFlowsPerClient = 64;
+
+static void scalingAdd(scalingLimit limits[], size_t* count, const char* sysctl, bool optional, uint64_t needed, uint64_t maximum, const char* fmt, ...) {
+	scalingLimit* limit = &limits[(*count)++];
+	limit->sysctl = sysctl;
+	limit->optional = optional;
+	limit->needed = needed;
+	limit->maximum = maximum;
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(limit->reason, SCALING_REASON_LEN, fmt, args);
+	va_end(args);
+}
+
+size_t scalingPlan(const scalingCounts* counts, uint32_t workers, scalingLimit limits[]) {
+	size_t count = 0;
+
+	// The neighbor table is shared by all namespaces. The kernel begins
+	// discarding entries when it exceeds gc_thresh2, and refuses to add more
+	// than gc_thresh3. We keep the default ratios between the thresholds.
+	uint64_t arpEntries = ArpEntriesPerLink * counts->links + ArpEntriesPerClient * counts->clientNodes + ArpEntriesExtra;
+	scalingAdd(limits, &count, "net.ipv4.neigh.default.gc_thresh1", false, arpEntries / 4, INT_MAX, "garbage collection threshold for %lu static ARP entries", arpEntries);
+	scalingAdd(limits, &count, "net.ipv4.neigh.default.gc_thresh2", false, arpEntries, INT_MAX, "%lu static ARP entries for %lu links and %lu clients", arpEntries, counts->links, counts->clientNodes);
+	scalingAdd(limits, &count, "net.ipv4.neigh.default.gc_thresh3", false, arpEntries * 2, INT_MAX, "hard limit of twice the %lu static ARP entries", arpEntries);
+
+	// Every namespace installs one route per client subnet and one per link
+	scalingAdd(limits, &count, "net.ipv4.route.max_size", true, counts->maxRoutes, INT_MAX, "up to %lu static routes in a single namespace", counts->maxRoutes);
+
+	// Packets sent over veth pairs are queued on the receiving CPU's backlog,
+	// so a burst crossing every link at once must fit
+	uint64_t interfaces = 2 * (counts->links + counts->clientNodes);
+	scalingAdd(limits, &count, "net.core.netdev_max_backlog", false, interfaces, INT_MAX, "one queued packet for each of %lu virtual interfaces", interfaces);
+
+	uint64_t openNamespaces = (uint64_t)workers * (counts->nodes + 1);
+	uint64_t files = FilesPerOpenNamespace * openNamespaces + FilesExtra;
+	scalingAdd(limits, &count, "fs.file-max", false, files, LONG_MAX, "%u workers holding %lu namespaces open", workers, counts->nodes + 1);
+
+	uint64_t flows = TrackedFlowsPerClient * counts->clientNodes;
+	scalingAdd(limits, &count, "net.netfilter.nf_conntrack_max", true, flows, INT_MAX, "%lu tracked flows for %lu clients", flows, counts->clientNodes);
+
+	return count;
+}
@@ -0,0 +1,53 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#pragma once
+
+// This module determines the kernel limits that must be raised in order to
+// support a virtual network. The limits are derived from the actual size of the
+// topology, rather than from worst-case assumptions about its connectivity.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+	uint64_t links;       // Virtual connections between distinct hosts
+	uint64_t nodes;       // Virtual hosts, each with its own namespace
+	uint64_t clientNodes;
+	uint64_t maxRoutes;   // Most static routes installed in a single namespace
+} scalingCounts;
+
+#define SCALING_REASON_LEN 128
+#define SCALING_MAX_LIMITS 7
+
+typedef struct {
+	const char* sysctl; // Dotted parameter name
+	bool optional;      // If true, the limit is skipped if the kernel lacks it
+	uint64_t needed;    // Smallest acceptable value
+	uint64_t maximum;   // Largest value that the kernel accepts
+	char reason[SCALING_REASON_LEN];
+} scalingLimit;
+
+// Computes the kernel limits needed for a network of the given size, which is
+// constructed by "workers" worker processes. Stores the limits in "limits",
+// which must have room for SCALING_MAX_LIMITS entries, and returns the number
+// of limits stored. Limits are never lowered, so the caller should only apply
+// the ones that exceed the current values.
+size_t scalingPlan(const scalingCounts* counts, uint32_t workers, scalingLimit limits[]);
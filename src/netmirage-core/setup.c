@@ -22,7 +22,6 @@
 #include "setup.h"
 
 #include <errno.h>
-#include <fenv.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -31,20 +30,35 @@
 #include <string.h>
 
 #include <glib.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "graphml.h"
+#include "intern.h"
 #include "ip.h"
 #include "log.h"
 #include "mem.h"
+#include "net.h"
+#include "progress.h"
 #include "routeplanner.h"
+#include "scaling.h"
+#include "snapshot.h"
 #include "topology.h"
 #include "work.h"
 
 static const setupParams* globalParams = NULL;
 
+// Returns true if the edge node is connected to this machine. When the network
+// is not partitioned, every edge node is.
+static bool setupEdgeIsLocal(const edgeNodeParams* edge) {
+	return edge->partition == globalParams->partition;
+}
+
 static bool edgeFileOpened = false;
 static FILE* edgeFile = NULL;
 
+static const char* JournalFileName = "setup.journal";
+
 #define DO_OR_GOTO(stmt, label, res) do{ \
 	res = (stmt); \
 	if (res != 0) { \
@@ -59,14 +73,108 @@ static FILE* edgeFile = NULL;
 	} \
 }while(0)
 
+// The setup journal is stored alongside the topology snapshot
+static char* setupJournalPath(void) {
+	char* path;
+	newSprintf(&path, "%s/%s", globalParams->ovsDir, JournalFileName);
+	return path;
+}
+
+static void fingerprintAdd(uint64_t* hash, const void* data, size_t len) {
+	const unsigned char* bytes = data;
+	for (size_t i = 0; i < len; ++i) {
+		*hash ^= bytes[i];
+		*hash *= 1099511628211ULL; // 64-bit FNV-1a prime
+	}
+}
+
+static void fingerprintAddStr(uint64_t* hash, const char* str) {
+	if (str == NULL) str = "";
+	fingerprintAdd(hash, str, strlen(str) + 1);
+}
+
+// Computes a fingerprint of the inputs that determine the sequence of setup
+// orders, so that a journal is only resumed with the same inputs. The topology
+// file is identified by its size and modification time, since reading a large
+// file again would be expensive.
+static uint64_t setupFingerprint(const setupParams* params, const setupGraphMLParams* gmlParams) {
+	uint64_t hash = 14695981039346656037ULL; // 64-bit FNV-1a offset basis
+	fingerprintAddStr(&hash, params->nsPrefix);
+	fingerprintAdd(&hash, &params->rootIsInitNs, sizeof(params->rootIsInitNs));
+	fingerprintAddStr(&hash, params->srcFile);
+	struct stat srcStat;
+	if (params->srcFile != NULL && stat(params->srcFile, &srcStat) == 0) {
+		int64_t size = srcStat.st_size;
+		int64_t mtime = srcStat.st_mtime;
+		fingerprintAdd(&hash, &size, sizeof(size));
+		fingerprintAdd(&hash, &mtime, sizeof(mtime));
+	}
+	const ip4Subnet* globalVSubnet = &params->edgeNodeDefaults.globalVSubnet;
+	fingerprintAdd(&hash, &globalVSubnet->addr, sizeof(globalVSubnet->addr));
+	fingerprintAdd(&hash, &globalVSubnet->prefixLen, sizeof(globalVSubnet->prefixLen));
+	for (size_t i = 0; i < params->edgeNodeCount; ++i) {
+		const edgeNodeParams* edge = &params->edgeNodes[i];
+		fingerprintAdd(&hash, &edge->ip, sizeof(edge->ip));
+		fingerprintAddStr(&hash, edge->intf != NULL ? edge->intf : params->edgeNodeDefaults.intf);
+		if (edge->macSpecified) fingerprintAdd(&hash, edge->mac.octets, MAC_ADDR_BYTES);
+		if (edge->vsubnetSpecified) {
+			fingerprintAdd(&hash, &edge->vsubnet.addr, sizeof(edge->vsubnet.addr));
+			fingerprintAdd(&hash, &edge->vsubnet.prefixLen, sizeof(edge->vsubnet.prefixLen));
+		}
+		fingerprintAdd(&hash, &edge->capacity, sizeof(edge->capacity));
+		fingerprintAdd(&hash, &edge->partition, sizeof(edge->partition));
+	}
+	fingerprintAdd(&hash, &params->partitionCount, sizeof(params->partitionCount));
+	fingerprintAdd(&hash, &params->partition, sizeof(params->partition));
+	if (params->partitionCount > 1) {
+		fingerprintAdd(&hash, params->partitionAddrs, params->partitionCount * sizeof(ip4Addr));
+	}
+	fingerprintAdd(&hash, &gmlParams->bandwidthDivisor, sizeof(gmlParams->bandwidthDivisor));
+	fingerprintAdd(&hash, &gmlParams->twoPass, sizeof(gmlParams->twoPass));
+	fingerprintAdd(&hash, &gmlParams->bufferEdges, sizeof(gmlParams->bufferEdges));
+	fingerprintAddStr(&hash, gmlParams->weightKey);
+	fingerprintAddStr(&hash, gmlParams->clientType);
+	uint32_t edgeAssignment = (uint32_t)gmlParams->edgeAssignment;
+	fingerprintAdd(&hash, &edgeAssignment, sizeof(edgeAssignment));
+	fingerprintAdd(&hash, &gmlParams->colocateClients, sizeof(gmlParams->colocateClients));
+	fingerprintAdd(&hash, &gmlParams->pruneUnused, sizeof(gmlParams->pruneUnused));
+	fingerprintAdd(&hash, &gmlParams->collapseChains, sizeof(gmlParams->collapseChains));
+	fingerprintAdd(&hash, &gmlParams->vrfPackSize, sizeof(gmlParams->vrfPackSize));
+	return hash;
+}
+
+// Starts the setup journal. The Open vSwitch directory is normally created
+// along with the root namespace, but the journal is needed before then.
+static int setupBeginJournal(const setupGraphMLParams* gmlParams, bool resume, bool* resumed) {
+	*resumed = false;
+	errno = 0;
+	if (mkdir(globalParams->ovsDir, 0700) != 0 && errno != EEXIST) {
+		int err = errno;
+		lprintf(LogError, "Could not create directory '%s' for the setup journal: %s\n", globalParams->ovsDir, strerror(err));
+		return err;
+	}
+	char* path = setupJournalPath();
+	int err = workBeginJournal(path, setupFingerprint(globalParams, gmlParams), resume, resumed);
+	free(path);
+	return err;
+}
+
 int setupInit(void) {
 	DO_OR_RETURN(workInit());
 	return 0;
 }
 
-int setupConfigure(const setupParams* params) {
+int setupConfigure(const setupParams* params, const setupGraphMLParams* gmlParams) {
 	globalParams = params;
 
+	if (params->printProgress || params->statusFile != NULL) {
+		DO_OR_RETURN(progressInit(params->progressInterval, params->printProgress, params->statusFile));
+	}
+
+	DO_OR_RETURN(workSetWorkers(params->workers, params->adaptiveWorkers, params->workerThreads));
+	if (params->printOrderStats || params->orderStatsFile != NULL) {
+		workEnableOrderStats(params->printOrderStats, params->orderStatsFile);
+	}
 	DO_OR_RETURN(workConfigure(logThreshold(), logColorized(), params->nsPrefix, params->ovsDir, params->ovsSchema, params->softMemCap));
 	DO_OR_RETURN(workJoin(false));
 
@@ -74,22 +182,65 @@ int setupConfigure(const setupParams* params) {
 		return destroyNetwork();
 	}
 
+	if (params->applyChanges) {
+		// The edge configuration of the running network is stored in its
+		// snapshot, and the network itself must be preserved
+		lprintln(LogInfo, "Applying topology changes to the existing virtual network");
+		return 0;
+	}
+
+	if (params->replayPlanFile != NULL) {
+		// Everything about the edge nodes is already stored in the plan
+		if (params->keepOldNetworks) {
+			lprintln(LogInfo, "Preserving existing virtual networks as requested");
+			return 0;
+		}
+		return destroyNetwork();
+	}
+
 	if (params->edgeNodeCount < 1) {
 		lprintln(LogError, "No edge nodes were specified. Configure them using a setup file or manually using --edge-node.");
 		return 1;
 	}
 
-	if (params->keepOldNetworks) {
-		lprintln(LogInfo, "Preserving existing virtual networks as requested");
+	// The journal records the responses to the queries below, so it must be
+	// started first. If there is nothing to resume, we start from scratch.
+	bool resumed = false;
+	if (params->resume) {
+		DO_OR_RETURN(setupBeginJournal(gmlParams, true, &resumed));
+	}
+
+	if (params->dryRun) {
+		lprintln(LogInfo, "Performing a dry run; existing virtual networks are left untouched");
+	} else if (params->compilePlanFile != NULL) {
+		lprintln(LogInfo, "Compiling a setup plan; existing virtual networks are left untouched");
+	} else if (resumed) {
+		lprintln(LogInfo, "Preserving the partially constructed virtual network in order to resume its setup");
 	} else {
-		int err = destroyNetwork();
-		if (err != 0) return err;
+		if (params->keepOldNetworks) {
+			lprintln(LogInfo, "Preserving existing virtual networks as requested");
+		} else {
+			int err = destroyNetwork();
+			if (err != 0) return err;
+		}
+		DO_OR_RETURN(setupBeginJournal(gmlParams, false, &resumed));
 	}
 
-	// Complete definitions for edge nodes by filling in default / missing data
+	// Complete definitions for edge nodes by filling in default / missing data.
+	// Edge nodes on other machines only need their client subnets.
 	size_t edgeSubnetsNeeded = 0;
 	for (size_t i = 0; i < params->edgeNodeCount; ++i) {
 		edgeNodeParams* edge = &params->edgeNodes[i];
+		if (edge->partition >= params->partitionCount) {
+			char ip[IP4_ADDR_BUFLEN];
+			ip4AddrToString(edge->ip, ip);
+			lprintf(LogError, "Edge node with IP %s belongs to partition %u, but there are only %u machines. Use --partition-hosts to list all of the machines.\n", ip, edge->partition, params->partitionCount);
+			return 1;
+		}
+		if (!edge->vsubnetSpecified) {
+			++edgeSubnetsNeeded;
+		}
+		if (!setupEdgeIsLocal(edge)) continue;
 		if (edge->intf == NULL) {
 			if (!params->edgeNodeDefaults.intfSpecified) {
 				char ip[IP4_ADDR_BUFLEN];
@@ -100,12 +251,33 @@ int setupConfigure(const setupParams* params) {
 			edge->intf = eamalloc(strlen(params->edgeNodeDefaults.intf), 1, 1);
 			strcpy(edge->intf, params->edgeNodeDefaults.intf);
 		}
-		if (!edge->macSpecified) {
-			DO_OR_RETURN(workGetEdgeRemoteMac(edge->intf, edge->ip, &edge->mac));
+	}
+
+	// Discover the MAC addresses of all unconfigured edge nodes at once
+	if (!params->dryRun) {
+		const char** macIntfs = eamalloc(params->edgeNodeCount, sizeof(const char*), 0);
+		ip4Addr* macIps = eamalloc(params->edgeNodeCount, sizeof(ip4Addr), 0);
+		macAddr* macs = eamalloc(params->edgeNodeCount, sizeof(macAddr), 0);
+		size_t macCount = 0;
+		for (size_t i = 0; i < params->edgeNodeCount; ++i) {
+			edgeNodeParams* edge = &params->edgeNodes[i];
+			if (edge->macSpecified || !setupEdgeIsLocal(edge)) continue;
+			macIntfs[macCount] = edge->intf;
+			macIps[macCount] = edge->ip;
+			++macCount;
 		}
-		if (!edge->vsubnetSpecified) {
-			++edgeSubnetsNeeded;
+		int err = workGetEdgeRemoteMacs(macCount, macIntfs, macIps, macs);
+		if (err == 0) {
+			size_t next = 0;
+			for (size_t i = 0; i < params->edgeNodeCount; ++i) {
+				edgeNodeParams* edge = &params->edgeNodes[i];
+				if (!edge->macSpecified && setupEdgeIsLocal(edge)) edge->mac = macs[next++];
+			}
 		}
+		free(macIntfs);
+		free(macIps);
+		free(macs);
+		if (err != 0) return err;
 	}
 
 	// Automatically provide client subnets to unconfigured edge nodes
@@ -143,6 +315,10 @@ int setupConfigure(const setupParams* params) {
 		ip4AddrToString(edge->ip, ip);
 		macAddrToString(&edge->mac, mac);
 		ip4SubnetToString(&edge->vsubnet, subnet);
+		if (!setupEdgeIsLocal(edge)) {
+			lprintf(LogInfo, "Configured edge node on machine %u: IP %s, client subnet %s\n", edge->partition, ip, subnet);
+			continue;
+		}
 		lprintf(LogInfo, "Configured edge node: IP %s, interface %s, MAC %s, client subnet %s\n", ip, edge->intf, mac, subnet);
 	}
 
@@ -163,7 +339,7 @@ int setupConfigure(const setupParams* params) {
 
 	if (subnetErr) return 1;
 
-	if (!params->quiet) {
+	if (!params->quiet && !params->dryRun) {
 		if (params->edgeFile == NULL) {
 			edgeFile = stdout;
 			lprintln(LogDebug, "Writing edge node commands to stdout");
@@ -183,6 +359,7 @@ int setupConfigure(const setupParams* params) {
 }
 
 int setupCleanup(void) {
+	progressCleanup();
 	DO_OR_RETURN(workCleanup());
 	if (edgeFileOpened) {
 		fclose(edgeFile);
@@ -196,6 +373,17 @@ int destroyNetwork(void) {
 	DO_OR_RETURN(workDestroyHosts());
 	DO_OR_RETURN(workJoin(false));
 
+	char* snapshotFile = snapPath(globalParams->ovsDir);
+	snapDelete(snapshotFile);
+	free(snapshotFile);
+
+	// The journal of an interrupted setup no longer describes anything
+	char* journalFile = setupJournalPath();
+	if (unlink(journalFile) != 0 && errno != ENOENT) {
+		lprintf(LogWarning, "Failed to delete setup journal '%s': %s\n", journalFile, strerror(errno));
+	}
+	free(journalFile);
+
 	return 0;
 }
 
@@ -204,11 +392,154 @@ int destroyNetwork(void) {
 |                               GraphML Parsing                                |
 \******************************************************************************/
 
+// Compact form of a link read from a GraphML file, referring to the endpoint
+// names by their identifiers in an edge buffer's name table
+typedef struct {
+	uint32_t sourceName;
+	uint32_t targetName;
+	float weight;
+	TopoLink t;
+} gmlBufferedLink;
+
+// Holds links read from a GraphML file until all of the nodes are known, which
+// allows files with <node> elements after <edge> elements to be processed in a
+// single pass. Links are kept in memory until the memory limit is reached, at
+// which point they are moved to an anonymous temporary file.
+typedef struct {
+	// Endpoint names, which may not refer to known nodes when they are buffered
+	internTable* names;
+
+	gmlBufferedLink* links;
+	size_t linkCount;
+	size_t linkCap;
+	size_t linkLimit;
+
+	FILE* spillFile;
+	uint64_t spilledLinks;
+} gmlEdgeBuffer;
+
+static void gmlFreeData(gpointer data) { free(data); }
+
+// Identifies an undirected link between two distinct nodes
+static uint64_t setupLinkKey(nodeId id1, nodeId id2) {
+	if (id1 > id2) {
+		nodeId tmp = id1;
+		id1 = id2;
+		id2 = tmp;
+	}
+	return ((uint64_t)id1 << 32) | (uint64_t)id2;
+}
+
+static void gmlInitEdgeBuffer(gmlEdgeBuffer* buf, uint64_t memLimit) {
+	buf->names = internNew();
+	flexBufferInit((void**)&buf->links, &buf->linkCount, &buf->linkCap);
+	uint64_t limit = memLimit / sizeof(gmlBufferedLink);
+	buf->linkLimit = (limit < 1 ? 1 : (limit > SIZE_MAX ? SIZE_MAX : (size_t)limit));
+	buf->spillFile = NULL;
+	buf->spilledLinks = 0;
+}
+
+static void gmlFreeEdgeBuffer(gmlEdgeBuffer* buf) {
+	internFree(buf->names);
+	flexBufferFree((void**)&buf->links, &buf->linkCount, &buf->linkCap);
+	if (buf->spillFile != NULL) fclose(buf->spillFile);
+}
+
+static int gmlBufferLink(gmlEdgeBuffer* buf, const GmlLink* link) {
+	gmlBufferedLink record = {
+		.sourceName = internAdd(buf->names, link->sourceName, NULL),
+		.targetName = internAdd(buf->names, link->targetName, NULL),
+		.weight = link->weight,
+		.t = link->t,
+	};
+	if (record.sourceName == INTERN_NONE || record.targetName == INTERN_NONE) {
+		lprintln(LogError, "The topology contains too many distinct node names to buffer its links");
+		return 1;
+	}
+
+	if (buf->linkCount >= buf->linkLimit) {
+		if (buf->spillFile == NULL) {
+			errno = 0;
+			buf->spillFile = tmpfile();
+			if (buf->spillFile == NULL) {
+				int err = errno;
+				lprintf(LogError, "Could not create a temporary file for buffering links: %s\n", strerror(err));
+				return err;
+			}
+			lprintf(LogDebug, "Link buffer exceeded the memory limit; spilling %lu links to a temporary file\n", buf->linkCount);
+		}
+		if (fwrite(buf->links, sizeof(gmlBufferedLink), buf->linkCount, buf->spillFile) != buf->linkCount) {
+			lprintln(LogError, "Failed to write buffered links to a temporary file");
+			return 1;
+		}
+		buf->spilledLinks += buf->linkCount;
+		buf->linkCount = 0;
+	}
+	flexBufferGrow((void**)&buf->links, buf->linkCount, &buf->linkCap, 1, sizeof(gmlBufferedLink));
+	flexBufferAppend(buf->links, &buf->linkCount, &record, 1, sizeof(gmlBufferedLink));
+	return 0;
+}
+
+// Resolves the endpoint names of a buffered link using the table of node names
+// from the parser and passes the link to newLink
+static int gmlReplayLink(gmlEdgeBuffer* buf, const internTable* nodeNames, const gmlBufferedLink* record, NewLinkFunc newLink, void* userData) {
+	GmlLink link = {
+		.sourceName = internString(buf->names, record->sourceName),
+		.targetName = internString(buf->names, record->targetName),
+		.weight = record->weight,
+		.t = record->t,
+	};
+	uint32_t sourceId = internFind(nodeNames, link.sourceName);
+	uint32_t targetId = internFind(nodeNames, link.targetName);
+	link.sourceId = (sourceId == INTERN_NONE ? INVALID_NODE_ID : sourceId);
+	link.targetId = (targetId == INTERN_NONE ? INVALID_NODE_ID : targetId);
+	return newLink(&link, userData);
+}
+
+// Passes all buffered links to newLink in their original order
+static int gmlReplayLinks(gmlEdgeBuffer* buf, const internTable* nodeNames, NewLinkFunc newLink, void* userData) {
+	lprintf(LogDebug, "Processing %lu buffered links (%lu spilled to disk)\n", buf->spilledLinks + buf->linkCount, buf->spilledLinks);
+	if (buf->spillFile != NULL) {
+		rewind(buf->spillFile);
+		gmlBufferedLink record;
+		for (uint64_t i = 0; i < buf->spilledLinks; ++i) {
+			if (fread(&record, sizeof(record), 1, buf->spillFile) != 1) {
+				lprintln(LogError, "Failed to read buffered links from a temporary file");
+				return 1;
+			}
+			DO_OR_RETURN(gmlReplayLink(buf, nodeNames, &record, newLink, userData));
+		}
+	}
+	for (size_t i = 0; i < buf->linkCount; ++i) {
+		DO_OR_RETURN(gmlReplayLink(buf, nodeNames, &buf->links[i], newLink, userData));
+	}
+	return 0;
+}
+
+// Portion of the soft memory cap that may be used for buffering links
+#define EDGE_BUFFER_MEM_DIVISOR 4
+
 typedef struct {
 	ip4Addr addr; // Duplicated for all interfaces
 	bool isClient;
 	ip4Subnet clientSubnet;
 	macAddr clientMacs[NEEDED_MACS_CLIENT];
+
+	// Parameters retained for the topology snapshot
+	TopoNode node;
+	bool hasSelfLink;
+	TopoLink selfLink;
+
+	// True if the node is inside a chain that was replaced by a single link
+	bool collapsed;
+
+	// Machine that constructs the node in a partitioned network
+	uint32_t partition;
+
+	// Used for assigning client nodes to edge nodes
+	size_t edgeIdx;
+	nodeId closestId;    // Neighbor connected by the link with the lowest weight
+	float closestWeight; // Negative if the node has no neighbors
 } gmlNodeState;
 
 typedef struct {
@@ -221,22 +552,56 @@ typedef struct {
 	size_t nodeCount;   // Total number of nodes (client + non-client)
 	size_t clientNodes; // Total number of client nodes
 	size_t nodeCap;
-	GHashTable* gmlToState; // Maps GraphML names to indices in nodeStates
+	internTable* names; // GraphML names, indexed by node identifier
 
 	int mtu;
 
-	double clientsPerEdge;
-	nodeId currentEdgeIdx;
-	nodeId currentEdgeClients;
-	ip4FragIter* clientIter;
+	ip4FragIter** clientIters; // Subnet fragments for each edge node
 
 	ip4Iter* intfAddrIter;
 	macAddr macAddrIter;
 
+	// All links between distinct nodes, retained for the topology snapshot
+	snapLink* links;
+	size_t linkCount;
+	size_t linkCap;
+
 	routePlanner* routes;
-} gmlContext;
 
-static void gmlFreeData(gpointer data) { free(data); }
+	// Links are buffered until all nodes have been read with --buffer-edges,
+	// or counted during the first pass with --two-pass, so that the kernel can
+	// be prepared for them. linksCounted is set once the count is complete.
+	gmlEdgeBuffer* edgeBuffer;
+	uint64_t countedLinks;
+	bool linksCounted;
+
+	// Orders completed before the hosts and links were created, used to
+	// report their progress
+	uint64_t hostOrderBase;
+	uint64_t linkOrderBase;
+
+	// If true, hosts and links are only created once the routes are known.
+	// This is needed when pruning (only hosts and links that are used by a
+	// route between two client nodes are created), when collapsing chains of
+	// transit nodes into single links, and when packing transit nodes into
+	// shared namespaces (packSize is not 0), and when the network is
+	// partitioned among several machines.
+	bool deferred;
+	bool prune;
+	bool collapse;
+	bool partitioned;
+	uint32_t packSize;
+	size_t prunedHosts;
+	size_t prunedLinks;
+	size_t collapsedHosts;
+	size_t collapsedChains;
+	size_t packedHosts;
+	uint32_t packs;
+	size_t localHosts;   // Hosts constructed on this machine
+	size_t cutLinks;     // Links between hosts on different machines
+	size_t tunnels;      // Cut links with an end on this machine
+	double cutTraffic;   // Fraction of the route hops that cross machines
+} gmlContext;
 
 static void gmlGenerateIp(gmlContext* ctx, bool* addrExhausted, ip4Addr* addr) {
 	if (*addrExhausted) return;
@@ -247,53 +612,55 @@ static void gmlGenerateIp(gmlContext* ctx, bool* addrExhausted, ip4Addr* addr) {
 	*addr = ip4IterAddr(ctx->intfAddrIter);
 }
 
-// Looks up the node state for a given string identifier from the GraphML file.
-// If the state does not exist, and "node" is not NULL, then a new state is
-// created and cached. Otherwise, an error occurs. Returns true on success, in
-// which case "id" and "state" are set. Otherwise, returns false and their
-// values are undefined.
-static bool gmlNameToState(gmlContext* ctx, const char* name, const TopoNode* node, nodeId* id, gmlNodeState** state) {
-	gpointer ptr;
-	gboolean exists = g_hash_table_lookup_extended(ctx->gmlToState, name, NULL, &ptr);
-	size_t index = GPOINTER_TO_SIZE(ptr);
-	*state = &ctx->nodeStates[index];
-	if (!exists) {
-		if (node == NULL) {
-			lprintf(LogError, "Requested existing state for unknown host '%s'\n", name);
-			return NULL;
-		}
-		bool addrExhausted = false;
-		ip4Addr newAddr;
-		gmlGenerateIp(ctx, &addrExhausted, &newAddr);
-		if (addrExhausted) {
-			lprintln(LogError, "Cannot set up all of the virtual hosts because the non-routable IPv4 address space has been exhausted. Either decrease the number of nodes in the topology, or assign fewer addresses to the edge nodes.");
-			return NULL;
-		}
-
-		index = ctx->nodeCount++;
+// Creates the state for a node that has just been assigned an identifier by the
+// parser. Returns NULL on failure.
+static gmlNodeState* gmlNewState(gmlContext* ctx, const GmlNode* node) {
+	if (node->id != ctx->nodeCount) {
+		lprintf(LogError, "The topology defines host '%s' more than once\n", node->name);
+		return NULL;
+	}
+	bool addrExhausted = false;
+	ip4Addr newAddr;
+	gmlGenerateIp(ctx, &addrExhausted, &newAddr);
+	if (addrExhausted) {
+		lprintln(LogError, "Cannot set up all of the virtual hosts because the non-routable IPv4 address space has been exhausted. Either decrease the number of nodes in the topology, or assign fewer addresses to the edge nodes.");
+		return NULL;
+	}
 
-		flexBufferGrow((void**)&ctx->nodeStates, ctx->nodeCount, &ctx->nodeCap, 1, sizeof(gmlNodeState));
-		g_hash_table_insert(ctx->gmlToState, (gpointer)strdup(name), GSIZE_TO_POINTER(index));
+	flexBufferGrow((void**)&ctx->nodeStates, ctx->nodeCount, &ctx->nodeCap, 1, sizeof(gmlNodeState));
+	gmlNodeState* state = &ctx->nodeStates[ctx->nodeCount++];
+	state->addr = newAddr;
+	state->isClient = node->t.client;
+	state->node = node->t;
+	state->hasSelfLink = false;
+	state->collapsed = false;
+	state->partition = 0;
+	state->closestWeight = -1.f;
+	return state;
+}
 
-		*state = &ctx->nodeStates[index];
-		(*state)->addr = newAddr;
-		(*state)->isClient = node->client;
+// Looks up the state for an endpoint of a link. Returns NULL if the endpoint
+// does not refer to a known node.
+static gmlNodeState* gmlEndpointState(gmlContext* ctx, nodeId id, const char* name) {
+	if (id >= ctx->nodeCount) {
+		lprintf(LogError, "Requested existing state for unknown host '%s'\n", name);
+		return NULL;
 	}
-	*id = (nodeId)index;
-	return state;
+	return &ctx->nodeStates[id];
 }
 
 static int gmlAddNode(const GmlNode* node, void* userData) {
 	gmlContext* ctx = userData;
 	if (ctx->ignoreNodes) return 0;
+	progressAdvance(1);
 	if (ctx->finishedNodes) {
-		lprintln(LogError, "The GraphML file contains some <node> elements after the <edge> elements. To parse this file, use the --two-pass option.");
+		lprintln(LogError, "The GraphML file contains some <node> elements after the <edge> elements. To parse this file, use the --buffer-edges or --two-pass option.");
 		return 1;
 	}
 
-	nodeId id;
-	gmlNodeState* state;
-	if (!gmlNameToState(ctx, node->name, &node->t, &id, &state)) return 1;
+	nodeId id = node->id;
+	gmlNodeState* state = gmlNewState(ctx, node);
+	if (state == NULL) return 1;
 
 	if (node->t.client) {
 		if (!macNextAddrs(&ctx->macAddrIter, state->clientMacs, NEEDED_MACS_CLIENT)) {
@@ -309,242 +676,1175 @@ static int gmlAddNode(const GmlNode* node, void* userData) {
 		lprintf(LogDebug, "GraphML node '%s' assigned identifier %u and IP address %s\n", node->name, id, ip);
 	}
 
-	DO_OR_RETURN(workAddHost(id, state->addr, state->clientMacs, ctx->mtu, &node->t));
+	if (!ctx->deferred) DO_OR_RETURN(workAddHost(id, state->addr, state->clientMacs, ctx->mtu, &node->t));
 	return 0;
 }
 
+// Raises the kernel limits for a network with the given number of namespaces
+// and links, where up to hostsPerNamespace hosts share a namespace. All hosts
+// must have been created, and links must not yet be added.
+static int setupEnsureScaling(uint64_t namespaces, uint64_t clientNodes, uint64_t links, uint64_t hostsPerNamespace) {
+	scalingCounts counts = {
+		.links = links,
+		.nodes = namespaces,
+		.clientNodes = clientNodes,
+		// A host has a route for every client subnet and every neighbor
+		.maxRoutes = (clientNodes + (links < namespaces ? links : namespaces)) * hostsPerNamespace,
+	};
+	DO_OR_RETURN(workJoin(false));
+	DO_OR_RETURN(workEnsureSystemScaling(&counts));
+	return workJoin(false);
+}
+
+// Progress counter for the work orders completed since the value in userData
+static uint64_t gmlCountOrders(void* userData) {
+	const uint64_t* base = userData;
+	return workGetCompletedOrders() - *base;
+}
+
+// Progress counter for route planning, with the planner in userData
+static uint64_t gmlCountPlanRounds(void* userData) {
+	uint64_t completed, total;
+	rpGetProgress(userData, &completed, &total);
+	return completed;
+}
+
 static int gmlOnFinishedNodes(gmlContext* ctx) {
-	lprintln(LogInfo, "Host creation complete. Now adding virtual ethernet connections.");
+	if (ctx->deferred) {
+		lprintln(LogInfo, "All hosts have been read. Hosts and links will be created once the routes are known.");
+	} else {
+		lprintln(LogInfo, "Host creation complete. Now adding virtual ethernet connections.");
+	}
 	lprintf(LogDebug, "Encountered %u nodes (%u clients)\n", ctx->nodeCount, ctx->clientNodes);
 	if (ctx->clientNodes < globalParams->edgeNodeCount) {
 		lprintf(LogError, "There are fewer client nodes in the topology (%u) than edges nodes (%u). Either use a larger topology, or decrease the number of edge nodes.\n", ctx->clientNodes, globalParams->edgeNodeCount);
 		return 1;
 	}
 
-	uint64_t worstCaseLinkCount = (uint64_t)ctx->nodeCount * (uint64_t)ctx->nodeCount;
-	DO_OR_RETURN(workJoin(false));
-	DO_OR_RETURN(workEnsureSystemScaling(worstCaseLinkCount, (nodeId)ctx->nodeCount, (nodeId)ctx->clientNodes));
-	DO_OR_RETURN(workJoin(false));
+	// Unless the links have been buffered or counted, the kernel is prepared
+	// for the worst case, in which every pair of hosts is linked
+	uint64_t linkCount = 0;
+	if (ctx->edgeBuffer != NULL) linkCount = ctx->edgeBuffer->spilledLinks + ctx->edgeBuffer->linkCount;
+	else if (ctx->linksCounted) linkCount = ctx->countedLinks;
+	if (!ctx->deferred) {
+		// The join waits for the remaining hosts to be created
+		progressSetTotal(ctx->nodeCount);
+		uint64_t scaledLinks = linkCount;
+		if (ctx->edgeBuffer == NULL && !ctx->linksCounted) scaledLinks = (uint64_t)ctx->nodeCount * (ctx->nodeCount - 1) / 2;
+		DO_OR_RETURN(setupEnsureScaling(ctx->nodeCount, ctx->clientNodes, scaledLinks, 1));
+		workSetPhase(PhaseLinks);
+		ctx->linkOrderBase = workGetCompletedOrders();
+		progressBeginCounter("links", linkCount, &gmlCountOrders, &ctx->linkOrderBase);
+	} else {
+		progressBegin("links", linkCount);
+	}
 
-	ctx->clientsPerEdge = (double)ctx->clientNodes / (double)globalParams->edgeNodeCount;
 	ctx->routes = rpNewPlanner((nodeId)ctx->nodeCount);
 	return 0;
 }
 
+// Records a neighbor of a node if it is the closest one seen so far
+static void gmlNoteNeighbor(gmlNodeState* state, nodeId neighborId, float weight) {
+	if (state->closestWeight < 0.f || weight < state->closestWeight) {
+		state->closestId = neighborId;
+		state->closestWeight = weight;
+	}
+}
+
 static int gmlAddLink(const GmlLink* link, void* userData) {
 	gmlContext* ctx = userData;
 
-	if (ctx->ignoreEdges) return 0;
+	if (ctx->ignoreEdges) {
+		++ctx->countedLinks;
+		progressAdvance(1);
+		return 0;
+	}
+	if (ctx->edgeBuffer != NULL && !ctx->finishedNodes) {
+		progressAdvance(1);
+		return gmlBufferLink(ctx->edgeBuffer, link);
+	}
 	if (!ctx->finishedNodes) {
 		ctx->finishedNodes = true;
 		int res = gmlOnFinishedNodes(ctx);
 		if (res != 0) return res;
 	}
 
-	nodeId sourceId, targetId;
-	gmlNodeState* sourceState;
-	gmlNodeState* targetState;
-	if (!gmlNameToState(ctx, link->sourceName, NULL, &sourceId, &sourceState)) return 1;
-	if (!gmlNameToState(ctx, link->targetName, NULL, &targetId, &targetState)) return 1;
+	nodeId sourceId = link->sourceId;
+	nodeId targetId = link->targetId;
+	gmlNodeState* sourceState = gmlEndpointState(ctx, sourceId, link->sourceName);
+	gmlNodeState* targetState = gmlEndpointState(ctx, targetId, link->targetName);
+	if (sourceState == NULL || targetState == NULL) return 1;
+	if (ctx->deferred) progressAdvance(1);
 
 	if (sourceId == targetId) {
 		if (sourceState->isClient) {
-			DO_OR_RETURN(workSetSelfLink(sourceId, &link->t));
+			if (!ctx->deferred) DO_OR_RETURN(workSetSelfLink(sourceId, &link->t));
+			sourceState->hasSelfLink = true;
+			sourceState->selfLink = link->t;
 		}
 	} else {
-		macAddr macs[NEEDED_MACS_LINK];
-		if (!macNextAddrs(&ctx->macAddrIter, macs, NEEDED_MACS_LINK)) {
-			lprintln(LogError, "Ran out of MAC addresses when adding a new virtual ethernet connection.");
-			return 1;
+		if (!ctx->deferred) {
+			macAddr macs[NEEDED_MACS_LINK];
+			if (!macNextAddrs(&ctx->macAddrIter, macs, NEEDED_MACS_LINK)) {
+				lprintln(LogError, "Ran out of MAC addresses when adding a new virtual ethernet connection.");
+				return 1;
+			}
+			DO_OR_RETURN(workAddLink(sourceId, targetId, sourceState->addr, targetState->addr, macs, ctx->mtu, &link->t));
 		}
-		DO_OR_RETURN(workAddLink(sourceId, targetId, sourceState->addr, targetState->addr, macs, ctx->mtu, &link->t));
 		if (link->weight < 0.f) {
 			lprintf(LogError, "The link from '%s' to '%s' in the topology has negative weight %f, which is not supported.\n", link->sourceName, link->targetName, link->weight);
 			return 1;
 		} else {
 			rpSetWeight(ctx->routes, sourceId, targetId, link->weight);
 			rpSetWeight(ctx->routes, targetId, sourceId, link->weight);
+			gmlNoteNeighbor(sourceState, targetId, link->weight);
+			gmlNoteNeighbor(targetState, sourceId, link->weight);
 		}
+		snapLink record = { .sourceId = sourceId, .targetId = targetId, .weight = link->weight, .t = link->t };
+		flexBufferGrow((void**)&ctx->links, ctx->linkCount, &ctx->linkCap, 1, sizeof(snapLink));
+		flexBufferAppend(ctx->links, &ctx->linkCount, &record, 1, sizeof(snapLink));
 	}
 	return 0;
 }
 
-static bool gmlNextEdge(gmlContext* ctx) {
-	if (ctx->clientIter == NULL) {
-		ctx->currentEdgeIdx = 0;
-	} else {
-		++ctx->currentEdgeIdx;
-		ip4FreeFragIter(ctx->clientIter);
-		if (ctx->currentEdgeIdx >= globalParams->edgeNodeCount) {
-			ctx->clientIter = NULL;
-			return false;
-		}
+// Combines the shaping parameters of two links that are traversed in sequence.
+// Delays add up, a packet must survive the loss of both links, and the jitter
+// of independent links adds in variance. The shorter queue is the bottleneck.
+static void gmlComposeLinks(TopoLink* composite, const TopoLink* next) {
+	composite->latency += next->latency;
+	composite->packetLoss = 1.0 - (1.0 - composite->packetLoss) * (1.0 - next->packetLoss);
+	composite->jitter = sqrt(composite->jitter * composite->jitter + next->jitter * next->jitter);
+	if (composite->queueLen == 0 || (next->queueLen != 0 && next->queueLen < composite->queueLen)) {
+		composite->queueLen = next->queueLen;
 	}
-	ctx->currentEdgeClients = 0;
-
-	// This approach avoids numerical robustness problems
-	double prevMarker = round(ctx->clientsPerEdge * ctx->currentEdgeIdx);
-	double nextMarker = round(ctx->clientsPerEdge * (ctx->currentEdgeIdx+1));
-	fesetround(FE_TONEAREST);
-	nodeId currentEdgeCapacity = (nodeId)llrint(nextMarker - prevMarker);
-
-	edgeNodeParams* edge = &globalParams->edgeNodes[ctx->currentEdgeIdx];
-	ctx->clientIter = ip4FragmentSubnet(&edge->vsubnet, currentEdgeCapacity);
-	if (!ip4FragIterNext(ctx->clientIter)) return false;
+}
 
-	if (PASSES_LOG_THRESHOLD(LogDebug)) {
-		char edgeIp[IP4_ADDR_BUFLEN];
-		char edgeSubnet[IP4_CIDR_BUFLEN];
-		ip4AddrToString(edge->ip, edgeIp);
-		ip4SubnetToString(&edge->vsubnet, edgeSubnet);
-		lprintf(LogDebug, "Now allocating %u client subnets for edge %s (range %s)\n", currentEdgeCapacity, edgeIp, edgeSubnet);
-	}
-
-	if (edgeFile != NULL) {
-		fprintf(edgeFile, "netmirage-edge");
-		if (globalParams->edgeNodeCount > 1) {
-			fprintf(edgeFile, " -e ");
-			for (size_t i = 0; i < globalParams->edgeNodeCount; ++i) {
-				edgeNodeParams *otherEdge = &globalParams->edgeNodes[i];
-				char otherEdgeSubnet[IP4_CIDR_BUFLEN];
-				ip4SubnetToString(&otherEdge->vsubnet, otherEdgeSubnet);
-				if (i > 0) fprintf(edgeFile, ",");
-				fprintf(edgeFile, "%s", otherEdgeSubnet);
-			}
+// Replaces every chain of non-client nodes that have exactly two neighbors with
+// a single link between the nodes at the ends of the chain. The nodes inside
+// the chain are marked as collapsed and are never created. Chains are left
+// alone if their ends are already connected, since the two could not be
+// distinguished when installing routes. The route planner is not modified:
+// shortest paths through a chain always traverse all of it, so the collapsed
+// nodes are simply removed from the planned routes (see gmlCollapsePath).
+static void gmlCollapseChains(gmlContext* ctx) {
+	size_t nodeCount = ctx->nodeCount;
+	size_t linkCount = ctx->linkCount;
+	uint32_t* degrees = eacalloc(nodeCount, sizeof(uint32_t), 0);
+	size_t* nodeLinks = eamalloc(nodeCount, 2 * sizeof(size_t), 0); // First two links of each node
+	bool* visited = eacalloc(linkCount, sizeof(bool), 0);
+	bool* removed = eacalloc(linkCount, sizeof(bool), 0);
+	bool* inner = eacalloc(nodeCount, sizeof(bool), 0);
+	GHashTable* linked = g_hash_table_new_full(&g_int64_hash, &g_int64_equal, &gmlFreeData, NULL);
+
+	for (size_t i = 0; i < linkCount; ++i) {
+		nodeId ends[2] = { ctx->links[i].sourceId, ctx->links[i].targetId };
+		for (int e = 0; e < 2; ++e) {
+			if (degrees[ends[e]] < 2) nodeLinks[ends[e] * 2 + degrees[ends[e]]] = i;
+			++degrees[ends[e]];
 		}
-		fprintf(edgeFile, " -c %u", currentEdgeCapacity);
-		if (edge->remoteDev == NULL) {
-			fprintf(edgeFile, " <iface>");
+		uint64_t* key = eamalloc(1, sizeof(uint64_t), 0);
+		*key = setupLinkKey(ends[0], ends[1]);
+		g_hash_table_insert(linked, key, key);
+	}
+	for (size_t id = 0; id < nodeCount; ++id) {
+		if (ctx->nodeStates[id].isClient || degrees[id] != 2) continue;
+		const snapLink* a = &ctx->links[nodeLinks[id * 2]];
+		const snapLink* b = &ctx->links[nodeLinks[id * 2 + 1]];
+		nodeId neighborA = (a->sourceId == id ? a->targetId : a->sourceId);
+		nodeId neighborB = (b->sourceId == id ? b->targetId : b->sourceId);
+		inner[id] = (neighborA != neighborB);
+	}
+
+	snapLink* composites;
+	size_t compositeCount, compositeCap;
+	flexBufferInit((void**)&composites, &compositeCount, &compositeCap);
+	for (size_t i = 0; i < linkCount; ++i) {
+		if (visited[i]) continue;
+		const snapLink* first = &ctx->links[i];
+
+		// Chains are walked from an end that is not collapsible
+		nodeId startId, curId;
+		if (!inner[first->sourceId] && inner[first->targetId]) {
+			startId = first->sourceId;
+			curId = first->targetId;
+		} else if (inner[first->sourceId] && !inner[first->targetId]) {
+			startId = first->targetId;
+			curId = first->sourceId;
 		} else {
-			fprintf(edgeFile, " %s", edge->remoteDev);
+			continue;
 		}
-		if (globalParams->routingIp == 0) {
-			fprintf(edgeFile, " <core-ip>");
-		} else {
-			char routingIpStr[IP4_ADDR_BUFLEN];
-			ip4AddrToString(globalParams->routingIp, routingIpStr);
-			fprintf(edgeFile, " %s", routingIpStr);
+
+		snapLink composite = { .sourceId = startId, .weight = first->weight, .t = first->t };
+		visited[i] = true;
+		size_t curLink = i;
+		while (inner[curId]) {
+			size_t nextLink = nodeLinks[curId * 2];
+			if (nextLink == curLink) nextLink = nodeLinks[curId * 2 + 1];
+			const snapLink* next = &ctx->links[nextLink];
+			visited[nextLink] = true;
+			composite.weight += next->weight;
+			gmlComposeLinks(&composite.t, &next->t);
+			curId = (next->sourceId == curId ? next->targetId : next->sourceId);
+			curLink = nextLink;
 		}
-		char edgeSubnet[IP4_CIDR_BUFLEN];
-		ip4SubnetToString(&edge->vsubnet, edgeSubnet);
-		fprintf(edgeFile, " %s", edgeSubnet);
-		if (edge->remoteApps == 0) {
-			fprintf(edgeFile, " <applications>");
-		} else {
-			fprintf(edgeFile, " %u", edge->remoteApps);
+		composite.targetId = curId;
+
+		uint64_t key = setupLinkKey(startId, curId);
+		if (startId == curId || g_hash_table_lookup(linked, &key) != NULL) continue;
+		uint64_t* keyPtr = eamalloc(1, sizeof(uint64_t), 0);
+		*keyPtr = key;
+		g_hash_table_insert(linked, keyPtr, keyPtr);
+
+		// Walk the chain again to remove it
+		size_t chainLink = i;
+		nodeId chainId = (first->sourceId == startId ? first->targetId : first->sourceId);
+		removed[chainLink] = true;
+		while (inner[chainId]) {
+			ctx->nodeStates[chainId].collapsed = true;
+			++ctx->collapsedHosts;
+			size_t nextLink = nodeLinks[chainId * 2];
+			if (nextLink == chainLink) nextLink = nodeLinks[chainId * 2 + 1];
+			const snapLink* next = &ctx->links[nextLink];
+			removed[nextLink] = true;
+			chainId = (next->sourceId == chainId ? next->targetId : next->sourceId);
+			chainLink = nextLink;
 		}
-		fprintf(edgeFile, "\n");
+		lprintf(LogDebug, "Collapsed the chain of transit hosts between %u and %u into a single link\n", startId, curId);
+		flexBufferGrow((void**)&composites, compositeCount, &compositeCap, 1, sizeof(snapLink));
+		flexBufferAppend(composites, &compositeCount, &composite, 1, sizeof(snapLink));
+		++ctx->collapsedChains;
 	}
 
-	return true;
+	size_t kept = 0;
+	for (size_t i = 0; i < linkCount; ++i) {
+		if (!removed[i]) ctx->links[kept++] = ctx->links[i];
+	}
+	ctx->linkCount = kept;
+	flexBufferGrow((void**)&ctx->links, ctx->linkCount, &ctx->linkCap, compositeCount, sizeof(snapLink));
+	flexBufferAppend(ctx->links, &ctx->linkCount, composites, compositeCount, sizeof(snapLink));
+	lprintf(LogInfo, "Collapsed %lu chains of transit hosts into single links, removing %lu hosts and %lu links\n", ctx->collapsedChains, ctx->collapsedHosts, linkCount - ctx->linkCount);
+
+	flexBufferFree((void**)&composites, &compositeCount, &compositeCap);
+	g_hash_table_destroy(linked);
+	free(inner);
+	free(removed);
+	free(visited);
+	free(nodeLinks);
+	free(degrees);
 }
 
-static bool gmlNextClientSubnet(gmlContext* ctx, ip4Subnet* subnet) {
-	if (ctx->clientIter == NULL || !ip4FragIterNext(ctx->clientIter)) {
-		if (!gmlNextEdge(ctx)) return false;
+// Removes the nodes that were collapsed by gmlCollapseChains from a planned
+// route. The remaining consecutive nodes are connected by links.
+static void gmlCollapsePath(const gmlContext* ctx, nodeId* path, nodeId* steps) {
+	nodeId kept = 0;
+	for (nodeId step = 0; step < *steps; ++step) {
+		if (!ctx->nodeStates[path[step]].collapsed) path[kept++] = path[step];
 	}
-	ip4FragIterSubnet(ctx->clientIter, subnet);
-	return true;
+	*steps = kept;
 }
 
-int setupGraphML(const setupGraphMLParams* gmlParams) {
-	lprintf(LogInfo, "Reading network topology in GraphML format from %s\n", globalParams->srcFile ? globalParams->srcFile : "<stdin>");
+// Returns true if the node is constructed on this machine
+static bool gmlIsLocal(const gmlContext* ctx, nodeId id) {
+	return !ctx->partitioned || ctx->nodeStates[id].partition == globalParams->partition;
+}
 
-	gmlContext ctx = {
-		.finishedNodes = false,
-		.ignoreNodes = false,
-		.ignoreEdges = false,
+// Adjacency of the used nodes and the expected traffic on each used link, used
+// for partitioning the network among machines
+typedef struct {
+	uint32_t parts;
+	uint64_t cap;        // Largest number of hosts for which a machine is chosen
+	size_t* offsets;     // Start of each node's neighbors in adjNodes / adjLinks
+	nodeId* adjNodes;
+	size_t* adjLinks;
+	uint64_t* traffic;   // Indexed by link; 1 plus the number of routes using it
+	uint32_t* part;      // Machine of each node, or UINT32_MAX if not yet chosen
+	uint64_t* loads;     // Number of hosts on each machine
+	uint64_t* attach;    // Scratch space: traffic from a node to each machine
+} gmlPartitioner;
+
+// Chooses the machine for a node: the one that its links carry the most traffic
+// to among those with room, preferring less loaded machines on ties. The node's
+// current machine (if any) always has room.
+static uint32_t gmlChoosePartition(gmlPartitioner* pt, nodeId id) {
+	memset(pt->attach, 0, pt->parts * sizeof(uint64_t));
+	for (size_t i = pt->offsets[id]; i < pt->offsets[id+1]; ++i) {
+		uint32_t otherPart = pt->part[pt->adjNodes[i]];
+		if (otherPart != UINT32_MAX) pt->attach[otherPart] += pt->traffic[pt->adjLinks[i]];
+	}
 
-		.clientNodes = 0,
+	uint32_t current = pt->part[id];
+	uint32_t best = UINT32_MAX;
+	uint32_t leastLoaded = 0;
+	for (uint32_t p = 0; p < pt->parts; ++p) {
+		if (pt->loads[p] < pt->loads[leastLoaded]) leastLoaded = p;
+		if (p != current && pt->loads[p] >= pt->cap) continue;
+		if (best == UINT32_MAX || pt->attach[p] > pt->attach[best] || (pt->attach[p] == pt->attach[best] && pt->loads[p] < pt->loads[best])) {
+			best = p;
+		}
+	}
+	// Every machine may be full if the clients alone exceed the capacity
+	return (best != UINT32_MAX ? best : leastLoaded);
+}
 
-		.clientIter = NULL,
-		.macAddrIter = { .octets = { 0 } },
+// Assigns every used node to a machine in a partitioned network. Clients are
+// placed on the machine of their edge node. The other nodes are assigned in
+// breadth-first order from the clients to the machine that they exchange the
+// most traffic with, where the traffic on a link is estimated by the number of
+// routes between client nodes that use it. A few refinement passes then move
+// single nodes whenever this reduces the traffic crossing machines. No machine
+// receives more than about 1/parts of the hosts unless the clients require it.
+// The result is deterministic, so every instance computes the same partition.
+static void gmlPartition(gmlContext* ctx, const bool usedNodes[], GHashTable* usedLinks, size_t hostCount) {
+	gmlPartitioner pt;
+	pt.parts = globalParams->partitionCount;
+	pt.cap = (hostCount + pt.parts - 1) / pt.parts;
+	pt.cap += pt.cap / 20 + 1; // Allow a small imbalance
+	size_t nodeCount = ctx->nodeCount;
+	size_t linkCount = ctx->linkCount;
+
+	// Index the used links by their endpoints so that routes can be attributed
+	// to them
+	uint64_t* linkKeys = eamalloc(linkCount, sizeof(uint64_t), 0);
+	GHashTable* linkIndex = g_hash_table_new(&g_int64_hash, &g_int64_equal);
+	pt.traffic = eacalloc(linkCount, sizeof(uint64_t), 0);
+	pt.offsets = eacalloc(nodeCount + 1, sizeof(size_t), 0);
+	for (size_t i = 0; i < linkCount; ++i) {
+		const snapLink* record = &ctx->links[i];
+		linkKeys[i] = setupLinkKey(record->sourceId, record->targetId);
+		if (usedLinks != NULL && g_hash_table_lookup(usedLinks, &linkKeys[i]) == NULL) continue;
+		g_hash_table_insert(linkIndex, &linkKeys[i], GSIZE_TO_POINTER(i + 1));
+		pt.traffic[i] = 1;
+		++pt.offsets[record->sourceId + 1];
+		++pt.offsets[record->targetId + 1];
+	}
 
-		.routes = NULL,
-	};
-	macNextAddr(&ctx.macAddrIter); // Skip all-zeroes address (unassignable)
-	flexBufferInit((void**)&ctx.nodeStates, &ctx.nodeCount, &ctx.nodeCap);
-	ctx.gmlToState = g_hash_table_new_full(&g_str_hash, &g_str_equal, &gmlFreeData, NULL);
+	progressBegin("partition", (uint64_t)ctx->clientNodes * (ctx->clientNodes - 1) / 2);
+	uint64_t totalHops = 0;
+	for (nodeId startId = 0; startId < nodeCount; ++startId) {
+		if (!ctx->nodeStates[startId].isClient) continue;
+		for (nodeId endId = startId+1; endId < nodeCount; ++endId) {
+			if (!ctx->nodeStates[endId].isClient) continue;
+			progressAdvance(1);
 
-	// We assign internal interface addresses from the full IPv4 space, but
-	// avoid the subnets reserved for the edge nodes. The fact that the
-	// addresses we use are publicly routable does not matter, since the
-	// internal node namespaces are not connected to the Internet.
-	const size_t ReservedSubnetCount = 3;
-	ip4Subnet reservedSubnets[ReservedSubnetCount];
-	ip4GetSubnet("0.0.0.0/8", &reservedSubnets[0]);
-	ip4GetSubnet("127.0.0.0/8", &reservedSubnets[1]);
-	ip4GetSubnet("255.255.255.255/32", &reservedSubnets[2]);
-	const ip4Subnet* restrictedSubnets[globalParams->edgeNodeCount+ReservedSubnetCount+1];
-	size_t subnets = 0;
-	for (size_t i = 0; i < ReservedSubnetCount; ++i) {
-		restrictedSubnets[subnets++] = &reservedSubnets[i];
+			nodeId* path;
+			nodeId steps;
+			if (!rpGetRoute(ctx->routes, startId, endId, &path, &steps)) continue;
+			if (ctx->collapse) gmlCollapsePath(ctx, path, &steps);
+			for (nodeId step = 1; step < steps; ++step) {
+				uint64_t key = setupLinkKey(path[step-1], path[step]);
+				gpointer found = g_hash_table_lookup(linkIndex, &key);
+				size_t idx = GPOINTER_TO_SIZE(found);
+				if (idx == 0) continue;
+				++pt.traffic[idx - 1];
+				++totalHops;
+			}
+		}
 	}
-	for (size_t i = 0; i < globalParams->edgeNodeCount; ++i) {
-		restrictedSubnets[subnets++] = &globalParams->edgeNodes[i].vsubnet;
+	g_hash_table_destroy(linkIndex);
+	free(linkKeys);
+
+	// Build the adjacency lists of the used links
+	for (size_t id = 0; id < nodeCount; ++id) pt.offsets[id+1] += pt.offsets[id];
+	pt.adjNodes = eamalloc(pt.offsets[nodeCount], sizeof(nodeId), 0);
+	pt.adjLinks = eamalloc(pt.offsets[nodeCount], sizeof(size_t), 0);
+	size_t* fill = eamalloc(nodeCount, sizeof(size_t), 0);
+	memcpy(fill, pt.offsets, nodeCount * sizeof(size_t));
+	for (size_t i = 0; i < linkCount; ++i) {
+		if (pt.traffic[i] == 0) continue;
+		const snapLink* record = &ctx->links[i];
+		pt.adjNodes[fill[record->sourceId]] = record->targetId;
+		pt.adjLinks[fill[record->sourceId]++] = i;
+		pt.adjNodes[fill[record->targetId]] = record->sourceId;
+		pt.adjLinks[fill[record->targetId]++] = i;
+	}
+	free(fill);
+
+	pt.part = eamalloc(nodeCount, sizeof(uint32_t), 0);
+	pt.loads = eacalloc(pt.parts, sizeof(uint64_t), 0);
+	pt.attach = eamalloc(pt.parts, sizeof(uint64_t), 0);
+	nodeId* queue = eamalloc(nodeCount, sizeof(nodeId), 0);
+	size_t queueHead = 0, queueTail = 0;
+	for (size_t id = 0; id < nodeCount; ++id) {
+		pt.part[id] = UINT32_MAX;
+		gmlNodeState* state = &ctx->nodeStates[id];
+		if (!usedNodes[id] || !state->isClient) continue;
+		pt.part[id] = globalParams->edgeNodes[state->edgeIdx].partition;
+		++pt.loads[pt.part[id]];
+		queue[queueTail++] = (nodeId)id;
 	}
-	restrictedSubnets[subnets++] = NULL;
-	ip4Subnet everything;
-	ip4GetSubnet("0.0.0.0/0", &everything);
-	ctx.intfAddrIter = ip4NewIter(&everything, false, restrictedSubnets);
-
-	int err;
-	uint32_t* edgePorts = eamalloc(globalParams->edgeNodeCount, sizeof(uint32_t), 0);
-	uint32_t nextOvsPort = 1;
 
-	ip4Addr rootAddrs[2];
-	for (int i = 0; i < 2; ++i) {
-		bool addrExhausted = false;
-		gmlGenerateIp(&ctx, &addrExhausted, &rootAddrs[i]);
-		if (addrExhausted) {
-			lprintln(LogError, "The edge node subnets completely fill the unreserved IPv4 space. Some addresses must be left for internal networking interfaces in the emulator.");
-			err = 1;
-			goto cleanup;
+	// Grow the partitions outwards from the clients. Nodes that cannot be
+	// reached from any client start new searches.
+	size_t nextUnreached = 0;
+	while (true) {
+		if (queueHead == queueTail) {
+			while (nextUnreached < nodeCount && (!usedNodes[nextUnreached] || pt.part[nextUnreached] != UINT32_MAX)) ++nextUnreached;
+			if (nextUnreached == nodeCount) break;
+			pt.part[nextUnreached] = gmlChoosePartition(&pt, (nodeId)nextUnreached);
+			++pt.loads[pt.part[nextUnreached]];
+			queue[queueTail++] = (nodeId)nextUnreached;
+		}
+		nodeId id = queue[queueHead++];
+		for (size_t i = pt.offsets[id]; i < pt.offsets[id+1]; ++i) {
+			nodeId otherId = pt.adjNodes[i];
+			if (pt.part[otherId] != UINT32_MAX) continue;
+			pt.part[otherId] = gmlChoosePartition(&pt, otherId);
+			++pt.loads[pt.part[otherId]];
+			queue[queueTail++] = otherId;
 		}
 	}
+	free(queue);
+
+	// Move single nodes to the machine that they exchange the most traffic with
+	for (int pass = 0; pass < 8; ++pass) {
+		size_t moves = 0;
+		for (size_t id = 0; id < nodeCount; ++id) {
+			if (!usedNodes[id] || ctx->nodeStates[id].isClient) continue;
+			uint32_t current = pt.part[id];
+			uint32_t best = gmlChoosePartition(&pt, (nodeId)id);
+			if (best == current || pt.attach[best] <= pt.attach[current]) continue;
+			--pt.loads[current];
+			++pt.loads[best];
+			pt.part[id] = best;
+			++moves;
+		}
+		lprintf(LogDebug, "Partition refinement pass %d moved %lu hosts\n", pass + 1, moves);
+		if (moves == 0) break;
+	}
 
-	// Determine the common MTU for all edge interfaces
-	ctx.mtu = 0;
-	for (size_t i = 0; i < globalParams->edgeNodeCount; ++i) {
-		edgeNodeParams *edge = &globalParams->edgeNodes[i];
-		int edgeMtu;
-		DO_OR_GOTO(workGetInterfaceMtu(edge->intf, &edgeMtu), cleanup, err);
-		if (edgeMtu <= 0) {
-			lprintf(LogError, "Interface %s has non-positive MTU: %d\n", edge->intf, edgeMtu);
+	uint64_t cutHops = 0;
+	for (size_t i = 0; i < linkCount; ++i) {
+		if (pt.traffic[i] == 0) continue;
+		const snapLink* record = &ctx->links[i];
+		if (pt.part[record->sourceId] == pt.part[record->targetId]) continue;
+		++ctx->cutLinks;
+		cutHops += pt.traffic[i] - 1;
+	}
+	ctx->cutTraffic = (totalHops > 0 ? (double)cutHops / (double)totalHops : 0.0);
+	for (size_t id = 0; id < nodeCount; ++id) {
+		if (usedNodes[id]) ctx->nodeStates[id].partition = pt.part[id];
+	}
+	lprintf(LogInfo, "Partitioned %lu hosts among %u machines; %lu links (carrying %.1f%% of the route hops) cross between machines, and this machine constructs %lu hosts\n", hostCount, pt.parts, ctx->cutLinks, ctx->cutTraffic * 100.0, pt.loads[globalParams->partition]);
+
+	free(pt.traffic);
+	free(pt.offsets);
+	free(pt.adjNodes);
+	free(pt.adjLinks);
+	free(pt.part);
+	free(pt.loads);
+	free(pt.attach);
+}
+
+// Sets the locations of the hosts that are about to be created. Hosts on other
+// machines are marked as remote. If packing is enabled, the local non-client
+// hosts are packed into shared namespaces, which are created.
+static int gmlLocateHosts(gmlContext* ctx, const bool usedNodes[]) {
+	workHostLoc* locs = eacalloc(ctx->nodeCount, sizeof(workHostLoc), 0);
+	uint32_t slot = 0;
+	for (size_t id = 0; id < ctx->nodeCount; ++id) {
+		if (!usedNodes[id]) continue;
+		if (!gmlIsLocal(ctx, (nodeId)id)) {
+			locs[id].pack = WORK_REMOTE_PACK;
+			continue;
 		}
-		if (ctx.mtu <= 0) {
-			ctx.mtu = edgeMtu;
-			lprintf(LogDebug, "Using edge MTU %d for network\n", ctx.mtu);
-		} else if (edgeMtu != ctx.mtu) {
-			lprintf(LogError, "Edge interfaces have different MTUs. All interfaces must share the same MTU to avoid segmentation problems. Interface %s has MTU %d, but interface %s has MTU %d.\n", globalParams->edgeNodes[0].intf, ctx.mtu, edge->intf, edgeMtu);
-			err = 1;
-			goto cleanup;
+		if (ctx->packSize == 0 || ctx->nodeStates[id].isClient) continue;
+		if (ctx->packs == 0 || slot == ctx->packSize) {
+			++ctx->packs;
+			slot = 0;
 		}
+		locs[id].pack = ctx->packs;
+		locs[id].slot = slot++;
+		++ctx->packedHosts;
 	}
+	workSetHostLocs(ctx->nodeCount, locs);
+	free(locs);
 
-	// If we're using a non-standard MTU, make sure that that this feature is supported
-	bool mtuSupported = false;
-	const char* failReason = NULL;
-	DO_OR_GOTO(workMtuSupported(ctx.mtu, &mtuSupported, &failReason), cleanup, err);
-	if (!mtuSupported) {
-		lprintf(LogError, "The edge interfaces have their MTU set to %d, which requires \"jumbo packet\" support. %s Alternatively, you can set the edge interface MTUs to the default value to avoid this requirement.\n", ctx.mtu, failReason);
-		err = 1;
-		goto cleanup;
+	if (ctx->packSize == 0) return 0;
+	lprintf(LogInfo, "Packing %lu non-client hosts into %u shared namespaces\n", ctx->packedHosts, ctx->packs);
+	for (uint32_t pack = 1; pack <= ctx->packs; ++pack) {
+		DO_OR_RETURN(workAddHostPack(pack));
 	}
+	return workJoin(false);
+}
 
-	DO_OR_GOTO(workAddRoot(rootAddrs[0], rootAddrs[1], ctx.mtu, globalParams->rootIsInitNs), cleanup, err);
-	DO_OR_GOTO(workJoin(false), cleanup, err);
+// Largest VXLAN network identifier (24 bits)
+#define GML_MAX_VNI 0xFFFFFF
+
+// Creates the hosts and links that were deferred until the routes were planned.
+// When pruning, only the hosts and links that are used by at least one route
+// between two client nodes are created. Collapsed hosts are never created. In a
+// partitioned network, only the hosts on this machine are created, and links
+// to hosts on other machines become tunnels.
+static int gmlCreateDeferred(gmlContext* ctx) {
+	int err = 0;
+	bool* usedNodes = eacalloc(ctx->nodeCount, sizeof(bool), 0);
+	GHashTable* usedLinks = NULL;
+
+	if (ctx->prune) {
+		usedLinks = g_hash_table_new_full(&g_int64_hash, &g_int64_equal, &gmlFreeData, NULL);
+		lprintln(LogInfo, "Finding the hosts and links used by routes between client nodes");
+		progressBegin("prune", (uint64_t)ctx->clientNodes * (ctx->clientNodes - 1) / 2);
+		for (nodeId startId = 0; startId < ctx->nodeCount; ++startId) {
+			if (!ctx->nodeStates[startId].isClient) continue;
+			usedNodes[startId] = true;
+
+			for (nodeId endId = startId+1; endId < ctx->nodeCount; ++endId) {
+				if (!ctx->nodeStates[endId].isClient) continue;
+				progressAdvance(1);
+
+				nodeId* path;
+				nodeId steps;
+				if (!rpGetRoute(ctx->routes, startId, endId, &path, &steps)) continue;
+				if (ctx->collapse) gmlCollapsePath(ctx, path, &steps);
+				for (nodeId step = 1; step < steps; ++step) {
+					usedNodes[path[step]] = true;
+					uint64_t key = setupLinkKey(path[step-1], path[step]);
+					if (g_hash_table_lookup(usedLinks, &key) != NULL) continue;
+					uint64_t* keyPtr = eamalloc(1, sizeof(uint64_t), 0);
+					*keyPtr = key;
+					g_hash_table_insert(usedLinks, keyPtr, keyPtr);
+				}
+			}
+		}
+	} else {
+		for (size_t id = 0; id < ctx->nodeCount; ++id) {
+			usedNodes[id] = !ctx->nodeStates[id].collapsed;
+		}
+	}
 
-	// Move all interfaces associated with edge nodes into the root namespace
-	for (size_t i = 0; i < globalParams->edgeNodeCount; ++i) {
-		edgeNodeParams* edge = &globalParams->edgeNodes[i];
+	size_t hostCount = 0;
+	for (size_t id = 0; id < ctx->nodeCount; ++id) {
+		if (usedNodes[id]) ++hostCount;
+	}
+	if (ctx->partitioned) gmlPartition(ctx, usedNodes, usedLinks, hostCount);
 
-		// Check to see if this is a duplicate interface. We simply perform
+	size_t localClients = 0;
+	for (size_t id = 0; id < ctx->nodeCount; ++id) {
+		if (!usedNodes[id] || !gmlIsLocal(ctx, (nodeId)id)) continue;
+		++ctx->localHosts;
+		if (ctx->nodeStates[id].isClient) ++localClients;
+	}
+	size_t localLinks = 0;
+	for (size_t i = 0; i < ctx->linkCount; ++i) {
+		const snapLink* record = &ctx->links[i];
+		if (usedLinks != NULL) {
+			uint64_t key = setupLinkKey(record->sourceId, record->targetId);
+			if (g_hash_table_lookup(usedLinks, &key) == NULL) continue;
+		}
+		if (gmlIsLocal(ctx, record->sourceId) || gmlIsLocal(ctx, record->targetId)) ++localLinks;
+	}
+
+	workSetPhase(PhaseHosts);
+	if (ctx->packSize > 0 || ctx->partitioned) DO_OR_GOTO(gmlLocateHosts(ctx, usedNodes), cleanup, err);
+	ctx->hostOrderBase = workGetCompletedOrders();
+	progressBeginCounter("hosts", ctx->localHosts, &gmlCountOrders, &ctx->hostOrderBase);
+	for (size_t id = 0; id < ctx->nodeCount; ++id) {
+		if (!usedNodes[id] || !gmlIsLocal(ctx, (nodeId)id)) continue;
+		gmlNodeState* state = &ctx->nodeStates[id];
+		DO_OR_GOTO(workAddHost((nodeId)id, state->addr, state->clientMacs, ctx->mtu, &state->node), cleanup, err);
+	}
+
+	uint64_t namespaces = ctx->localHosts - ctx->packedHosts + ctx->packs;
+	DO_OR_GOTO(setupEnsureScaling(namespaces, localClients, localLinks, (ctx->packSize > 0 ? ctx->packSize : 1)), cleanup, err);
+	workSetPhase(PhaseLinks);
+	ctx->linkOrderBase = workGetCompletedOrders();
+	progressBeginCounter("links", localLinks, &gmlCountOrders, &ctx->linkOrderBase);
+	for (size_t id = 0; id < ctx->nodeCount; ++id) {
+		gmlNodeState* state = &ctx->nodeStates[id];
+		if (state->isClient && state->hasSelfLink && gmlIsLocal(ctx, (nodeId)id)) {
+			DO_OR_GOTO(workSetSelfLink((nodeId)id, &state->selfLink), cleanup, err);
+		}
+	}
+	size_t createdLinks = 0;
+	uint32_t vni = 0;
+	for (size_t i = 0; i < ctx->linkCount; ++i) {
+		const snapLink* record = &ctx->links[i];
+		if (usedLinks != NULL) {
+			uint64_t key = setupLinkKey(record->sourceId, record->targetId);
+			if (g_hash_table_lookup(usedLinks, &key) == NULL) continue;
+		}
+
+		// Addresses and tunnel identifiers are allocated for every link, even
+		// those on other machines, so that all instances agree on them
+		macAddr macs[NEEDED_MACS_LINK];
+		if (!macNextAddrs(&ctx->macAddrIter, macs, NEEDED_MACS_LINK)) {
+			lprintln(LogError, "Ran out of MAC addresses when adding a new virtual ethernet connection.");
+			err = 1;
+			goto cleanup;
+		}
+		++createdLinks;
+
+		const gmlNodeState* source = &ctx->nodeStates[record->sourceId];
+		const gmlNodeState* target = &ctx->nodeStates[record->targetId];
+		bool sourceLocal = gmlIsLocal(ctx, record->sourceId);
+		bool targetLocal = gmlIsLocal(ctx, record->targetId);
+		if (sourceLocal && targetLocal) {
+			DO_OR_GOTO(workAddLink(record->sourceId, record->targetId, source->addr, target->addr, macs, ctx->mtu, &record->t), cleanup, err);
+			continue;
+		}
+		if (source->partition == target->partition) continue;
+		if (vni == GML_MAX_VNI) {
+			lprintf(LogError, "The partitioned network needs more than %u tunnels between machines. Use fewer machines or a smaller topology.\n", GML_MAX_VNI);
+			err = 1;
+			goto cleanup;
+		}
+		++vni;
+		if (!sourceLocal && !targetLocal) continue;
+
+		const ip4Addr* underlay = globalParams->partitionAddrs;
+		if (sourceLocal) {
+			DO_OR_GOTO(workAddTunnel(record->sourceId, record->targetId, source->addr, target->addr, macs, ctx->mtu, &record->t, vni, underlay[source->partition], underlay[target->partition]), cleanup, err);
+		} else {
+			macAddr swappedMacs[NEEDED_MACS_LINK] = { macs[1], macs[0] };
+			DO_OR_GOTO(workAddTunnel(record->targetId, record->sourceId, target->addr, source->addr, swappedMacs, ctx->mtu, &record->t, vni, underlay[target->partition], underlay[source->partition]), cleanup, err);
+		}
+		++ctx->tunnels;
+	}
+	DO_OR_GOTO(workJoin(false), cleanup, err);
+
+	if (ctx->prune) {
+		size_t presentHosts = ctx->nodeCount - ctx->collapsedHosts;
+		ctx->prunedHosts = presentHosts - hostCount;
+		ctx->prunedLinks = ctx->linkCount - createdLinks;
+		lprintf(LogInfo, "Pruned %lu of %lu hosts and %lu of %lu links that are not used by any route between client nodes\n", ctx->prunedHosts, presentHosts, ctx->prunedLinks, ctx->linkCount);
+	}
+
+cleanup:
+	if (usedLinks != NULL) g_hash_table_destroy(usedLinks);
+	free(usedNodes);
+	return err;
+}
+
+// Writes the command for instantiating an edge node that hosts "clients"
+// client nodes to the edge file, if there is one
+static void gmlWriteEdgeCommand(const edgeNodeParams* edge, nodeId clients) {
+	if (edgeFile == NULL) return;
+
+	fprintf(edgeFile, "netmirage-edge");
+	if (globalParams->edgeNodeCount > 1) {
+		fprintf(edgeFile, " -e ");
+		for (size_t i = 0; i < globalParams->edgeNodeCount; ++i) {
+			edgeNodeParams *otherEdge = &globalParams->edgeNodes[i];
+			char otherEdgeSubnet[IP4_CIDR_BUFLEN];
+			ip4SubnetToString(&otherEdge->vsubnet, otherEdgeSubnet);
+			if (i > 0) fprintf(edgeFile, ",");
+			fprintf(edgeFile, "%s", otherEdgeSubnet);
+		}
+	}
+	fprintf(edgeFile, " -c %u", clients);
+	if (edge->remoteDev == NULL) {
+		fprintf(edgeFile, " <iface>");
+	} else {
+		fprintf(edgeFile, " %s", edge->remoteDev);
+	}
+	if (globalParams->routingIp == 0) {
+		fprintf(edgeFile, " <core-ip>");
+	} else {
+		char routingIpStr[IP4_ADDR_BUFLEN];
+		ip4AddrToString(globalParams->routingIp, routingIpStr);
+		fprintf(edgeFile, " %s", routingIpStr);
+	}
+	char edgeSubnet[IP4_CIDR_BUFLEN];
+	ip4SubnetToString(&edge->vsubnet, edgeSubnet);
+	fprintf(edgeFile, " %s", edgeSubnet);
+	if (edge->remoteApps == 0) {
+		fprintf(edgeFile, " <applications>");
+	} else {
+		fprintf(edgeFile, " %u", edge->remoteApps);
+	}
+	fprintf(edgeFile, "\n");
+}
+
+// Assigns client nodes to edge nodes in topology order, giving each edge node
+// an equal number of clients. The number of clients assigned to each edge node
+// is added to edgeClients.
+static void gmlAssignSequential(gmlContext* ctx, nodeId edgeClients[]) {
+	size_t edgeCount = globalParams->edgeNodeCount;
+	double clientsPerEdge = (double)ctx->clientNodes / (double)edgeCount;
+
+	// This approach avoids numerical robustness problems
+	size_t edgeIdx = 0;
+	double nextMarker = round(clientsPerEdge);
+	double seen = 0.0;
+	for (size_t id = 0; id < ctx->nodeCount; ++id) {
+		gmlNodeState* state = &ctx->nodeStates[id];
+		if (!state->isClient) continue;
+		while (edgeIdx+1 < edgeCount && seen >= nextMarker) {
+			++edgeIdx;
+			nextMarker = round(clientsPerEdge * (double)(edgeIdx+1));
+		}
+		state->edgeIdx = edgeIdx;
+		++edgeClients[edgeIdx];
+		seen += 1.0;
+	}
+}
+
+typedef struct {
+	nodeId groupId; // Clients with the same group are placed together if possible
+	nodeId id;
+	double demand;  // Total client bandwidth in Mbit/s
+} gmlClientDemand;
+
+typedef struct {
+	size_t first;   // Index of the first client in the sorted demand list
+	size_t count;
+	double demand;
+} gmlAssignUnit;
+
+static int gmlCompareClientGroups(const void* a, const void* b) {
+	const gmlClientDemand* ca = a;
+	const gmlClientDemand* cb = b;
+	if (ca->groupId != cb->groupId) return ca->groupId < cb->groupId ? -1 : 1;
+	if (ca->id != cb->id) return ca->id < cb->id ? -1 : 1;
+	return 0;
+}
+
+static int gmlCompareUnitDemand(const void* a, const void* b) {
+	const gmlAssignUnit* ua = a;
+	const gmlAssignUnit* ub = b;
+	if (ua->demand != ub->demand) return ua->demand > ub->demand ? -1 : 1;
+	if (ua->first != ub->first) return ua->first < ub->first ? -1 : 1;
+	return 0;
+}
+
+// Assigns client nodes to edge nodes so that the total bandwidth of the clients
+// on each edge node is proportional to its capacity. Clients (or groups of
+// co-located clients) are placed in order of decreasing demand on the edge
+// node whose relative load would be the lowest afterwards. The number of
+// clients assigned to each edge node is added to edgeClients.
+static void gmlAssignBandwidth(gmlContext* ctx, nodeId edgeClients[], bool colocate) {
+	size_t edgeCount = globalParams->edgeNodeCount;
+
+	// Edge nodes without a configured capacity get the average of the others
+	double* capacities = eamalloc(edgeCount, sizeof(double), 0);
+	double totalCapacity = 0.0;
+	size_t knownCapacities = 0;
+	for (size_t i = 0; i < edgeCount; ++i) {
+		if (globalParams->edgeNodes[i].capacity > 0.0) {
+			totalCapacity += globalParams->edgeNodes[i].capacity;
+			++knownCapacities;
+		}
+	}
+	double defaultCapacity = (knownCapacities > 0 ? totalCapacity / (double)knownCapacities : 1.0);
+	totalCapacity = 0.0;
+	double minCapacity = 0.0;
+	for (size_t i = 0; i < edgeCount; ++i) {
+		double capacity = globalParams->edgeNodes[i].capacity;
+		capacities[i] = (capacity > 0.0 ? capacity : defaultCapacity);
+		totalCapacity += capacities[i];
+		if (i == 0 || capacities[i] < minCapacity) minCapacity = capacities[i];
+	}
+
+	// Clients without a bandwidth get the average demand of the others
+	gmlClientDemand* clients = eamalloc(ctx->clientNodes, sizeof(gmlClientDemand), 0);
+	size_t clientCount = 0;
+	double totalDemand = 0.0;
+	size_t knownDemands = 0;
+	for (size_t id = 0; id < ctx->nodeCount; ++id) {
+		gmlNodeState* state = &ctx->nodeStates[id];
+		if (!state->isClient) continue;
+		gmlClientDemand* client = &clients[clientCount++];
+		client->id = (nodeId)id;
+		client->groupId = (colocate && state->closestWeight >= 0.f ? state->closestId : (nodeId)id);
+		client->demand = state->node.bandwidthUp + state->node.bandwidthDown;
+		if (client->demand > 0.0) {
+			totalDemand += client->demand;
+			++knownDemands;
+		}
+	}
+	double defaultDemand = (knownDemands > 0 ? totalDemand / (double)knownDemands : 1.0);
+	totalDemand = 0.0;
+	for (size_t i = 0; i < clientCount; ++i) {
+		if (clients[i].demand <= 0.0) clients[i].demand = defaultDemand;
+		totalDemand += clients[i].demand;
+	}
+	if (colocate) {
+		qsort(clients, clientCount, sizeof(gmlClientDemand), &gmlCompareClientGroups);
+	}
+
+	// Groups are split if they would exceed the share of the smallest edge
+	// node, since they could otherwise not be balanced
+	double maxUnitDemand = totalDemand * minCapacity / totalCapacity;
+	gmlAssignUnit* units = eamalloc(clientCount, sizeof(gmlAssignUnit), 0);
+	size_t unitCount = 0;
+	for (size_t i = 0; i < clientCount; ++i) {
+		gmlAssignUnit* unit = (unitCount > 0 ? &units[unitCount-1] : NULL);
+		if (unit == NULL || clients[unit->first].groupId != clients[i].groupId || unit->demand + clients[i].demand > maxUnitDemand) {
+			unit = &units[unitCount++];
+			unit->first = i;
+			unit->count = 0;
+			unit->demand = 0.0;
+		}
+		++unit->count;
+		unit->demand += clients[i].demand;
+	}
+	qsort(units, unitCount, sizeof(gmlAssignUnit), &gmlCompareUnitDemand);
+
+	double* loads = eacalloc(edgeCount, sizeof(double), 0);
+	for (size_t u = 0; u < unitCount; ++u) {
+		gmlAssignUnit* unit = &units[u];
+		size_t best = 0;
+		double bestLoad = 0.0;
+		for (size_t i = 0; i < edgeCount; ++i) {
+			double load = (loads[i] + unit->demand) / capacities[i];
+			if (i == 0 || load < bestLoad || (load == bestLoad && edgeClients[i] < edgeClients[best])) {
+				best = i;
+				bestLoad = load;
+			}
+		}
+		loads[best] += unit->demand;
+		edgeClients[best] += (nodeId)unit->count;
+		for (size_t i = unit->first; i < unit->first + unit->count; ++i) {
+			ctx->nodeStates[clients[i].id].edgeIdx = best;
+		}
+	}
+
+	// Every edge node needs at least one client, so we take the smallest client
+	// from the edge node with the most clients if necessary
+	for (size_t i = 0; i < edgeCount; ++i) {
+		if (edgeClients[i] > 0) continue;
+		size_t donor = 0;
+		for (size_t j = 1; j < edgeCount; ++j) {
+			if (edgeClients[j] > edgeClients[donor]) donor = j;
+		}
+		gmlClientDemand* smallest = NULL;
+		for (size_t c = 0; c < clientCount; ++c) {
+			if (ctx->nodeStates[clients[c].id].edgeIdx != donor) continue;
+			if (smallest == NULL || clients[c].demand < smallest->demand) smallest = &clients[c];
+		}
+		ctx->nodeStates[smallest->id].edgeIdx = i;
+		--edgeClients[donor];
+		++edgeClients[i];
+		loads[donor] -= smallest->demand;
+		loads[i] += smallest->demand;
+	}
+
+	for (size_t i = 0; i < edgeCount; ++i) {
+		edgeNodeParams* edge = &globalParams->edgeNodes[i];
+		char edgeIp[IP4_ADDR_BUFLEN];
+		ip4AddrToString(edge->ip, edgeIp);
+		lprintf(LogInfo, "Edge node %s hosts %u clients with %.1f Mbit/s of bandwidth\n", edgeIp, edgeClients[i], loads[i]);
+		if (edge->capacity > 0.0 && loads[i] > edge->capacity) {
+			lprintf(LogWarning, "The clients assigned to edge node %s require %.1f Mbit/s, which exceeds its capacity of %.1f Mbit/s\n", edgeIp, loads[i], edge->capacity);
+		}
+	}
+
+	free(loads);
+	free(units);
+	free(clients);
+	free(capacities);
+}
+
+// Assigns every client node to an edge node and allocates its client subnet
+// from the edge node's range. Also writes the edge node commands.
+static int gmlAssignClients(gmlContext* ctx, const setupGraphMLParams* gmlParams) {
+	size_t edgeCount = globalParams->edgeNodeCount;
+	lprintf(LogDebug, "Assigning %u client nodes to %u edge nodes\n", ctx->clientNodes, edgeCount);
+
+	nodeId* edgeClients = eacalloc(edgeCount, sizeof(nodeId), 0);
+	if (gmlParams->edgeAssignment == EdgeAssignBandwidth) {
+		gmlAssignBandwidth(ctx, edgeClients, gmlParams->colocateClients);
+	} else {
+		if (gmlParams->colocateClients) {
+			lprintln(LogWarning, "Client co-location is only supported by the bandwidth edge assignment strategy");
+		}
+		gmlAssignSequential(ctx, edgeClients);
+	}
+
+	int err = 0;
+	for (size_t i = 0; i < edgeCount; ++i) {
+		edgeNodeParams* edge = &globalParams->edgeNodes[i];
+		char edgeSubnet[IP4_CIDR_BUFLEN];
+		ip4SubnetToString(&edge->vsubnet, edgeSubnet);
+		ctx->clientIters[i] = ip4FragmentSubnet(&edge->vsubnet, edgeClients[i]);
+		if (ctx->clientIters[i] == NULL) {
+			lprintf(LogError, "The client subnet %s is not large enough for the %u clients assigned to its edge node. Either increase the subnet size or add more edge nodes.\n", edgeSubnet, edgeClients[i]);
+			err = 1;
+			goto cleanup;
+		}
+		if (PASSES_LOG_THRESHOLD(LogDebug)) {
+			char edgeIp[IP4_ADDR_BUFLEN];
+			ip4AddrToString(edge->ip, edgeIp);
+			lprintf(LogDebug, "Allocating %u client subnets for edge %s (range %s)\n", edgeClients[i], edgeIp, edgeSubnet);
+		}
+		if (setupEdgeIsLocal(edge)) gmlWriteEdgeCommand(edge, edgeClients[i]);
+	}
+
+	for (size_t id = 0; id < ctx->nodeCount; ++id) {
+		gmlNodeState* node = &ctx->nodeStates[id];
+		if (!node->isClient) continue;
+		if (!ip4FragIterNext(ctx->clientIters[node->edgeIdx])) {
+			lprintln(LogError, "BUG: exhausted client node subnet space");
+			err = 1;
+			goto cleanup;
+		}
+		ip4FragIterSubnet(ctx->clientIters[node->edgeIdx], &node->clientSubnet);
+	}
+
+cleanup:
+	free(edgeClients);
+	return err;
+}
+
+// Stores a description of the constructed network so that it can later be
+// updated incrementally with setupApplyGraphML. The links are moved from the
+// context into the snapshot.
+static int gmlWriteSnapshot(gmlContext* ctx, const ip4Addr rootAddrs[]) {
+	topoSnapshot snap;
+	snapInit(&snap);
+	snap.mtu = ctx->mtu;
+	snap.rootAddrs[0] = rootAddrs[0];
+	snap.rootAddrs[1] = rootAddrs[1];
+	snap.nextMac = ctx->macAddrIter;
+
+	snap.edgeSubnetCount = globalParams->edgeNodeCount;
+	snap.edgeSubnets = eamalloc(snap.edgeSubnetCount, sizeof(ip4Subnet), 0);
+	for (size_t i = 0; i < globalParams->edgeNodeCount; ++i) {
+		snap.edgeSubnets[i] = globalParams->edgeNodes[i].vsubnet;
+	}
+
+	flexBufferGrow((void**)&snap.nodes, 0, &snap.nodeCap, ctx->nodeCount, sizeof(snapNode));
+	snap.nodeCount = ctx->nodeCount;
+	for (size_t id = 0; id < ctx->nodeCount; ++id) {
+		gmlNodeState* state = &ctx->nodeStates[id];
+		snapNode* node = &snap.nodes[id];
+		node->name = NULL;
+		node->addr = state->addr;
+		node->isClient = state->isClient;
+		node->clientSubnet = state->clientSubnet;
+		memcpy(node->clientMacs, state->clientMacs, sizeof(node->clientMacs));
+		node->node = state->node;
+		node->hasSelfLink = state->hasSelfLink;
+		node->selfLink = state->selfLink;
+	}
+	for (size_t id = 0; id < ctx->nodeCount; ++id) {
+		snap.nodes[id].name = strdup(internString(ctx->names, (uint32_t)id));
+	}
+
+	free(snap.links);
+	snap.links = ctx->links;
+	snap.linkCount = ctx->linkCount;
+	snap.linkCap = ctx->linkCap;
+	flexBufferInit((void**)&ctx->links, &ctx->linkCount, &ctx->linkCap);
+
+	char* snapshotFile = snapPath(globalParams->ovsDir);
+	int err = snapWrite(snapshotFile, &snap);
+	if (err != 0) {
+		lprintln(LogWarning, "The network was constructed, but it will not be possible to update it incrementally with --apply");
+	}
+	free(snapshotFile);
+	snapFree(&snap);
+	return err;
+}
+
+// Number of operations of each type performed when benchmarking the host
+static const uint32_t DryRunSamples = 32;
+
+// Prints the resources and time needed to construct the network counted during
+// a dry run. startTime is the time at which topology processing began.
+static int gmlReportEstimate(const gmlContext* ctx, gint64 startTime) {
+	workPlanStats stats;
+	workGetPlanStats(&stats);
+	double processingSecs = (double)(g_get_monotonic_time() - startTime) / (double)G_USEC_PER_SEC;
+
+	lprintln(LogInfo, "Measuring the cost of network operations on this host");
+	workBenchmarkResult bench;
+	DO_OR_RETURN(workBenchmark(DryRunSamples, &bench));
+
+	// Hosts, links, and most routes are distributed among the workers, but
+	// routes that are separated by joins are installed one at a time
+	uint32_t workers = (stats.workers > 0 ? stats.workers : 1);
+	uint64_t parallelRoutes = stats.routes - stats.serialRoutes;
+	double parallelSecs = ((double)stats.hosts * bench.hostSecs + (double)stats.links * bench.linkSecs + (double)parallelRoutes * bench.routeSecs) / workers;
+	double serialSecs = (double)stats.serialRoutes * bench.routeSecs;
+	double constructionSecs = parallelSecs + serialSecs;
+
+	const double MiB = 1024.0 * 1024.0;
+	uint64_t plannerBytes = rpEstimateMemory((nodeId)ctx->nodeCount);
+	double plannerMiB = (double)plannerBytes / MiB;
+	double kernelMiB = ((double)stats.hosts * (double)bench.hostBytes + (double)stats.links * (double)bench.linkBytes) / MiB;
+
+	printf("Dry run estimate for %lu nodes (%lu clients) and %lu links\n", ctx->nodeCount, ctx->clientNodes, ctx->linkCount);
+	if (ctx->collapse) {
+		printf("  Collapsed transit chains:  %lu (%lu hosts removed)\n", ctx->collapsedChains, ctx->collapsedHosts);
+	}
+	if (ctx->prune) {
+		printf("  Pruned (unused by routes): %lu hosts, %lu links\n", ctx->prunedHosts, ctx->prunedLinks);
+	}
+	if (ctx->packSize > 0) {
+		printf("  Packed VRF hosts:          %lu (in %u shared namespaces)\n", ctx->packedHosts, ctx->packs);
+	}
+	if (ctx->partitioned) {
+		printf("  Partition:                 machine %u of %u (%lu hosts, %lu tunnels)\n", globalParams->partition, globalParams->partitionCount, ctx->localHosts, ctx->tunnels);
+		printf("  Links between machines:    %lu (%.1f%% of route hops)\n", ctx->cutLinks, ctx->cutTraffic * 100.0);
+	}
+	printf("  Network namespaces:        %lu\n", stats.hosts);
+	printf("  Virtual ethernet pairs:    %lu\n", stats.links);
+	printf("  Route modifications:       %lu (%lu installed one at a time)\n", stats.routes, stats.serialRoutes);
+	printf("  Switch ports:              %lu\n", stats.switchPorts);
+	printf("  Switch flow rules:         %lu\n", stats.switchFlows);
+	printf("  Work orders:               %lu (%lu joins)\n", stats.orders, stats.joins);
+	printf("  Route planner memory:      %.1f MiB\n", plannerMiB);
+	printf("  Kernel memory:             %.1f MiB (approximate)\n", kernelMiB);
+	printf("  Measured host cost:        %.2f ms per namespace, %.2f ms per link, %.3f ms per route\n", bench.hostSecs * 1000.0, bench.linkSecs * 1000.0, bench.routeSecs * 1000.0);
+	printf("  Topology processing:       %.1f s (measured)\n", processingSecs);
+	printf("  Network construction:      %.1f s (estimated with %u workers)\n", constructionSecs, workers);
+	printf("  Expected total duration:   %.1f s\n", processingSecs + constructionSecs);
+	printf("The estimate excludes the time spent configuring Open vSwitch, which depends on its version and database size.\n");
+	return 0;
+}
+
+int setupGraphML(const setupGraphMLParams* gmlParams) {
+	gint64 startTime = g_get_monotonic_time();
+	lprintf(LogInfo, "Reading network topology in GraphML format from %s\n", globalParams->srcFile ? globalParams->srcFile : "<stdin>");
+
+	gmlContext ctx = {
+		.finishedNodes = false,
+		.ignoreNodes = false,
+		.ignoreEdges = false,
+
+		.clientNodes = 0,
+
+		.macAddrIter = { .octets = { 0 } },
+
+		.routes = NULL,
+		.edgeBuffer = NULL,
+		.countedLinks = 0,
+		.linksCounted = false,
+
+		.deferred = (gmlParams->pruneUnused || gmlParams->collapseChains || gmlParams->vrfPackSize > 0 || globalParams->partitionCount > 1),
+		.prune = gmlParams->pruneUnused,
+		.collapse = gmlParams->collapseChains,
+		.partitioned = (globalParams->partitionCount > 1),
+		.packSize = gmlParams->vrfPackSize,
+		.prunedHosts = 0,
+		.prunedLinks = 0,
+		.collapsedHosts = 0,
+		.collapsedChains = 0,
+		.packedHosts = 0,
+		.packs = 0,
+		.localHosts = 0,
+		.cutLinks = 0,
+		.tunnels = 0,
+		.cutTraffic = 0.0,
+	};
+	macNextAddr(&ctx.macAddrIter); // Skip all-zeroes address (unassignable)
+	flexBufferInit((void**)&ctx.nodeStates, &ctx.nodeCount, &ctx.nodeCap);
+	flexBufferInit((void**)&ctx.links, &ctx.linkCount, &ctx.linkCap);
+	ctx.names = internNew();
+
+	// We assign internal interface addresses from the full IPv4 space, but
+	// avoid the subnets reserved for the edge nodes. The fact that the
+	// addresses we use are publicly routable does not matter, since the
+	// internal node namespaces are not connected to the Internet.
+	const size_t ReservedSubnetCount = 3;
+	ip4Subnet reservedSubnets[ReservedSubnetCount];
+	ip4GetSubnet("0.0.0.0/8", &reservedSubnets[0]);
+	ip4GetSubnet("127.0.0.0/8", &reservedSubnets[1]);
+	ip4GetSubnet("255.255.255.255/32", &reservedSubnets[2]);
+	const ip4Subnet* restrictedSubnets[globalParams->edgeNodeCount+ReservedSubnetCount+1];
+	size_t subnets = 0;
+	for (size_t i = 0; i < ReservedSubnetCount; ++i) {
+		restrictedSubnets[subnets++] = &reservedSubnets[i];
+	}
+	for (size_t i = 0; i < globalParams->edgeNodeCount; ++i) {
+		restrictedSubnets[subnets++] = &globalParams->edgeNodes[i].vsubnet;
+	}
+	restrictedSubnets[subnets++] = NULL;
+	ip4Subnet everything;
+	ip4GetSubnet("0.0.0.0/0", &everything);
+	ctx.intfAddrIter = ip4NewIter(&everything, false, restrictedSubnets);
+
+	int err;
+	uint32_t* edgePorts = eamalloc(globalParams->edgeNodeCount, sizeof(uint32_t), 0);
+	size_t* localEdges = eamalloc(globalParams->edgeNodeCount, sizeof(size_t), 0);
+	const char** localIntfs = eamalloc(globalParams->edgeNodeCount, sizeof(const char*), 0);
+	int* edgeMtus = eamalloc(globalParams->edgeNodeCount, sizeof(int), 0);
+	macAddr* edgeLocalMacs = eamalloc(globalParams->edgeNodeCount, sizeof(macAddr), 0);
+	ctx.clientIters = eacalloc(globalParams->edgeNodeCount, sizeof(ip4FragIter*), 0);
+	uint32_t nextOvsPort = 1;
+
+	if (globalParams->compilePlanFile != NULL || globalParams->dryRun) {
+		// A dry run records a plan without a file in order to count the orders
+		DO_OR_GOTO(workBeginPlan(globalParams->compilePlanFile), cleanup, err);
+	}
+
+	ip4Addr rootAddrs[2];
+	for (int i = 0; i < 2; ++i) {
+		bool addrExhausted = false;
+		gmlGenerateIp(&ctx, &addrExhausted, &rootAddrs[i]);
+		if (addrExhausted) {
+			lprintln(LogError, "The edge node subnets completely fill the unreserved IPv4 space. Some addresses must be left for internal networking interfaces in the emulator.");
+			err = 1;
+			goto cleanup;
+		}
+	}
+
+	// Local edge interfaces are probed together. localEdges maps the queries
+	// to the indices of the edge nodes.
+	size_t localEdgeCount = 0;
+	for (size_t i = 0; i < globalParams->edgeNodeCount; ++i) {
+		edgeNodeParams* edge = &globalParams->edgeNodes[i];
+		if (!setupEdgeIsLocal(edge)) continue;
+		localEdges[localEdgeCount] = i;
+		localIntfs[localEdgeCount] = edge->intf;
+		++localEdgeCount;
+	}
+
+	// Determine the common MTU for all edge interfaces
+	DO_OR_GOTO(workGetInterfaceMtus(localEdgeCount, localIntfs, edgeMtus), cleanup, err);
+	ctx.mtu = 0;
+	for (size_t q = 0; q < localEdgeCount; ++q) {
+		edgeNodeParams *edge = &globalParams->edgeNodes[localEdges[q]];
+		int edgeMtu = edgeMtus[q];
+		if (edgeMtu <= 0) {
+			lprintf(LogError, "Interface %s has non-positive MTU: %d\n", edge->intf, edgeMtu);
+		}
+		if (ctx.mtu <= 0) {
+			ctx.mtu = edgeMtu;
+			lprintf(LogDebug, "Using edge MTU %d for network\n", ctx.mtu);
+		} else if (edgeMtu != ctx.mtu) {
+			lprintf(LogError, "Edge interfaces have different MTUs. All interfaces must share the same MTU to avoid segmentation problems. Interface %s has MTU %d, but interface %s has MTU %d.\n", globalParams->edgeNodes[0].intf, ctx.mtu, edge->intf, edgeMtu);
+			err = 1;
+			goto cleanup;
+		}
+	}
+
+	if (ctx.mtu <= 0) {
+		// A machine in a partitioned network may have no edge nodes
+		ctx.mtu = IP4_DEFAULT_MTU;
+	}
+
+	// If we're using a non-standard MTU, make sure that that this feature is supported
+	bool mtuSupported = false;
+	const char* failReason = NULL;
+	DO_OR_GOTO(workMtuSupported(ctx.mtu, &mtuSupported, &failReason), cleanup, err);
+	if (!mtuSupported) {
+		lprintf(LogError, "The edge interfaces have their MTU set to %d, which requires \"jumbo packet\" support. %s Alternatively, you can set the edge interface MTUs to the default value to avoid this requirement.\n", ctx.mtu, failReason);
+		err = 1;
+		goto cleanup;
+	}
+
+	progressBegin("edges", globalParams->edgeNodeCount);
+	workSetPhase(PhaseRoot);
+	DO_OR_GOTO(workAddRoot(rootAddrs[0], rootAddrs[1], ctx.mtu, globalParams->rootIsInitNs), cleanup, err);
+	DO_OR_GOTO(workJoin(false), cleanup, err);
+
+	// Move all interfaces associated with edge nodes into the root namespace
+	for (size_t i = 0; i < globalParams->edgeNodeCount; ++i) {
+		edgeNodeParams* edge = &globalParams->edgeNodes[i];
+		if (!setupEdgeIsLocal(edge)) {
+			progressAdvance(1);
+			continue;
+		}
+
+		// Check to see if this is a duplicate interface. We simply perform
 		// linear searches because the number of edge nodes should be relatively
 		// small (typically less than 10).
 		bool duplicateIntf = false;
 		for (size_t j = 0; j < i; ++j) {
 			edgeNodeParams* otherEdge = &globalParams->edgeNodes[j];
+			if (!setupEdgeIsLocal(otherEdge)) continue;
 			if (strcmp(edge->intf, otherEdge->intf) == 0) {
 				edgePorts[i] = edgePorts[j];
 				duplicateIntf = true;
@@ -556,21 +1856,40 @@ int setupGraphML(const setupGraphMLParams* gmlParams) {
 			DO_OR_GOTO(workJoin(false), cleanup, err);
 			edgePorts[i] = nextOvsPort++;
 		}
+	}
 
-		macAddr edgeLocalMac;
-		DO_OR_GOTO(workGetEdgeLocalMac(edge->intf, &edgeLocalMac), cleanup, err);
-		DO_OR_GOTO(workAddEdgeRoutes(&edge->vsubnet, edgePorts[i], &edgeLocalMac, &edge->mac), cleanup, err);
+	// Route traffic for the edge nodes through their interfaces
+	DO_OR_GOTO(workGetEdgeLocalMacs(localEdgeCount, localIntfs, edgeLocalMacs), cleanup, err);
+	for (size_t q = 0; q < localEdgeCount; ++q) {
+		size_t i = localEdges[q];
+		edgeNodeParams* edge = &globalParams->edgeNodes[i];
+		DO_OR_GOTO(workAddEdgeRoutes(&edge->vsubnet, edgePorts[i], &edgeLocalMacs[q], &edge->mac), cleanup, err);
+		progressAdvance(1);
 	}
 	DO_OR_GOTO(workJoin(false), cleanup, err);
+	workSetPhase(PhaseHosts);
+
+	// Unless their creation is deferred, hosts are created while the file is
+	// parsed, but we only know how many there are once all of the nodes have
+	// been read
+	ctx.hostOrderBase = workGetCompletedOrders();
+	if (ctx.deferred) progressBegin("parse", 0);
+	else progressBeginCounter("hosts", 0, &gmlCountOrders, &ctx.hostOrderBase);
+
+	gmlEdgeBuffer edgeBuffer;
+	if (gmlParams->bufferEdges) {
+		gmlInitEdgeBuffer(&edgeBuffer, globalParams->softMemCap / EDGE_BUFFER_MEM_DIVISOR);
+		ctx.edgeBuffer = &edgeBuffer;
+	}
 
 	if (globalParams->srcFile) {
-		int passes = gmlParams->twoPass ? 2 : 1;
+		int passes = (gmlParams->twoPass && !gmlParams->bufferEdges) ? 2 : 1;
 
 		// Setup based on number of passes
 		if (passes > 1) ctx.ignoreEdges = true;
 
 		for (int pass = passes; pass > 0; --pass) {
-			err = gmlParseFile(globalParams->srcFile, &gmlAddNode, &gmlAddLink, &ctx, gmlParams->clientType, gmlParams->weightKey);
+			err = gmlParseFile(globalParams->srcFile, ctx.names, &gmlAddNode, &gmlAddLink, &ctx, gmlParams->clientType, gmlParams->weightKey);
 			if (err != 0) goto cleanup;
 
 			// Transitions between passes
@@ -581,54 +1900,95 @@ int setupGraphML(const setupGraphMLParams* gmlParams) {
 				ctx.finishedNodes = true;
 				ctx.ignoreNodes = true;
 				ctx.ignoreEdges = false;
+				ctx.linksCounted = true;
 			}
 		}
 	} else {
-		if (gmlParams->twoPass) {
-			lprintln(LogError, "Cannot perform two passes when reading a GraphML file from stdin. Either ensure that all nodes appear before edges, or read from a file.");
+		if (gmlParams->twoPass && !gmlParams->bufferEdges) {
+			lprintln(LogError, "Cannot perform two passes when reading a GraphML file from stdin. Either ensure that all nodes appear before edges, use --buffer-edges, or read from a file.");
 			err = 1;
 			goto cleanup;
 
 		}
-		err = gmlParse(stdin, &gmlAddNode, &gmlAddLink, &ctx, gmlParams->clientType, gmlParams->weightKey);
+		err = gmlParse(stdin, ctx.names, &gmlAddNode, &gmlAddLink, &ctx, gmlParams->clientType, gmlParams->weightKey);
 	}
 
-	DO_OR_GOTO(workJoin(false), cleanup, err);
+	if (err != 0) goto cleanup;
 
-	// Host and link construction is finished. Now we set up routing
-	lprintln(LogInfo, "Setting up static routing for the network");
+	if (ctx.edgeBuffer != NULL && ctx.edgeBuffer->spilledLinks + ctx.edgeBuffer->linkCount > 0) {
+		// Every node has been created, so the buffered links can be added
+		// without reading the file again
+		ctx.finishedNodes = true;
+		ctx.ignoreNodes = true;
+		DO_OR_GOTO(gmlOnFinishedNodes(&ctx), cleanup, err);
+		DO_OR_GOTO(gmlReplayLinks(ctx.edgeBuffer, ctx.names, &gmlAddLink, &ctx), cleanup, err);
+	}
 
 	if (ctx.routes == NULL) {
 		lprintln(LogError, "Network topology did not contain any links");
 		err = 1;
 		goto cleanup;
 	}
-	rpPlanRoutes(ctx.routes);
+	if (ctx.collapse) gmlCollapseChains(&ctx);
+
+	// All link weights are known at this point, but the workers may still be
+	// busy creating hosts and links. Route planning is independent of that
+	// work, so we overlap the two and wait for both to finish before routes
+	// can be installed. When pruning, nothing has been created yet.
+	if (ctx.deferred) {
+		lprintln(LogInfo, "Planning routes");
+	} else {
+		lprintln(LogInfo, "Planning routes while waiting for host and link construction to finish");
+	}
+	DO_OR_GOTO(rpPlanRoutesAsync(ctx.routes), cleanup, err);
+	int joinErr = workJoin(false);
+	uint64_t plannedRounds, planRounds;
+	rpGetProgress(ctx.routes, &plannedRounds, &planRounds);
+	progressBeginCounter("plan", planRounds, &gmlCountPlanRounds, ctx.routes);
+	int planErr = rpWaitForRoutes(ctx.routes);
+	if (joinErr != 0) {
+		err = joinErr;
+		goto cleanup;
+	}
+	if (planErr != 0) {
+		err = planErr;
+		goto cleanup;
+	}
+	// Clients are assigned before deferred construction because a partitioned
+	// network places each client on the machine of its edge node
+	DO_OR_GOTO(gmlAssignClients(&ctx, gmlParams), cleanup, err);
+	if (ctx.deferred) DO_OR_GOTO(gmlCreateDeferred(&ctx), cleanup, err);
+
+	// Host and link construction is finished. Now we set up routing
+	lprintln(LogInfo, "Setting up static routing for the network");
 
-	lprintf(LogDebug, "Assigning %u client nodes to %u edge nodes\n", ctx.clientNodes, globalParams->edgeNodeCount);
+	size_t localClients = 0;
+	for (size_t id = 0; id < ctx.nodeCount; ++id) {
+		if (ctx.nodeStates[id].isClient && gmlIsLocal(&ctx, (nodeId)id)) ++localClients;
+	}
+	workSetPhase(PhaseClientRoutes);
+	progressBegin("client routes", localClients);
 	for (size_t id = 0; id < ctx.nodeCount; ++id) {
 		gmlNodeState* node = &ctx.nodeStates[id];
-		if (!node->isClient) continue;
+		if (!node->isClient || !gmlIsLocal(&ctx, (nodeId)id)) continue;
 
-		if (!gmlNextClientSubnet(&ctx, &node->clientSubnet)) {
-			lprintln(LogError, "BUG: exhausted client node subnet space");
-			goto cleanup;
-		}
-		size_t edgeIdx = ctx.currentEdgeIdx;
+		size_t edgeIdx = node->edgeIdx;
 		if (PASSES_LOG_THRESHOLD(LogDebug)) {
 			char subnet[IP4_CIDR_BUFLEN];
 			ip4SubnetToString(&node->clientSubnet, subnet);
 			lprintf(LogDebug, "Assigned client node %u to subnet %s owned by edge %lu\n", id, subnet, edgeIdx);
 		}
+		// Open vSwitch locks the database file when processing commands, so
+		// they cannot be parallelized. The work module orders them for us.
 		DO_OR_GOTO(workAddClientRoutes((nodeId)id, node->clientMacs, &node->clientSubnet, edgePorts[edgeIdx], nextOvsPort), cleanup, err);
 		nextOvsPort += NEEDED_PORTS_CLIENT;
-		// We need to join here because Open vSwitch locks the database file
-		// when processing commands. They cannot be parallelized.
-		DO_OR_GOTO(workJoin(false), cleanup, err);
+		progressAdvance(1);
 	}
 
 	// Build routes between every pair of client nodes
 	lprintln(LogDebug, "Adding static routes along paths for all client node pairs");
+	workSetPhase(PhaseInternalRoutes);
+	progressBegin("internal routes", (uint64_t)ctx.clientNodes * (ctx.clientNodes - 1) / 2);
 	bool seenUnroutable = false;
 	for (nodeId startId = 0; startId < ctx.nodeCount; ++startId) {
 		gmlNodeState* start = &ctx.nodeStates[startId];
@@ -637,6 +1997,7 @@ int setupGraphML(const setupGraphMLParams* gmlParams) {
 		for (nodeId endId = startId+1; endId < ctx.nodeCount; ++endId) {
 			gmlNodeState* end = &ctx.nodeStates[endId];
 			if (!end->isClient) continue;
+			progressAdvance(1);
 
 			lprintf(LogDebug, "Constructing route from client %u to %u\n", startId, endId);
 			nodeId* path;
@@ -648,6 +2009,7 @@ int setupGraphML(const setupGraphMLParams* gmlParams) {
 				}
 				continue;
 			}
+			if (ctx.collapse) gmlCollapsePath(&ctx, path, &steps);
 			if (steps < 2) {
 				lprintf(LogError, "BUG: route from client %u to %u has %d steps\n", startId, endId, steps);
 				continue;
@@ -656,23 +2018,573 @@ int setupGraphML(const setupGraphMLParams* gmlParams) {
 			nodeId prevId = path[0];
 			for (nodeId step = 1; step < steps; ++step) {
 				nodeId nextId = path[step];
-				lprintf(LogDebug, "Hop %d for %u => %u: %u => %u\n", step, startId, endId, prevId, nextId);
-				DO_OR_GOTO(workAddInternalRoutes(prevId, nextId, ctx.nodeStates[prevId].addr, ctx.nodeStates[nextId].addr, &start->clientSubnet, &end->clientSubnet), cleanup, err);
-				// Another join mandated by locking Open vSwitch commands
-				DO_OR_GOTO(workJoin(false), cleanup, err);
+				// Hops between hosts on other machines are routed there
+				if (gmlIsLocal(&ctx, prevId) || gmlIsLocal(&ctx, nextId)) {
+					lprintf(LogDebug, "Hop %d for %u => %u: %u => %u\n", step, startId, endId, prevId, nextId);
+					DO_OR_GOTO(workAddInternalRoutes(prevId, nextId, ctx.nodeStates[prevId].addr, ctx.nodeStates[nextId].addr, &start->clientSubnet, &end->clientSubnet), cleanup, err);
+				}
 
 				prevId = nextId;
 			}
 		}
 	}
 	DO_OR_GOTO(workJoin(false), cleanup, err);
+	DO_OR_GOTO(workEndJournal(true), cleanup, err);
+
+	if (globalParams->compilePlanFile == NULL && !globalParams->dryRun) {
+		if (ctx.deferred) {
+			// The snapshot describes a network with one namespace for every
+			// node in the topology, which this one is not
+			lprintln(LogInfo, "Networks constructed with --prune-unused, --collapse-chains, --vrf-pack, or --partition-hosts cannot be updated incrementally with --apply");
+		} else {
+			// A failure here does not affect the network itself
+			gmlWriteSnapshot(&ctx, rootAddrs);
+		}
+	}
 
 cleanup:
-	if (ctx.clientIter != NULL) ip4FreeFragIter(ctx.clientIter);
+	if (globalParams->compilePlanFile != NULL || globalParams->dryRun) {
+		int endErr = workEndPlan(err == 0);
+		if (err == 0) err = endErr;
+		if (err == 0 && globalParams->dryRun) err = gmlReportEstimate(&ctx, startTime);
+	}
+	// The progress counters refer to the context, so they must be stopped
+	// before it is freed
+	progressFinish(err == 0);
+	for (size_t i = 0; i < globalParams->edgeNodeCount; ++i) {
+		if (ctx.clientIters[i] != NULL) ip4FreeFragIter(ctx.clientIters[i]);
+	}
+	free(ctx.clientIters);
 	if (ctx.routes != NULL) rpFreePlan(ctx.routes);
-	g_hash_table_destroy(ctx.gmlToState);
+	if (ctx.edgeBuffer != NULL) gmlFreeEdgeBuffer(ctx.edgeBuffer);
+	internFree(ctx.names);
 	ip4FreeIter(ctx.intfAddrIter);
 	flexBufferFree((void**)&ctx.nodeStates, &ctx.nodeCount, &ctx.nodeCap);
+	flexBufferFree((void**)&ctx.links, &ctx.linkCount, &ctx.linkCap);
 	free(edgePorts);
+	free(localEdges);
+	free(localIntfs);
+	free(edgeMtus);
+	free(edgeLocalMacs);
+	return err;
+}
+
+int setupReplayPlan(void) {
+	lprintf(LogInfo, "Constructing network from setup plan '%s'\n", globalParams->replayPlanFile);
+	DO_OR_RETURN(workReplayPlan(globalParams->replayPlanFile));
+	DO_OR_RETURN(workJoin(false));
+	return 0;
+}
+
+
+/******************************************************************************\
+|                              Incremental Updates                             |
+\******************************************************************************/
+
+typedef struct {
+	bool defined; // True if the node appears in the new topology
+	TopoNode node;
+	bool hasSelfLink;
+	TopoLink selfLink;
+} applyNodeState;
+
+typedef struct {
+	bool finishedNodes;
+	bool ignoreNodes;
+	bool ignoreEdges;
+
+	const topoSnapshot* snap;
+
+	// Node states are indexed by identifier. Identifiers for nodes in the
+	// snapshot are preserved, and new nodes are assigned identifiers after the
+	// last one in the snapshot.
+	applyNodeState* nodeStates;
+	size_t nodeCount;
+	size_t nodeCap;
+	internTable* names; // Preloaded with the names in the snapshot
+
+	snapLink* links;
+	size_t linkCount;
+	size_t linkCap;
+	GHashTable* linkIndices; // Maps link keys to indices in links (plus one)
+
+	gmlEdgeBuffer* edgeBuffer; // Only used if links are being buffered
+} applyContext;
+
+static bool applyNodesEqual(const TopoNode* a, const TopoNode* b) {
+	return a->client == b->client && a->packetLoss == b->packetLoss && a->bandwidthUp == b->bandwidthUp && a->bandwidthDown == b->bandwidthDown;
+}
+
+static bool applyLinksEqual(const TopoLink* a, const TopoLink* b) {
+	return a->latency == b->latency && a->packetLoss == b->packetLoss && a->jitter == b->jitter && a->queueLen == b->queueLen;
+}
+
+static bool applyNodePresent(const applyContext* ctx, nodeId id) {
+	return ctx->nodeStates[id].defined;
+}
+
+static int applyAddNode(const GmlNode* node, void* userData) {
+	applyContext* ctx = userData;
+	if (ctx->ignoreNodes) return 0;
+	if (ctx->finishedNodes) {
+		lprintln(LogError, "The GraphML file contains some <node> elements after the <edge> elements. To parse this file, use the --buffer-edges or --two-pass option.");
+		return 1;
+	}
+
+	// New names are assigned identifiers after the ones in the snapshot
+	size_t id = node->id;
+	if (id < ctx->nodeCount) {
+		if (ctx->nodeStates[id].defined) {
+			lprintf(LogError, "The topology defines host '%s' more than once\n", node->name);
+			return 1;
+		}
+	} else {
+		flexBufferGrow((void**)&ctx->nodeStates, ctx->nodeCount, &ctx->nodeCap, 1, sizeof(applyNodeState));
+		++ctx->nodeCount;
+	}
+	applyNodeState* state = &ctx->nodeStates[id];
+	state->defined = true;
+	state->node = node->t;
+	state->hasSelfLink = false;
+	return 0;
+}
+
+static bool applyEndpointKnown(const applyContext* ctx, nodeId id, const char* name) {
+	if (id >= ctx->nodeCount || !ctx->nodeStates[id].defined) {
+		lprintf(LogError, "Requested existing state for unknown host '%s'\n", name);
+		return false;
+	}
+	return true;
+}
+
+static int applyAddLink(const GmlLink* link, void* userData) {
+	applyContext* ctx = userData;
+	if (ctx->ignoreEdges) return 0;
+	if (ctx->edgeBuffer != NULL && !ctx->finishedNodes) return gmlBufferLink(ctx->edgeBuffer, link);
+	ctx->finishedNodes = true;
+
+	nodeId sourceId = link->sourceId;
+	nodeId targetId = link->targetId;
+	if (!applyEndpointKnown(ctx, sourceId, link->sourceName)) return 1;
+	if (!applyEndpointKnown(ctx, targetId, link->targetName)) return 1;
+
+	if (sourceId == targetId) {
+		applyNodeState* state = &ctx->nodeStates[sourceId];
+		if (state->node.client) {
+			state->hasSelfLink = true;
+			state->selfLink = link->t;
+		}
+		return 0;
+	}
+
+	if (link->weight < 0.f) {
+		lprintf(LogError, "The link from '%s' to '%s' in the topology has negative weight %f, which is not supported.\n", link->sourceName, link->targetName, link->weight);
+		return 1;
+	}
+
+	uint64_t key = setupLinkKey(sourceId, targetId);
+	if (g_hash_table_lookup(ctx->linkIndices, &key) != NULL) {
+		lprintf(LogError, "The topology contains more than one link between '%s' and '%s'\n", link->sourceName, link->targetName);
+		return 1;
+	}
+
+	snapLink record = { .sourceId = sourceId, .targetId = targetId, .weight = link->weight, .t = link->t };
+	flexBufferGrow((void**)&ctx->links, ctx->linkCount, &ctx->linkCap, 1, sizeof(snapLink));
+	flexBufferAppend(ctx->links, &ctx->linkCount, &record, 1, sizeof(snapLink));
+
+	uint64_t* keyPtr = eamalloc(1, sizeof(uint64_t), 0);
+	*keyPtr = key;
+	g_hash_table_insert(ctx->linkIndices, keyPtr, GSIZE_TO_POINTER(ctx->linkCount));
+	return 0;
+}
+
+// Computes the next hop towards the subnet of client "dest" for every node,
+// given the routes in a planner. The result mirrors the routes installed by
+// setupGraphML, including the order in which paths overwrite each other.
+static void applyNextHops(routePlanner* routes, const bool* isClient, size_t nodeCount, nodeId dest, nodeId* nextHops) {
+	for (size_t id = 0; id < nodeCount; ++id) nextHops[id] = INVALID_NODE_ID;
+
+	nodeId* path;
+	nodeId steps;
+	for (nodeId startId = 0; startId < dest; ++startId) {
+		if (!isClient[startId]) continue;
+		if (!rpGetRoute(routes, startId, dest, &path, &steps)) continue;
+		for (nodeId step = 0; step+1 < steps; ++step) {
+			nextHops[path[step]] = path[step+1];
+		}
+	}
+	for (nodeId endId = dest+1; endId < nodeCount; ++endId) {
+		if (!isClient[endId]) continue;
+		if (!rpGetRoute(routes, dest, endId, &path, &steps)) continue;
+		for (nodeId step = 1; step < steps; ++step) {
+			nextHops[path[step]] = path[step-1];
+		}
+	}
+}
+
+static int applyParse(const setupGraphMLParams* gmlParams, applyContext* ctx) {
+	gmlEdgeBuffer edgeBuffer;
+	if (gmlParams->bufferEdges) {
+		gmlInitEdgeBuffer(&edgeBuffer, globalParams->softMemCap / EDGE_BUFFER_MEM_DIVISOR);
+		ctx->edgeBuffer = &edgeBuffer;
+	}
+
+	int err = 0;
+	if (globalParams->srcFile) {
+		int passes = (gmlParams->twoPass && !gmlParams->bufferEdges) ? 2 : 1;
+		if (passes > 1) ctx->ignoreEdges = true;
+		for (int pass = passes; pass > 0; --pass) {
+			DO_OR_GOTO(gmlParseFile(globalParams->srcFile, ctx->names, &applyAddNode, &applyAddLink, ctx, gmlParams->clientType, gmlParams->weightKey), cleanup, err);
+			if (pass == 2) {
+				ctx->finishedNodes = true;
+				ctx->ignoreNodes = true;
+				ctx->ignoreEdges = false;
+			}
+		}
+	} else if (gmlParams->twoPass && !gmlParams->bufferEdges) {
+		lprintln(LogError, "Cannot perform two passes when reading a GraphML file from stdin. Either ensure that all nodes appear before edges, use --buffer-edges, or read from a file.");
+		err = 1;
+		goto cleanup;
+	} else {
+		DO_OR_GOTO(gmlParse(stdin, ctx->names, &applyAddNode, &applyAddLink, ctx, gmlParams->clientType, gmlParams->weightKey), cleanup, err);
+	}
+
+	if (ctx->edgeBuffer != NULL) {
+		ctx->finishedNodes = true;
+		ctx->ignoreNodes = true;
+		err = gmlReplayLinks(ctx->edgeBuffer, ctx->names, &applyAddLink, ctx);
+	}
+
+cleanup:
+	if (ctx->edgeBuffer != NULL) {
+		gmlFreeEdgeBuffer(ctx->edgeBuffer);
+		ctx->edgeBuffer = NULL;
+	}
+	return err;
+}
+
+// Ensures that the new topology can be applied to the running network without
+// rebuilding it. Client nodes are bound to edge subnets and switch ports when
+// the network is constructed, so the set of clients must not change.
+static int applyValidate(const applyContext* ctx) {
+	const topoSnapshot* snap = ctx->snap;
+	for (size_t id = 0; id < ctx->nodeCount; ++id) {
+		const applyNodeState* state = &ctx->nodeStates[id];
+		bool wasClient = (id < snap->nodeCount && snap->nodes[id].name != NULL && snap->nodes[id].isClient);
+		bool isClient = (state->defined && state->node.client);
+		if (wasClient != isClient) {
+			const char* name = (id < snap->nodeCount && snap->nodes[id].name != NULL ? snap->nodes[id].name : "<new>");
+			lprintf(LogError, "The set of client nodes in the topology has changed (e.g., host %lu, '%s'). Client subnets and switch ports are assigned when the network is constructed, so this change requires a full rebuild without --apply.\n", id, name);
+			return 1;
+		}
+	}
+	if (ctx->linkCount == 0) {
+		lprintln(LogError, "Network topology did not contain any links");
+		return 1;
+	}
+	return 0;
+}
+
+// Prepares a context for applying a topology to the network recorded in a
+// snapshot. Nodes keep their identifiers from the snapshot, so the recorded
+// names are interned first. Returns false if those names cannot be used.
+static bool applyInitContext(applyContext* ctx, const topoSnapshot* snap) {
+	ctx->finishedNodes = false;
+	ctx->ignoreNodes = false;
+	ctx->ignoreEdges = false;
+	ctx->snap = snap;
+	ctx->edgeBuffer = NULL;
+	flexBufferInit((void**)&ctx->nodeStates, &ctx->nodeCount, &ctx->nodeCap);
+	flexBufferInit((void**)&ctx->links, &ctx->linkCount, &ctx->linkCap);
+	ctx->names = internNew();
+	ctx->linkIndices = g_hash_table_new_full(&g_int64_hash, &g_int64_equal, &gmlFreeData, NULL);
+
+	flexBufferGrow((void**)&ctx->nodeStates, 0, &ctx->nodeCap, snap->nodeCount, sizeof(applyNodeState));
+	ctx->nodeCount = snap->nodeCount;
+	for (size_t id = 0; id < snap->nodeCount; ++id) {
+		ctx->nodeStates[id].defined = false;
+	}
+	// Identifiers must match those in the snapshot
+	return (snapInternNames(snap, ctx->names) == 0);
+}
+
+static void applyFreeContext(applyContext* ctx) {
+	g_hash_table_destroy(ctx->linkIndices);
+	internFree(ctx->names);
+	flexBufferFree((void**)&ctx->links, &ctx->linkCount, &ctx->linkCap);
+	flexBufferFree((void**)&ctx->nodeStates, &ctx->nodeCount, &ctx->nodeCap);
+}
+
+// Records the state of the network after the topology in the context has been
+// applied. Removed hosts lose their names but keep their identifiers, and new
+// hosts are appended with the addresses in "addrs". The links are moved from
+// the context to the snapshot.
+static void applyUpdateSnapshot(applyContext* ctx, topoSnapshot* snap, const ip4Addr addrs[]) {
+	size_t oldNodeCount = snap->nodeCount;
+	size_t nodeCount = ctx->nodeCount;
+	for (size_t id = 0; id < oldNodeCount; ++id) {
+		if (snap->nodes[id].name != NULL && !applyNodePresent(ctx, (nodeId)id)) {
+			free(snap->nodes[id].name);
+			snap->nodes[id].name = NULL;
+		}
+	}
+	flexBufferGrow((void**)&snap->nodes, oldNodeCount, &snap->nodeCap, nodeCount - oldNodeCount, sizeof(snapNode));
+	for (size_t id = oldNodeCount; id < nodeCount; ++id) {
+		snapNode* node = &snap->nodes[id];
+		memset(node, 0, sizeof(*node));
+		node->name = strdup(internString(ctx->names, (uint32_t)id));
+		node->addr = addrs[id];
+		node->isClient = false;
+	}
+	snap->nodeCount = nodeCount;
+	for (size_t id = 0; id < nodeCount; ++id) {
+		if (!applyNodePresent(ctx, (nodeId)id)) continue;
+		snap->nodes[id].node = ctx->nodeStates[id].node;
+		snap->nodes[id].hasSelfLink = ctx->nodeStates[id].hasSelfLink;
+		snap->nodes[id].selfLink = ctx->nodeStates[id].selfLink;
+	}
+	free(snap->links);
+	snap->links = ctx->links;
+	snap->linkCount = ctx->linkCount;
+	snap->linkCap = ctx->linkCap;
+	flexBufferInit((void**)&ctx->links, &ctx->linkCount, &ctx->linkCap);
+}
+
+int setupApplyGraphML(const setupGraphMLParams* gmlParams) {
+	char* snapshotFile = snapPath(globalParams->ovsDir);
+	topoSnapshot snap;
+	int err = snapRead(snapshotFile, &snap);
+	if (err != 0) {
+		if (err == ENOENT) {
+			lprintf(LogError, "No record of a running network was found at '%s'. Incremental updates can only be applied to networks that were constructed from a topology by this program. Construct the network without --apply first.\n", snapshotFile);
+		}
+		free(snapshotFile);
+		return 1;
+	}
+
+	lprintf(LogInfo, "Reading updated network topology in GraphML format from %s\n", globalParams->srcFile ? globalParams->srcFile : "<stdin>");
+
+	applyContext ctx;
+	bool namesValid = applyInitContext(&ctx, &snap);
+
+	GHashTable* oldLinks = g_hash_table_new_full(&g_int64_hash, &g_int64_equal, &gmlFreeData, NULL);
+	for (size_t i = 0; i < snap.linkCount; ++i) {
+		uint64_t* key = eamalloc(1, sizeof(uint64_t), 0);
+		*key = setupLinkKey(snap.links[i].sourceId, snap.links[i].targetId);
+		g_hash_table_insert(oldLinks, key, GSIZE_TO_POINTER(i+1));
+	}
+
+	ip4Addr* addrs = NULL;
+	bool* isClient = NULL;
+	nodeId* oldNext = NULL;
+	nodeId* newNext = NULL;
+	ip4Iter* addrIter = NULL;
+	GHashTable* usedAddrs = NULL;
+	routePlanner* oldRoutes = NULL;
+	routePlanner* newRoutes = NULL;
+	bool modified = false;
+
+	if (!namesValid) {
+		lprintf(LogError, "The record of the running network in '%s' is corrupt. Construct the network without --apply first.\n", snapshotFile);
+		err = 1;
+		goto cleanup;
+	}
+	DO_OR_GOTO(applyParse(gmlParams, &ctx), cleanup, err);
+	DO_OR_GOTO(applyValidate(&ctx), cleanup, err);
+
+	size_t nodeCount = ctx.nodeCount;
+	addrs = eamalloc(nodeCount, sizeof(ip4Addr), 0);
+	isClient = eamalloc(nodeCount, sizeof(bool), 0);
+	size_t liveNodes = 0, clientNodes = 0;
+	for (size_t id = 0; id < nodeCount; ++id) {
+		isClient[id] = (ctx.nodeStates[id].defined && ctx.nodeStates[id].node.client);
+		addrs[id] = (id < snap.nodeCount ? snap.nodes[id].addr : 0);
+		if (ctx.nodeStates[id].defined) ++liveNodes;
+		if (isClient[id]) ++clientNodes;
+	}
+
+	// From this point on, the snapshot no longer describes the network unless
+	// all of the changes succeed
+	modified = true;
+
+	// Remove hosts and links that no longer exist. Destroying a host also
+	// destroys all of its links.
+	size_t removedHosts = 0, removedLinks = 0;
+	for (size_t id = 0; id < snap.nodeCount; ++id) {
+		if (snap.nodes[id].name == NULL || applyNodePresent(&ctx, (nodeId)id)) continue;
+		lprintf(LogDebug, "Host '%s' (%lu) was removed from the topology\n", snap.nodes[id].name, id);
+		DO_OR_GOTO(workDestroyHost((nodeId)id), cleanup, err);
+		++removedHosts;
+	}
+	for (size_t i = 0; i < snap.linkCount; ++i) {
+		snapLink* link = &snap.links[i];
+		if (!applyNodePresent(&ctx, link->sourceId) || !applyNodePresent(&ctx, link->targetId)) continue;
+		uint64_t key = setupLinkKey(link->sourceId, link->targetId);
+		if (g_hash_table_lookup(ctx.linkIndices, &key) != NULL) continue;
+		DO_OR_GOTO(workRemoveLink(link->sourceId, link->targetId), cleanup, err);
+		++removedLinks;
+	}
+	DO_OR_GOTO(workJoin(false), cleanup, err);
+
+	// Update clients and create new hosts
+	bool rootLoaded = false;
+	size_t reshapedClients = 0, addedHosts = 0;
+	for (size_t id = 0; id < snap.nodeCount; ++id) {
+		if (!isClient[id] || applyNodesEqual(&snap.nodes[id].node, &ctx.nodeStates[id].node)) continue;
+		if (!rootLoaded) {
+			DO_OR_GOTO(workLoadRoot(snap.rootAddrs[0], snap.rootAddrs[1], snap.mtu, globalParams->rootIsInitNs), cleanup, err);
+			rootLoaded = true;
+		}
+		DO_OR_GOTO(workSetClientShaping((nodeId)id, &ctx.nodeStates[id].node), cleanup, err);
+		++reshapedClients;
+	}
+
+	if (nodeCount > snap.nodeCount) {
+		// New addresses are drawn from the same space as the original ones,
+		// skipping those that are still in use. Address 0 is reserved, so
+		// every key is a non-NULL pointer.
+		usedAddrs = g_hash_table_new(&g_direct_hash, &g_direct_equal);
+		g_hash_table_insert(usedAddrs, GUINT_TO_POINTER(snap.rootAddrs[0]), GUINT_TO_POINTER(snap.rootAddrs[0]));
+		g_hash_table_insert(usedAddrs, GUINT_TO_POINTER(snap.rootAddrs[1]), GUINT_TO_POINTER(snap.rootAddrs[1]));
+		for (size_t id = 0; id < snap.nodeCount; ++id) {
+			if (applyNodePresent(&ctx, (nodeId)id)) g_hash_table_insert(usedAddrs, GUINT_TO_POINTER(addrs[id]), GUINT_TO_POINTER(addrs[id]));
+		}
+
+		const size_t ReservedSubnetCount = 3;
+		ip4Subnet reservedSubnets[ReservedSubnetCount];
+		ip4GetSubnet("0.0.0.0/8", &reservedSubnets[0]);
+		ip4GetSubnet("127.0.0.0/8", &reservedSubnets[1]);
+		ip4GetSubnet("255.255.255.255/32", &reservedSubnets[2]);
+		const ip4Subnet* restrictedSubnets[snap.edgeSubnetCount+ReservedSubnetCount+1];
+		size_t subnets = 0;
+		for (size_t i = 0; i < ReservedSubnetCount; ++i) {
+			restrictedSubnets[subnets++] = &reservedSubnets[i];
+		}
+		for (size_t i = 0; i < snap.edgeSubnetCount; ++i) {
+			restrictedSubnets[subnets++] = &snap.edgeSubnets[i];
+		}
+		restrictedSubnets[subnets++] = NULL;
+		ip4Subnet everything;
+		ip4GetSubnet("0.0.0.0/0", &everything);
+		addrIter = ip4NewIter(&everything, false, restrictedSubnets);
+
+		macAddr noMacs[NEEDED_MACS_CLIENT];
+		memset(noMacs, 0, sizeof(noMacs));
+		for (size_t id = snap.nodeCount; id < nodeCount; ++id) {
+			do {
+				if (!ip4IterNext(addrIter)) {
+					lprintln(LogError, "Cannot add all of the new virtual hosts because the non-routable IPv4 address space has been exhausted.");
+					err = 1;
+					goto cleanup;
+				}
+				addrs[id] = ip4IterAddr(addrIter);
+			} while (g_hash_table_lookup(usedAddrs, GUINT_TO_POINTER(addrs[id])) != NULL);
+			DO_OR_GOTO(workAddHost((nodeId)id, addrs[id], noMacs, snap.mtu, &ctx.nodeStates[id].node), cleanup, err);
+			++addedHosts;
+		}
+	}
+	DO_OR_GOTO(setupEnsureScaling(liveNodes, clientNodes, ctx.linkCount, 1), cleanup, err);
+
+	// Add new links and update the shaping of existing ones
+	size_t addedLinks = 0, reshapedLinks = 0;
+	oldRoutes = rpNewPlanner((nodeId)nodeCount);
+	newRoutes = rpNewPlanner((nodeId)nodeCount);
+	if (oldRoutes == NULL || newRoutes == NULL) {
+		err = 1;
+		goto cleanup;
+	}
+	for (size_t i = 0; i < snap.linkCount; ++i) {
+		snapLink* link = &snap.links[i];
+		rpSetWeight(oldRoutes, link->sourceId, link->targetId, link->weight);
+		rpSetWeight(oldRoutes, link->targetId, link->sourceId, link->weight);
+	}
+	for (size_t i = 0; i < ctx.linkCount; ++i) {
+		snapLink* link = &ctx.links[i];
+		rpSetWeight(newRoutes, link->sourceId, link->targetId, link->weight);
+		rpSetWeight(newRoutes, link->targetId, link->sourceId, link->weight);
+
+		uint64_t key = setupLinkKey(link->sourceId, link->targetId);
+		gpointer oldIdxPtr = g_hash_table_lookup(oldLinks, &key);
+		size_t oldIdx = GPOINTER_TO_SIZE(oldIdxPtr);
+		if (oldIdx == 0) {
+			macAddr macs[NEEDED_MACS_LINK];
+			if (!macNextAddrs(&snap.nextMac, macs, NEEDED_MACS_LINK)) {
+				lprintln(LogError, "Ran out of MAC addresses when adding a new virtual ethernet connection.");
+				err = 1;
+				goto cleanup;
+			}
+			DO_OR_GOTO(workAddLink(link->sourceId, link->targetId, addrs[link->sourceId], addrs[link->targetId], macs, snap.mtu, &link->t), cleanup, err);
+			++addedLinks;
+		} else {
+			// The running link keeps its original orientation
+			snapLink* oldLink = &snap.links[oldIdx-1];
+			if (applyLinksEqual(&oldLink->t, &link->t)) continue;
+			DO_OR_GOTO(workSetLinkShaping(oldLink->sourceId, oldLink->targetId, &link->t), cleanup, err);
+			++reshapedLinks;
+		}
+	}
+	TopoLink defaultLink = { .latency = 0.0, .packetLoss = 0.0, .jitter = 0.0, .queueLen = 0 };
+	for (size_t id = 0; id < nodeCount; ++id) {
+		if (!isClient[id]) continue;
+		snapNode* oldNode = &snap.nodes[id];
+		applyNodeState* state = &ctx.nodeStates[id];
+		if (oldNode->hasSelfLink == state->hasSelfLink && (!state->hasSelfLink || applyLinksEqual(&oldNode->selfLink, &state->selfLink))) continue;
+		DO_OR_GOTO(workSetSelfLink((nodeId)id, state->hasSelfLink ? &state->selfLink : &defaultLink), cleanup, err);
+	}
+
+	lprintln(LogInfo, "Planning routes while waiting for topology changes to finish");
+	int oldPlanErr = rpPlanRoutesAsync(oldRoutes);
+	int newPlanErr = rpPlanRoutesAsync(newRoutes);
+	int joinErr = workJoin(false);
+	if (oldPlanErr == 0) oldPlanErr = rpWaitForRoutes(oldRoutes);
+	if (newPlanErr == 0) newPlanErr = rpWaitForRoutes(newRoutes);
+	if (joinErr != 0) err = joinErr;
+	else if (oldPlanErr != 0) err = oldPlanErr;
+	else err = newPlanErr;
+	if (err != 0) goto cleanup;
+
+	// Only install or remove the routes whose next hop changed
+	lprintln(LogInfo, "Updating static routing for the network");
+	size_t changedRoutes = 0, removedRoutes = 0;
+	oldNext = eamalloc(nodeCount, sizeof(nodeId), 0);
+	newNext = eamalloc(nodeCount, sizeof(nodeId), 0);
+	for (nodeId destId = 0; destId < nodeCount; ++destId) {
+		if (!isClient[destId]) continue;
+		applyNextHops(oldRoutes, isClient, nodeCount, destId, oldNext);
+		applyNextHops(newRoutes, isClient, nodeCount, destId, newNext);
+		const ip4Subnet* subnet = &snap.nodes[destId].clientSubnet;
+		for (nodeId id = 0; id < nodeCount; ++id) {
+			if (!applyNodePresent(&ctx, id) || oldNext[id] == newNext[id]) continue;
+			if (newNext[id] != INVALID_NODE_ID) {
+				DO_OR_GOTO(workModifyInternalRoute(id, newNext[id], addrs[newNext[id]], subnet, false), cleanup, err);
+				++changedRoutes;
+			} else {
+				DO_OR_GOTO(workModifyInternalRoute(id, oldNext[id], addrs[oldNext[id]], subnet, true), cleanup, err);
+				++removedRoutes;
+			}
+		}
+	}
+	DO_OR_GOTO(workJoin(false), cleanup, err);
+
+	lprintf(LogInfo, "Applied topology changes: %lu hosts added, %lu hosts removed, %lu clients reshaped, %lu links added, %lu links removed, %lu links reshaped, %lu routes changed, %lu routes removed\n", addedHosts, removedHosts, reshapedClients, addedLinks, removedLinks, reshapedLinks, changedRoutes, removedRoutes);
+
+	// Record the new state of the network
+	applyUpdateSnapshot(&ctx, &snap, addrs);
+	err = snapWrite(snapshotFile, &snap);
+
+cleanup:
+	if (err != 0 && modified) snapDelete(snapshotFile);
+	if (oldRoutes != NULL) rpFreePlan(oldRoutes);
+	if (newRoutes != NULL) rpFreePlan(newRoutes);
+	if (addrIter != NULL) ip4FreeIter(addrIter);
+	if (usedAddrs != NULL) g_hash_table_destroy(usedAddrs);
+	free(newNext);
+	free(oldNext);
+	free(isClient);
+	free(addrs);
+	g_hash_table_destroy(oldLinks);
+	applyFreeContext(&ctx);
+	snapFree(&snap);
+	free(snapshotFile);
 	return err;
 }
@@ -42,6 +42,10 @@ typedef struct {
 
 	char* remoteDev;       // The interface on the edge node
 	uint32_t remoteApps;   // The number of remote applications to configure
+
+	double capacity;       // Client bandwidth limit in Mbit/s, or 0 if unknown
+
+	uint32_t partition;    // Machine that the edge node is connected to
 } edgeNodeParams;
 
 typedef struct {
@@ -74,16 +78,100 @@ typedef struct {
 	} edgeNodeDefaults;
 
 	uint64_t softMemCap; // (Very) approximate memory use
+
+	// Maximum number of worker processes, or 0 for one per processor. If
+	// adaptiveWorkers is true, the number in use is tuned while each phase runs
+	// (see workSetWorkers). If workerThreads is true, the workers are threads
+	// instead of processes.
+	uint32_t workers;
+	bool adaptiveWorkers;
+	bool workerThreads;
+
+	// If compilePlanFile is not NULL, the orders needed to construct the
+	// network are written to this file instead of being executed. If
+	// replayPlanFile is not NULL, the network is constructed by executing the
+	// orders in a previously compiled plan instead of reading a topology.
+	const char* compilePlanFile;
+	const char* replayPlanFile;
+
+	// If true, the topology is processed and the resources and time needed to
+	// construct it are estimated, but the network is not modified
+	bool dryRun;
+
+	// If true, the running network is updated to match a new topology rather
+	// than being destroyed and reconstructed
+	bool applyChanges;
+
+	// If true, a setup that was interrupted before finishing is continued from
+	// the last checkpoint in its journal. The inputs must be unchanged.
+	bool resume;
+
+	// While a network is being constructed, progress through the setup phases
+	// is reported every progressInterval seconds. Reports are printed to
+	// stderr if printProgress is true, and written to statusFile in JSON
+	// format if it is not NULL.
+	bool printProgress;
+	double progressInterval;
+	const char* statusFile;
+
+	// If printOrderStats is true or orderStatsFile is not NULL, latency
+	// statistics for the setup operations in each phase are printed to stderr
+	// or written to the file in JSON format when the work module is cleaned up.
+	bool printOrderStats;
+	const char* orderStatsFile;
+
+	// If partitionCount is greater than 1, the network is split among that
+	// many machines, each running its own instance of the program with the
+	// same topology and configuration, and only the hosts assigned to machine
+	// "partition" are constructed here. partitionAddrs holds the underlay
+	// address of every machine, which terminates the tunnels that carry links
+	// between machines. Only edge nodes whose partition matches are used.
+	uint32_t partitionCount;
+	uint32_t partition;
+	ip4Addr* partitionAddrs;
 } setupParams;
 
+typedef enum {
+	EdgeAssignSequential, // Equal client counts in topology order
+	EdgeAssignBandwidth,  // Client bandwidth balanced by edge capacity
+} EdgeAssignment;
+
 typedef struct {
 	// Divisor to convert bandwidth rates in the GraphML file into Mbit/s.
 	float bandwidthDivisor;
 
 	bool twoPass; // True if the file contains node elements after edge elements
 
+	// If true, links are buffered until all nodes have been read, which allows
+	// node elements after edge elements without a second pass. Takes priority
+	// over twoPass.
+	bool bufferEdges;
+
 	const char* weightKey; // Data key used for static routing computation
 	const char* clientType; // Value for "type" identifying client nodes
+
+	// Strategy for distributing client nodes among the edge nodes. If
+	// colocateClients is true, clients that share their closest neighbor in
+	// the topology are kept on the same edge node where possible.
+	EdgeAssignment edgeAssignment;
+	bool colocateClients;
+
+	// If true, only the hosts and links used by at least one route between two
+	// client nodes are constructed. They are created after route planning
+	// rather than while the topology is read. Pruned networks cannot be
+	// updated with setupApplyGraphML.
+	bool pruneUnused;
+
+	// If true, chains of non-client nodes that each have exactly two neighbors
+	// are replaced by a single link with the combined shaping parameters of
+	// the chain. Collapsed networks cannot be updated with setupApplyGraphML.
+	bool collapseChains;
+
+	// If not 0, non-client nodes are packed into shared namespaces holding up
+	// to this many nodes each (at most MAX_HOSTS_PER_PACK), where every node
+	// is a VRF device with its own routing table. Packed networks cannot be
+	// updated with setupApplyGraphML.
+	uint32_t vrfPackSize;
 } setupGraphMLParams;
 
 // Initializes the setup system. setupConfigure must be called before any
@@ -91,17 +179,31 @@ typedef struct {
 // otherwise.
 int setupInit(void);
 
-// Configures the setup system with the given global parameters. Returns 0 on
-// success or an error code otherwise.
-int setupConfigure(const setupParams* params);
+// Configures the setup system with the given global parameters. gmlParams must
+// be the parameters that will be passed to setupGraphML, since they are part
+// of the inputs recorded by the setup journal. Returns 0 on success or an error
+// code otherwise.
+int setupConfigure(const setupParams* params, const setupGraphMLParams* gmlParams);
 
 // Releases all setup-related resources. The program must not call any other
 // setup calls after this.
 int setupCleanup(void);
 
-// Sets up a virtual network from a GraphML topology. Returns 0 on success or an
-// error code otherwise.
+// Sets up a virtual network from a GraphML topology. If the network is
+// partitioned, the hosts are created after route planning and divided among
+// the machines so that few routes cross between them. Returns 0 on success or
+// an error code otherwise.
 int setupGraphML(const setupGraphMLParams* gmlParams);
 
+// Updates a virtual network previously constructed by setupGraphML so that it
+// matches a new GraphML topology. Only the hosts, links, and routes that differ
+// are modified. The set of client nodes must not change. Returns 0 on success
+// or an error code otherwise.
+int setupApplyGraphML(const setupGraphMLParams* gmlParams);
+
+// Sets up a virtual network by replaying a setup plan previously compiled with
+// setupGraphML. Returns 0 on success or an error code otherwise.
+int setupReplayPlan(void);
+
 // Destroys a previous network. Returns 0 on success or an error code otherwise.
 int destroyNetwork(void);
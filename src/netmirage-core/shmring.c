@@ -0,0 +1,244 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#define _GNU_SOURCE // Needed for Linux-specific functionality
+
+#include "shmring.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Interval between checks for a vanished peer while blocked
+#define RING_POLL_NS 100000000L
+
+// Size of a cache line, used to keep the fields written by each side apart
+#define RING_LINE 64
+
+typedef struct {
+	volatile gint pos;     // Offset of the next byte to write or read
+	volatile gint seq;     // Futex word advanced whenever pos changes
+	volatile gint waiting; // Non-zero while this side sleeps on the other's seq
+} ringSide;
+
+struct shmRing {
+	ringSide producer;
+	char producerPad[RING_LINE - sizeof(ringSide)];
+	ringSide consumer;
+	char consumerPad[RING_LINE - sizeof(ringSide)];
+	volatile gint closed;
+	gint capacity;
+	size_t mapLen;
+	char data[];
+};
+
+shmRing* shmRingNew(size_t capacity) {
+	if (capacity < 2 || capacity > INT_MAX || (capacity & (capacity - 1)) != 0) return NULL;
+
+	size_t mapLen = sizeof(shmRing) + capacity;
+	void* mem = mmap(NULL, mapLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) return NULL;
+
+	// Anonymous mappings are zero-filled, so the positions start out empty
+	shmRing* ring = mem;
+	ring->capacity = (gint)capacity;
+	ring->mapLen = mapLen;
+	return ring;
+}
+
+void shmRingFree(shmRing* ring) {
+	munmap(ring, ring->mapLen);
+}
+
+static void ringWake(volatile gint* seq) {
+	syscall(SYS_futex, seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Advances our sequence number after moving our position, and wakes the other
+// side if it is sleeping on it
+static void ringNotify(ringSide* self, ringSide* other) {
+	g_atomic_int_inc(&self->seq);
+	if (g_atomic_int_get(&other->waiting) != 0) ringWake(&self->seq);
+}
+
+// Returns true if the process at the other end of fd has gone away
+static bool peerGone(int fd) {
+	struct pollfd pfd = { .fd = fd, .events = 0 };
+	if (poll(&pfd, 1, 0) < 0) return false;
+	return (pfd.revents & (POLLHUP | POLLERR | POLLNVAL)) != 0;
+}
+
+// Sleeps until the other side's sequence number moves from seen. The caller
+// must read seen before checking the ring state that led it to wait, which
+// guarantees that a concurrent notification is not missed. Returns false if the
+// ring was closed or the peer disappeared.
+static bool ringSleep(shmRing* ring, ringSide* self, ringSide* other, gint seen, int peerFd) {
+	g_atomic_int_set(&self->waiting, 1);
+	while (g_atomic_int_get(&other->seq) == seen) {
+		if (g_atomic_int_get(&ring->closed) != 0) break;
+
+		struct timespec timeout = { .tv_sec = 0, .tv_nsec = RING_POLL_NS };
+		long res = syscall(SYS_futex, &other->seq, FUTEX_WAIT, seen, &timeout, NULL, 0);
+		if (res != 0 && errno == ETIMEDOUT && peerGone(peerFd)) break;
+	}
+	g_atomic_int_set(&self->waiting, 0);
+	return g_atomic_int_get(&other->seq) != seen;
+}
+
+bool shmRingWrite(shmRing* ring, const void* data, size_t len, int peerFd) {
+	const char* p = data;
+	gint mask = ring->capacity - 1;
+	while (len > 0) {
+		if (g_atomic_int_get(&ring->closed) != 0) return false;
+
+		gint seen = g_atomic_int_get(&ring->consumer.seq);
+		gint head = g_atomic_int_get(&ring->producer.pos);
+		gint tail = g_atomic_int_get(&ring->consumer.pos);
+		size_t space = (size_t)((tail - head - 1) & mask);
+		if (space == 0) {
+			if (!ringSleep(ring, &ring->producer, &ring->consumer, seen, peerFd)) return false;
+			continue;
+		}
+
+		size_t contiguous = (size_t)(ring->capacity - head);
+		size_t chunk = (len < space ? len : space);
+		if (chunk > contiguous) chunk = contiguous;
+		memcpy(&ring->data[head], p, chunk);
+		g_atomic_int_set(&ring->producer.pos, (head + (gint)chunk) & mask);
+		ringNotify(&ring->producer, &ring->consumer);
+
+		p += chunk;
+		len -= chunk;
+	}
+	return true;
+}
+
+bool shmRingRead(shmRing* ring, void* data, size_t len, int peerFd) {
+	char* p = data;
+	gint mask = ring->capacity - 1;
+	while (len > 0) {
+		gint seen = g_atomic_int_get(&ring->producer.seq);
+		gint tail = g_atomic_int_get(&ring->consumer.pos);
+		gint head = g_atomic_int_get(&ring->producer.pos);
+		size_t avail = (size_t)((head - tail) & mask);
+		if (avail == 0) {
+			if (g_atomic_int_get(&ring->closed) != 0) return false;
+			if (!ringSleep(ring, &ring->consumer, &ring->producer, seen, peerFd)) {
+				// The producer may have published its last data just before
+				// leaving, so only give up once the ring is drained
+				if (g_atomic_int_get(&ring->producer.pos) == tail) return false;
+			}
+			continue;
+		}
+
+		size_t contiguous = (size_t)(ring->capacity - tail);
+		size_t chunk = (len < avail ? len : avail);
+		if (chunk > contiguous) chunk = contiguous;
+		memcpy(p, &ring->data[tail], chunk);
+		g_atomic_int_set(&ring->consumer.pos, (tail + (gint)chunk) & mask);
+		ringNotify(&ring->consumer, &ring->producer);
+
+		p += chunk;
+		len -= chunk;
+	}
+	return true;
+}
+
+void shmRingClose(shmRing* ring) {
+	g_atomic_int_set(&ring->closed, 1);
+	g_atomic_int_inc(&ring->producer.seq);
+	g_atomic_int_inc(&ring->consumer.seq);
+	ringWake(&ring->producer.seq);
+	ringWake(&ring->consumer.seq);
+}
+
+struct shmCounter {
+	volatile gint value;   // Futex word holding the count
+	volatile gint waiting; // Number of threads sleeping on value
+	volatile gint closed;
+};
+
+shmCounter* shmCounterNew(void) {
+	void* mem = mmap(NULL, sizeof(shmCounter), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) return NULL;
+	return mem;
+}
+
+void shmCounterFree(shmCounter* counter) {
+	munmap(counter, sizeof(shmCounter));
+}
+
+void shmCounterAdd(shmCounter* counter, uint32_t n) {
+	g_atomic_int_add(&counter->value, (gint)n);
+	if (g_atomic_int_get(&counter->waiting) != 0) ringWake(&counter->value);
+}
+
+uint32_t shmCounterGet(const shmCounter* counter) {
+	return (uint32_t)g_atomic_int_get(&counter->value);
+}
+
+static bool counterReached(gint value, uint64_t target) {
+	return (gint)((guint)value - (guint)target) >= 0;
+}
+
+bool shmCounterReached(const shmCounter* counter, uint64_t target) {
+	return counterReached(g_atomic_int_get(&counter->value), target);
+}
+
+bool shmCounterWait(shmCounter* counter, uint64_t target) {
+	g_atomic_int_inc(&counter->waiting);
+	while (true) {
+		gint value = g_atomic_int_get(&counter->value);
+		if (counterReached(value, target) || g_atomic_int_get(&counter->closed) != 0) break;
+
+		// The timeout covers a close that happens just before we sleep
+		struct timespec timeout = { .tv_sec = 0, .tv_nsec = RING_POLL_NS };
+		syscall(SYS_futex, &counter->value, FUTEX_WAIT, value, &timeout, NULL, 0);
+	}
+	g_atomic_int_add(&counter->waiting, -1);
+	return shmCounterReached(counter, target);
+}
+
+void shmCounterClose(shmCounter* counter) {
+	g_atomic_int_set(&counter->closed, 1);
+	ringWake(&counter->value);
+}
+
+bool shmCounterClosed(const shmCounter* counter) {
+	return g_atomic_int_get(&counter->closed) != 0;
+}
+
+void* shmBlockNew(size_t len) {
+	void* mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) return NULL;
+	return mem;
+}
+
+void shmBlockFree(void* block, size_t len) {
+	munmap(block, len);
+}
@@ -0,0 +1,97 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#pragma once
+
+// This module implements byte-stream rings in shared memory for passing data
+// between a single producer and a single consumer in different processes, as
+// well as counters that one process advances while others wait for them to
+// reach a target, and plain blocks of shared memory. Rings, counters, and
+// blocks must be created before forking so that both processes map the same
+// memory. Blocked threads sleep on futexes, so
+// transfers only require system calls when one side is waiting for the other.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct shmRing shmRing;
+
+// Maps a new ring that can buffer up to capacity-1 bytes. capacity must be a
+// power of two. Returns NULL if the shared memory could not be allocated.
+shmRing* shmRingNew(size_t capacity);
+
+// Unmaps a ring in the calling process
+void shmRingFree(shmRing* ring);
+
+// Copies len bytes into the ring, blocking while it is full. peerFd is a
+// descriptor connected to the consumer's process (e.g., a pipe) that is checked
+// for hangups while waiting, so that a crashed consumer does not leave the
+// producer blocked forever. Returns false if the ring was closed or the
+// consumer went away before all of the data was written.
+bool shmRingWrite(shmRing* ring, const void* data, size_t len, int peerFd);
+
+// Copies len bytes out of the ring, blocking until they are available. peerFd
+// has the same meaning as for shmRingWrite. Data written before the ring was
+// closed can still be read. Returns false if the ring was closed or the
+// producer went away before len bytes arrived.
+bool shmRingRead(shmRing* ring, void* data, size_t len, int peerFd);
+
+// Marks the ring as closed and wakes any process waiting on it. Either side may
+// close the ring.
+void shmRingClose(shmRing* ring);
+
+typedef struct shmCounter shmCounter;
+
+// Maps a new counter with the value 0. Returns NULL if the shared memory could
+// not be allocated.
+shmCounter* shmCounterNew(void);
+
+// Unmaps a counter in the calling process
+void shmCounterFree(shmCounter* counter);
+
+// Advances the counter by n and wakes any threads waiting on it. Only a single
+// thread may advance a counter.
+void shmCounterAdd(shmCounter* counter, uint32_t n);
+
+// Returns the current value of the counter. Values wrap around at 2^32.
+uint32_t shmCounterGet(const shmCounter* counter);
+
+// Returns true if the counter has reached target. Since values wrap around,
+// targets must be less than 2^31 ahead of or behind the current value.
+bool shmCounterReached(const shmCounter* counter, uint64_t target);
+
+// Blocks until the counter reaches target. Returns false if the counter was
+// closed before reaching it.
+bool shmCounterWait(shmCounter* counter, uint64_t target);
+
+// Marks the counter as closed (e.g., because the process that advances it has
+// exited) and wakes any threads waiting on it
+void shmCounterClose(shmCounter* counter);
+
+// Returns true if the counter was closed
+bool shmCounterClosed(const shmCounter* counter);
+
+// Maps len bytes of zero-filled memory without any synchronization, for data
+// whose accesses are ordered by other means (e.g., a counter). Returns NULL if
+// the shared memory could not be allocated.
+void* shmBlockNew(size_t len);
+
+// Unmaps a block in the calling process
+void shmBlockFree(void* block, size_t len);
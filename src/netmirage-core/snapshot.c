@@ -0,0 +1,218 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#define _POSIX_C_SOURCE 200809L // Require POSIX.1-2008
+
+#include "snapshot.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "ip.h"
+#include "log.h"
+#include "mem.h"
+#include "topology.h"
+
+// Snapshots are stored in the native byte order and structure layout. They
+// are only meant to be read by the same build that wrote them.
+static const char SnapMagic[8] = { 'N', 'M', 'T', 'O', 'P', 'O', '0', '1' };
+static const char* SnapFileName = "topology.snapshot";
+
+void snapInit(topoSnapshot* snap) {
+	snap->mtu = 0;
+	snap->rootAddrs[0] = 0;
+	snap->rootAddrs[1] = 0;
+	memset(snap->nextMac.octets, 0, MAC_ADDR_BYTES);
+	snap->edgeSubnets = NULL;
+	snap->edgeSubnetCount = 0;
+	flexBufferInit((void**)&snap->nodes, &snap->nodeCount, &snap->nodeCap);
+	flexBufferInit((void**)&snap->links, &snap->linkCount, &snap->linkCap);
+}
+
+void snapFree(topoSnapshot* snap) {
+	for (size_t i = 0; i < snap->nodeCount; ++i) {
+		free(snap->nodes[i].name);
+	}
+	free(snap->edgeSubnets);
+	snap->edgeSubnets = NULL;
+	flexBufferFree((void**)&snap->nodes, &snap->nodeCount, &snap->nodeCap);
+	flexBufferFree((void**)&snap->links, &snap->linkCount, &snap->linkCap);
+}
+
+char* snapPath(const char* ovsDir) {
+	char* path;
+	newSprintf(&path, "%s/%s", ovsDir, SnapFileName);
+	return path;
+}
+
+int snapInternNames(const topoSnapshot* snap, internTable* names) {
+	for (size_t id = 0; id < snap->nodeCount; ++id) {
+		// XML documents cannot contain control characters, so no node
+		// identifier in a topology can match the placeholder
+		char placeholder[24];
+		const char* name = snap->nodes[id].name;
+		if (name == NULL) {
+			snprintf(placeholder, sizeof(placeholder), "\001%lu", id);
+			name = placeholder;
+		}
+		bool added = false;
+		if (internAdd(names, name, &added) != id || !added) return 1;
+	}
+	return 0;
+}
+
+static bool snapWriteData(FILE* file, const void* data, size_t len) {
+	return len == 0 || fwrite(data, len, 1, file) == 1;
+}
+
+static bool snapReadData(FILE* file, void* data, size_t len) {
+	return len == 0 || fread(data, len, 1, file) == 1;
+}
+
+int snapWrite(const char* filename, const topoSnapshot* snap) {
+	char* tmpName;
+	newSprintf(&tmpName, "%s.tmp", filename);
+
+	errno = 0;
+	FILE* file = fopen(tmpName, "wbe");
+	if (file == NULL) {
+		int err = errno;
+		lprintf(LogError, "Could not open topology snapshot '%s' for writing: %s\n", tmpName, strerror(err));
+		free(tmpName);
+		return err;
+	}
+
+	uint64_t edgeSubnetCount = snap->edgeSubnetCount;
+	uint64_t nodeCount = snap->nodeCount;
+	uint64_t linkCount = snap->linkCount;
+
+	bool success = snapWriteData(file, SnapMagic, sizeof(SnapMagic)) &&
+			snapWriteData(file, &snap->mtu, sizeof(snap->mtu)) &&
+			snapWriteData(file, snap->rootAddrs, sizeof(snap->rootAddrs)) &&
+			snapWriteData(file, &snap->nextMac, sizeof(snap->nextMac)) &&
+			snapWriteData(file, &edgeSubnetCount, sizeof(edgeSubnetCount)) &&
+			snapWriteData(file, snap->edgeSubnets, snap->edgeSubnetCount * sizeof(ip4Subnet)) &&
+			snapWriteData(file, &nodeCount, sizeof(nodeCount));
+	for (size_t i = 0; success && i < snap->nodeCount; ++i) {
+		const snapNode* node = &snap->nodes[i];
+		uint32_t nameLen = (node->name == NULL ? 0 : (uint32_t)strlen(node->name));
+		snapNode stored = *node;
+		stored.name = NULL;
+		success = snapWriteData(file, &stored, sizeof(stored)) &&
+				snapWriteData(file, &nameLen, sizeof(nameLen)) &&
+				snapWriteData(file, node->name, nameLen);
+	}
+	success = success &&
+			snapWriteData(file, &linkCount, sizeof(linkCount)) &&
+			snapWriteData(file, snap->links, snap->linkCount * sizeof(snapLink));
+	if (fclose(file) != 0) success = false;
+
+	int err = 0;
+	if (!success) {
+		lprintf(LogError, "Failed to write topology snapshot '%s'\n", tmpName);
+		unlink(tmpName);
+		err = 1;
+	} else if (rename(tmpName, filename) != 0) {
+		err = errno;
+		lprintf(LogError, "Failed to replace topology snapshot '%s': %s\n", filename, strerror(err));
+		unlink(tmpName);
+	} else {
+		lprintf(LogDebug, "Wrote topology snapshot with %lu nodes and %lu links to '%s'\n", snap->nodeCount, snap->linkCount, filename);
+	}
+	free(tmpName);
+	return err;
+}
+
+int snapRead(const char* filename, topoSnapshot* snap) {
+	snapInit(snap);
+
+	errno = 0;
+	FILE* file = fopen(filename, "rbe");
+	if (file == NULL) {
+		int err = errno;
+		if (err != ENOENT) {
+			lprintf(LogError, "Could not open topology snapshot '%s': %s\n", filename, strerror(err));
+		}
+		return err;
+	}
+
+	char magic[sizeof(SnapMagic)];
+	uint64_t edgeSubnetCount, nodeCount, linkCount;
+	bool success = snapReadData(file, magic, sizeof(magic)) && memcmp(magic, SnapMagic, sizeof(SnapMagic)) == 0 &&
+			snapReadData(file, &snap->mtu, sizeof(snap->mtu)) &&
+			snapReadData(file, snap->rootAddrs, sizeof(snap->rootAddrs)) &&
+			snapReadData(file, &snap->nextMac, sizeof(snap->nextMac)) &&
+			snapReadData(file, &edgeSubnetCount, sizeof(edgeSubnetCount)) &&
+			edgeSubnetCount <= SIZE_MAX;
+	if (success) {
+		snap->edgeSubnetCount = (size_t)edgeSubnetCount;
+		snap->edgeSubnets = eamalloc(snap->edgeSubnetCount, sizeof(ip4Subnet), 0);
+		success = snapReadData(file, snap->edgeSubnets, snap->edgeSubnetCount * sizeof(ip4Subnet)) &&
+				snapReadData(file, &nodeCount, sizeof(nodeCount)) &&
+				nodeCount <= MAX_NODE_ID;
+	}
+	for (uint64_t i = 0; success && i < nodeCount; ++i) {
+		snapNode node;
+		uint32_t nameLen;
+		success = snapReadData(file, &node, sizeof(node)) && snapReadData(file, &nameLen, sizeof(nameLen));
+		if (!success) break;
+		node.name = NULL;
+		if (nameLen > 0) {
+			node.name = eamalloc(nameLen, 1, 1);
+			success = snapReadData(file, node.name, nameLen);
+			node.name[nameLen] = '\0';
+		}
+		flexBufferGrow((void**)&snap->nodes, snap->nodeCount, &snap->nodeCap, 1, sizeof(snapNode));
+		flexBufferAppend(snap->nodes, &snap->nodeCount, &node, 1, sizeof(snapNode));
+	}
+	success = success && snapReadData(file, &linkCount, sizeof(linkCount)) && linkCount <= SIZE_MAX;
+	if (success) {
+		flexBufferGrow((void**)&snap->links, 0, &snap->linkCap, (size_t)linkCount, sizeof(snapLink));
+		success = snapReadData(file, snap->links, (size_t)linkCount * sizeof(snapLink));
+		if (success) snap->linkCount = (size_t)linkCount;
+	}
+	for (size_t i = 0; success && i < snap->linkCount; ++i) {
+		if (snap->links[i].sourceId >= snap->nodeCount || snap->links[i].targetId >= snap->nodeCount) success = false;
+	}
+	fclose(file);
+
+	if (!success) {
+		lprintf(LogError, "Topology snapshot '%s' is corrupted or was written by an incompatible build of the program\n", filename);
+		snapFree(snap);
+		return 1;
+	}
+	lprintf(LogDebug, "Read topology snapshot with %lu nodes and %lu links from '%s'\n", snap->nodeCount, snap->linkCount, filename);
+	return 0;
+}
+
+int snapDelete(const char* filename) {
+	errno = 0;
+	if (unlink(filename) != 0 && errno != ENOENT) {
+		int err = errno;
+		lprintf(LogWarning, "Failed to delete topology snapshot '%s': %s\n", filename, strerror(err));
+		return err;
+	}
+	return 0;
+}
@@ -0,0 +1,101 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+#pragma once
+
+// This module stores a description of a network that has been applied to the
+// system. The description contains everything needed to compute the changes
+// required to transform the running network into a new topology.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "intern.h"
+#include "ip.h"
+#include "topology.h"
+#include "work.h"
+
+typedef struct {
+	char* name;         // Identifier in the source file, or NULL if removed
+	ip4Addr addr;
+	bool isClient;
+	ip4Subnet clientSubnet;
+	macAddr clientMacs[NEEDED_MACS_CLIENT];
+	TopoNode node;
+	bool hasSelfLink;
+	TopoLink selfLink;
+} snapNode;
+
+typedef struct {
+	nodeId sourceId;
+	nodeId targetId;
+	float weight;
+	TopoLink t;
+} snapLink;
+
+typedef struct {
+	int mtu;
+	ip4Addr rootAddrs[2];
+	macAddr nextMac; // Next unused MAC address
+
+	// Subnets that may not be used for internal interface addresses
+	ip4Subnet* edgeSubnets;
+	size_t edgeSubnetCount;
+
+	// Nodes are indexed by their identifiers. Identifiers of removed nodes are
+	// never reused, so these entries remain in the buffer with a NULL name.
+	snapNode* nodes;
+	size_t nodeCount;
+	size_t nodeCap;
+
+	snapLink* links;
+	size_t linkCount;
+	size_t linkCap;
+} topoSnapshot;
+
+// Initializes an empty snapshot.
+void snapInit(topoSnapshot* snap);
+
+// Releases all resources associated with a snapshot, including node names.
+void snapFree(topoSnapshot* snap);
+
+// Stores the path of the snapshot file for networks using the given Open
+// vSwitch directory in a newly allocated string.
+char* snapPath(const char* ovsDir);
+
+// Writes a snapshot to a file. The file is replaced atomically. Returns 0 on
+// success or an error code otherwise.
+int snapWrite(const char* filename, const topoSnapshot* snap);
+
+// Reads a snapshot from a file into an uninitialized snapshot structure.
+// Returns 0 on success, ENOENT if the file does not exist, or another error
+// code otherwise.
+int snapRead(const char* filename, topoSnapshot* snap);
+
+// Adds the node names in a snapshot to an empty intern table, so that the
+// identifier of each name is the identifier of its node. Removed nodes receive
+// placeholder names that cannot appear in a GraphML file, which reserves their
+// identifiers. Returns 0 on success, or 1 if the snapshot contains a duplicate
+// name or the table is full.
+int snapInternNames(const topoSnapshot* snap, internTable* names);
+
+// Deletes a snapshot file, if it exists. Returns 0 on success or an error code
+// otherwise.
+int snapDelete(const char* filename);
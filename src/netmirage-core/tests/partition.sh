@@ -0,0 +1,144 @@
+#!/bin/sh
+################################################################################
+# Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+# Foundation for Education, Science and Community Development.
+#
+# This file is part of NetMirage.
+#
+# NetMirage is free software: you can redistribute it and/or modify it under
+# the terms of the GNU Affero General Public License as published by the Free
+# Software Foundation, either version 3 of the License, or (at your option) any
+# later version.
+#
+# NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+# WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+# A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+# details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+################################################################################
+
+# Checks partitioned construction (--partition-hosts) on a single machine. Two
+# network namespaces stand in for the machines, and are joined by a virtual
+# Ethernet pair that carries the VXLAN tunnels. Each machine has an edge node in
+# its own namespace. The topology is a chain of hosts between the two clients,
+# so at least one link crosses the machines. The check passes if the edge nodes
+# can reach each other through the emulated network.
+#
+# The check must be run as root, requires Open vSwitch, and uses the binaries
+# in bin/ unless NETMIRAGE_BIN names another directory. It is not part of
+# "scons check" because it modifies the system's network configuration.
+
+set -e
+
+BIN=${NETMIRAGE_BIN:-$(cd "$(dirname "$0")/../../.." && pwd)/bin}
+TAG=nmcheck
+WORK=$(mktemp -d /tmp/netmirage-partition-XXXXXX)
+
+fail() {
+	echo "Partition check failed: $1" >&2
+	for log in "$WORK"/*.log; do
+		[ -f "$log" ] && { echo "--- $log" >&2; cat "$log" >&2; }
+	done
+	exit 1
+}
+
+cleanup() {
+	set +e
+	for m in 0 1; do
+		if [ -f "$WORK/edge$m.started" ]; then
+			ip netns exec $TAG-e$m "$BIN/netmirage-edge" -r $(cat "$WORK/edge$m.args") >/dev/null 2>&1
+		fi
+		ip netns exec $TAG-m$m "$BIN/netmirage-core" -d -p $TAG$m- --ovs-dir "$WORK/ovs$m" >/dev/null 2>&1
+		ip netns del $TAG-e$m 2>/dev/null
+		ip netns del $TAG-m$m 2>/dev/null
+	done
+	rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+[ "$(id -u)" -eq 0 ] || { echo "The partition check must be run as root" >&2; exit 1; }
+[ -x "$BIN/netmirage-core" ] && [ -x "$BIN/netmirage-edge" ] || { echo "Build the programs first, or set NETMIRAGE_BIN" >&2; exit 1; }
+
+# Machines m0 and m1 share the underlay 192.168.249.0/24. The underlay MTU leaves
+# room for the VXLAN headers around the emulated MTU of 1500 bytes.
+for m in 0 1; do
+	ip netns add $TAG-m$m
+	ip netns add $TAG-e$m
+	ip -n $TAG-m$m link set lo up
+	ip -n $TAG-e$m link set lo up
+done
+ip link add $TAG-u0 netns $TAG-m0 mtu 1600 type veth peer name $TAG-u1 netns $TAG-m1 mtu 1600
+for m in 0 1; do
+	ip -n $TAG-m$m addr add 192.168.249.$((m+1))/24 dev $TAG-u$m
+	ip -n $TAG-m$m link set $TAG-u$m up
+
+	# Edge node e<m> is connected to machine m<m>
+	ip link add edge netns $TAG-m$m type veth peer name eth0 netns $TAG-e$m
+	ip -n $TAG-m$m addr add 10.97.$m.1/24 dev edge
+	ip -n $TAG-m$m link set edge up
+	ip -n $TAG-e$m addr add 10.97.$m.2/24 dev eth0
+	ip -n $TAG-e$m link set eth0 up
+done
+mac0=$(ip -n $TAG-e0 -o link show eth0 | sed -n 's/.*link\/ether \([0-9a-f:]*\).*/\1/p')
+mac1=$(ip -n $TAG-e1 -o link show eth0 | sed -n 's/.*link\/ether \([0-9a-f:]*\).*/\1/p')
+
+cat > "$WORK/topology.graphml" <<'GRAPH'
+<?xml version="1.0" encoding="UTF-8"?>
+<graphml xmlns="http://graphml.graphdrawing.org/xmlns">
+<key attr.name="type" attr.type="string" for="node" id="t"/>
+<key attr.name="latency" attr.type="double" for="edge" id="l"/>
+<graph edgedefault="undirected">
+<node id="c0"><data key="t">client</data></node>
+<node id="r0"/>
+<node id="r1"/>
+<node id="r2"/>
+<node id="c1"><data key="t">client</data></node>
+<edge source="c0" target="r0"><data key="l">1.0</data></edge>
+<edge source="r0" target="r1"><data key="l">1.0</data></edge>
+<edge source="r1" target="r2"><data key="l">1.0</data></edge>
+<edge source="r2" target="c1"><data key="l">1.0</data></edge>
+</graph>
+</graphml>
+GRAPH
+
+# Both instances use the same topology and edge nodes; only --partition and the
+# names of their local resources differ
+cd "$WORK"
+for m in 0 1; do
+	edges=""
+	for e in 0 1; do
+		edge="10.97.$e.2,vsubnet=10.10$e.0.0/24,rdev=eth0,rapps=2,partition=$e"
+		[ $e -eq $m ] && edge="$edge,iface=edge,mac=$(eval echo \$mac$e)"
+		edges="$edges -e $edge"
+	done
+	ip netns exec $TAG-m$m "$BIN/netmirage-core" -f "$WORK/topology.graphml" --client-node client \
+		$edges -I 10.97.$m.1 -E "$WORK/edge$m.out" -p $TAG$m- --ovs-dir "$WORK/ovs$m" \
+		--partition-hosts 192.168.249.1,192.168.249.2 --partition $m >"$WORK/core$m.log" 2>&1 \
+		|| fail "netmirage-core did not construct partition $m"
+	sed -n 's/^netmirage-edge //p' "$WORK/edge$m.out" > "$WORK/edge$m.args"
+	[ -s "$WORK/edge$m.args" ] || fail "no edge node command was written for partition $m"
+done
+
+# Cut links must have become VXLAN tunnels
+tunnels=0
+for ns in $(ip netns list | sed -n "s/^\($TAG[01]-[^ ]*\).*/\1/p"); do
+	count=$(ip -n "$ns" -o -d link show type vxlan | wc -l)
+	tunnels=$((tunnels + count))
+done
+[ $tunnels -ge 2 ] || fail "expected a tunnel end on each machine, found $tunnels"
+
+for m in 0 1; do
+	touch "$WORK/edge$m.started"
+	ip netns exec $TAG-e$m "$BIN/netmirage-edge" $(cat "$WORK/edge$m.args") >"$WORK/edge$m.log" 2>&1 \
+		|| fail "netmirage-edge did not configure edge node $m"
+done
+
+src=$(ip -n $TAG-e0 -o -4 addr show dev eth0 | sed -n 's/.* inet \(10\.100\.0\.[0-9]*\).*/\1/p' | head -n 1)
+dst=$(ip -n $TAG-e1 -o -4 addr show dev eth0 | sed -n 's/.* inet \(10\.101\.0\.[0-9]*\).*/\1/p' | head -n 1)
+[ -n "$src" ] && [ -n "$dst" ] || fail "the edge nodes were not given application addresses"
+ip netns exec $TAG-e0 ping -c 3 -W 2 -I "$src" "$dst" >"$WORK/ping.log" 2>&1 \
+	|| fail "$dst is not reachable from $src across the partitions"
+
+echo "Partition checks passed ($tunnels tunnel ends)"
@@ -0,0 +1,180 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+// Checks that the node names recorded in topology snapshots remain usable by
+// --apply after hosts have been removed. Each update runs the snapshot preload,
+// topology parsing, and snapshot bookkeeping of setupApplyGraphML on a real
+// GraphML file; only the orders that change the running network are skipped.
+// The apply code is internal to the setup module, so its source is included
+// directly.
+
+#include "setup.c"
+
+#include <stdio.h>
+
+#include "check.h"
+
+static char snapshotPath[64];
+static char topologyPath[64];
+
+static setupParams params;
+static setupGraphMLParams gmlParams;
+
+// Adds a node to a snapshot, as setupGraphML records it
+static void addSnapNode(topoSnapshot* snap, const char* name, bool client) {
+	snapNode node;
+	memset(&node, 0, sizeof(node));
+	node.name = strdup(name);
+	node.addr = (ip4Addr)(0x0a000001 + snap->nodeCount);
+	node.isClient = client;
+	node.node.client = client;
+	flexBufferGrow((void**)&snap->nodes, snap->nodeCount, &snap->nodeCap, 1, sizeof(snapNode));
+	flexBufferAppend(snap->nodes, &snap->nodeCount, &node, 1, sizeof(snapNode));
+}
+
+static void addSnapLink(topoSnapshot* snap, nodeId sourceId, nodeId targetId) {
+	snapLink link;
+	memset(&link, 0, sizeof(link));
+	link.sourceId = sourceId;
+	link.targetId = targetId;
+	link.weight = 1.f;
+	flexBufferGrow((void**)&snap->links, snap->linkCount, &snap->linkCap, 1, sizeof(snapLink));
+	flexBufferAppend(snap->links, &snap->linkCount, &link, 1, sizeof(snapLink));
+}
+
+// Writes a GraphML topology in which the clients "c1" and "c2" are connected
+// by a chain of routers. "routers" is a NULL-terminated list of names.
+static void writeTopology(const char* routers[]) {
+	FILE* file = fopen(topologyPath, "w");
+	CHECK(file != NULL);
+	if (file == NULL) return;
+	fprintf(file, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<graphml xmlns=\"http://graphml.graphdrawing.org/xmlns\">\n");
+	fprintf(file, "<key attr.name=\"type\" attr.type=\"string\" for=\"node\" id=\"t\"/>\n<key attr.name=\"latency\" attr.type=\"double\" for=\"edge\" id=\"l\"/>\n");
+	fprintf(file, "<graph edgedefault=\"undirected\">\n");
+	fprintf(file, "<node id=\"c1\"><data key=\"t\">client</data></node>\n<node id=\"c2\"><data key=\"t\">client</data></node>\n");
+	for (size_t i = 0; routers[i] != NULL; ++i) fprintf(file, "<node id=\"%s\"/>\n", routers[i]);
+	const char* prev = "c1";
+	for (size_t i = 0; routers[i] != NULL; ++i) {
+		fprintf(file, "<edge source=\"%s\" target=\"%s\"><data key=\"l\">1.0</data></edge>\n", prev, routers[i]);
+		prev = routers[i];
+	}
+	fprintf(file, "<edge source=\"%s\" target=\"c2\"><data key=\"l\">1.0</data></edge>\n</graph>\n</graphml>\n", prev);
+	fclose(file);
+}
+
+// Applies a topology to the network recorded in the snapshot file, in the same
+// way as setupApplyGraphML, and stores the result for the next invocation
+static void applyTopology(const char* routers[]) {
+	writeTopology(routers);
+
+	topoSnapshot snap;
+	CHECK(snapRead(snapshotPath, &snap) == 0);
+	applyContext ctx;
+	CHECK(applyInitContext(&ctx, &snap));
+	CHECK(applyParse(&gmlParams, &ctx) == 0);
+	CHECK(applyValidate(&ctx) == 0);
+
+	ip4Addr* addrs = eamalloc(ctx.nodeCount, sizeof(ip4Addr), 0);
+	for (size_t id = 0; id < ctx.nodeCount; ++id) {
+		addrs[id] = (id < snap.nodeCount ? snap.nodes[id].addr : (ip4Addr)(0x0a000001 + id));
+	}
+	applyUpdateSnapshot(&ctx, &snap, addrs);
+	CHECK(snapWrite(snapshotPath, &snap) == 0);
+
+	free(addrs);
+	applyFreeContext(&ctx);
+	snapFree(&snap);
+}
+
+// Returns the identifier that the next update would give to a name
+static uint32_t recordedId(const char* name) {
+	topoSnapshot snap;
+	CHECK(snapRead(snapshotPath, &snap) == 0);
+	applyContext ctx;
+	CHECK(applyInitContext(&ctx, &snap));
+	uint32_t id = internFind(ctx.names, name);
+	applyFreeContext(&ctx);
+	snapFree(&snap);
+	return id;
+}
+
+int main(void) {
+	char dir[] = "/tmp/netmirage-check-XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(snapshotPath, sizeof(snapshotPath), "%s/topology.snapshot", dir);
+	snprintf(topologyPath, sizeof(topologyPath), "%s/topology.graphml", dir);
+	logSetStream(stderr);
+	logSetThreshold(LogWarning);
+
+	params.srcFile = topologyPath;
+	params.softMemCap = 64LL * 1024LL * 1024LL;
+	globalParams = &params;
+	gmlParams.weightKey = "latency";
+	gmlParams.clientType = "client";
+	gmlParams.twoPass = false;
+	gmlParams.bufferEdges = false;
+
+	// The network as constructed: c1 - a - b - c2
+	topoSnapshot snap;
+	snapInit(&snap);
+	addSnapNode(&snap, "c1", true);
+	addSnapNode(&snap, "c2", true);
+	addSnapNode(&snap, "a", false);
+	addSnapNode(&snap, "b", false);
+	addSnapLink(&snap, 0, 2);
+	addSnapLink(&snap, 2, 3);
+	addSnapLink(&snap, 3, 1);
+	CHECK(snapWrite(snapshotPath, &snap) == 0);
+	snapFree(&snap);
+
+	// Removing a host leaves its identifier reserved
+	applyTopology((const char*[]){ "a", NULL });
+	CHECK(snapRead(snapshotPath, &snap) == 0);
+	CHECK(snap.nodeCount == 4 && snap.nodes[3].name == NULL && snap.linkCount == 2);
+	snapFree(&snap);
+
+	// Later updates must still accept the snapshot. A host that reuses the
+	// removed name receives a new identifier.
+	applyTopology((const char*[]){ "a", "d", NULL });
+	applyTopology((const char*[]){ "b", "d", NULL });
+	CHECK(recordedId("a") == INTERN_NONE);
+	CHECK(recordedId("c2") == 1);
+	CHECK(recordedId("d") == 4);
+	CHECK(recordedId("b") == 5);
+
+	// Duplicate names still indicate a corrupt snapshot
+	CHECK(snapRead(snapshotPath, &snap) == 0);
+	free(snap.nodes[4].name);
+	snap.nodes[4].name = strdup("c2");
+	applyContext ctx;
+	CHECK(!applyInitContext(&ctx, &snap));
+	applyFreeContext(&ctx);
+	snapFree(&snap);
+
+	unlink(snapshotPath);
+	unlink(topologyPath);
+	rmdir(dir);
+
+	if (failed) return 1;
+	printf("Snapshot name checks passed\n");
+	return 0;
+}
@@ -0,0 +1,145 @@
+/*******************************************************************************
+ * Copyright © 2018 Nik Unger, Ian Goldberg, Qatar University, and the Qatar
+ * Foundation for Education, Science and Community Development.
+ *
+ * This file is part of NetMirage.
+ *
+ * NetMirage is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * NetMirage is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with NetMirage. If not, see <http://www.gnu.org/licenses/>.
+ *******************************************************************************/
+
+// Checks that every kind of work order survives the compact wire encoding used
+// between the main process and the workers. The codec is internal to the work
+// module, so its source is included directly.
+
+#include "work.c"
+
+#include <stdio.h>
+
+#include "check.h"
+
+static char NsPrefix[] = "nm-";
+static char OvsDir[] = "/tmp/netmirage-ovs";
+static char OvsSchema[] = "/usr/share/openvswitch/vswitch.ovsschema";
+
+// Creates an order whose parameters are filled with a pattern. Some orders end
+// with zero bytes so that trimming is exercised, and the key fields of
+// consecutive orders differ by both small and large amounts.
+static WorkerOrder* makeOrder(WorkerOrderCode code) {
+	WorkerOrder* order = newOrder(code);
+	order->tag = (code % 3 == 0 ? 0 : 1000u * (uint32_t)code);
+	order->handOff = (code == WorkerAddLink || code == WorkerSetLinkShaping);
+
+	void* paramsPtr;
+	size_t paramsLen;
+	CHECK(getOrderParams(order, &paramsPtr, &paramsLen));
+	unsigned char* params = paramsPtr;
+	for (size_t i = 0; i < paramsLen; ++i) {
+		params[i] = (unsigned char)(i * 37 + (size_t)code * 11 + 1);
+	}
+	if (code % 2 == 1 && paramsLen > 8) memset(&params[paramsLen - 8], 0, 8);
+
+	if (code == WorkerConfigure) {
+		order->configure.nsPrefixLen = strlen(NsPrefix);
+		order->configure.ovsDirLen = strlen(OvsDir);
+		order->configure.ovsSchemaLen = strlen(OvsSchema);
+		order->configure.nsPrefix = NsPrefix;
+		order->configure.ovsDir = OvsDir;
+		order->configure.ovsSchema = OvsSchema;
+	} else if (code == WorkerGetEdgeRemoteMacs) {
+		order->getEdgeRemoteMacs.count = 2;
+		order->getEdgeRemoteMacs.queries = eacalloc(2, sizeof(EdgeMacQuery), 0);
+		strcpy(order->getEdgeRemoteMacs.queries[0].intfName, "eth0");
+		order->getEdgeRemoteMacs.queries[0].ip = 0x0A000001;
+		strcpy(order->getEdgeRemoteMacs.queries[1].intfName, "eth1");
+		order->getEdgeRemoteMacs.queries[1].ip = 0x0A000002;
+	}
+	return order;
+}
+
+static void checkDecoded(WorkerOrder* sent, WorkerOrder* received) {
+	CHECK(received->code == sent->code);
+	CHECK(received->handOff == sent->handOff);
+	CHECK(received->tag == sent->tag);
+
+	// The buffers of these orders are compared separately, since their
+	// parameters contain pointers
+	if (sent->code == WorkerConfigure) {
+		CHECK(received->configure.logThreshold == sent->configure.logThreshold);
+		CHECK(received->configure.logColorize == sent->configure.logColorize);
+		CHECK(received->configure.softMemCap == sent->configure.softMemCap);
+		CHECK(strcmp(received->configure.nsPrefix, NsPrefix) == 0);
+		CHECK(strcmp(received->configure.ovsDir, OvsDir) == 0);
+		CHECK(strcmp(received->configure.ovsSchema, OvsSchema) == 0);
+		return;
+	}
+	if (sent->code == WorkerGetEdgeRemoteMacs) {
+		CHECK(received->getEdgeRemoteMacs.count == sent->getEdgeRemoteMacs.count);
+		CHECK(memcmp(received->getEdgeRemoteMacs.queries, sent->getEdgeRemoteMacs.queries, 2 * sizeof(EdgeMacQuery)) == 0);
+		return;
+	}
+
+	void* sentParams;
+	void* receivedParams;
+	size_t sentLen, receivedLen;
+	CHECK(getOrderParams(sent, &sentParams, &sentLen));
+	CHECK(getOrderParams(received, &receivedParams, &receivedLen));
+	CHECK(sentLen == receivedLen);
+	if (sentLen == receivedLen && sentLen > 0 && memcmp(sentParams, receivedParams, sentLen) != 0) {
+		fprintf(stderr, "Parameters of order code %d (%s) changed in transit\n", sent->code, OrderCodeNames[sent->code]);
+		failed = true;
+	}
+}
+
+int main(void) {
+	WorkerOrder* orders[ORDER_CODE_COUNT];
+	char* wire;
+	size_t wireLen, wireCap;
+	flexBufferInit((void**)&wire, &wireLen, &wireCap);
+
+	// All of the orders are encoded as a single batch
+	uint32_t prevKeys[WireKeyKinds] = { 0 };
+	for (size_t code = 0; code < ORDER_CODE_COUNT; ++code) {
+		orders[code] = makeOrder((WorkerOrderCode)code);
+		encodeOrder(orders[code], prevKeys, &wire, &wireLen, &wireCap);
+	}
+	size_t encodedLen = wireLen;
+
+	workChild.batch = wire;
+	workChild.batchLen = wireLen;
+	workChild.batchCap = wireCap;
+	workChild.batchPos = 0;
+	workChild.batchCount = (uint32_t)ORDER_CODE_COUNT;
+	memset(workChild.batchKeys, 0, sizeof(workChild.batchKeys));
+	for (size_t code = 0; code < ORDER_CODE_COUNT; ++code) {
+		WorkerOrder received;
+		if (!readOrder(&received)) {
+			fprintf(stderr, "Could not decode order code %lu (%s)\n", code, OrderCodeNames[code]);
+			failed = true;
+			break;
+		}
+		checkDecoded(orders[code], &received);
+		freeOrderContents(&received);
+	}
+	CHECK(failed || workChild.batchPos == workChild.batchLen);
+
+	for (size_t code = 0; code < ORDER_CODE_COUNT; ++code) {
+		if (code == WorkerGetEdgeRemoteMacs) free(orders[code]->getEdgeRemoteMacs.queries);
+		free(orders[code]);
+	}
+	flexBufferFree((void**)&wire, &wireLen, &wireCap);
+
+	if (failed) return 1;
+	printf("Order codec checks passed (%lu orders in %lu bytes instead of %lu)\n", (size_t)ORDER_CODE_COUNT, encodedLen, ORDER_CODE_COUNT * sizeof(WorkerOrder));
+	return 0;
+}
@@ -21,20 +21,26 @@
 
 #include "work.h"
 
+#include <errno.h>
+#include <inttypes.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <glib.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "ip.h"
+#include "latency.h"
 #include "log.h"
 #include "mem.h"
 #include "net.h"
+#include "shmring.h"
 #include "topology.h"
 #include "worker.h"
 
@@ -42,57 +48,158 @@
  * 1) Enable parallel execution of kernel commands
  * 2) Isolate elevated privileges from the main program I/O
  * The primary constraint informing the design is that many of the kernel calls
- * performed by the functions in net.h operate on the process' active network
- * namespace. Since there can only be one active network namespace per PID, this
- * means that achieving parallelization requires a process pool rather than a
- * thread pool.
+ * performed by the functions in net.h operate on the active network namespace.
+ * The active namespace belongs to a thread, so each worker must switch
+ * namespaces on its own. Workers are either child processes (the default) or
+ * threads of the main process (see workSetWorkers). Only the former isolate
+ * privileges, since worker threads require the main process to keep them.
  *
  * Given these objectives and constraint, we use the following architecture:
- * - An unprivileged main process
  * - Calls to the work module generate work order structures defining the call
+ * - Orders that modify a host are queued for the worker that owns the host's
+ *   namespace, so that each worker only keeps contexts for its own share of
+ *   the namespaces. Orders that involve two hosts are divided between the
+ *   owners of both (see dispatchOrder).
+ * - An order that uses a namespace that an unfinished order in another worker
+ *   also used is held back until that order is executed, so callers only need
+ *   global joins for unrelated dependencies
+ * - Each worker counts the orders that it has executed in shared memory. Both
+ *   dependencies and joins wait for these counters to reach the number of
+ *   orders sent to the workers, so idle workers are not disturbed by joins.
+ * - Workers call the appropriate kernel interfaces to fulfill orders
+ *
+ * For worker processes:
  * - A custom thread pool running in the main process receives work orders
  * - Each order thread in the main process serializes incoming orders and sends
- *   them through a pipe to the associated worker process
- * - Worker processes call the appropriate kernel interfaces to fulfill orders
+ *   them in batches through a shared memory ring to the associated worker
+ *   process
  * - Worker processes send serialized responses or log messages back through a
- *   reverse pipe to the main process, as necessary
+ *   reverse ring to the main process, as necessary
  * - In the main process, each worker has an associated response thread that
- *   receives responses and relays them to the main thread
+ *   receives responses and relays them to the main thread. Queries are tagged
+ *   so that the main thread can have several outstanding at once, and their
+ *   responses are matched to them regardless of the order of arrival.
+ *
+ * For worker threads:
+ * - Each thread takes orders directly from its queue and waits for their
+ *   dependencies itself, so there are no send or response threads
+ * - Orders are not serialized (broadcast orders are copied for each thread),
+ *   and responses are handled by the worker thread as if they had been
+ *   received from a worker process
+ * - Log messages are written by the worker threads directly
+ *
+ * The rings are mapped before forking the workers and avoid system calls while
+ * both sides are busy. Each worker process is also connected to the main
+ * process by a pair of pipes. If the rings cannot be allocated, the serialized
+ * data is sent through the pipes instead; otherwise, the pipes only serve to
+ * detect when the process on the other side has exited.
  *
  * All of the state associated with a worker (e.g, pipe descriptors and thread
  * pointers) is stored in a "workplace". There are two different perspectives of
  * a workplace: the struct stored by the main process, and the one stored by the
- * child process. This module defines the management of these states and the
- * communication mechanism. The "worker" module defines the actual procedures
- * performed by the child processes.
+ * child process. Worker threads only use the former. This module defines the
+ * management of these states and the communication mechanism. The "worker"
+ * module defines the actual procedures performed by the workers.
  */
 
 typedef enum {
-	WorkerPing,
 	WorkerTerminate,
 	WorkerConfigure,
-	WorkerGetEdgeRemoteMac,
+	WorkerGetEdgeRemoteMacs,
 	WorkerGetEdgeLocalMac,
 	WorkerGetInterfaceMtu,
 	WorkerMtuSupported,
+	WorkerBenchmark,
 	WorkerAddRoot,
 	WorkerAddEdgeInterface,
 	WorkerAddHost,
+	WorkerSetClientShaping,
 	WorkerSetSelfLink,
 	WorkerEnsureSystemScaling,
 	WorkerAddLink,
+	WorkerSetLinkShaping,
+	WorkerRemoveLink,
 	WorkerAddInternalRoutes,
+	WorkerModifyInternalRoute,
 	WorkerAddClientRoutes,
 	WorkerAddEdgeRoutes,
+	WorkerDestroyHost,
 	WorkerDestroyHosts,
+	WorkerSetRecovery,
+	WorkerCheckHost,
+	WorkerCheckLink,
+	WorkerAddHostPack,
+	WorkerAddTunnel,
+	WorkerAddLinkPeer,
+	WorkerOrderCodes,
 } WorkerOrderCode;
+#define ORDER_CODE_COUNT ((size_t)WorkerOrderCodes)
+
+// Names of the order codes in latency statistics. New codes must be named here
+// as well.
+static const char* OrderCodeNames[] = {
+	"terminate", "configure", "getEdgeRemoteMacs", "getEdgeLocalMac",
+	"getInterfaceMtu", "mtuSupported", "benchmark", "addRoot",
+	"addEdgeInterface", "addHost", "setClientShaping", "setSelfLink",
+	"ensureSystemScaling", "addLink", "setLinkShaping", "removeLink",
+	"addInternalRoutes", "modifyInternalRoute", "addClientRoutes",
+	"addEdgeRoutes", "destroyHost", "destroyHosts", "setRecovery", "checkHost",
+	"checkLink", "addHostPack", "addTunnel", "addLinkPeer",
+};
+G_STATIC_ASSERT(G_N_ELEMENTS(OrderCodeNames) == WorkerOrderCodes);
+
+// An edge node whose MAC address is requested by WorkerGetEdgeRemoteMacs
+typedef struct {
+	char intfName[INTERFACE_BUF_LEN];
+	ip4Addr ip;
+} EdgeMacQuery;
+
+// Identifies an order by the workplace that it was queued for and its position
+// in that workplace's sequence of orders (starting at 1)
+typedef struct {
+	gint wp;
+	uint64_t seq;
+} OrderToken;
+
+// Maximum number of orders in other workplaces that an order can depend on
+#define ORDER_MAX_DEPS 2
+
+// Keys for the resources tracked in workMain.lastOrders. Dedicated namespaces
+// are identified by their node identifiers.
+#define RESOURCE_PACK (UINT64_C(1) << 32) // Combined with the pack number
+#define RESOURCE_OVS (UINT64_C(2) << 32)  // The Open vSwitch database
 
 typedef struct {
 	WorkerOrderCode code;
+
+	// True for the extra orders created when an order is divided between
+	// workplaces. These are not counted as dispatched.
+	bool secondary;
+
+	// For WorkerAddLink, true if the target's side of the link is configured
+	// by a separate WorkerAddLinkPeer order. For WorkerSetLinkShaping, true if
+	// only the source's end is shaped, since the target's end is shaped by a
+	// copy of the order with the hosts swapped.
+	bool handOff;
+
+	// Orders in other workplaces that must be executed before this one is sent.
+	// This is only used by the main process.
+	OrderToken after[ORDER_MAX_DEPS];
+	uint32_t afterCount;
+
+	// For queries, identifies the future that receives the responses. It is
+	// echoed in every response to the order.
+	uint32_t tag;
+
+	// Time when the main process queued the order. This is not sent to the
+	// workers.
+	gint64 queuedAt;
+
 	union {
 		struct {
 			LogLevel logThreshold;
 			bool logColorize;
+			bool orderStats;
 			size_t nsPrefixLen;
 			size_t ovsDirLen;
 			size_t ovsSchemaLen;
@@ -102,9 +209,9 @@ typedef struct {
 			char* ovsSchema;
 		} configure;
 		struct {
-			char intfName[INTERFACE_BUF_LEN];
-			ip4Addr ip;
-		} getEdgeRemoteMac;
+			size_t count;
+			EdgeMacQuery* queries;
+		} getEdgeRemoteMacs;
 		struct {
 			char intfName[INTERFACE_BUF_LEN];
 		} getEdgeLocalMac;
@@ -114,6 +221,9 @@ typedef struct {
 		struct {
 			int mtu;
 		} mtuSupported;
+		struct {
+			uint32_t samples;
+		} benchmark;
 		struct {
 			ip4Addr addrSelf;
 			ip4Addr addrOther;
@@ -121,39 +231,79 @@ typedef struct {
 			bool useInitNs;
 			bool existing;
 		} addRoot;
+		struct {
+			uint32_t pack;
+		} addHostPack;
 		struct {
 			nodeId id;
+			workHostLoc loc;
 			ip4Addr ip;
 			macAddr macs[NEEDED_MACS_CLIENT];
 			int mtu;
 			TopoNode node;
 		} addHost;
+		struct {
+			nodeId id;
+			TopoNode node;
+		} setClientShaping;
 		struct {
 			nodeId id;
 			TopoLink link;
 		} setSelfLink;
 		struct {
-			uint64_t linkCount;
-			nodeId nodeCount;
-			nodeId clientNodes;
+			scalingCounts counts;
+			uint32_t workers;
 		} ensureSystemScaling;
 		struct {
 			nodeId sourceId;
 			nodeId targetId;
+			workHostLoc sourceLoc;
+			workHostLoc targetLoc;
 			ip4Addr sourceIp;
 			ip4Addr targetIp;
 			macAddr macs[NEEDED_MACS_LINK];
 			int mtu;
 			TopoLink link;
 		} addLink;
+		struct {
+			nodeId localId;
+			nodeId remoteId;
+			workHostLoc localLoc;
+			ip4Addr localIp;
+			ip4Addr remoteIp;
+			macAddr macs[NEEDED_MACS_LINK];
+			int mtu;
+			TopoLink link;
+			uint32_t vni;
+			ip4Addr underlayLocal;
+			ip4Addr underlayRemote;
+		} addTunnel;
+		struct {
+			nodeId sourceId;
+			nodeId targetId;
+			TopoLink link;
+		} setLinkShaping;
+		struct {
+			nodeId sourceId;
+			nodeId targetId;
+		} removeLink;
 		struct {
 			nodeId id1;
 			nodeId id2;
+			workHostLoc loc1;
+			workHostLoc loc2;
 			ip4Addr ip1;
 			ip4Addr ip2;
 			ip4Subnet subnet1;
 			ip4Subnet subnet2;
 		} addInternalRoutes;
+		struct {
+			nodeId id;
+			nodeId nextId;
+			ip4Addr nextIp;
+			ip4Subnet subnet;
+			bool remove;
+		} modifyInternalRoute;
 		struct {
 			nodeId clientId;
 			macAddr clientMacs[NEEDED_MACS_CLIENT];
@@ -170,22 +320,41 @@ typedef struct {
 		struct {
 			char intfName[INTERFACE_BUF_LEN];
 		} addEdgeInterface;
+		struct {
+			nodeId id;
+		} destroyHost;
+		struct {
+			bool enabled;
+		} setRecovery;
+		struct {
+			nodeId id;
+			workHostLoc loc;
+		} checkHost;
+		struct {
+			nodeId sourceId;
+			nodeId targetId;
+			workHostLoc sourceLoc;
+			workHostLoc targetLoc;
+		} checkLink;
 	};
 } WorkerOrder;
 
 typedef enum {
 	ResponseError,
-	ResponsePong,
 	ResponseLogPrint,
 	ResponseLogEnd,
 	ResponseGotMac,
 	ResponseGotMtu,
 	ResponseGotMtuSupported,
+	ResponseBenchmarked,
 	ResponseAddedEdgeInterface,
+	ResponseGotEdgeMac,
 } WorkerResponseCode;
 
 typedef struct {
 	WorkerResponseCode code;
+	uint32_t tag;   // Tag of the query being answered, if any
+	gint64 sentAt;  // Time when a query response was written by the worker
 	union {
 		struct {
 			int code;
@@ -203,22 +372,93 @@ typedef struct {
 			bool supported;
 			const char* failReason;
 		} gotMtuSupported;
+		workBenchmarkResult benchmarked;
+		struct {
+			bool found;
+			macAddr mac;
+		} gotEdgeMac;
 	};
 } WorkerResponse;
 
-// Workplace context from the perspective of the main process
+// Latencies of the orders with one code. Orders spend "queue" time in the main
+// process between being queued and being written to a worker (which includes
+// waiting for dependencies), "wait" time between being written and being
+// started by the worker (behind the earlier orders in its batch), and "exec"
+// time being executed. For queries, "response" is the time between the worker
+// writing a response and the main process receiving it.
+typedef struct {
+	latencyHistogram queue;
+	latencyHistogram wait;
+	latencyHistogram exec;
+	latencyHistogram response;
+} OrderLatencies;
+
+// Latencies measured by a child process, in memory shared with the main
+// process. The main process only collects them during joins, after the
+// completion counter shows that the worker has finished its orders.
+typedef struct {
+	latencyHistogram wait[ORDER_CODE_COUNT];
+	latencyHistogram exec[ORDER_CODE_COUNT];
+} WorkerLatencies;
+
+// Workplace context from the perspective of the main process. If threaded is
+// true, the worker is a thread of the main process (workThread) that takes
+// orders directly from the queue, and the members for communicating with a
+// child process are unused.
 typedef struct {
 	bool established;
+	bool threaded;
+	GAsyncQueue* queue; // Orders waiting to be sent to this workplace
+
+	// Number of orders queued for this workplace, and the number that have
+	// been handed to its worker. Protected by workMain.lock.
+	uint64_t queuedOrders;
+	uint64_t sentOrders;
+
+	// Counters in shared memory that the child process advances after
+	// executing orders and after reporting errors. The response thread counts
+	// the errors that it has received in reportedErrors (protected by
+	// workMain.lock) and closes "completed" when the child process exits.
+	shmCounter* completed;
+	shmCounter* failed;
+	uint32_t reportedErrors;
+
+	// Latencies measured by the child process, and the queueing latencies
+	// measured by the send thread
+	WorkerLatencies* latencies;
+	latencyHistogram queueLatencies[ORDER_CODE_COUNT];
+
 	GThread* sendThread;
 	GThread* responseThread;
+	GThread* workThread;
 	int ordersFd;    // Write end of work order pipe
 	int responsesFd; // Read end of work response pipe
 
+	// Shared memory rings carrying the orders and responses, or NULL if the
+	// pipes are used for transport
+	shmRing* ordersRing;
+	shmRing* responsesRing;
+
 	char* logBuffer;
 	size_t logLen;
 	size_t logCap;
+
+	// Buffer holding the encoded orders of the batch being sent
+	char* wire;
+	size_t wireLen;
+	size_t wireCap;
 } Workplace;
 
+// State of the search for the number of active workers that executes the
+// orders in a phase at the highest rate (see adaptWorkers)
+typedef struct {
+	guint workers;   // Active workers while the phase runs
+	gint step;       // Change applied after the next measurement
+	double lastRate; // Orders per second in the previous measurement, or 0
+} WorkerAdaptation;
+
+#define PHASE_COUNT (PhaseInternalRoutes + 1)
+
 // Module state for the main process
 static struct {
 	GMutex lock;
@@ -228,24 +468,195 @@ static struct {
 
 	// State for handling outgoing orders:
 
-	GAsyncQueue* orderQueue;
+	// Orders that are not tied to a namespace are distributed among the
+	// workplaces in turn
+	guint nextWorkplace;
+
+	// Orders are only given to the first activeWorkers workplaces. Workplaces
+	// beyond workerLimit have been retired. In adaptive mode, activeWorkers is
+	// tuned while each phase runs, and owners records the workplace that each
+	// namespace was given when it was first used (see hostOwner). adaptQueued
+	// counts the orders sent so far. The current measurement began at time
+	// adaptStart, when adaptOrders orders had been completed. If adaptStart is
+	// 0, the measurement begins once adaptOrders orders have been completed.
+	guint workerLimit;
+	guint activeWorkers;
+	bool adaptive;
+	WorkerAdaptation adaptation[PHASE_COUNT];
+	GHashTable* owners;
+	uint64_t adaptQueued;
+	uint64_t adaptOrders;
+	gint64 adaptStart;
 
 	uint32_t unsentOrders;
 	GCond allOrdersSent;
 
+	// Token of the latest order that used each namespace or other resource
+	// that cannot be modified concurrently, keyed by RESOURCE values. Orders
+	// that depend on unfinished orders in other workplaces are held back by
+	// the send threads until the completion counters of those workplaces
+	// reach them.
+	GHashTable* lastOrders;
+
+	// Orders written to the workers, recorded in a plan, or skipped while
+	// resuming, and the latest value returned by workGetCompletedOrders. These
+	// are only used for reporting progress.
+	uint64_t dispatchedOrders;
+	uint64_t completedOrders;
+
 	// State for responses from the child processes:
 
 	bool receivedError;
 	int errorCode;
 
-	bool responseQueued;
+	// Queries that are waiting for responses, keyed by tag. Since each response
+	// identifies its query, the main thread can issue several queries before
+	// collecting their results.
+	GHashTable* futures;
+	uint32_t nextTag;
+
+	// Queries that were abandoned because of an error, mapped to the number of
+	// responses that may still arrive for them. The entries are cleared at the
+	// next join, after which late responses are recognized by having a tag no
+	// greater than abandonedBefore.
+	GHashTable* abandonedTags;
+	uint32_t abandonedBefore;
 	GCond receivedResponse;
-	WorkerResponse response;
 
-	guint pongsExpected;
-	GCond pongsFinished;
+	GCond errorsReported;
+
+	// State for recording setup plans. While recording is true, orders that
+	// modify the system are written to planFile (if it is not NULL) instead of
+	// being executed, and their resources are tallied in planStats.
+	bool recording;
+	FILE* planFile;
+	char* planFilename;
+	workPlanStats planStats;
+	uint64_t batchOrders; // Orders recorded since the last join
+	uint64_t batchRoutes;
+
+	// State for the setup journal. Orders that can be stored in a plan are
+	// numbered in the sequence in which they are issued. When resuming, the
+	// first skipOrders orders were completed by the interrupted setup, and the
+	// queries issued before its last checkpoint are answered from
+	// replayResponses.
+	FILE* journalFile;
+	char* journalFilename;
+	WorkPhase phase;
+	WorkPhase orderPhase;       // Phase when the latest order was issued
+	uint64_t issuedOrders;
+	uint64_t checkpointOrders;  // Orders completed at the latest checkpoint
+	WorkPhase checkpointPhase;
+	uint64_t skipOrders;
+	WorkPhase skipPhase;
+	WorkerResponse* replayResponses;
+	size_t replayCount;
+	size_t replayCap;
+	size_t replayNext;
+	bool recovering;
+	uint64_t checkedHosts;
+	uint64_t checkedLinks;
+
+	// Locations of packed hosts (see workSetHostLocs), indexed by identifier
+	workHostLoc* hostLocs;
+	size_t hostLocCount;
+
+	// Latency statistics (see workEnableOrderStats). The latencies measured
+	// since the previous join are attributed to the phase in effect during the
+	// join. phaseUsecs holds the time spent in each phase before the current
+	// one, which began at phaseStart. responseLatencies is protected by lock.
+	bool orderStats;
+	bool printOrderStats;
+	char* orderStatsFile;
+	latencyHistogram responseLatencies[ORDER_CODE_COUNT];
+	OrderLatencies* phaseLatencies[PHASE_COUNT];
+	gint64 phaseUsecs[PHASE_COUNT];
+	gint64 phaseStart;
 } workMain;
 
+// A query that has been sent to the workers. The responses are stored in the
+// order in which they arrive. If replayed is true, the responses were taken
+// from the journal of an interrupted setup.
+typedef struct {
+	uint32_t tag;
+	WorkerOrderCode orderCode;
+	WorkerResponseCode expectedCode;
+	WorkerResponse* responses;
+	size_t count;
+	size_t received;
+	bool replayed;
+} QueryFuture;
+
+// Capacities of the shared memory rings for each workplace
+#define ORDERS_RING_SIZE (256 * 1024)
+#define RESPONSES_RING_SIZE (64 * 1024)
+
+// Orders are sent to the child processes in batches, each of which is preceded
+// by this header. Send threads add orders that are already waiting in the queue
+// (or that arrive within BATCH_LINGER_US) to a batch until one of the limits is
+// reached.
+typedef struct {
+	gint64 sentAt;  // Time when the batch was written
+	uint32_t count; // Number of orders in the batch
+	uint32_t len;   // Bytes of serialized orders following the header
+} OrderBatchHeader;
+
+#define BATCH_MAX_ORDERS 256
+#define BATCH_MAX_BYTES (128 * 1024)
+#define BATCH_LINGER_US 50
+
+// Maximum number of buffers passed to a single writev call (the minimum value
+// of IOV_MAX on Linux)
+#define WRITEV_MAX 1024
+
+// Orders are encoded for the workers as a code byte, a byte of OrderWire flags,
+// the query tag (if any), the key fields of the parameters, the length of the
+// remaining parameters, and the remaining parameter bytes without any trailing
+// zeros, followed by the extraneous buffers. Key fields are node identifiers
+// and addresses, which are encoded as the difference from the same kind of key
+// in the previous order of the batch. Consecutive orders usually refer to
+// nearby hosts and addresses, so the differences are short. Integers are
+// written as unsigned LEB128 varints, and differences are zigzag encoded.
+enum {
+	OrderWireHandOff = 0x01,
+	OrderWireTag = 0x02,
+};
+
+typedef enum {
+	WireKeyNode,
+	WireKeyAddr,
+	WireKeyKinds,
+} WireKeyKind;
+
+#define WIRE_NO_KEY SIZE_MAX
+#define WIRE_VARINT_MAX 10
+
+// Module state for child processes. The rings are NULL if the pipes connected
+// to the standard streams are used for transport. batch holds the serialized
+// orders of the most recently received batch, of which the first batchPos
+// bytes have been decoded. The counters and latencies are shared with the main
+// process (see Workplace). Latencies are only recorded if orderStats is true.
+static struct {
+	shmRing* ordersRing;
+	shmRing* responsesRing;
+	shmCounter* completed;
+	shmCounter* failed;
+	WorkerLatencies* latencies;
+	bool orderStats;
+
+	char* batch;
+	size_t batchLen;
+	size_t batchCap;
+	size_t batchPos;
+	uint32_t batchCount;
+	uint32_t batchKeys[WireKeyKinds]; // Latest keys decoded from the batch
+	gint64 batchSentAt;
+} workChild;
+
+// Workplace of the calling thread if it is a worker thread, or NULL in the
+// main process threads and in child processes
+static __thread Workplace* threadWorkplace = NULL;
+
 // Memory clearing functions to prevent irrelevant alerts from debuggers
 #ifdef DEBUG
 #define ZERO_ORDER(order) do{ memset((order), 0, sizeof(WorkerOrder)); }while(0)
@@ -259,6 +670,11 @@ static WorkerOrder* newOrder(WorkerOrderCode code) {
 	WorkerOrder* order = emalloc(sizeof(WorkerOrder));
 	ZERO_ORDER(order);
 	order->code = code;
+	order->secondary = false;
+	order->handOff = false;
+	order->afterCount = 0;
+	order->tag = 0;
+	order->queuedAt = 0;
 	return order;
 }
 
@@ -286,35 +702,373 @@ static bool readAll(int fd, void* data, size_t len) {
 	return true;
 }
 
+// Writes a sequence of buffers to fd, retrying after partial writes. The
+// buffers in iov are modified.
+static bool writeAllVec(int fd, struct iovec* iov, int count) {
+	while (count > 0) {
+		ssize_t written = writev(fd, iov, (count < WRITEV_MAX ? count : WRITEV_MAX));
+		if (written <= 0) return false;
+
+		// Skip past the buffers that were written completely
+		size_t remaining = (size_t)written;
+		while (count > 0 && remaining >= iov->iov_len) {
+			remaining -= iov->iov_len;
+			++iov;
+			--count;
+		}
+		if (remaining > 0) {
+			iov->iov_base = (char*)iov->iov_base + remaining;
+			iov->iov_len -= remaining;
+		}
+	}
+	return true;
+}
+
+// Called by main process. Sends a sequence of serialized buffers to the child
+// of a workplace. The buffers in iov may be modified.
+static bool writeVecToWorker(Workplace* wp, struct iovec* iov, int count) {
+	if (wp->ordersRing != NULL) {
+		for (int i = 0; i < count; ++i) {
+			if (!shmRingWrite(wp->ordersRing, iov[i].iov_base, iov[i].iov_len, wp->ordersFd)) return false;
+		}
+		return true;
+	}
+	return writeAllVec(wp->ordersFd, iov, count);
+}
+
+// Called by main process. Receives serialized data from the child of a
+// workplace.
+static bool readFromWorker(Workplace* wp, void* data, size_t len) {
+	if (wp->responsesRing != NULL) return shmRingRead(wp->responsesRing, data, len, wp->responsesFd);
+	return readAll(wp->responsesFd, data, len);
+}
+
+// Called by child process. Sends serialized data to the main process.
+static bool writeToMain(const void* data, size_t len) {
+	if (workChild.responsesRing != NULL) return shmRingWrite(workChild.responsesRing, data, len, STDOUT_FILENO);
+	return writeAll(STDOUT_FILENO, data, len);
+}
+
+// Called by child process. Receives serialized data from the main process.
+static bool readFromMain(void* data, size_t len) {
+	if (workChild.ordersRing != NULL) return shmRingRead(workChild.ordersRing, data, len, STDIN_FILENO);
+	return readAll(STDIN_FILENO, data, len);
+}
+
 // Releases memory associated with an order (but not the order itself)
 static void freeOrderContents(WorkerOrder* order) {
 	if (order->code == WorkerConfigure) {
 		free(order->configure.nsPrefix);
 		free(order->configure.ovsDir);
 		free(order->configure.ovsSchema);
+	} else if (order->code == WorkerGetEdgeRemoteMacs) {
+		free(order->getEdgeRemoteMacs.queries);
+	}
+}
+
+// Called by main process. Returns a copy of an order with its own extraneous
+// buffers.
+static WorkerOrder* copyOrder(const WorkerOrder* order) {
+	WorkerOrder* copy = emalloc(sizeof(WorkerOrder));
+	*copy = *order;
+	if (order->code == WorkerConfigure) {
+		copy->configure.nsPrefix = strdup(order->configure.nsPrefix);
+		copy->configure.ovsDir = strdup(order->configure.ovsDir);
+		copy->configure.ovsSchema = strdup(order->configure.ovsSchema);
+	} else if (order->code == WorkerGetEdgeRemoteMacs) {
+		size_t count = order->getEdgeRemoteMacs.count;
+		copy->getEdgeRemoteMacs.queries = eamalloc(count, sizeof(EdgeMacQuery), 0);
+		memcpy(copy->getEdgeRemoteMacs.queries, order->getEdgeRemoteMacs.queries, count * sizeof(EdgeMacQuery));
+	}
+	return copy;
+}
+
+// Locates the parameters of an order, which are the only part of the union that
+// is used by its code. Returns false if the code is unknown.
+static bool getOrderParams(WorkerOrder* order, void** params, size_t* len) {
+	switch (order->code) {
+	case WorkerConfigure: *params = &order->configure; *len = sizeof(order->configure); break;
+	case WorkerGetEdgeRemoteMacs: *params = &order->getEdgeRemoteMacs; *len = sizeof(order->getEdgeRemoteMacs); break;
+	case WorkerGetEdgeLocalMac: *params = &order->getEdgeLocalMac; *len = sizeof(order->getEdgeLocalMac); break;
+	case WorkerGetInterfaceMtu: *params = &order->getInterfaceMtu; *len = sizeof(order->getInterfaceMtu); break;
+	case WorkerMtuSupported: *params = &order->mtuSupported; *len = sizeof(order->mtuSupported); break;
+	case WorkerBenchmark: *params = &order->benchmark; *len = sizeof(order->benchmark); break;
+	case WorkerAddRoot: *params = &order->addRoot; *len = sizeof(order->addRoot); break;
+	case WorkerAddEdgeInterface: *params = &order->addEdgeInterface; *len = sizeof(order->addEdgeInterface); break;
+	case WorkerAddHostPack: *params = &order->addHostPack; *len = sizeof(order->addHostPack); break;
+	case WorkerAddHost: *params = &order->addHost; *len = sizeof(order->addHost); break;
+	case WorkerSetClientShaping: *params = &order->setClientShaping; *len = sizeof(order->setClientShaping); break;
+	case WorkerSetSelfLink: *params = &order->setSelfLink; *len = sizeof(order->setSelfLink); break;
+	case WorkerEnsureSystemScaling: *params = &order->ensureSystemScaling; *len = sizeof(order->ensureSystemScaling); break;
+	case WorkerAddLink:
+	case WorkerAddLinkPeer: *params = &order->addLink; *len = sizeof(order->addLink); break;
+	case WorkerAddTunnel: *params = &order->addTunnel; *len = sizeof(order->addTunnel); break;
+	case WorkerSetLinkShaping: *params = &order->setLinkShaping; *len = sizeof(order->setLinkShaping); break;
+	case WorkerRemoveLink: *params = &order->removeLink; *len = sizeof(order->removeLink); break;
+	case WorkerAddInternalRoutes: *params = &order->addInternalRoutes; *len = sizeof(order->addInternalRoutes); break;
+	case WorkerModifyInternalRoute: *params = &order->modifyInternalRoute; *len = sizeof(order->modifyInternalRoute); break;
+	case WorkerAddClientRoutes: *params = &order->addClientRoutes; *len = sizeof(order->addClientRoutes); break;
+	case WorkerAddEdgeRoutes: *params = &order->addEdgeRoutes; *len = sizeof(order->addEdgeRoutes); break;
+	case WorkerDestroyHost: *params = &order->destroyHost; *len = sizeof(order->destroyHost); break;
+	case WorkerSetRecovery: *params = &order->setRecovery; *len = sizeof(order->setRecovery); break;
+	case WorkerCheckHost: *params = &order->checkHost; *len = sizeof(order->checkHost); break;
+	case WorkerCheckLink: *params = &order->checkLink; *len = sizeof(order->checkLink); break;
+	case WorkerTerminate:
+	case WorkerDestroyHosts: *params = NULL; *len = 0; break;
+	default: return false;
+	}
+	return true;
+}
+
+#define PARAM_OFFSET(params, field) (offsetof(WorkerOrder, params.field) - offsetof(WorkerOrder, params))
+
+// Locates the 32-bit key fields of an order relative to its parameters. Keys
+// that the order does not have are set to WIRE_NO_KEY. Node keys always
+// precede address keys.
+static void getOrderWireKeys(WorkerOrderCode code, size_t keys[WireKeyKinds]) {
+	keys[WireKeyNode] = WIRE_NO_KEY;
+	keys[WireKeyAddr] = WIRE_NO_KEY;
+	switch (code) {
+	case WorkerAddHost:
+		keys[WireKeyNode] = PARAM_OFFSET(addHost, id);
+		keys[WireKeyAddr] = PARAM_OFFSET(addHost, ip);
+		break;
+	case WorkerAddLink:
+	case WorkerAddLinkPeer:
+		keys[WireKeyNode] = PARAM_OFFSET(addLink, sourceId);
+		keys[WireKeyAddr] = PARAM_OFFSET(addLink, sourceIp);
+		break;
+	case WorkerAddTunnel:
+		keys[WireKeyNode] = PARAM_OFFSET(addTunnel, localId);
+		keys[WireKeyAddr] = PARAM_OFFSET(addTunnel, localIp);
+		break;
+	case WorkerAddInternalRoutes:
+		keys[WireKeyNode] = PARAM_OFFSET(addInternalRoutes, id1);
+		keys[WireKeyAddr] = PARAM_OFFSET(addInternalRoutes, ip1);
+		break;
+	case WorkerModifyInternalRoute:
+		keys[WireKeyNode] = PARAM_OFFSET(modifyInternalRoute, id);
+		keys[WireKeyAddr] = PARAM_OFFSET(modifyInternalRoute, nextIp);
+		break;
+	case WorkerSetClientShaping: keys[WireKeyNode] = PARAM_OFFSET(setClientShaping, id); break;
+	case WorkerSetSelfLink: keys[WireKeyNode] = PARAM_OFFSET(setSelfLink, id); break;
+	case WorkerSetLinkShaping: keys[WireKeyNode] = PARAM_OFFSET(setLinkShaping, sourceId); break;
+	case WorkerRemoveLink: keys[WireKeyNode] = PARAM_OFFSET(removeLink, sourceId); break;
+	case WorkerAddClientRoutes: keys[WireKeyNode] = PARAM_OFFSET(addClientRoutes, clientId); break;
+	case WorkerDestroyHost: keys[WireKeyNode] = PARAM_OFFSET(destroyHost, id); break;
+	case WorkerCheckHost: keys[WireKeyNode] = PARAM_OFFSET(checkHost, id); break;
+	case WorkerCheckLink: keys[WireKeyNode] = PARAM_OFFSET(checkLink, sourceId); break;
+	default: break;
 	}
 }
 
-// Serializes a work order and sends it through the pipe to a child process
-static bool writeOrderToWorkplace(WorkerOrder* order, Workplace* wp) {
-	lprintf(LogDebug, "Sending order code %d to child in workplace %p\n", order->code, wp);
-	if (!writeAll(wp->ordersFd, order, sizeof(WorkerOrder))) goto fail;
+static void wirePutVarint(char** buf, size_t* len, size_t* cap, uint64_t value) {
+	flexBufferGrow((void**)buf, *len, cap, WIRE_VARINT_MAX, 1);
+	do {
+		uint8_t byte = (uint8_t)(value & 0x7F);
+		value >>= 7;
+		if (value != 0) byte |= 0x80;
+		(*buf)[(*len)++] = (char)byte;
+	} while (value != 0);
+}
+
+static uint64_t wireZigzag(uint32_t value, uint32_t prev) {
+	int32_t delta = (int32_t)(value - prev);
+	return (uint64_t)(((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+}
+
+static uint32_t wireUnzigzag(uint64_t encoded, uint32_t prev) {
+	uint32_t zigzag = (uint32_t)encoded;
+	return prev + ((zigzag >> 1) ^ (0U - (zigzag & 1U)));
+}
+
+// Called by main process. Appends the encoding of an order to a buffer.
+// prevKeys holds the latest key of each kind in the batch, and is updated.
+static void encodeOrder(WorkerOrder* order, uint32_t prevKeys[WireKeyKinds], char** buf, size_t* len, size_t* cap) {
+	void* paramsPtr;
+	size_t paramsLen;
+	if (!getOrderParams(order, &paramsPtr, &paramsLen)) {
+		lprintf(LogError, "BUG: attempted to encode unknown order code %d\n", order->code);
+		paramsLen = 0;
+	}
+	const char* params = paramsPtr;
+
+	uint8_t flags = 0;
+	if (order->handOff) flags |= OrderWireHandOff;
+	if (order->tag != 0) flags |= OrderWireTag;
+	flexBufferGrow((void**)buf, *len, cap, 2, 1);
+	(*buf)[(*len)++] = (char)order->code;
+	(*buf)[(*len)++] = (char)flags;
+	if (order->tag != 0) wirePutVarint(buf, len, cap, order->tag);
+
+	size_t keys[WireKeyKinds];
+	getOrderWireKeys(order->code, keys);
+	for (int k = 0; k < WireKeyKinds; ++k) {
+		if (keys[k] == WIRE_NO_KEY) continue;
+		uint32_t value;
+		memcpy(&value, &params[keys[k]], sizeof(uint32_t));
+		wirePutVarint(buf, len, cap, wireZigzag(value, prevKeys[k]));
+		prevKeys[k] = value;
+	}
+
+	// Gather the parameter bytes around the keys
+	char rest[sizeof(WorkerOrder)];
+	size_t restLen = 0;
+	size_t pos = 0;
+	for (int k = 0; k <= WireKeyKinds; ++k) {
+		size_t end = (k < WireKeyKinds ? keys[k] : paramsLen);
+		if (end == WIRE_NO_KEY) continue;
+		if (end > pos) memcpy(&rest[restLen], &params[pos], end - pos);
+		restLen += end - pos;
+		pos = end + sizeof(uint32_t);
+	}
+	while (restLen > 0 && rest[restLen-1] == 0) --restLen;
+	wirePutVarint(buf, len, cap, restLen);
+	flexBufferGrow((void**)buf, *len, cap, restLen, 1);
+	flexBufferAppend(*buf, len, rest, restLen, 1);
 
-	// Write extraneous buffers
+	// Add extraneous buffers
 	if (order->code == WorkerConfigure) {
-		if (!writeAll(wp->ordersFd, order->configure.nsPrefix, order->configure.nsPrefixLen)) goto fail;
-		else if (!writeAll(wp->ordersFd, order->configure.ovsDir, order->configure.ovsDirLen)) goto fail;
-		else if (!writeAll(wp->ordersFd, order->configure.ovsSchema, order->configure.ovsSchemaLen)) goto fail;
+		size_t extraLen = order->configure.nsPrefixLen + order->configure.ovsDirLen + order->configure.ovsSchemaLen;
+		flexBufferGrow((void**)buf, *len, cap, extraLen, 1);
+		flexBufferAppend(*buf, len, order->configure.nsPrefix, order->configure.nsPrefixLen, 1);
+		flexBufferAppend(*buf, len, order->configure.ovsDir, order->configure.ovsDirLen, 1);
+		flexBufferAppend(*buf, len, order->configure.ovsSchema, order->configure.ovsSchemaLen, 1);
+	} else if (order->code == WorkerGetEdgeRemoteMacs) {
+		size_t extraLen = order->getEdgeRemoteMacs.count * sizeof(EdgeMacQuery);
+		flexBufferGrow((void**)buf, *len, cap, extraLen, 1);
+		flexBufferAppend(*buf, len, order->getEdgeRemoteMacs.queries, extraLen, 1);
+	}
+}
+
+// Serializes a batch of work orders and sends it to a child process using a
+// single vectored write. The caller must count the orders in the workplace's
+// queuedOrders.
+static bool writeBatchToWorkplace(WorkerOrder** orders, uint32_t count, Workplace* wp) {
+	uint32_t prevKeys[WireKeyKinds] = { 0 };
+	gint64 now = g_get_monotonic_time();
+	wp->wireLen = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		lprintf(LogDebug, "Sending order code %d to child in workplace %p\n", orders[i]->code, wp);
+		encodeOrder(orders[i], prevKeys, &wp->wire, &wp->wireLen, &wp->wireCap);
+		if (workMain.orderStats) latencyRecord(&wp->queueLatencies[orders[i]->code], now - orders[i]->queuedAt);
+	}
+
+	OrderBatchHeader header;
+	header.sentAt = now;
+	header.count = count;
+	header.len = (uint32_t)wp->wireLen;
+	struct iovec iov[2] = {
+		{ .iov_base = &header, .iov_len = sizeof(OrderBatchHeader) },
+		{ .iov_base = wp->wire, .iov_len = wp->wireLen },
+	};
+	if (!writeVecToWorker(wp, iov, 2)) {
+		lprintf(LogError, "Failed to send batch of %u worker orders to child in workplace %p\n", count, wp);
+		return false;
 	}
 	return true;
-fail:
-	lprintf(LogError, "Failed to send worker order code %d to child in workplace %p\n", order->code, wp);
+}
+
+// Called by child process. Copies the next len bytes of the current batch.
+static bool takeFromBatch(void* data, size_t len) {
+	if (workChild.batchLen - workChild.batchPos < len) {
+		lprintln(LogError, "Received a truncated order batch");
+		return false;
+	}
+	memcpy(data, &workChild.batch[workChild.batchPos], len);
+	workChild.batchPos += len;
+	return true;
+}
+
+// Called by child process. Decodes the next varint in the current batch.
+static bool takeVarintFromBatch(uint64_t* value) {
+	*value = 0;
+	for (unsigned int shift = 0; shift < 64; shift += 7) {
+		uint8_t byte;
+		if (!takeFromBatch(&byte, 1)) return false;
+		*value |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0) return true;
+	}
+	lprintln(LogError, "Received a malformed order batch");
 	return false;
 }
 
-// Deserializes a work order from stdin
+// Called by child process. Decodes the next order of the current batch (see
+// encodeOrder), other than its extraneous buffers.
+static bool decodeOrder(WorkerOrder* order) {
+	uint8_t code, flags;
+	if (!takeFromBatch(&code, 1) || !takeFromBatch(&flags, 1)) return false;
+	ZERO_ORDER(order);
+	order->code = (WorkerOrderCode)code;
+	order->secondary = false;
+	order->handOff = ((flags & OrderWireHandOff) != 0);
+	order->afterCount = 0;
+	order->tag = 0;
+	if ((flags & OrderWireTag) != 0) {
+		uint64_t tag;
+		if (!takeVarintFromBatch(&tag)) return false;
+		order->tag = (uint32_t)tag;
+	}
+
+	void* paramsPtr;
+	size_t paramsLen;
+	if (!getOrderParams(order, &paramsPtr, &paramsLen)) {
+		lprintf(LogError, "Received unknown order code %d\n", order->code);
+		return false;
+	}
+	char* params = paramsPtr;
+	if (paramsLen > 0) memset(params, 0, paramsLen);
+
+	size_t keys[WireKeyKinds];
+	uint32_t keyValues[WireKeyKinds];
+	getOrderWireKeys(order->code, keys);
+	for (int k = 0; k < WireKeyKinds; ++k) {
+		if (keys[k] == WIRE_NO_KEY) continue;
+		uint64_t encoded;
+		if (!takeVarintFromBatch(&encoded)) return false;
+		keyValues[k] = wireUnzigzag(encoded, workChild.batchKeys[k]);
+		workChild.batchKeys[k] = keyValues[k];
+	}
+
+	// Scatter the remaining bytes around the keys
+	uint64_t restLen;
+	if (!takeVarintFromBatch(&restLen)) return false;
+	size_t pos = 0;
+	for (int k = 0; k <= WireKeyKinds; ++k) {
+		size_t end = (k < WireKeyKinds ? keys[k] : paramsLen);
+		if (end == WIRE_NO_KEY) continue;
+		size_t chunk = end - pos;
+		if (chunk > restLen) chunk = (size_t)restLen;
+		if (chunk > 0 && !takeFromBatch(&params[pos], chunk)) return false;
+		restLen -= chunk;
+		if (k < WireKeyKinds) memcpy(&params[end], &keyValues[k], sizeof(uint32_t));
+		pos = end + sizeof(uint32_t);
+	}
+	if (restLen > 0) {
+		lprintf(LogError, "Received oversized parameters for order code %d\n", order->code);
+		return false;
+	}
+	return true;
+}
+
+// Deserializes the next work order sent by the main process. When the current
+// batch has been decoded, the next one is received with a single read.
 static bool readOrder(WorkerOrder* order) {
-	if (!readAll(STDIN_FILENO, order, sizeof(WorkerOrder))) return false;
+	while (workChild.batchPos == workChild.batchLen) {
+		OrderBatchHeader header;
+		if (!readFromMain(&header, sizeof(OrderBatchHeader))) return false;
+		workChild.batchLen = 0;
+		workChild.batchPos = 0;
+		flexBufferGrow((void**)&workChild.batch, 0, &workChild.batchCap, header.len, 1);
+		if (!readFromMain(workChild.batch, header.len)) return false;
+		workChild.batchLen = header.len;
+		workChild.batchCount = header.count;
+		workChild.batchSentAt = header.sentAt;
+		memset(workChild.batchKeys, 0, sizeof(workChild.batchKeys));
+		lprintf(LogDebug, "Received batch of %u orders\n", header.count);
+	}
+
+	if (!decodeOrder(order)) return false;
 
 	// Read extraneous buffers
 	if (order->code == WorkerConfigure) {
@@ -323,186 +1077,1044 @@ static bool readOrder(WorkerOrder* order) {
 		order->configure.ovsSchema = ecalloc(order->configure.ovsSchemaLen+1, 1);
 
 		bool failed = false;
-		if (!readAll(STDIN_FILENO, order->configure.nsPrefix, order->configure.nsPrefixLen)) failed = true;
-		else if (!readAll(STDIN_FILENO, order->configure.ovsDir, order->configure.ovsDirLen)) failed = true;
-		else if (!readAll(STDIN_FILENO, order->configure.ovsSchema, order->configure.ovsSchemaLen)) failed = true;
+		if (!takeFromBatch(order->configure.nsPrefix, order->configure.nsPrefixLen)) failed = true;
+		else if (!takeFromBatch(order->configure.ovsDir, order->configure.ovsDirLen)) failed = true;
+		else if (!takeFromBatch(order->configure.ovsSchema, order->configure.ovsSchemaLen)) failed = true;
 		if (failed) {
 			freeOrderContents(order);
 			return false;
 		}
+	} else if (order->code == WorkerGetEdgeRemoteMacs) {
+		order->getEdgeRemoteMacs.queries = eamalloc(order->getEdgeRemoteMacs.count, sizeof(EdgeMacQuery), 0);
+		if (!takeFromBatch(order->getEdgeRemoteMacs.queries, order->getEdgeRemoteMacs.count * sizeof(EdgeMacQuery))) {
+			freeOrderContents(order);
+			return false;
+		}
 	}
 	return true;
 }
 
-static void waitForSending(void) {
-	g_mutex_lock(&workMain.lock);
-	lprintln(LogDebug, "Waiting until all orders are sent to child processes");
-	while (workMain.unsentOrders > 0) {
-		g_cond_wait(&workMain.allOrdersSent, &workMain.lock);
+// Setup plan files store a sequence of entries, each of which begins with a tag
+// byte. Tags smaller than PlanTagJoin are order codes, and are followed by the
+// fixed-size parameters for that order. Broadcast entries contain an order code
+// and parameters after the tag. Plans are stored using the native byte order
+// and structure layout, so they can only be replayed by a build of the program
+// for the same architecture.
+static const char PlanMagic[8] = { 'N', 'M', 'P', 'L', 'A', 'N', '0', '1' };
+enum {
+	PlanTagJoin = 0xF0,
+	PlanTagBroadcast = 0xF1,
+	PlanTagEnd = 0xFF,
+};
+
+// Locates the parameters of an order that can be stored in a setup plan. If the
+// order cannot be stored in a plan (e.g., because it is a query or a control
+// order), returns false.
+static bool getPlanOrderParams(WorkerOrder* order, void** params, size_t* len) {
+	switch (order->code) {
+	case WorkerAddRoot:
+	case WorkerAddEdgeInterface:
+	case WorkerAddHostPack:
+	case WorkerAddHost:
+	case WorkerSetClientShaping:
+	case WorkerSetSelfLink:
+	case WorkerEnsureSystemScaling:
+	case WorkerAddLink:
+	case WorkerAddTunnel:
+	case WorkerSetLinkShaping:
+	case WorkerRemoveLink:
+	case WorkerAddInternalRoutes:
+	case WorkerModifyInternalRoute:
+	case WorkerAddClientRoutes:
+	case WorkerAddEdgeRoutes:
+	case WorkerDestroyHost:
+		return getOrderParams(order, params, len);
+	default: return false;
 	}
-	g_mutex_unlock(&workMain.lock);
 }
 
-// Called by main process => main thread. The caller must hold workMain.lock
-static int waitForResponse(WorkerResponseCode expectedCode) {
-	lprintln(LogDebug, "Waiting for response from worker pool");
-	while (!workMain.receivedError && !workMain.responseQueued) {
-		g_cond_wait(&workMain.receivedResponse, &workMain.lock);
-	}
-	int err = 0;
-	if (workMain.receivedError) {
-		err = workMain.errorCode;
-	} else if (workMain.response.code != expectedCode) {
-		lprintf(LogError, "Unexpected response code %d from worker pool\n", workMain.response.code);
-		err = 1;
-	} else {
-		workMain.responseQueued = false;
+static bool orderIsPlannable(WorkerOrder* order) {
+	void* params;
+	size_t len;
+	return getPlanOrderParams(order, &params, &len);
+}
+
+// Called by main process => main thread. Adds the system resources that an
+// order would create to the plan statistics. The counts mirror the operations
+// performed by the worker module.
+static void tallyPlanOrder(const WorkerOrder* order) {
+	workPlanStats* stats = &workMain.planStats;
+	uint64_t routes = 0;
+	++stats->orders;
+	switch (order->code) {
+	case WorkerAddRoot:
+		if (!order->addRoot.useInitNs && !order->addRoot.existing) ++stats->hosts;
+		break;
+	case WorkerAddEdgeInterface:
+		++stats->switchPorts;
+		++stats->switchFlows;
+		break;
+	case WorkerAddHostPack: ++stats->hosts; break;
+	case WorkerAddHost:
+		// Packed hosts do not have their own namespaces
+		if (order->addHost.loc.pack == 0) ++stats->hosts;
+		if (order->addHost.node.client) {
+			++stats->clientHosts;
+			stats->links += 2;
+		}
+		break;
+	case WorkerAddLink: ++stats->links; routes = 2; break;
+	case WorkerAddTunnel: ++stats->links; routes = 1; break;
+	case WorkerAddInternalRoutes: routes = 2; break;
+	case WorkerModifyInternalRoute: routes = 1; break;
+	case WorkerAddClientRoutes:
+		routes = 5;
+		stats->switchPorts += NEEDED_PORTS_CLIENT;
+		stats->switchFlows += NEEDED_PORTS_CLIENT;
+		break;
+	case WorkerAddEdgeRoutes: ++stats->switchFlows; break;
+	default: break;
 	}
-	return err;
+	stats->routes += routes;
+	++workMain.batchOrders;
+	workMain.batchRoutes += routes;
 }
 
-// Called by main process => main thread
-static int sendOrder(WorkerOrder* order, bool ignoreErrors) {
-	bool abort = false;
-	if (!ignoreErrors) {
-		g_mutex_lock(&workMain.lock);
-		if (workMain.receivedError) abort = true;
-		g_mutex_unlock(&workMain.lock);
+// Called by main process => main thread. Appends an entry to the plan file. If
+// order is not NULL, its code and parameters are also written.
+static bool recordPlanEntry(int tag, WorkerOrder* order) {
+	if (tag == PlanTagJoin) {
+		// Routes issued alone between two joins cannot be parallelized
+		++workMain.planStats.joins;
+		if (workMain.batchOrders == 1) workMain.planStats.serialRoutes += workMain.batchRoutes;
+		workMain.batchOrders = 0;
+		workMain.batchRoutes = 0;
+	} else if (order != NULL) {
+		tallyPlanOrder(order);
+	}
+	if (workMain.planFile == NULL) return true;
+
+	uint8_t tagByte = (uint8_t)tag;
+	if (fwrite(&tagByte, 1, 1, workMain.planFile) != 1) goto fail;
+	if (order != NULL) {
+		if (tag == PlanTagBroadcast) {
+			uint8_t code = (uint8_t)order->code;
+			if (fwrite(&code, 1, 1, workMain.planFile) != 1) goto fail;
+		}
+		void* params;
+		size_t len;
+		if (!getPlanOrderParams(order, &params, &len)) {
+			lprintf(LogError, "BUG: attempted to record order code %d in a setup plan\n", order->code);
+			return false;
+		}
+		if (fwrite(params, len, 1, workMain.planFile) != 1) goto fail;
 	}
-	if (abort) return workMain.errorCode;
+	return true;
+fail:
+	lprintf(LogError, "Failed to write to setup plan file '%s'\n", workMain.planFilename);
+	return false;
+}
 
+static void waitForSending(void) {
 	g_mutex_lock(&workMain.lock);
-	++workMain.unsentOrders;
-	g_async_queue_push(workMain.orderQueue, order);
+	lprintln(LogDebug, "Waiting until all orders are sent to child processes");
+	while (workMain.unsentOrders > 0) {
+		g_cond_wait(&workMain.allOrdersSent, &workMain.lock);
+	}
 	g_mutex_unlock(&workMain.lock);
-
-	return 0;
 }
 
-// Called by main process => main thread
-static bool broadcastOrder(WorkerOrder* order) {
+// Called by main process => main thread. Sends an order directly to every
+// child process, bypassing plans and journals.
+static bool broadcastToWorkplaces(WorkerOrder* order) {
 	// Make sure that all sender threads are blocked reading from the queue
 	waitForSending();
 
 	lprintf(LogDebug, "Broadcasting order code %d to all child processes\n", order->code);
+	order->queuedAt = g_get_monotonic_time();
 
 	// Send the order directly to each child process
 	bool success = true;
 	for (guint i = 0; i < workMain.poolSize; ++i) {
 		Workplace* wp = &workMain.workplaces[i];
-		if (!writeOrderToWorkplace(order, wp)) {
+		if (!wp->established) continue;
+		if (wp->threaded) {
+			// Worker threads receive their own copies through their queues.
+			// Like other broadcast orders, these are not counted as dispatched.
+			WorkerOrder* copy = copyOrder(order);
+			copy->secondary = true;
+			g_mutex_lock(&workMain.lock);
+			++wp->queuedOrders;
+			++workMain.unsentOrders;
+			g_async_queue_push(wp->queue, copy);
+			g_mutex_unlock(&workMain.lock);
+			continue;
+		}
+		if (!writeBatchToWorkplace(&order, 1, wp)) {
 			lprintf(LogWarning, "Could not broadcast configuration order to child in workplace %p\n", wp);
 			success = false;
+			continue;
 		}
+		g_mutex_lock(&workMain.lock);
+		++wp->queuedOrders;
+		++wp->sentOrders;
+		g_mutex_unlock(&workMain.lock);
 	}
 	return success;
 }
 
-// The entry point for the send threads in the main process
-static void* sendThread(gpointer data) {
-	Workplace* wp = data;
+// Setup journals begin with JournalMagic, the size of WorkerResponse, and the
+// fingerprint of the setup inputs. The header is followed by entries, each of
+// which begins with a tag byte. Checkpoint entries contain the number of
+// completed orders and the phase of the last one. Like setup plans, journals
+// use the native byte order and structure layout.
+static const char JournalMagic[8] = { 'N', 'M', 'J', 'R', 'N', 'L', '0', '2' };
+enum {
+	JournalTagResponse = 0x01,
+	JournalTagCheckpoint = 0x02,
+	JournalTagComplete = 0x03,
+};
+
+// Unless the phase changes, checkpoints are only written after this many
+// orders. Longer sequences of orders without joins are split by automatic
+// joins, which bounds the work that must be redone after an interruption.
+#define JOURNAL_INTERVAL 1024
+
+// In adaptive mode, the rate at which orders are completed is measured over
+// this many orders. The completion counters are sampled whenever another
+// ADAPT_SAMPLE_ORDERS orders have been sent.
+#define ADAPT_EPOCH_ORDERS 1024
+#define ADAPT_SAMPLE_ORDERS 128
+
+static const char* PhaseNames[] = { "start", "root", "hosts", "links", "client routes", "internal routes" };
+
+// Called by main process => main thread. Appends an entry to the journal. The
+// journal is flushed to the kernel, but not synchronized with the disk: the
+// virtual network itself does not survive a system crash.
+static bool writeJournalEntry(uint8_t tag, const void* data, size_t len) {
+	FILE* file = workMain.journalFile;
+	if (fwrite(&tag, 1, 1, file) != 1) goto fail;
+	if (len > 0 && fwrite(data, len, 1, file) != 1) goto fail;
+	if (fflush(file) != 0) goto fail;
+	return true;
+fail:
+	lprintf(LogError, "Failed to write to setup journal '%s'\n", workMain.journalFilename);
+	return false;
+}
 
-	bool loop = true;
-	while (loop) {
-		gpointer item = g_async_queue_pop(workMain.orderQueue);
-		WorkerOrder* order = item;
-		if (order->code == WorkerTerminate) {
-			loop = false;
-		} else {
-			writeOrderToWorkplace(order, wp);
+static void logJournalMismatch(const char* detail) {
+	lprintf(LogError, "The setup does not match the interrupted one recorded in the journal '%s' (%s). Resume it with the same topology and options, or construct the network from scratch.\n", workMain.journalFilename, detail);
+}
+
+// Called by main process => main thread. Numbers an order that can be stored in
+// a plan. If the order was completed by an interrupted setup that is being
+// resumed, it is replaced by an order that verifies its result, or execute is
+// set to false if there is nothing to verify.
+static int journalOrder(WorkerOrder* order, bool* execute) {
+	*execute = true;
+	++workMain.issuedOrders;
+	workMain.orderPhase = workMain.phase;
+
+	if (workMain.issuedOrders > workMain.skipOrders) {
+		if (workMain.skipOrders > 0 && workMain.issuedOrders == workMain.skipOrders + 1) {
+			lprintf(LogInfo, "Skipped %" PRIu64 " orders completed by the interrupted setup (checking %" PRIu64 " hosts and %" PRIu64 " links); continuing in the %s phase\n", workMain.skipOrders, workMain.checkedHosts, workMain.checkedLinks, PhaseNames[workMain.orderPhase]);
+
+			// The interrupted batch may have been partially executed
+			WorkerOrder recoveryOrder;
+			recoveryOrder.code = WorkerSetRecovery;
+			recoveryOrder.setRecovery.enabled = true;
+			if (!broadcastToWorkplaces(&recoveryOrder)) return 1;
+			workMain.recovering = true;
 		}
-		freeOrderContents(order);
-		free(order);
+		return 0;
+	}
 
-		g_mutex_lock(&workMain.lock);
-		--workMain.unsentOrders;
-		if (workMain.unsentOrders == 0) g_cond_signal(&workMain.allOrdersSent);
-		g_mutex_unlock(&workMain.lock);
+	if (workMain.issuedOrders == workMain.skipOrders && workMain.orderPhase != workMain.skipPhase) {
+		logJournalMismatch("the last checkpoint is in a different phase");
+		return 1;
 	}
 
-	lprintf(LogDebug, "Order sending thread for workplace %p shutting down\n", wp);
-	close(wp->ordersFd);
-	return NULL;
+	switch (order->code) {
+	case WorkerAddHost: {
+		nodeId id = order->addHost.id;
+		workHostLoc loc = order->addHost.loc;
+		order->code = WorkerCheckHost;
+		order->checkHost.id = id;
+		order->checkHost.loc = loc;
+		++workMain.checkedHosts;
+		break;
+	}
+	case WorkerAddLink: {
+		nodeId sourceId = order->addLink.sourceId;
+		nodeId targetId = order->addLink.targetId;
+		workHostLoc sourceLoc = order->addLink.sourceLoc;
+		workHostLoc targetLoc = order->addLink.targetLoc;
+		order->code = WorkerCheckLink;
+		order->checkLink.sourceId = sourceId;
+		order->checkLink.targetId = targetId;
+		order->checkLink.sourceLoc = sourceLoc;
+		order->checkLink.targetLoc = targetLoc;
+		++workMain.checkedLinks;
+		break;
+	}
+	case WorkerAddTunnel: {
+		// The remote end is checked by the instance on its own machine
+		nodeId localId = order->addTunnel.localId;
+		nodeId remoteId = order->addTunnel.remoteId;
+		workHostLoc localLoc = order->addTunnel.localLoc;
+		order->code = WorkerCheckLink;
+		order->checkLink.sourceId = localId;
+		order->checkLink.targetId = remoteId;
+		order->checkLink.sourceLoc = localLoc;
+		order->checkLink.targetLoc = (workHostLoc){ .pack = WORK_REMOTE_PACK, .slot = 0 };
+		++workMain.checkedLinks;
+		break;
+	}
+	case WorkerAddRoot:
+		// Every worker still needs to load the existing root namespace
+		*execute = order->addRoot.existing;
+		break;
+	default:
+		*execute = false;
+		break;
+	}
+	return 0;
 }
 
-// The entry point for the response threads in the main process
-static void* responseThread(gpointer data) {
-	Workplace* wp = data;
+// Called by main process => main thread after a successful join. Records a
+// checkpoint if enough orders were completed since the previous one.
+static int journalCheckpoint(void) {
+	if (workMain.issuedOrders <= workMain.checkpointOrders) return 0;
+	if (workMain.orderPhase == workMain.checkpointPhase && workMain.issuedOrders - workMain.checkpointOrders < JOURNAL_INTERVAL) return 0;
+
+	uint64_t entry[2] = { workMain.issuedOrders, (uint64_t)workMain.orderPhase };
+	if (!writeJournalEntry(JournalTagCheckpoint, entry, sizeof(entry))) return 1;
+	lprintf(LogDebug, "Setup journal checkpoint: %" PRIu64 " orders completed (%s phase)\n", workMain.issuedOrders, PhaseNames[workMain.orderPhase]);
+	workMain.checkpointOrders = workMain.issuedOrders;
+	workMain.checkpointPhase = workMain.orderPhase;
+
+	if (workMain.recovering) {
+		// Everything from the interrupted batch has been completed again
+		WorkerOrder recoveryOrder;
+		recoveryOrder.code = WorkerSetRecovery;
+		recoveryOrder.setRecovery.enabled = false;
+		if (!broadcastToWorkplaces(&recoveryOrder)) return 1;
+		workMain.recovering = false;
+	}
+	return 0;
+}
 
-	while (true) {
-		WorkerResponse resp;
-		if (!readAll(wp->responsesFd, &resp, sizeof(WorkerResponse))) break;
+// Called by main process => main thread
+static void countDispatchedOrder(void) {
+	g_mutex_lock(&workMain.lock);
+	++workMain.dispatchedOrders;
+	g_mutex_unlock(&workMain.lock);
+}
 
-		switch (resp.code) {
-		case ResponsePong:
-			g_mutex_lock(&workMain.lock);
-			--workMain.pongsExpected;
-			if (workMain.pongsExpected == 0) g_cond_signal(&workMain.pongsFinished);
-			g_mutex_unlock(&workMain.lock);
-			break;
-		case ResponseLogPrint:
-			flexBufferGrow((void**)&wp->logBuffer, wp->logLen, &wp->logCap, resp.logMessage.len, 1);
-			if (!readAll(wp->responsesFd, &wp->logBuffer[wp->logLen], resp.logMessage.len)) goto done;
-			wp->logLen += resp.logMessage.len;
-			break;
-		case ResponseLogEnd:
-			flexBufferGrowAppendStr((void**)&wp->logBuffer, &wp->logLen, &wp->logCap, "");
-			lprintRaw(wp->logBuffer);
-			wp->logLen = 0;
-			break;
-		case ResponseError:
-			g_mutex_lock(&workMain.lock);
-			workMain.errorCode = resp.error.code;
-			workMain.receivedError = true;
+// Identifies the namespace holding a host in workMain.lastOrders
+static uint64_t hostResource(nodeId id, workHostLoc loc) {
+	return (loc.pack != 0 ? RESOURCE_PACK | loc.pack : id);
+}
 
-			// We need to signal other conditions just in case an error occurred
-			// while we were waiting for something else. Normally, we just
-			// handle errors asynchronously.
-			g_cond_signal(&workMain.receivedResponse);
-			g_cond_signal(&workMain.pongsFinished);
+// Called by main process with workMain.lock held. Returns the workplace that
+// owns the namespace holding a host. Packed hosts are owned by the workplace
+// that owns their pack. Hosts on other machines have no owner, in which case
+// -1 is returned. In adaptive mode, a namespace keeps the owner chosen among
+// the active workers when it was first used, so that changing their number
+// does not move namespaces between workers.
+static gint hostOwner(nodeId id, workHostLoc loc) {
+	if (loc.pack == WORK_REMOTE_PACK) return -1;
+	uint32_t key = (loc.pack != 0 ? loc.pack : id);
+	if (!workMain.adaptive) return (gint)(key % workMain.workerLimit);
+
+	uint64_t resource = hostResource(id, loc);
+	gpointer owner = g_hash_table_lookup(workMain.owners, &resource);
+	if (owner != NULL) return GPOINTER_TO_INT(owner) - 1;
+	gint wp = (gint)(key % workMain.activeWorkers);
+	uint64_t* ownerKey = emalloc(sizeof(uint64_t));
+	*ownerKey = resource;
+	g_hash_table_insert(workMain.owners, ownerKey, GINT_TO_POINTER(wp + 1));
+	return wp;
+}
 
-			g_mutex_unlock(&workMain.lock);
-			break;
-		default:
-			g_mutex_lock(&workMain.lock);
-			workMain.response = resp;
-			workMain.responseQueued = true;
-			g_cond_signal(&workMain.receivedResponse);
-			g_mutex_unlock(&workMain.lock);
-		}
-	}
+// Returns the owner of a host that is only modified in its own namespace
+static gint dedicatedOwner(nodeId id) {
+	workHostLoc loc = { .pack = 0, .slot = 0 };
+	return hostOwner(id, loc);
+}
 
-done:
-	lprintf(LogDebug, "Response thread for workplace %p shutting down\n", wp);
-	close(wp->responsesFd);
-	return NULL;
+// Returns true if the order identified by a token has been executed, or if it
+// never will be because its worker exited
+static bool tokenCompleted(const OrderToken* token) {
+	shmCounter* completed = workMain.workplaces[token->wp].completed;
+	return shmCounterReached(completed, token->seq) || shmCounterClosed(completed);
 }
 
-// Called by child process
-static void childLogPrint(const char* msg) {
-	WorkerResponse resp;
-	ZERO_RESPONSE(&resp);
-	if (msg == NULL) {
-		resp.code = ResponseLogEnd;
-	} else {
-		resp.code = ResponseLogPrint;
-		resp.logMessage.len = strlen(msg);
+// Called by main process with workMain.lock held. Queues an order for a
+// workplace, or for the next one in turn if wp is negative. The order depends
+// on the latest order that used each of the given resources in a different
+// workplace, and it becomes the latest order for those resources. Orders in
+// the same workplace are executed in sequence, so they need no dependencies.
+static void queueOrder(WorkerOrder* order, gint wp, const uint64_t resources[], size_t resourceCount) {
+	if (wp < 0) {
+		wp = (gint)(workMain.nextWorkplace % workMain.activeWorkers);
+		workMain.nextWorkplace = (guint)wp + 1;
 	}
-	resp.code = (msg == NULL ? ResponseLogEnd : ResponseLogPrint);
-	writeAll(STDOUT_FILENO, &resp, sizeof(WorkerResponse));
-	if (msg != NULL) {
-		writeAll(STDOUT_FILENO, msg, resp.logMessage.len);
+	Workplace* workplace = &workMain.workplaces[wp];
+	OrderToken token = { .wp = wp, .seq = ++workplace->queuedOrders };
+	order->queuedAt = g_get_monotonic_time();
+
+	order->afterCount = 0;
+	for (size_t i = 0; i < resourceCount; ++i) {
+		OrderToken* last = g_hash_table_lookup(workMain.lastOrders, &resources[i]);
+		if (last == NULL) {
+			last = emalloc(sizeof(OrderToken) + sizeof(uint64_t));
+			*(uint64_t*)(last + 1) = resources[i];
+			g_hash_table_insert(workMain.lastOrders, last + 1, last);
+		} else if (last->wp != wp && !tokenCompleted(last)) {
+			order->after[order->afterCount++] = *last;
+		}
+		*last = token;
 	}
+
+	++workMain.unsentOrders;
+	g_async_queue_push(workplace->queue, order);
+}
+
+// Copies an order that has no extraneous buffers
+static WorkerOrder* copySecondaryOrder(const WorkerOrder* order) {
+	WorkerOrder* copy = emalloc(sizeof(WorkerOrder));
+	*copy = *order;
+	copy->secondary = true;
+	return copy;
+}
+
+// Called by main process with workMain.lock held. Queues an order for the
+// workplace that owns the namespace that it modifies, after any orders that it
+// depends on. Orders that modify two hosts with different owners are divided.
+// The route and check orders act on each host independently, so each owner
+// receives a copy in which the other host is marked as remote, causing the
+// worker to skip it. For new links, the source's owner creates the pair and
+// configures its end, and then hands off the target's end to the target's
+// owner with a WorkerAddLinkPeer order that depends on the first half. Link
+// shaping is divided in the same way, except that the halves are independent.
+// Orders that use Open vSwitch depend on each other, since its commands cannot be
+// executed in parallel. Other orders are distributed in turn.
+static void dispatchOrder(WorkerOrder* order) {
+	gint owner = -1;
+	uint64_t resources[ORDER_MAX_DEPS];
+	size_t resourceCount = 0;
+
+	switch (order->code) {
+	case WorkerAddHostPack: {
+		workHostLoc loc = { .pack = order->addHostPack.pack, .slot = 0 };
+		owner = hostOwner(0, loc);
+		resources[resourceCount++] = hostResource(0, loc);
+		break;
+	}
+	case WorkerAddHost:
+		owner = hostOwner(order->addHost.id, order->addHost.loc);
+		resources[resourceCount++] = hostResource(order->addHost.id, order->addHost.loc);
+		break;
+	case WorkerSetClientShaping:
+		owner = dedicatedOwner(order->setClientShaping.id);
+		resources[resourceCount++] = order->setClientShaping.id;
+		break;
+	case WorkerSetSelfLink:
+		owner = dedicatedOwner(order->setSelfLink.id);
+		resources[resourceCount++] = order->setSelfLink.id;
+		break;
+	case WorkerAddTunnel:
+		owner = hostOwner(order->addTunnel.localId, order->addTunnel.localLoc);
+		resources[resourceCount++] = hostResource(order->addTunnel.localId, order->addTunnel.localLoc);
+		break;
+	case WorkerSetLinkShaping: {
+		nodeId sourceId = order->setLinkShaping.sourceId;
+		nodeId targetId = order->setLinkShaping.targetId;
+		owner = dedicatedOwner(sourceId);
+		gint other = dedicatedOwner(targetId);
+		resources[resourceCount++] = sourceId;
+		if (owner != other) {
+			order->handOff = true;
+			WorkerOrder* peer = copySecondaryOrder(order);
+			peer->setLinkShaping.sourceId = targetId;
+			peer->setLinkShaping.targetId = sourceId;
+			uint64_t targetResource = targetId;
+			queueOrder(peer, other, &targetResource, 1);
+		} else {
+			resources[resourceCount++] = targetId;
+		}
+		break;
+	}
+	case WorkerRemoveLink:
+		owner = dedicatedOwner(order->removeLink.sourceId);
+		resources[resourceCount++] = order->removeLink.sourceId;
+		resources[resourceCount++] = order->removeLink.targetId;
+		break;
+	case WorkerModifyInternalRoute:
+		owner = dedicatedOwner(order->modifyInternalRoute.id);
+		resources[resourceCount++] = order->modifyInternalRoute.id;
+		break;
+	case WorkerAddClientRoutes:
+		owner = dedicatedOwner(order->addClientRoutes.clientId);
+		resources[resourceCount++] = order->addClientRoutes.clientId;
+		resources[resourceCount++] = RESOURCE_OVS;
+		break;
+	case WorkerAddRoot:
+	case WorkerAddEdgeInterface:
+	case WorkerAddEdgeRoutes:
+		resources[resourceCount++] = RESOURCE_OVS;
+		break;
+	case WorkerDestroyHost:
+		owner = dedicatedOwner(order->destroyHost.id);
+		resources[resourceCount++] = order->destroyHost.id;
+		break;
+	case WorkerCheckHost:
+		owner = hostOwner(order->checkHost.id, order->checkHost.loc);
+		resources[resourceCount++] = hostResource(order->checkHost.id, order->checkHost.loc);
+		break;
+	case WorkerCheckLink: {
+		nodeId sourceId = order->checkLink.sourceId;
+		nodeId targetId = order->checkLink.targetId;
+		owner = hostOwner(sourceId, order->checkLink.sourceLoc);
+		gint other = hostOwner(targetId, order->checkLink.targetLoc);
+		if (owner >= 0 && other >= 0 && owner != other) {
+			WorkerOrder* copy = copySecondaryOrder(order);
+			copy->checkLink.sourceLoc.pack = WORK_REMOTE_PACK;
+			order->checkLink.targetLoc.pack = WORK_REMOTE_PACK;
+			uint64_t copyResource = hostResource(targetId, copy->checkLink.targetLoc);
+			queueOrder(copy, other, &copyResource, 1);
+		}
+		if (owner < 0) owner = other;
+		if (order->checkLink.sourceLoc.pack != WORK_REMOTE_PACK) resources[resourceCount++] = hostResource(sourceId, order->checkLink.sourceLoc);
+		if (order->checkLink.targetLoc.pack != WORK_REMOTE_PACK) resources[resourceCount++] = hostResource(targetId, order->checkLink.targetLoc);
+		break;
+	}
+	case WorkerAddInternalRoutes: {
+		nodeId id1 = order->addInternalRoutes.id1;
+		nodeId id2 = order->addInternalRoutes.id2;
+		owner = hostOwner(id1, order->addInternalRoutes.loc1);
+		gint other = hostOwner(id2, order->addInternalRoutes.loc2);
+		if (owner >= 0 && other >= 0 && owner != other) {
+			WorkerOrder* copy = copySecondaryOrder(order);
+			copy->addInternalRoutes.loc1.pack = WORK_REMOTE_PACK;
+			order->addInternalRoutes.loc2.pack = WORK_REMOTE_PACK;
+			uint64_t copyResource = hostResource(id2, copy->addInternalRoutes.loc2);
+			queueOrder(copy, other, &copyResource, 1);
+		}
+		if (owner < 0) owner = other;
+		if (order->addInternalRoutes.loc1.pack != WORK_REMOTE_PACK) resources[resourceCount++] = hostResource(id1, order->addInternalRoutes.loc1);
+		if (order->addInternalRoutes.loc2.pack != WORK_REMOTE_PACK) resources[resourceCount++] = hostResource(id2, order->addInternalRoutes.loc2);
+		break;
+	}
+	case WorkerAddLink: {
+		workHostLoc sourceLoc = order->addLink.sourceLoc;
+		workHostLoc targetLoc = order->addLink.targetLoc;
+		owner = hostOwner(order->addLink.sourceId, sourceLoc);
+		gint other = hostOwner(order->addLink.targetId, targetLoc);
+		uint64_t targetResource = hostResource(order->addLink.targetId, targetLoc);
+		resources[resourceCount++] = hostResource(order->addLink.sourceId, sourceLoc);
+		resources[resourceCount++] = targetResource;
+		if (owner != other) {
+			order->handOff = true;
+			WorkerOrder* peer = copySecondaryOrder(order);
+			peer->code = WorkerAddLinkPeer;
+			queueOrder(order, owner, resources, resourceCount);
+			queueOrder(peer, other, &targetResource, 1);
+			return;
+		}
+		break;
+	}
+	default: break;
+	}
+	queueOrder(order, owner, resources, resourceCount);
+}
+
+// Called by main process => main thread in adaptive mode, whenever another
+// ADAPT_SAMPLE_ORDERS orders have been sent. The completion counters are
+// sampled without waiting for the workers. Once ADAPT_EPOCH_ORDERS orders have
+// been completed since the measurement began, their rate is compared with the
+// previous measurement in the same phase and the number of active workers is
+// changed immediately. The search keeps moving in the same direction while the
+// rate improves, and turns back with a smaller step when it does not. Once the
+// step is a single worker, the count keeps probing its neighbours, which
+// follows changes in contention as the network grows. The next measurement
+// only begins after the orders that were queued for the previous workers have
+// been completed.
+static void adaptWorkers(void) {
+	uint64_t completed = workGetCompletedOrders();
+	if (completed < workMain.adaptOrders) return;
+	gint64 now = g_get_monotonic_time();
+	if (workMain.adaptStart == 0) {
+		workMain.adaptOrders = completed;
+		workMain.adaptStart = now;
+		return;
+	}
+	uint64_t orders = completed - workMain.adaptOrders;
+	gint64 elapsed = now - workMain.adaptStart;
+	if (orders < ADAPT_EPOCH_ORDERS || elapsed <= 0) return;
+
+	double rate = (double)orders * G_USEC_PER_SEC / (double)elapsed;
+	WorkerAdaptation* adapt = &workMain.adaptation[workMain.phase];
+	if (adapt->lastRate > 0.0 && rate < adapt->lastRate) {
+		gint step = -adapt->step / 2;
+		adapt->step = (step != 0 ? step : (adapt->step > 0 ? -1 : 1));
+	}
+	adapt->lastRate = rate;
+
+	gint workers = (gint)workMain.activeWorkers + adapt->step;
+	if (workers < 1 || workers > (gint)workMain.workerLimit) {
+		adapt->step = -adapt->step;
+		workers = (gint)workMain.activeWorkers + adapt->step;
+	}
+	lprintf(LogDebug, "Adaptive worker pool completed %" PRIu64 " orders at %.0f orders/s with %u workers in the %s phase; switching to %d workers\n", orders, rate, workMain.activeWorkers, PhaseNames[workMain.phase], workers);
+	adapt->workers = (guint)workers;
+	workMain.activeWorkers = adapt->workers;
+	workMain.adaptOrders = workMain.adaptQueued;
+	workMain.adaptStart = 0;
+}
+
+// Called by main process => main thread. The order is released even if it is
+// not sent.
+static int sendOrder(WorkerOrder* order, bool ignoreErrors) {
+	bool abort = false;
+	if (!ignoreErrors) {
+		g_mutex_lock(&workMain.lock);
+		if (workMain.receivedError) abort = true;
+		g_mutex_unlock(&workMain.lock);
+	}
+	if (abort) {
+		freeOrderContents(order);
+		free(order);
+		return workMain.errorCode;
+	}
+
+	if (workMain.recording && orderIsPlannable(order)) {
+		bool recorded = recordPlanEntry(order->code, order);
+		freeOrderContents(order);
+		free(order);
+		countDispatchedOrder();
+		return recorded ? 0 : 1;
+	}
+
+	bool journaled = (workMain.journalFile != NULL && orderIsPlannable(order));
+	if (journaled) {
+		bool execute;
+		int err = journalOrder(order, &execute);
+		if (err != 0 || !execute) {
+			freeOrderContents(order);
+			free(order);
+			if (err == 0) countDispatchedOrder();
+			return err;
+		}
+	}
+
+	g_mutex_lock(&workMain.lock);
+	dispatchOrder(order);
+	g_mutex_unlock(&workMain.lock);
+	if (workMain.adaptive && ++workMain.adaptQueued % ADAPT_SAMPLE_ORDERS == 0) adaptWorkers();
+
+	// Long sequences of orders are split so that the journal has checkpoints
+	if (journaled && workMain.issuedOrders >= workMain.checkpointOrders + JOURNAL_INTERVAL) {
+		return workJoin(false);
+	}
+
+	return 0;
+}
+
+// Called by main process => main thread
+static bool broadcastOrder(WorkerOrder* order) {
+	if (workMain.recording && orderIsPlannable(order)) {
+		return recordPlanEntry(PlanTagBroadcast, order);
+	}
+	if (workMain.journalFile != NULL && orderIsPlannable(order)) {
+		bool execute;
+		if (journalOrder(order, &execute) != 0) return false;
+		if (!execute) return true;
+	}
+	return broadcastToWorkplaces(order);
+}
+
+// Orders gathered by a send thread for its next batch
+typedef struct {
+	WorkerOrder* orders[BATCH_MAX_ORDERS];
+	uint32_t count;
+	uint32_t primary; // Orders that are not secondary
+	size_t bytes;
+} SendBatch;
+
+// Called by send threads. Sends the orders in a batch and accounts for them,
+// along with "discarded" orders that were removed from the queue without being
+// sent.
+static void flushBatch(Workplace* wp, SendBatch* batch, uint32_t discarded) {
+	if (batch->count > 0) writeBatchToWorkplace(batch->orders, batch->count, wp);
+	for (uint32_t i = 0; i < batch->count; ++i) {
+		freeOrderContents(batch->orders[i]);
+		free(batch->orders[i]);
+	}
+
+	g_mutex_lock(&workMain.lock);
+	workMain.dispatchedOrders += batch->primary;
+	wp->sentOrders += batch->count;
+	workMain.unsentOrders -= batch->count + discarded;
+	if (workMain.unsentOrders == 0) g_cond_signal(&workMain.allOrdersSent);
+	g_mutex_unlock(&workMain.lock);
+
+	batch->count = 0;
+	batch->primary = 0;
+	batch->bytes = 0;
+}
+
+// Called by send threads and worker threads. Returns true if the orders that an
+// order depends on have been executed. If wait is true, the function blocks
+// until they are.
+static bool dependenciesCompleted(const WorkerOrder* order, bool wait) {
+	for (uint32_t i = 0; i < order->afterCount; ++i) {
+		const OrderToken* token = &order->after[i];
+		if (tokenCompleted(token)) continue;
+		if (!wait) return false;
+		shmCounterWait(workMain.workplaces[token->wp].completed, token->seq);
+	}
+	return true;
+}
+
+// The entry point for the send threads in the main process
+static void* sendThread(gpointer data) {
+	Workplace* wp = data;
+
+	SendBatch batch;
+	batch.count = 0;
+	batch.primary = 0;
+	batch.bytes = 0;
+
+	bool loop = true;
+	while (loop) {
+		// Wait for an order, and then gather any others that follow shortly
+		// into the same batch
+		uint32_t discarded = 0;
+		gpointer item = g_async_queue_pop(wp->queue);
+		while (item != NULL) {
+			WorkerOrder* order = item;
+			if (order->code == WorkerTerminate) {
+				loop = false;
+				free(order);
+				++discarded;
+				break;
+			}
+
+			// Orders that depend on unfinished work in other workplaces are
+			// held back. The batch so far is sent first, since other
+			// workplaces may be waiting for it.
+			if (!dependenciesCompleted(order, false)) {
+				flushBatch(wp, &batch, 0);
+				dependenciesCompleted(order, true);
+			}
+
+			batch.orders[batch.count++] = order;
+			if (!order->secondary) ++batch.primary;
+			batch.bytes += sizeof(WorkerOrder);
+			if (order->code == WorkerConfigure) {
+				batch.bytes += order->configure.nsPrefixLen + order->configure.ovsDirLen + order->configure.ovsSchemaLen;
+			} else if (order->code == WorkerGetEdgeRemoteMacs) {
+				batch.bytes += order->getEdgeRemoteMacs.count * sizeof(EdgeMacQuery);
+			}
+			if (batch.count == BATCH_MAX_ORDERS || batch.bytes >= BATCH_MAX_BYTES) break;
+			item = g_async_queue_timeout_pop(wp->queue, BATCH_LINGER_US);
+		}
+		flushBatch(wp, &batch, discarded);
+	}
+
+	lprintf(LogDebug, "Order sending thread for workplace %p shutting down\n", wp);
+	if (wp->ordersRing != NULL) shmRingClose(wp->ordersRing);
+	close(wp->ordersFd);
+	return NULL;
+}
+
+// Called by main process => response threads and worker threads. Records an
+// error reported by a workplace, or a response to a query.
+static void handleResponse(Workplace* wp, const WorkerResponse* resp) {
+	g_mutex_lock(&workMain.lock);
+	if (resp->code == ResponseError) {
+		workMain.errorCode = resp->error.code;
+		workMain.receivedError = true;
+		++wp->reportedErrors;
+
+		// We need to signal other conditions just in case an error occurred
+		// while we were waiting for something else. Normally, we just handle
+		// errors asynchronously.
+		g_cond_broadcast(&workMain.receivedResponse);
+		g_cond_broadcast(&workMain.errorsReported);
+	} else {
+		QueryFuture* future = g_hash_table_lookup(workMain.futures, GUINT_TO_POINTER(resp->tag));
+		gpointer pending;
+		if (future == NULL && g_hash_table_lookup_extended(workMain.abandonedTags, GUINT_TO_POINTER(resp->tag), NULL, &pending)) {
+			lprintf(LogDebug, "Discarding late response code %d for abandoned query %u\n", resp->code, resp->tag);
+			size_t remaining = GPOINTER_TO_SIZE(pending) - 1;
+			if (remaining == 0) g_hash_table_remove(workMain.abandonedTags, GUINT_TO_POINTER(resp->tag));
+			else g_hash_table_insert(workMain.abandonedTags, GUINT_TO_POINTER(resp->tag), GSIZE_TO_POINTER(remaining));
+		} else if (future == NULL && resp->tag <= workMain.abandonedBefore) {
+			lprintf(LogDebug, "Discarding late response code %d for query %u, which was abandoned before the last join\n", resp->code, resp->tag);
+		} else if (future == NULL || future->received == future->count) {
+			lprintf(LogError, "BUG: received response code %d for unknown query %u\n", resp->code, resp->tag);
+		} else {
+			if (workMain.orderStats) latencyRecord(&workMain.responseLatencies[future->orderCode], g_get_monotonic_time() - resp->sentAt);
+			future->responses[future->received++] = *resp;
+			if (future->received == future->count) g_cond_broadcast(&workMain.receivedResponse);
+		}
+	}
+	g_mutex_unlock(&workMain.lock);
+}
+
+// The entry point for the response threads in the main process
+static void* responseThread(gpointer data) {
+	Workplace* wp = data;
+
+	while (true) {
+		WorkerResponse resp;
+		if (!readFromWorker(wp, &resp, sizeof(WorkerResponse))) break;
+
+		switch (resp.code) {
+		case ResponseLogPrint:
+			flexBufferGrow((void**)&wp->logBuffer, wp->logLen, &wp->logCap, resp.logMessage.len, 1);
+			if (!readFromWorker(wp, &wp->logBuffer[wp->logLen], resp.logMessage.len)) goto done;
+			wp->logLen += resp.logMessage.len;
+			break;
+		case ResponseLogEnd:
+			flexBufferGrowAppendStr((void**)&wp->logBuffer, &wp->logLen, &wp->logCap, "");
+			lprintRaw(wp->logBuffer);
+			wp->logLen = 0;
+			break;
+		default:
+			handleResponse(wp, &resp);
+			break;
+		}
+	}
+
+done:
+	// Orders that depend on this workplace and joins must not wait for it
+	// forever
+	shmCounterClose(wp->completed);
+	g_mutex_lock(&workMain.lock);
+	g_cond_broadcast(&workMain.errorsReported);
+	g_mutex_unlock(&workMain.lock);
+
+	lprintf(LogDebug, "Response thread for workplace %p shutting down\n", wp);
+	close(wp->responsesFd);
+	return NULL;
 }
 
 // Called by child process
+static void childLogPrint(const char* msg) {
+	WorkerResponse resp;
+	ZERO_RESPONSE(&resp);
+	if (msg == NULL) {
+		resp.code = ResponseLogEnd;
+	} else {
+		resp.code = ResponseLogPrint;
+		resp.logMessage.len = strlen(msg);
+	}
+	resp.code = (msg == NULL ? ResponseLogEnd : ResponseLogPrint);
+	writeToMain(&resp, sizeof(WorkerResponse));
+	if (msg != NULL) {
+		writeToMain(msg, resp.logMessage.len);
+	}
+}
+
+// Called by workers
 static void respondError(int code) {
 	lprintf(LogDebug, "Sending error code %d to parent process\n", code);
 	WorkerResponse resp;
 	ZERO_RESPONSE(&resp);
 	resp.code = ResponseError;
 	resp.error.code = code;
-	writeAll(STDOUT_FILENO, &resp, sizeof(WorkerResponse));
+
+	// The error is counted after it is sent so that a join that sees the count
+	// knows that the response is already on its way
+	if (threadWorkplace != NULL) {
+		handleResponse(threadWorkplace, &resp);
+		shmCounterAdd(threadWorkplace->failed, 1);
+	} else {
+		writeToMain(&resp, sizeof(WorkerResponse));
+		shmCounterAdd(workChild.failed, 1);
+	}
+}
+
+// Called by workers. Sends a response to a query.
+static bool respondToQuery(WorkerResponse* resp) {
+	resp->sentAt = g_get_monotonic_time();
+	if (threadWorkplace != NULL) {
+		handleResponse(threadWorkplace, resp);
+		return true;
+	}
+	return writeToMain(resp, sizeof(WorkerResponse));
+}
+
+// Called by workers. Executes an order and reports any error to the main
+// process. initialized tracks whether the worker has been configured.
+static void executeOrder(WorkerOrder* order, bool* initialized) {
+	// The worker must only be initialized once
+	if (*initialized && (order->code == WorkerConfigure)) {
+		lprintln(LogError, "Attempted duplicate worker initialization");
+		respondError(1);
+	} else if (!*initialized && order->code != WorkerConfigure) {
+		lprintf(LogError, "Invalid order code for uninitialized worker: %d\n", order->code);
+		respondError(1);
+	} else {
+		int err = 0;
+		switch (order->code) {
+		case WorkerConfigure: {
+			// Worker threads share the log settings of the main process
+			if (threadWorkplace == NULL) {
+				logSetColorize(order->configure.logColorize);
+				logSetThreshold(order->configure.logThreshold);
+				workChild.orderStats = order->configure.orderStats;
+			}
+			lprintf(LogDebug, "Configuring worker\n");
+			err = workerInit(order->configure.nsPrefix, order->configure.ovsDir, order->configure.ovsSchema, order->configure.softMemCap);
+			if (err == 0) {
+				*initialized = true;
+			} else {
+				lprintln(LogError, "Failed to initialize worker due to configuration order");
+			}
+			break;
+		}
+		case WorkerGetEdgeRemoteMacs: {
+			size_t count = order->getEdgeRemoteMacs.count;
+			netArpTarget* targets = eamalloc(count, sizeof(netArpTarget), 0);
+			for (size_t i = 0; i < count; ++i) {
+				targets[i].intfName = order->getEdgeRemoteMacs.queries[i].intfName;
+				targets[i].ip = order->getEdgeRemoteMacs.queries[i].ip;
+			}
+
+			// One response is sent for each edge node, in order
+			err = workerGetEdgeRemoteMacs(targets, count);
+			for (size_t i = 0; err == 0 && i < count; ++i) {
+				WorkerResponse resp;
+				ZERO_RESPONSE(&resp);
+				resp.code = ResponseGotEdgeMac;
+				resp.tag = order->tag;
+				resp.gotEdgeMac.found = targets[i].found;
+				memcpy(resp.gotEdgeMac.mac.octets, targets[i].mac.octets, MAC_ADDR_BYTES);
+				respondToQuery(&resp);
+			}
+			free(targets);
+			break;
+		}
+		case WorkerGetEdgeLocalMac: {
+			WorkerResponse resp;
+			ZERO_RESPONSE(&resp);
+			resp.code = ResponseGotMac;
+			resp.tag = order->tag;
+
+			err = workerGetEdgeLocalMac(order->getEdgeLocalMac.intfName, &resp.gotMac.mac);
+			if (err == 0) respondToQuery(&resp);
+			break;
+		}
+		case WorkerGetInterfaceMtu: {
+			WorkerResponse resp;
+			ZERO_RESPONSE(&resp);
+			resp.code = ResponseGotMtu;
+			resp.tag = order->tag;
+
+			err = workerGetInterfaceMtu(order->getInterfaceMtu.intfName, &resp.gotMtu.mtu);
+			if (err == 0) respondToQuery(&resp);
+			break;
+		}
+		case WorkerMtuSupported: {
+			WorkerResponse resp;
+			ZERO_RESPONSE(&resp);
+			resp.code = ResponseGotMtuSupported;
+			resp.tag = order->tag;
+
+			err = workerMtuSupported(order->mtuSupported.mtu, &resp.gotMtuSupported.supported, &resp.gotMtuSupported.failReason);
+			if (err == 0) respondToQuery(&resp);
+			break;
+		}
+		case WorkerBenchmark: {
+			WorkerResponse resp;
+			ZERO_RESPONSE(&resp);
+			resp.code = ResponseBenchmarked;
+			resp.tag = order->tag;
+
+			err = workerBenchmark(order->benchmark.samples, &resp.benchmarked);
+			if (err == 0) respondToQuery(&resp);
+			break;
+		}
+		case WorkerAddRoot:
+			err = workerAddRoot(order->addRoot.addrSelf, order->addRoot.addrOther, order->addRoot.mtu, order->addRoot.useInitNs, order->addRoot.existing);
+			break;
+		case WorkerAddEdgeInterface: {
+			err = workerAddEdgeInterface(order->addEdgeInterface.intfName);
+			break;
+		}
+		case WorkerAddHostPack:
+			err = workerAddHostPack(order->addHostPack.pack);
+			break;
+		case WorkerAddHost:
+			err = workerAddHost(order->addHost.id, &order->addHost.loc, order->addHost.ip, order->addHost.macs, order->addHost.mtu, &order->addHost.node);
+			break;
+		case WorkerSetClientShaping:
+			err = workerSetClientShaping(order->setClientShaping.id, &order->setClientShaping.node);
+			break;
+		case WorkerSetSelfLink:
+			err = workerSetSelfLink(order->setSelfLink.id, &order->setSelfLink.link);
+			break;
+		case WorkerEnsureSystemScaling:
+			err = workerEnsureSystemScaling(&order->ensureSystemScaling.counts, order->ensureSystemScaling.workers);
+			break;
+		case WorkerAddLink:
+			if (!order->handOff) {
+				err = workerAddLink(order->addLink.sourceId, order->addLink.targetId, &order->addLink.sourceLoc, &order->addLink.targetLoc, order->addLink.sourceIp, order->addLink.targetIp, order->addLink.macs, order->addLink.mtu, &order->addLink.link);
+			} else {
+				err = workerAddLinkSource(order->addLink.sourceId, order->addLink.targetId, &order->addLink.sourceLoc, &order->addLink.targetLoc, order->addLink.sourceIp, order->addLink.targetIp, order->addLink.macs, order->addLink.mtu, &order->addLink.link);
+			}
+			break;
+		case WorkerAddLinkPeer:
+			err = workerAddLinkTarget(order->addLink.sourceId, order->addLink.targetId, &order->addLink.sourceLoc, &order->addLink.targetLoc, order->addLink.sourceIp, order->addLink.targetIp, order->addLink.macs, order->addLink.mtu, &order->addLink.link);
+			break;
+		case WorkerAddTunnel:
+			err = workerAddTunnel(order->addTunnel.localId, order->addTunnel.remoteId, &order->addTunnel.localLoc, order->addTunnel.localIp, order->addTunnel.remoteIp, order->addTunnel.macs, order->addTunnel.mtu, &order->addTunnel.link, order->addTunnel.vni, order->addTunnel.underlayLocal, order->addTunnel.underlayRemote);
+			break;
+		case WorkerSetLinkShaping:
+			err = workerSetLinkShaping(order->setLinkShaping.sourceId, order->setLinkShaping.targetId, order->handOff, &order->setLinkShaping.link);
+			break;
+		case WorkerRemoveLink:
+			err = workerRemoveLink(order->removeLink.sourceId, order->removeLink.targetId);
+			break;
+		case WorkerAddInternalRoutes:
+			err = workerAddInternalRoutes(order->addInternalRoutes.id1, order->addInternalRoutes.id2, &order->addInternalRoutes.loc1, &order->addInternalRoutes.loc2, order->addInternalRoutes.ip1, order->addInternalRoutes.ip2, &order->addInternalRoutes.subnet1, &order->addInternalRoutes.subnet2);
+			break;
+		case WorkerModifyInternalRoute:
+			err = workerModifyInternalRoute(order->modifyInternalRoute.id, order->modifyInternalRoute.nextId, order->modifyInternalRoute.nextIp, &order->modifyInternalRoute.subnet, order->modifyInternalRoute.remove);
+			break;
+		case WorkerAddClientRoutes:
+			err = workerAddClientRoutes(order->addClientRoutes.clientId, order->addClientRoutes.clientMacs, &order->addClientRoutes.subnet, order->addClientRoutes.edgePort, order->addClientRoutes.clientPorts);
+			break;
+		case WorkerAddEdgeRoutes:
+			err = workerAddEdgeRoutes(&order->addEdgeRoutes.edgeSubnet, order->addEdgeRoutes.edgePort, &order->addEdgeRoutes.edgeLocalMac, &order->addEdgeRoutes.edgeRemoteMac);
+			break;
+		case WorkerDestroyHost:
+			err = workerDestroyHost(order->destroyHost.id);
+			break;
+		case WorkerDestroyHosts:
+			err = workerDestroyHosts();
+			break;
+		case WorkerSetRecovery:
+			workerSetRecovery(order->setRecovery.enabled);
+			break;
+		case WorkerCheckHost:
+			err = workerCheckHost(order->checkHost.id, &order->checkHost.loc);
+			break;
+		case WorkerCheckLink:
+			err = workerCheckLink(order->checkLink.sourceId, order->checkLink.targetId, &order->checkLink.sourceLoc, &order->checkLink.targetLoc);
+			break;
+		default:
+			lprintf(LogError, "Unknown order code %d\n", order->code);
+			err = 1;
+			break;
+		}
+		if (err != 0) respondError(err);
+	}
 }
 
 // The entry point for child processes
@@ -521,111 +2133,20 @@ static int childProcess(guint id) {
 		WorkerOrder order;
 		if (!readOrder(&order)) break;
 		lprintf(LogDebug, "Received order code %d\n", order.code);
+		gint64 startTime = g_get_monotonic_time();
 
-		// The worker must only be initialized once
-		if (initialized && (order.code == WorkerConfigure)) {
-			lprintln(LogError, "Attempted duplicate worker initialization");
-			respondError(1);
-		} else if (!initialized && !(order.code == WorkerConfigure || order.code == WorkerPing)) {
-			lprintf(LogError, "Invalid order code for uninitialized worker: %d\n", order.code);
-			respondError(1);
-		} else {
-			int err = 0;
-			switch (order.code) {
-			case WorkerPing: {
-				WorkerResponse resp;
-				ZERO_RESPONSE(&resp);
-				resp.code = ResponsePong;
-				writeAll(STDOUT_FILENO, &resp, sizeof(WorkerResponse));
-				break;
-			}
-			case WorkerConfigure: {
-				logSetColorize(order.configure.logColorize);
-				logSetThreshold(order.configure.logThreshold);
-				lprintf(LogDebug, "Configuring worker process\n");
-				err = workerInit(order.configure.nsPrefix, order.configure.ovsDir, order.configure.ovsSchema, order.configure.softMemCap);
-				if (err == 0) {
-					initialized = true;
-				} else {
-					lprintln(LogError, "Failed to initialize worker due to configuration order");
-				}
-				break;
-			}
-			case WorkerGetEdgeRemoteMac: {
-				WorkerResponse resp;
-				ZERO_RESPONSE(&resp);
-				resp.code = ResponseGotMac;
-
-				err = workerGetEdgeRemoteMac(order.getEdgeRemoteMac.intfName, order.getEdgeRemoteMac.ip, &resp.gotMac.mac);
-				if (err == 0) writeAll(STDOUT_FILENO, &resp, sizeof(WorkerResponse));
-				break;
-			}
-			case WorkerGetEdgeLocalMac: {
-				WorkerResponse resp;
-				ZERO_RESPONSE(&resp);
-				resp.code = ResponseGotMac;
-
-				err = workerGetEdgeLocalMac(order.getEdgeLocalMac.intfName, &resp.gotMac.mac);
-				if (err == 0) writeAll(STDOUT_FILENO, &resp, sizeof(WorkerResponse));
-				break;
-			}
-			case WorkerGetInterfaceMtu: {
-				WorkerResponse resp;
-				ZERO_RESPONSE(&resp);
-				resp.code = ResponseGotMtu;
-
-				err = workerGetInterfaceMtu(order.getInterfaceMtu.intfName, &resp.gotMtu.mtu);
-				if (err == 0) writeAll(STDOUT_FILENO, &resp, sizeof(WorkerResponse));
-				break;
-			}
-			case WorkerMtuSupported: {
-				WorkerResponse resp;
-				ZERO_RESPONSE(&resp);
-				resp.code = ResponseGotMtuSupported;
-
-				err = workerMtuSupported(order.mtuSupported.mtu, &resp.gotMtuSupported.supported, &resp.gotMtuSupported.failReason);
-				if (err == 0) writeAll(STDOUT_FILENO, &resp, sizeof(WorkerResponse));
-				break;
-			}
-			case WorkerAddRoot:
-				err = workerAddRoot(order.addRoot.addrSelf, order.addRoot.addrOther, order.addRoot.mtu, order.addRoot.useInitNs, order.addRoot.existing);
-				break;
-			case WorkerAddEdgeInterface: {
-				err = workerAddEdgeInterface(order.addEdgeInterface.intfName);
-				break;
-			}
-			case WorkerAddHost:
-				err = workerAddHost(order.addHost.id, order.addHost.ip, order.addHost.macs, order.addHost.mtu, &order.addHost.node);
-				break;
-			case WorkerSetSelfLink:
-				err = workerSetSelfLink(order.setSelfLink.id, &order.setSelfLink.link);
-				break;
-			case WorkerEnsureSystemScaling:
-				err = workerEnsureSystemScaling(order.ensureSystemScaling.linkCount, order.ensureSystemScaling.nodeCount, order.ensureSystemScaling.clientNodes);
-				break;
-			case WorkerAddLink:
-				err = workerAddLink(order.addLink.sourceId, order.addLink.targetId, order.addLink.sourceIp, order.addLink.targetIp, order.addLink.macs, order.addLink.mtu, &order.addLink.link);
-				break;
-			case WorkerAddInternalRoutes:
-				err = workerAddInternalRoutes(order.addInternalRoutes.id1, order.addInternalRoutes.id2, order.addInternalRoutes.ip1, order.addInternalRoutes.ip2, &order.addInternalRoutes.subnet1, &order.addInternalRoutes.subnet2);
-				break;
-			case WorkerAddClientRoutes:
-				err = workerAddClientRoutes(order.addClientRoutes.clientId, order.addClientRoutes.clientMacs, &order.addClientRoutes.subnet, order.addClientRoutes.edgePort, order.addClientRoutes.clientPorts);
-				break;
-			case WorkerAddEdgeRoutes:
-				err = workerAddEdgeRoutes(&order.addEdgeRoutes.edgeSubnet, order.addEdgeRoutes.edgePort, &order.addEdgeRoutes.edgeLocalMac, &order.addEdgeRoutes.edgeRemoteMac);
-				break;
-			case WorkerDestroyHosts:
-				err = workerDestroyHosts();
-				break;
-			default:
-				lprintf(LogError, "Unknown order code %d\n", order.code);
-				err = 1;
-				break;
-			}
-			if (err != 0) respondError(err);
+		executeOrder(&order, &initialized);
+		if (workChild.orderStats && (size_t)order.code < ORDER_CODE_COUNT) {
+			latencyRecord(&workChild.latencies->wait[order.code], startTime - workChild.batchSentAt);
+			latencyRecord(&workChild.latencies->exec[order.code], g_get_monotonic_time() - startTime);
 		}
 		freeOrderContents(&order);
+
+		// Orders are counted as executed once the whole batch is finished
+		if (workChild.batchPos == workChild.batchLen && workChild.batchCount > 0) {
+			shmCounterAdd(workChild.completed, workChild.batchCount);
+			workChild.batchCount = 0;
+		}
 	}
 	lprintln(LogDebug, "Child process terminating");
 	if (initialized) {
@@ -634,13 +2155,104 @@ static int childProcess(guint id) {
 	return 0;
 }
 
+// The entry point for worker threads. Each thread executes the orders in its
+// queue once their dependencies have been completed, switching between
+// namespaces on its own, and handles its own responses.
+static void* workThread(gpointer data) {
+	Workplace* wp = data;
+	threadWorkplace = wp;
+
+	char prefix[20];
+	snprintf(prefix, 20, " [T%u]", (guint)(wp - workMain.workplaces));
+	logSetPrefix(prefix);
+
+	bool initialized = false;
+
+	while (true) {
+		WorkerOrder* order = g_async_queue_pop(wp->queue);
+		bool terminate = (order->code == WorkerTerminate);
+
+		g_mutex_lock(&workMain.lock);
+		if (!terminate && !order->secondary) ++workMain.dispatchedOrders;
+		if (!terminate) ++wp->sentOrders;
+		--workMain.unsentOrders;
+		if (workMain.unsentOrders == 0) g_cond_signal(&workMain.allOrdersSent);
+		g_mutex_unlock(&workMain.lock);
+
+		if (terminate) {
+			free(order);
+			break;
+		}
+
+		dependenciesCompleted(order, true);
+		lprintf(LogDebug, "Executing order code %d\n", order->code);
+		gint64 startTime = g_get_monotonic_time();
+		executeOrder(order, &initialized);
+		if (workMain.orderStats && (size_t)order->code < ORDER_CODE_COUNT) {
+			latencyRecord(&wp->queueLatencies[order->code], startTime - order->queuedAt);
+			latencyRecord(&wp->latencies->exec[order->code], g_get_monotonic_time() - startTime);
+		}
+		freeOrderContents(order);
+		free(order);
+		shmCounterAdd(wp->completed, 1);
+	}
+
+	lprintf(LogDebug, "Worker thread for workplace %p shutting down\n", wp);
+	if (initialized) workerCleanup();
+	logSetPrefix(NULL);
+	shmCounterClose(wp->completed);
+	return NULL;
+}
+
+// Called by main process => main thread. Starts a worker thread for a
+// workplace that is not established.
+static bool initWorkplaceThread(Workplace* wp) {
+	wp->completed = shmCounterNew();
+	wp->failed = (wp->completed == NULL ? NULL : shmCounterNew());
+	wp->latencies = (wp->failed == NULL ? NULL : shmBlockNew(sizeof(WorkerLatencies)));
+	if (wp->latencies == NULL) {
+		lprintf(LogError, "Could not allocate counters for workplace %p\n", wp);
+		if (wp->failed != NULL) shmCounterFree(wp->failed);
+		if (wp->completed != NULL) shmCounterFree(wp->completed);
+		return false;
+	}
+	memset(wp->queueLatencies, 0, sizeof(wp->queueLatencies));
+	wp->queuedOrders = 0;
+	wp->sentOrders = 0;
+	wp->reportedErrors = 0;
+	wp->threaded = true;
+	wp->established = true;
+	wp->workThread = g_thread_new("WorkThread", &workThread, wp);
+	return true;
+}
+
 // Called by main process => main thread
 static bool initWorkplaceMainForks(Workplace* wpm, guint id) {
 	int pipefd[2];
 
 	flexBufferInit((void**)&wpm->logBuffer, &wpm->logLen, &wpm->logCap);
+	flexBufferInit((void**)&wpm->wire, &wpm->wireLen, &wpm->wireCap);
+
+	wpm->completed = shmCounterNew();
+	wpm->failed = (wpm->completed == NULL ? NULL : shmCounterNew());
+	wpm->latencies = (wpm->failed == NULL ? NULL : shmBlockNew(sizeof(WorkerLatencies)));
+	if (wpm->latencies == NULL) {
+		lprintf(LogError, "Could not allocate shared memory counters for workplace %p\n", wpm);
+		if (wpm->failed != NULL) shmCounterFree(wpm->failed);
+		if (wpm->completed != NULL) shmCounterFree(wpm->completed);
+		return false;
+	}
+	memset(wpm->queueLatencies, 0, sizeof(wpm->queueLatencies));
+
+	wpm->ordersRing = shmRingNew(ORDERS_RING_SIZE);
+	wpm->responsesRing = (wpm->ordersRing == NULL ? NULL : shmRingNew(RESPONSES_RING_SIZE));
+	if (wpm->responsesRing == NULL) {
+		lprintf(LogWarning, "Could not allocate shared memory for workplace %p; falling back to pipes\n", wpm);
+		if (wpm->ordersRing != NULL) shmRingFree(wpm->ordersRing);
+		wpm->ordersRing = NULL;
+	}
 
-	if (pipe(pipefd) != 0) return false;
+	if (pipe(pipefd) != 0) goto ringAbort;
 	int childOrdersFd = pipefd[0];
 	wpm->ordersFd = pipefd[1];
 
@@ -656,7 +2268,22 @@ static bool initWorkplaceMainForks(Workplace* wpm, guint id) {
 			if (!otherWpm->established && otherWpm != wpm) continue;
 			close(otherWpm->ordersFd);
 			close(otherWpm->responsesFd);
+			if (otherWpm == wpm) continue;
+			shmCounterFree(otherWpm->completed);
+			shmCounterFree(otherWpm->failed);
+			shmBlockFree(otherWpm->latencies, sizeof(WorkerLatencies));
+			if (otherWpm->ordersRing != NULL) {
+				shmRingFree(otherWpm->ordersRing);
+				shmRingFree(otherWpm->responsesRing);
+			}
 		}
+		workChild.ordersRing = wpm->ordersRing;
+		workChild.responsesRing = wpm->responsesRing;
+		workChild.completed = wpm->completed;
+		workChild.failed = wpm->failed;
+		workChild.latencies = wpm->latencies;
+		flexBufferInit((void**)&workChild.batch, &workChild.batchLen, &workChild.batchCap);
+		workChild.batchPos = 0;
 
 		// Redirect standard streams to pipes
 		if (dup2(childOrdersFd, STDIN_FILENO) == -1) exit(1);
@@ -667,7 +2294,10 @@ static bool initWorkplaceMainForks(Workplace* wpm, guint id) {
 		close(childResponsesFd);
 		close(STDERR_FILENO);
 
-		exit(childProcess(id));
+		int res = childProcess(id);
+		flexBufferFree((void**)&workChild.batch, &workChild.batchLen, &workChild.batchCap);
+		if (workChild.responsesRing != NULL) shmRingClose(workChild.responsesRing);
+		exit(res);
 	} else if (pid == -1) goto forkAbort;
 
 	// Parent process
@@ -685,239 +2315,1026 @@ forkAbort:
 pipeAbort:
 	close(childOrdersFd);
 	close(wpm->ordersFd);
+ringAbort:
+	if (wpm->ordersRing != NULL) {
+		shmRingFree(wpm->ordersRing);
+		shmRingFree(wpm->responsesRing);
+	}
+	shmCounterFree(wpm->completed);
+	shmCounterFree(wpm->failed);
+	shmBlockFree(wpm->latencies, sizeof(WorkerLatencies));
 	return false;
 }
 
-// Called by main process => main thread
-static void initWorkplaceMainThreads(Workplace* wp) {
-	lprintf(LogDebug, "Launching worker threads for workplace %p\n", wp);
-	wp->sendThread = g_thread_new("SendThread", &sendThread, wp);
-	wp->responseThread = g_thread_new("ResponseThread", &responseThread, wp);
+// Called by main process => main thread
+static void initWorkplaceMainThreads(Workplace* wp) {
+	lprintf(LogDebug, "Launching worker threads for workplace %p\n", wp);
+	wp->sendThread = g_thread_new("SendThread", &sendThread, wp);
+	wp->responseThread = g_thread_new("ResponseThread", &responseThread, wp);
+}
+
+// Called by main process => main thread. Waits for the threads associated
+// with a workplace to exit.
+static void joinWorkplaceThreads(Workplace* wp) {
+	if (wp->threaded) {
+		g_thread_join(wp->workThread);
+	} else {
+		g_thread_join(wp->sendThread);
+		g_thread_join(wp->responseThread);
+	}
+}
+
+// Called by main process => main thread
+static void freeWorkplaceMain(Workplace* wpm) {
+	if (!wpm->threaded) {
+		flexBufferFree((void**)&wpm->logBuffer, &wpm->logLen, &wpm->logCap);
+		flexBufferFree((void**)&wpm->wire, &wpm->wireLen, &wpm->wireCap);
+		if (wpm->ordersRing != NULL) {
+			shmRingFree(wpm->ordersRing);
+			shmRingFree(wpm->responsesRing);
+		}
+	}
+	shmCounterFree(wpm->completed);
+	shmCounterFree(wpm->failed);
+	shmBlockFree(wpm->latencies, sizeof(WorkerLatencies));
+}
+
+// Called by main process => main thread
+int workInit(void) {
+	if (!workerHaveCap()) {
+		lprintln(LogError, "The process does not have the necessary capabilities for constructing the network. The process must be run as root.");
+		return 1;
+	}
+
+	workMain.poolSize = g_get_num_processors();
+	workMain.workplaces = eamalloc(workMain.poolSize, sizeof(Workplace), 0);
+	workMain.nextWorkplace = 0;
+	workMain.workerLimit = workMain.poolSize;
+	workMain.activeWorkers = workMain.poolSize;
+	workMain.adaptive = false;
+	workMain.owners = NULL;
+	workMain.adaptQueued = 0;
+	workMain.adaptOrders = 0;
+	workMain.adaptStart = 0;
+	workMain.unsentOrders = 0;
+	workMain.lastOrders = g_hash_table_new_full(&g_int64_hash, &g_int64_equal, NULL, &free);
+	workMain.dispatchedOrders = 0;
+	workMain.completedOrders = 0;
+	workMain.futures = g_hash_table_new(&g_direct_hash, &g_direct_equal);
+	workMain.abandonedTags = g_hash_table_new(&g_direct_hash, &g_direct_equal);
+	workMain.nextTag = 0;
+	workMain.abandonedBefore = 0;
+	workMain.recording = false;
+	workMain.planFile = NULL;
+	workMain.planFilename = NULL;
+	workMain.journalFile = NULL;
+	workMain.journalFilename = NULL;
+	workMain.hostLocs = NULL;
+	workMain.hostLocCount = 0;
+	workMain.orderStats = false;
+	workMain.orderStatsFile = NULL;
+
+	lprintf(LogDebug, "Initializing %u worker processes\n", workMain.poolSize);
+
+	for (guint i = 0; i < workMain.poolSize; ++i) {
+		workMain.workplaces[i].established = false;
+		workMain.workplaces[i].threaded = false;
+		workMain.workplaces[i].queue = g_async_queue_new_full(&g_free);
+		workMain.workplaces[i].queuedOrders = 0;
+		workMain.workplaces[i].sentOrders = 0;
+		workMain.workplaces[i].reportedErrors = 0;
+	}
+
+	// First, spawn the child processes
+	bool setupSuccess = true;
+	for (guint i = 0; i < workMain.poolSize; ++i) {
+		bool success  = initWorkplaceMainForks(&workMain.workplaces[i], i);
+		if (success) {
+			workMain.workplaces[i].established = true;
+		} else {
+			lprintf(LogError, "Failed to launch child process %u\n", i);
+			setupSuccess = false;
+		}
+	}
+
+	// Spawn associated threads for successfully started children. We do this as
+	// a separate step so that the forks occur while the main process is still
+	// single threaded. This prevents the possibility of permanently locked
+	// synchronization objects in libraries.
+	for (guint i = 0; i < workMain.poolSize; ++i) {
+		if (!workMain.workplaces[i].established) continue;
+		initWorkplaceMainThreads(&workMain.workplaces[i]);
+	}
+
+	if (!setupSuccess) {
+		lprintln(LogDebug, "Performing cleanup of partially constructed worker subsystem");
+		workCleanup();
+		return 1;
+	}
+	return 0;
+}
+
+// Called by main process => main thread
+int workConfigure(LogLevel logThreshold, bool logColorize, const char* nsPrefix, const char* ovsDir, const char* ovsSchema, uint64_t softMemCap) {
+	WorkerOrder order;
+	order.code = WorkerConfigure;
+	order.configure.logThreshold = logThreshold;
+	order.configure.logColorize = logColorize;
+	order.configure.orderStats = workMain.orderStats;
+	order.configure.nsPrefixLen = strlen(nsPrefix);
+	order.configure.ovsDirLen = strlen(ovsDir);
+	order.configure.ovsSchemaLen = (ovsSchema == NULL ? 0 : strlen(ovsSchema));
+	order.configure.softMemCap = (uint64_t)llrint((double)softMemCap / (double)workMain.workerLimit);
+	order.configure.nsPrefix = strdup(nsPrefix);
+	order.configure.ovsDir = strdup(ovsDir);
+	order.configure.ovsSchema = strdup(ovsSchema == NULL ? "" : ovsSchema);
+	bool success = broadcastOrder(&order);
+	freeOrderContents(&order);
+	return success ? 0 : 1;
+}
+
+// Called by main process => main thread during a join, while the workers have
+// nothing to do. Moves the latencies measured since the previous join into the
+// statistics for the current phase.
+static void collectOrderStats(void) {
+	OrderLatencies** stats = &workMain.phaseLatencies[workMain.phase];
+	if (*stats == NULL) *stats = ecalloc(ORDER_CODE_COUNT, sizeof(OrderLatencies));
+
+	for (guint i = 0; i < workMain.poolSize; ++i) {
+		Workplace* wp = &workMain.workplaces[i];
+		if (!wp->established) continue;
+		for (size_t code = 0; code < ORDER_CODE_COUNT; ++code) {
+			latencyMerge(&(*stats)[code].queue, &wp->queueLatencies[code]);
+			latencyMerge(&(*stats)[code].wait, &wp->latencies->wait[code]);
+			latencyMerge(&(*stats)[code].exec, &wp->latencies->exec[code]);
+		}
+		memset(wp->queueLatencies, 0, sizeof(wp->queueLatencies));
+		memset(wp->latencies, 0, sizeof(WorkerLatencies));
+	}
+
+	g_mutex_lock(&workMain.lock);
+	for (size_t code = 0; code < ORDER_CODE_COUNT; ++code) {
+		latencyMerge(&(*stats)[code].response, &workMain.responseLatencies[code]);
+	}
+	memset(workMain.responseLatencies, 0, sizeof(workMain.responseLatencies));
+	g_mutex_unlock(&workMain.lock);
+}
+
+// Formats the median, 99th percentile, and maximum of a histogram in
+// milliseconds for the summary table
+static void formatLatency(char* buf, size_t len, const latencyHistogram* hist) {
+	if (hist->count == 0) {
+		snprintf(buf, len, "-");
+		return;
+	}
+	uint64_t median = latencyPercentile(hist, 0.5);
+	uint64_t tail = latencyPercentile(hist, 0.99);
+	snprintf(buf, len, "%.2f/%.2f/%.2f", (double)median / 1000.0, (double)tail / 1000.0, (double)hist->max / 1000.0);
+}
+
+// Prints a table of the order latencies in each phase to stderr
+static void printOrderStats(void) {
+	for (size_t phase = 0; phase < PHASE_COUNT; ++phase) {
+		const OrderLatencies* stats = workMain.phaseLatencies[phase];
+		if (stats == NULL) continue;
+
+		uint64_t orders = 0;
+		for (size_t code = 0; code < ORDER_CODE_COUNT; ++code) orders += stats[code].exec.count;
+		if (orders == 0) continue;
+		double secs = (double)workMain.phaseUsecs[phase] / G_USEC_PER_SEC;
+		fprintf(stderr, "Order latencies in the %s phase: %" PRIu64 " orders in %.1f s (%.0f orders/s); median/p99/max in ms\n", PhaseNames[phase], orders, secs, (secs > 0.0 ? (double)orders / secs : 0.0));
+		fprintf(stderr, "  %-20s %10s  %-22s %-22s %-22s %s\n", "Order", "Count", "Queue", "Wait", "Execution", "Response");
+
+		for (size_t code = 0; code < ORDER_CODE_COUNT; ++code) {
+			const OrderLatencies* lat = &stats[code];
+			if (lat->exec.count == 0) continue;
+			char queue[64], wait[64], exec[64], response[64];
+			formatLatency(queue, sizeof(queue), &lat->queue);
+			formatLatency(wait, sizeof(wait), &lat->wait);
+			formatLatency(exec, sizeof(exec), &lat->exec);
+			formatLatency(response, sizeof(response), &lat->response);
+			fprintf(stderr, "  %-20s %10" PRIu64 "  %-22s %-22s %-22s %s\n", OrderCodeNames[code], lat->exec.count, queue, wait, exec, response);
+		}
+	}
+}
+
+// Writes a histogram as a JSON object with values in microseconds
+static void writeLatencyJson(FILE* file, const char* name, const latencyHistogram* hist) {
+	fprintf(file, "\"%s\":{\"count\":%" PRIu64 ",\"mean\":%.1f,\"p50\":%" PRIu64 ",\"p90\":%" PRIu64 ",\"p99\":%" PRIu64 ",\"p999\":%" PRIu64 ",\"max\":%" PRIu64 "}", name, hist->count, latencyMean(hist), latencyPercentile(hist, 0.5), latencyPercentile(hist, 0.9), latencyPercentile(hist, 0.99), latencyPercentile(hist, 0.999), hist->max);
+}
+
+// Writes the order latencies in each phase to a file as a JSON object
+static bool writeOrderStatsJson(const char* filename) {
+	FILE* file = fopen(filename, "we");
+	if (file == NULL) {
+		lprintf(LogError, "Could not open order statistics file '%s' for writing: %s\n", filename, strerror(errno));
+		return false;
+	}
+
+	fprintf(file, "{\"phases\":[");
+	bool firstPhase = true;
+	for (size_t phase = 0; phase < PHASE_COUNT; ++phase) {
+		const OrderLatencies* stats = workMain.phaseLatencies[phase];
+		if (stats == NULL) continue;
+
+		fprintf(file, "%s{\"phase\":\"%s\",\"elapsed\":%.3f,\"orders\":[", (firstPhase ? "" : ","), PhaseNames[phase], (double)workMain.phaseUsecs[phase] / G_USEC_PER_SEC);
+		firstPhase = false;
+		bool firstOrder = true;
+		for (size_t code = 0; code < ORDER_CODE_COUNT; ++code) {
+			const OrderLatencies* lat = &stats[code];
+			if (lat->exec.count == 0) continue;
+			fprintf(file, "%s{\"order\":\"%s\",\"count\":%" PRIu64 ",", (firstOrder ? "" : ","), OrderCodeNames[code], lat->exec.count);
+			firstOrder = false;
+			writeLatencyJson(file, "queue", &lat->queue);
+			fputc(',', file);
+			writeLatencyJson(file, "wait", &lat->wait);
+			fputc(',', file);
+			writeLatencyJson(file, "execution", &lat->exec);
+			fputc(',', file);
+			writeLatencyJson(file, "response", &lat->response);
+			fputc('}', file);
+		}
+		fprintf(file, "]}");
+	}
+	fprintf(file, "]}\n");
+
+	if (ferror(file) | (fclose(file) != 0)) {
+		lprintf(LogError, "Failed to write order statistics file '%s'\n", filename);
+		return false;
+	}
+	lprintf(LogInfo, "Wrote order statistics to '%s'\n", filename);
+	return true;
+}
+
+// Called by main process => main thread
+int workSetWorkers(uint32_t limit, bool adaptive, bool threads) {
+	if (limit > workMain.poolSize) {
+		lprintf(LogWarning, "Only %u workers are available; using all of them instead of %u\n", workMain.poolSize, limit);
+	}
+	if (limit == 0 || limit > workMain.poolSize) limit = workMain.poolSize;
+
+	// The worker processes were started by workInit before any user input was
+	// handled, so the thread backend replaces all of them
+	guint retired = (threads ? 0 : limit);
+	if (retired < workMain.workerLimit) {
+		lprintf(LogDebug, "Retiring %u idle worker processes\n", workMain.workerLimit - retired);
+		for (guint i = retired; i < workMain.workerLimit; ++i) {
+			g_mutex_lock(&workMain.lock);
+			queueOrder(newOrder(WorkerTerminate), (gint)i, NULL, 0);
+			g_mutex_unlock(&workMain.lock);
+		}
+		waitForSending();
+		for (guint i = retired; i < workMain.workerLimit; ++i) {
+			Workplace* wp = &workMain.workplaces[i];
+			joinWorkplaceThreads(wp);
+			freeWorkplaceMain(wp);
+			wp->established = false;
+		}
+	}
+	if (threads) {
+		lprintf(LogDebug, "Starting %u worker threads\n", limit);
+		for (guint i = 0; i < limit; ++i) {
+			if (!initWorkplaceThread(&workMain.workplaces[i])) return 1;
+		}
+	}
+	workMain.workerLimit = limit;
+	workMain.activeWorkers = limit;
+
+	// A single worker leaves nothing to adapt
+	workMain.adaptive = (adaptive && limit > 1);
+	for (size_t i = 0; i < sizeof(workMain.adaptation) / sizeof(workMain.adaptation[0]); ++i) {
+		WorkerAdaptation* adapt = &workMain.adaptation[i];
+		adapt->workers = limit;
+		adapt->step = -(gint)(limit >= 4 ? limit / 4 : 1);
+		adapt->lastRate = 0.0;
+	}
+	if (workMain.adaptive) {
+		lprintf(LogInfo, "Adapting the number of active workers to the observed throughput (up to %u)\n", limit);
+		if (workMain.owners == NULL) workMain.owners = g_hash_table_new_full(&g_int64_hash, &g_int64_equal, &free, NULL);
+		workMain.adaptOrders = workMain.adaptQueued;
+		workMain.adaptStart = 0;
+	}
+	return 0;
+}
+
+// Called by main process => main thread
+int workCleanup(void) {
+	int err = 0;
+
+	g_mutex_lock(&workMain.lock);
+	if (workMain.receivedError) {
+		err = workMain.errorCode;
+	}
+	g_mutex_unlock(&workMain.lock);
+
+	// Send enough WorkerTerminate orders to stop all order threads. This will
+	// cause the processes to exit, which will cause the response threads to
+	// exit. Worker threads exit directly.
+	if (workMain.recording) workEndPlan(false);
+	if (workMain.journalFile != NULL) workEndJournal(false);
+
+	lprintln(LogDebug, "Sending termination orders to worker threads");
+	for (guint i = 0; i < workMain.poolSize; ++i) {
+		if (!workMain.workplaces[i].established) continue;
+		g_mutex_lock(&workMain.lock);
+		queueOrder(newOrder(WorkerTerminate), (gint)i, NULL, 0);
+		g_mutex_unlock(&workMain.lock);
+	}
+
+	// Wait until all threads exit
+	waitForSending();
+	for (guint i = 0; i < workMain.poolSize; ++i) {
+		if (!workMain.workplaces[i].established) continue;
+		joinWorkplaceThreads(&workMain.workplaces[i]);
+	}
+
+	if (workMain.orderStats) {
+		collectOrderStats();
+		workMain.phaseUsecs[workMain.phase] += g_get_monotonic_time() - workMain.phaseStart;
+		if (workMain.printOrderStats) printOrderStats();
+		if (workMain.orderStatsFile != NULL && !writeOrderStatsJson(workMain.orderStatsFile) && err == 0) err = 1;
+	}
+
+	// Everything is terminated, so we can release the resources
+	lprintln(LogDebug, "Releasing resources for worker subsystem");
+	for (guint i = 0; i < workMain.poolSize; ++i) {
+		g_async_queue_unref(workMain.workplaces[i].queue);
+		if (!workMain.workplaces[i].established) continue;
+		freeWorkplaceMain(&workMain.workplaces[i]);
+	}
+	free(workMain.workplaces);
+	g_hash_table_destroy(workMain.lastOrders);
+	g_hash_table_destroy(workMain.futures);
+	g_hash_table_destroy(workMain.abandonedTags);
+	if (workMain.owners != NULL) g_hash_table_destroy(workMain.owners);
+	free(workMain.hostLocs);
+	for (size_t phase = 0; phase < PHASE_COUNT; ++phase) free(workMain.phaseLatencies[phase]);
+	free(workMain.orderStatsFile);
+	return err;
+}
+
+// Called by main process => main thread
+int workJoin(bool resetError) {
+	lprintf(LogDebug, "Performing join on worker pool%s to ensure that all work is finished\n", (resetError ? " (and resetting error state)" : ""));
+
+	if (workMain.recording) {
+		// Only queries are executed while recording, and they join on their
+		// own. We simply preserve the barrier for replay.
+		return recordPlanEntry(PlanTagJoin, NULL) ? 0 : 1;
+	}
+
+	// Flush all previous work
+	waitForSending();
+
+	// Wait until every worker has executed all of the orders sent to it, and
+	// until the response threads have received the errors that they reported
+	// while doing so. Workers that have nothing left to do are not involved.
+	bool exited = false;
+	for (guint i = 0; i < workMain.poolSize; ++i) {
+		Workplace* wp = &workMain.workplaces[i];
+		if (!wp->established) continue;
+
+		g_mutex_lock(&workMain.lock);
+		uint64_t target = wp->queuedOrders;
+		g_mutex_unlock(&workMain.lock);
+		if (!shmCounterWait(wp->completed, target)) {
+			lprintf(LogError, "Child process in workplace %p exited before finishing its orders\n", wp);
+			exited = true;
+			continue;
+		}
+
+		uint32_t failed = shmCounterGet(wp->failed);
+		g_mutex_lock(&workMain.lock);
+		while (wp->reportedErrors != failed && !shmCounterClosed(wp->completed)) {
+			g_cond_wait(&workMain.errorsReported, &workMain.lock);
+		}
+		g_mutex_unlock(&workMain.lock);
+	}
+
+	g_mutex_lock(&workMain.lock);
+	if (resetError) {
+		workMain.receivedError = false;
+	}
+	int err = 0;
+	if (workMain.receivedError) err = workMain.errorCode;
+	else if (exited) err = 1;
+
+	// Every order has been executed, so no dependencies remain. Abandoned
+	// queries that are still unanswered will never be answered, except by
+	// responses that are already on their way.
+	g_hash_table_remove_all(workMain.lastOrders);
+	if (g_hash_table_size(workMain.abandonedTags) > 0) {
+		g_hash_table_remove_all(workMain.abandonedTags);
+		workMain.abandonedBefore = workMain.nextTag;
+	}
+	g_mutex_unlock(&workMain.lock);
+
+	lprintln(LogDebug, "Worker pool has finished all of its work");
+	if (workMain.orderStats) collectOrderStats();
+	if (err == 0 && workMain.journalFile != NULL) err = journalCheckpoint();
+	return err;
+}
+
+// Called by main process => any thread. The completion counters include the
+// secondary orders, which are not counted as dispatched, so the orders that
+// are still in flight are subtracted from the dispatched orders instead. The
+// result can lag behind by the number of secondary orders in flight, so it is
+// kept from decreasing.
+uint64_t workGetCompletedOrders(void) {
+	g_mutex_lock(&workMain.lock);
+	uint64_t orders = workMain.dispatchedOrders;
+	for (guint i = 0; i < workMain.poolSize; ++i) {
+		Workplace* wp = &workMain.workplaces[i];
+		if (!wp->established) continue;
+		uint32_t inFlight = (uint32_t)wp->sentOrders - shmCounterGet(wp->completed);
+		orders = (orders > inFlight ? orders - inFlight : 0);
+	}
+	if (orders > workMain.completedOrders) workMain.completedOrders = orders;
+	orders = workMain.completedOrders;
+	g_mutex_unlock(&workMain.lock);
+	return orders;
+}
+
+// Called by main process => main thread
+int workBeginPlan(const char* filename) {
+	if (workMain.recording) {
+		lprintln(LogError, "BUG: started recording a setup plan while another was being recorded");
+		return 1;
+	}
+	int err = workJoin(false);
+	if (err != 0) return err;
+
+	FILE* file = NULL;
+	if (filename != NULL) {
+		errno = 0;
+		file = fopen(filename, "wbe");
+		if (file == NULL) {
+			err = errno;
+			lprintf(LogError, "Could not open setup plan file '%s' for writing: %s\n", filename, strerror(err));
+			return err;
+		}
+		uint32_t orderSize = (uint32_t)sizeof(WorkerOrder);
+		if (fwrite(PlanMagic, sizeof(PlanMagic), 1, file) != 1 || fwrite(&orderSize, sizeof(orderSize), 1, file) != 1) {
+			lprintf(LogError, "Failed to write to setup plan file '%s'\n", filename);
+			fclose(file);
+			unlink(filename);
+			return 1;
+		}
+		workMain.planFilename = strdup(filename);
+		lprintf(LogInfo, "Recording setup plan to '%s'; the network will not be modified\n", filename);
+	} else {
+		lprintln(LogInfo, "Counting setup operations; the network will not be modified");
+	}
+	workMain.recording = true;
+	workMain.planFile = file;
+	memset(&workMain.planStats, 0, sizeof(workMain.planStats));
+	workMain.planStats.workers = workMain.workerLimit;
+	workMain.batchOrders = 0;
+	workMain.batchRoutes = 0;
+	return 0;
+}
+
+// Called by main process => main thread
+int workEndPlan(bool commit) {
+	if (!workMain.recording) return 0;
+	workMain.recording = false;
+	if (workMain.planFile == NULL) return 0;
+
+	bool success = commit && recordPlanEntry(PlanTagEnd, NULL);
+	if (fclose(workMain.planFile) != 0) success = false;
+	workMain.planFile = NULL;
+
+	int err = 0;
+	if (success) {
+		lprintf(LogInfo, "Setup plan with %" PRIu64 " orders written to '%s'\n", workMain.planStats.orders, workMain.planFilename);
+	} else {
+		if (commit) {
+			lprintf(LogError, "Failed to finish writing setup plan file '%s'\n", workMain.planFilename);
+			err = 1;
+		}
+		unlink(workMain.planFilename);
+	}
+	free(workMain.planFilename);
+	workMain.planFilename = NULL;
+	return err;
+}
+
+void workGetPlanStats(workPlanStats* stats) {
+	*stats = workMain.planStats;
 }
 
 // Called by main process => main thread
-static void freeWorkplaceMain(Workplace* wpm) {
-	flexBufferFree((void**)&wpm->logBuffer, &wpm->logLen, &wpm->logCap);
-}
+int workReplayPlan(const char* filename) {
+	errno = 0;
+	FILE* file = fopen(filename, "rbe");
+	if (file == NULL) {
+		int err = errno;
+		lprintf(LogError, "Could not open setup plan file '%s': %s\n", filename, strerror(err));
+		return err;
+	}
 
-// Called by main process => main thread
-int workInit(void) {
-	if (!workerHaveCap()) {
-		lprintln(LogError, "The process does not have the necessary capabilities for constructing the network. The process must be run as root.");
-		return 1;
+	int err = 0;
+	char magic[sizeof(PlanMagic)];
+	uint32_t orderSize;
+	if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, PlanMagic, sizeof(PlanMagic)) != 0) {
+		lprintf(LogError, "'%s' is not a setup plan file\n", filename);
+		err = 1;
+		goto cleanup;
+	}
+	if (fread(&orderSize, sizeof(orderSize), 1, file) != 1 || orderSize != sizeof(WorkerOrder)) {
+		lprintf(LogError, "Setup plan file '%s' was created by an incompatible build of the program\n", filename);
+		err = 1;
+		goto cleanup;
 	}
 
-	workMain.poolSize = g_get_num_processors();
-	workMain.workplaces = eamalloc(workMain.poolSize, sizeof(Workplace), 0);
-	workMain.orderQueue = g_async_queue_new_full(&g_free);
-	workMain.unsentOrders = 0;
-	workMain.responseQueued = false;
+	uint64_t replayed = 0;
+	while (true) {
+		uint8_t tag;
+		if (fread(&tag, 1, 1, file) != 1) {
+			lprintf(LogError, "Setup plan file '%s' is truncated\n", filename);
+			err = 1;
+			break;
+		}
+		if (tag == PlanTagEnd) break;
+		if (tag == PlanTagJoin) {
+			err = workJoin(false);
+			if (err != 0) break;
+			continue;
+		}
 
-	lprintf(LogDebug, "Initializing %u worker processes\n", workMain.poolSize);
+		bool broadcast = (tag == PlanTagBroadcast);
+		uint8_t code = tag;
+		if (broadcast && fread(&code, 1, 1, file) != 1) code = PlanTagEnd;
+
+		WorkerOrder* order = newOrder((WorkerOrderCode)code);
+		void* params;
+		size_t len;
+		if (!getPlanOrderParams(order, &params, &len) || fread(params, len, 1, file) != 1) {
+			lprintf(LogError, "Setup plan file '%s' contains an invalid entry after %" PRIu64 " orders\n", filename, replayed);
+			free(order);
+			err = 1;
+			break;
+		}
+		++replayed;
 
-	for (guint i = 0; i < workMain.poolSize; ++i) {
-		workMain.workplaces[i].established = false;
+		if (broadcast) {
+			bool success = broadcastOrder(order);
+			free(order);
+			if (!success) {
+				err = 1;
+				break;
+			}
+		} else {
+			err = sendOrder(order, false);
+			if (err != 0) break;
+		}
+	}
+	if (err == 0) {
+		lprintf(LogInfo, "Replayed %" PRIu64 " orders from setup plan '%s'\n", replayed, filename);
 	}
 
-	// First, spawn the child processes
-	bool setupSuccess = true;
-	for (guint i = 0; i < workMain.poolSize; ++i) {
-		bool success  = initWorkplaceMainForks(&workMain.workplaces[i], i);
-		if (success) {
-			workMain.workplaces[i].established = true;
+cleanup:
+	fclose(file);
+	return err;
+}
+
+// Called by main process => main thread. Reads the journal of an interrupted
+// setup and prepares to resume it. If there is nothing to resume, file is set
+// to NULL.
+static int readJournal(const char* filename, uint64_t fingerprint, FILE** result) {
+	*result = NULL;
+	errno = 0;
+	FILE* file = fopen(filename, "r+be");
+	if (file == NULL) {
+		int err = errno;
+		if (err == ENOENT) {
+			lprintf(LogWarning, "No setup journal was found at '%s', so the network will be constructed from scratch\n", filename);
+			return 0;
+		}
+		lprintf(LogError, "Could not open setup journal '%s': %s\n", filename, strerror(err));
+		return err;
+	}
+
+	int err = 0;
+	char magic[sizeof(JournalMagic)];
+	uint32_t responseSize;
+	uint64_t journalFingerprint;
+	if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, JournalMagic, sizeof(JournalMagic)) != 0) {
+		lprintf(LogError, "'%s' is not a setup journal\n", filename);
+		err = 1;
+		goto cleanup;
+	}
+	if (fread(&responseSize, sizeof(responseSize), 1, file) != 1 || responseSize != sizeof(WorkerResponse) || fread(&journalFingerprint, sizeof(journalFingerprint), 1, file) != 1) {
+		lprintf(LogError, "Setup journal '%s' was created by an incompatible build of the program\n", filename);
+		err = 1;
+		goto cleanup;
+	}
+	if (journalFingerprint != fingerprint) {
+		lprintf(LogError, "The setup journal '%s' was recorded for a different topology file, topology options, or edge node configuration. Resume the setup with the same inputs, or construct the network from scratch.\n", filename);
+		err = 1;
+		goto cleanup;
+	}
+
+	// Anything after the last checkpoint describes work that will be redone
+	off_t validLen = ftello(file);
+	size_t validResponses = 0;
+	bool complete = false;
+	while (!complete) {
+		uint8_t tag;
+		if (fread(&tag, 1, 1, file) != 1) break;
+		if (tag == JournalTagResponse) {
+			WorkerResponse resp;
+			if (fread(&resp, sizeof(resp), 1, file) != 1) break;
+			// Pointers are meaningless in a different process
+			if (resp.code == ResponseGotMtuSupported) resp.gotMtuSupported.failReason = NULL;
+			flexBufferGrow((void**)&workMain.replayResponses, workMain.replayCount, &workMain.replayCap, 1, sizeof(WorkerResponse));
+			flexBufferAppend(workMain.replayResponses, &workMain.replayCount, &resp, 1, sizeof(WorkerResponse));
+		} else if (tag == JournalTagCheckpoint) {
+			uint64_t entry[2];
+			if (fread(entry, sizeof(entry), 1, file) != 1 || entry[1] > PhaseInternalRoutes) break;
+			workMain.skipOrders = entry[0];
+			workMain.skipPhase = (WorkPhase)entry[1];
+			validResponses = workMain.replayCount;
+			validLen = ftello(file);
+		} else if (tag == JournalTagComplete) {
+			complete = true;
 		} else {
-			lprintf(LogError, "Failed to launch child process %u\n", i);
-			setupSuccess = false;
+			break;
 		}
 	}
+	workMain.replayCount = validResponses;
 
-	// Spawn associated threads for successfully started children. We do this as
-	// a separate step so that the forks occur while the main process is still
-	// single threaded. This prevents the possibility of permanently locked
-	// synchronization objects in libraries.
-	for (guint i = 0; i < workMain.poolSize; ++i) {
-		if (!workMain.workplaces[i].established) continue;
-		initWorkplaceMainThreads(&workMain.workplaces[i]);
+	if (complete) {
+		lprintf(LogError, "The setup recorded in the journal '%s' already finished, so there is nothing to resume\n", filename);
+		err = 1;
+		goto cleanup;
+	}
+	if (workMain.skipOrders == 0) {
+		lprintf(LogWarning, "The setup journal '%s' does not contain any checkpoints, so the network will be constructed from scratch\n", filename);
+		workMain.replayCount = 0;
+		goto cleanup;
 	}
 
-	if (!setupSuccess) {
-		lprintln(LogDebug, "Performing cleanup of partially constructed worker subsystem");
-		workCleanup();
+	if (validLen < 0 || fflush(file) != 0 || ftruncate(fileno(file), validLen) != 0 || fseeko(file, 0, SEEK_END) != 0) {
+		lprintf(LogError, "Failed to prepare setup journal '%s' for resuming\n", filename);
+		err = 1;
+		goto cleanup;
+	}
+
+	workMain.checkpointOrders = workMain.skipOrders;
+	workMain.checkpointPhase = workMain.skipPhase;
+	lprintf(LogInfo, "Resuming the setup recorded in '%s' after %" PRIu64 " completed orders (%s phase)\n", filename, workMain.skipOrders, PhaseNames[workMain.skipPhase]);
+	*result = file;
+	return 0;
+
+cleanup:
+	workMain.skipOrders = 0;
+	fclose(file);
+	return err;
+}
+
+// Called by main process => main thread
+int workBeginJournal(const char* filename, uint64_t fingerprint, bool resume, bool* resumed) {
+	*resumed = false;
+	if (workMain.journalFile != NULL) {
+		lprintln(LogError, "BUG: started a setup journal while another was active");
 		return 1;
 	}
+	workMain.phase = PhaseStart;
+	workMain.orderPhase = PhaseStart;
+	workMain.issuedOrders = 0;
+	workMain.checkpointOrders = 0;
+	workMain.checkpointPhase = PhaseStart;
+	workMain.skipOrders = 0;
+	workMain.skipPhase = PhaseStart;
+	workMain.recovering = false;
+	workMain.checkedHosts = 0;
+	workMain.checkedLinks = 0;
+	flexBufferInit((void**)&workMain.replayResponses, &workMain.replayCount, &workMain.replayCap);
+	workMain.replayNext = 0;
+
+	FILE* file = NULL;
+	if (resume) {
+		int err = readJournal(filename, fingerprint, &file);
+		if (err == 0 && file == NULL) {
+			// The caller is expected to start a new journal after cleaning up
+			flexBufferFree((void**)&workMain.replayResponses, &workMain.replayCount, &workMain.replayCap);
+			return 0;
+		}
+		if (err != 0) {
+			flexBufferFree((void**)&workMain.replayResponses, &workMain.replayCount, &workMain.replayCap);
+			return err;
+		}
+		*resumed = true;
+	} else {
+		errno = 0;
+		file = fopen(filename, "wbe");
+		if (file == NULL) {
+			int err = errno;
+			lprintf(LogError, "Could not open setup journal '%s' for writing: %s\n", filename, strerror(err));
+			return err;
+		}
+		uint32_t responseSize = sizeof(WorkerResponse);
+		if (fwrite(JournalMagic, sizeof(JournalMagic), 1, file) != 1 || fwrite(&responseSize, sizeof(responseSize), 1, file) != 1 || fwrite(&fingerprint, sizeof(fingerprint), 1, file) != 1 || fflush(file) != 0) {
+			lprintf(LogError, "Failed to write to setup journal '%s'\n", filename);
+			fclose(file);
+			return 1;
+		}
+		lprintf(LogDebug, "Recording setup journal in '%s'\n", filename);
+	}
+
+	workMain.journalFile = file;
+	workMain.journalFilename = strdup(filename);
 	return 0;
 }
 
 // Called by main process => main thread
-int workConfigure(LogLevel logThreshold, bool logColorize, const char* nsPrefix, const char* ovsDir, const char* ovsSchema, uint64_t softMemCap) {
-	WorkerOrder order;
-	order.code = WorkerConfigure;
-	order.configure.logThreshold = logThreshold;
-	order.configure.logColorize = logColorize;
-	order.configure.nsPrefixLen = strlen(nsPrefix);
-	order.configure.ovsDirLen = strlen(ovsDir);
-	order.configure.ovsSchemaLen = (ovsSchema == NULL ? 0 : strlen(ovsSchema));
-	order.configure.softMemCap = (uint64_t)llrint((double)softMemCap / (double)workMain.poolSize);
-	order.configure.nsPrefix = strdup(nsPrefix);
-	order.configure.ovsDir = strdup(ovsDir);
-	order.configure.ovsSchema = strdup(ovsSchema == NULL ? "" : ovsSchema);
-	bool success = broadcastOrder(&order);
-	freeOrderContents(&order);
-	return success ? 0 : 1;
+void workSetPhase(WorkPhase phase) {
+	if (workMain.adaptive && phase != workMain.phase) {
+		// Each phase has its own search, and its measurements begin once the
+		// orders of the previous phase have been completed
+		if (workMain.adaptation[workMain.phase].lastRate > 0.0) {
+			lprintf(LogInfo, "Adaptive worker pool ended the %s phase with %u active workers\n", PhaseNames[workMain.phase], workMain.activeWorkers);
+		}
+		workMain.activeWorkers = workMain.adaptation[phase].workers;
+		workMain.adaptOrders = workMain.adaptQueued;
+		workMain.adaptStart = 0;
+	}
+	if (workMain.orderStats && phase != workMain.phase) {
+		gint64 now = g_get_monotonic_time();
+		workMain.phaseUsecs[workMain.phase] += now - workMain.phaseStart;
+		workMain.phaseStart = now;
+	}
+	workMain.phase = phase;
 }
 
 // Called by main process => main thread
-int workCleanup(void) {
+void workEnableOrderStats(bool print, const char* jsonFile) {
+	workMain.orderStats = true;
+	workMain.printOrderStats = print;
+	free(workMain.orderStatsFile);
+	workMain.orderStatsFile = (jsonFile == NULL ? NULL : strdup(jsonFile));
+	workMain.phaseStart = g_get_monotonic_time();
+}
+
+// Called by main process => main thread
+int workEndJournal(bool complete) {
+	if (workMain.journalFile == NULL) return 0;
+
 	int err = 0;
-	int res;
+	if (complete) {
+		if (workMain.issuedOrders < workMain.skipOrders || workMain.replayNext < workMain.replayCount) {
+			logJournalMismatch("the setup finished before reaching the last checkpoint");
+			err = 1;
+		} else if (!writeJournalEntry(JournalTagComplete, NULL, 0)) {
+			err = 1;
+		}
+	}
+	if (fclose(workMain.journalFile) != 0 && err == 0) {
+		lprintf(LogError, "Failed to finish writing setup journal '%s'\n", workMain.journalFilename);
+		err = 1;
+	}
+	workMain.journalFile = NULL;
+	free(workMain.journalFilename);
+	workMain.journalFilename = NULL;
+	flexBufferFree((void**)&workMain.replayResponses, &workMain.replayCount, &workMain.replayCap);
+	return err;
+}
 
-	g_mutex_lock(&workMain.lock);
-	if (workMain.receivedError) {
-		err = workMain.errorCode;
+// Called by main process => main thread. Sends a query order without waiting
+// for its "count" responses, which are stored in "responses" once the returned
+// future is passed to awaitQuery. While an interrupted setup is being resumed,
+// the responses that it recorded in the journal are used instead. Futures must
+// be awaited in the order in which they were issued so that the journal
+// records the responses in sequence.
+static int issueQuery(WorkerOrder* order, WorkerResponseCode expectedCode, WorkerResponse* responses, size_t count, QueryFuture** future) {
+	QueryFuture* f = emalloc(sizeof(QueryFuture));
+	f->orderCode = order->code;
+	f->expectedCode = expectedCode;
+	f->responses = responses;
+	f->count = count;
+	f->received = 0;
+	f->replayed = false;
+
+	if (workMain.replayNext < workMain.replayCount) {
+		freeOrderContents(order);
+		free(order);
+		f->tag = 0;
+		f->replayed = true;
+		for (; f->received < count; ++f->received) {
+			if (workMain.replayNext == workMain.replayCount) {
+				logJournalMismatch("a query has more responses");
+				free(f);
+				return 1;
+			}
+			responses[f->received] = workMain.replayResponses[workMain.replayNext++];
+		}
+		*future = f;
+		return 0;
 	}
+
+	g_mutex_lock(&workMain.lock);
+	f->tag = ++workMain.nextTag;
+	order->tag = f->tag;
+	g_hash_table_insert(workMain.futures, GUINT_TO_POINTER(f->tag), f);
 	g_mutex_unlock(&workMain.lock);
 
-	// Send enough WorkerTerminate orders to stop all order threads. This will
-	// cause the processes to exit, which will cause the response threads to
-	// exit.
-	lprintln(LogDebug, "Sending termination orders to worker threads");
-	for (guint i = 0; i < workMain.poolSize; ++i) {
-		if (!workMain.workplaces[i].established) continue;
-		res = sendOrder(newOrder(WorkerTerminate), true);
-		if (err == 0) err = res;
+	int err = sendOrder(order, false);
+	if (err != 0) {
+		g_mutex_lock(&workMain.lock);
+		g_hash_table_remove(workMain.futures, GUINT_TO_POINTER(f->tag));
+		g_mutex_unlock(&workMain.lock);
+		free(f);
+		return err;
 	}
+	*future = f;
+	return 0;
+}
 
-	// Wait until all threads exit
-	waitForSending();
-	for (guint i = 0; i < workMain.poolSize; ++i) {
-		if (!workMain.workplaces[i].established) continue;
-		g_thread_join(workMain.workplaces[i].sendThread);
-		g_thread_join(workMain.workplaces[i].responseThread);
+// Called by main process => main thread. Waits until all of the responses to a
+// query issued by issueQuery have arrived, and records them if a journal is
+// active. The future is released.
+static int awaitQuery(QueryFuture* future) {
+	int err = 0;
+	if (!future->replayed) {
+		g_mutex_lock(&workMain.lock);
+		lprintf(LogDebug, "Waiting for responses to query %u from worker pool\n", future->tag);
+		while (!workMain.receivedError && future->received < future->count) {
+			g_cond_wait(&workMain.receivedResponse, &workMain.lock);
+		}
+		if (workMain.receivedError) err = workMain.errorCode;
+		g_hash_table_remove(workMain.futures, GUINT_TO_POINTER(future->tag));
+
+		// Other workers may still answer a query that failed
+		if (future->received < future->count) {
+			g_hash_table_insert(workMain.abandonedTags, GUINT_TO_POINTER(future->tag), GSIZE_TO_POINTER(future->count - future->received));
+		}
+		g_mutex_unlock(&workMain.lock);
 	}
 
-	// Everything is terminated, so we can release the resources
-	lprintln(LogDebug, "Releasing resources for worker subsystem");
-	if (err == 0) err = res;
-	for (guint i = 0; i < workMain.poolSize; ++i) {
-		if (!workMain.workplaces[i].established) continue;
-		freeWorkplaceMain(&workMain.workplaces[i]);
+	for (size_t i = 0; err == 0 && i < future->count; ++i) {
+		if (future->responses[i].code == future->expectedCode) continue;
+		if (future->replayed) {
+			logJournalMismatch("a query has a different type");
+		} else {
+			lprintf(LogError, "Unexpected response code %d from worker pool\n", future->responses[i].code);
+		}
+		err = 1;
 	}
-	free(workMain.workplaces);
-	g_async_queue_unref(workMain.orderQueue);
+
+	for (size_t i = 0; err == 0 && !future->replayed && workMain.journalFile != NULL && i < future->count; ++i) {
+		if (!writeJournalEntry(JournalTagResponse, &future->responses[i], sizeof(WorkerResponse))) err = 1;
+	}
+	free(future);
 	return err;
 }
 
-// Called by main process => main thread
-int workJoin(bool resetError) {
-	lprintf(LogDebug, "Performing join on worker pool%s to ensure that all work is finished\n", (resetError ? " (and resetting error state)" : ""));
-
-	// Flush all previous work
-	waitForSending();
+// Called by main process => main thread. Sends a query order and waits for
+// "count" responses.
+static int queryWorkers(WorkerOrder* order, WorkerResponseCode expectedCode, WorkerResponse* responses, size_t count) {
+	QueryFuture* future;
+	int err = issueQuery(order, expectedCode, responses, count, &future);
+	if (err != 0) return err;
+	return awaitQuery(future);
+}
 
-	g_mutex_lock(&workMain.lock);
-	workMain.pongsExpected = workMain.poolSize;
-	if (resetError) {
-		workMain.receivedError = false;
+// Called by main process => main thread. Sends "count" query orders with one
+// response each at once, so that the workers can answer them concurrently, and
+// then waits for all of the responses.
+static int queryWorkersEach(WorkerOrder* orders[], WorkerResponseCode expectedCode, WorkerResponse responses[], size_t count) {
+	QueryFuture** futures = eamalloc(count, sizeof(QueryFuture*), 0);
+	size_t issued = 0;
+	int err = 0;
+	for (; issued < count; ++issued) {
+		err = issueQuery(orders[issued], expectedCode, &responses[issued], 1, &futures[issued]);
+		if (err != 0) break;
 	}
-	g_mutex_unlock(&workMain.lock);
-
-	// Request ping replies from all processes. This demonstrates that all work
-	// has been finished by the processes (not merely sent to them).
-	WorkerOrder order;
-	order.code = WorkerPing;
-	if (!broadcastOrder(&order)) return 1;
-	g_mutex_lock(&workMain.lock);
-	while (workMain.pongsExpected > 0) {
-		g_cond_wait(&workMain.pongsFinished, &workMain.lock);
-		if (workMain.receivedError) {
-			if (resetError) workMain.receivedError = false;
-			else break;
-		}
+	for (size_t i = issued + (err == 0 ? 0 : 1); i < count; ++i) {
+		freeOrderContents(orders[i]);
+		free(orders[i]);
 	}
-	int err = 0;
-	if (workMain.receivedError) err = workMain.errorCode;
-	g_mutex_unlock(&workMain.lock);
 
-	lprintln(LogDebug, "Worker pool has finished all of its work");
+	// Issuing only fails after an error was reported, in which case the
+	// outstanding futures are released immediately
+	for (size_t i = 0; i < issued; ++i) {
+		int awaitErr = awaitQuery(futures[i]);
+		if (err == 0) err = awaitErr;
+	}
+	free(futures);
 	return err;
 }
 
 // All of the following functions expose worker functionality to the main thread
 // of the main process
 
-int workGetEdgeRemoteMac(const char* intfName, ip4Addr ip, macAddr* edgeRemoteMac) {
-	WorkerOrder* order = newOrder(WorkerGetEdgeRemoteMac);
-	strncpy(order->getEdgeRemoteMac.intfName, intfName, INTERFACE_BUF_LEN);
-	order->getEdgeRemoteMac.ip = ip;
-	int err = sendOrder(order, false);
-	if (err != 0) return err;
+int workGetEdgeRemoteMacs(size_t count, const char* const intfNames[], const ip4Addr ips[], macAddr edgeRemoteMacs[]) {
+	if (count == 0) return 0;
 
-	g_mutex_lock(&workMain.lock);
-	err = waitForResponse(ResponseGotMac);
-	if (err == 0) {
-		memcpy(edgeRemoteMac->octets, workMain.response.gotMac.mac.octets, MAC_ADDR_BYTES);
-	} else {
+	WorkerOrder* order = newOrder(WorkerGetEdgeRemoteMacs);
+	order->getEdgeRemoteMacs.count = count;
+	order->getEdgeRemoteMacs.queries = eamalloc(count, sizeof(EdgeMacQuery), 0);
+	for (size_t i = 0; i < count; ++i) {
+		strncpy(order->getEdgeRemoteMacs.queries[i].intfName, intfNames[i], INTERFACE_BUF_LEN);
+		order->getEdgeRemoteMacs.queries[i].ip = ips[i];
+	}
+
+	WorkerResponse* resps = eamalloc(count, sizeof(WorkerResponse), 0);
+	int err = queryWorkers(order, ResponseGotEdgeMac, resps, count);
+	bool missing = false;
+	for (size_t i = 0; err == 0 && i < count; ++i) {
+		if (resps[i].gotEdgeMac.found) {
+			memcpy(edgeRemoteMacs[i].octets, resps[i].gotEdgeMac.mac.octets, MAC_ADDR_BYTES);
+			continue;
+		}
 		char ipStr[IP4_ADDR_BUFLEN];
-		ip4AddrToString(ip, ipStr);
-		lprintf(LogError, "Could not find the MAC address for edge node with IP %s on interface '%s'. Ensure that the edge node is online, or manually specify the MAC address in the setup file or command arguments.\n", ipStr, intfName);
+		ip4AddrToString(ips[i], ipStr);
+		lprintf(LogError, "Could not find the MAC address for edge node with IP %s on interface '%s'. Ensure that the edge node is online, or manually specify the MAC address in the setup file or command arguments.\n", ipStr, intfNames[i]);
+		missing = true;
 	}
-	g_mutex_unlock(&workMain.lock);
+	free(resps);
+	if (err == 0 && missing) err = 1;
 	return err;
 }
 
-int workGetEdgeLocalMac(const char* intfName, macAddr* edgeLocalMac) {
-	WorkerOrder* order = newOrder(WorkerGetEdgeLocalMac);
-	strncpy(order->getEdgeLocalMac.intfName, intfName, INTERFACE_BUF_LEN);
-	int err = sendOrder(order, false);
-	if (err != 0) return err;
+int workGetEdgeLocalMacs(size_t count, const char* const intfNames[], macAddr edgeLocalMacs[]) {
+	if (count == 0) return 0;
 
-	g_mutex_lock(&workMain.lock);
-	err = waitForResponse(ResponseGotMac);
-	if (err == 0) {
-		memcpy(edgeLocalMac->octets, workMain.response.gotMac.mac.octets, MAC_ADDR_BYTES);
+	WorkerOrder** orders = eamalloc(count, sizeof(WorkerOrder*), 0);
+	for (size_t i = 0; i < count; ++i) {
+		orders[i] = newOrder(WorkerGetEdgeLocalMac);
+		strncpy(orders[i]->getEdgeLocalMac.intfName, intfNames[i], INTERFACE_BUF_LEN);
 	}
-	g_mutex_unlock(&workMain.lock);
+	WorkerResponse* resps = eamalloc(count, sizeof(WorkerResponse), 0);
+	int err = queryWorkersEach(orders, ResponseGotMac, resps, count);
+	for (size_t i = 0; err == 0 && i < count; ++i) {
+		memcpy(edgeLocalMacs[i].octets, resps[i].gotMac.mac.octets, MAC_ADDR_BYTES);
+	}
+	free(resps);
+	free(orders);
 	return err;
 }
 
-int workGetInterfaceMtu(const char* intfName, int* mtu) {
-	WorkerOrder* order = newOrder(WorkerGetInterfaceMtu);
-	strncpy(order->getInterfaceMtu.intfName, intfName, INTERFACE_BUF_LEN);
-	int err = sendOrder(order, false);
-	if (err != 0) return err;
+int workGetEdgeLocalMac(const char* intfName, macAddr* edgeLocalMac) {
+	return workGetEdgeLocalMacs(1, &intfName, edgeLocalMac);
+}
 
-	g_mutex_lock(&workMain.lock);
-	err = waitForResponse(ResponseGotMtu);
-	if (err == 0) {
-		*mtu = workMain.response.gotMtu.mtu;
+int workGetInterfaceMtus(size_t count, const char* const intfNames[], int mtus[]) {
+	if (count == 0) return 0;
+
+	WorkerOrder** orders = eamalloc(count, sizeof(WorkerOrder*), 0);
+	for (size_t i = 0; i < count; ++i) {
+		orders[i] = newOrder(WorkerGetInterfaceMtu);
+		strncpy(orders[i]->getInterfaceMtu.intfName, intfNames[i], INTERFACE_BUF_LEN);
 	}
-	g_mutex_unlock(&workMain.lock);
+	WorkerResponse* resps = eamalloc(count, sizeof(WorkerResponse), 0);
+	int err = queryWorkersEach(orders, ResponseGotMtu, resps, count);
+	for (size_t i = 0; err == 0 && i < count; ++i) {
+		mtus[i] = resps[i].gotMtu.mtu;
+	}
+	free(resps);
+	free(orders);
 	return err;
 }
 
+int workGetInterfaceMtu(const char* intfName, int* mtu) {
+	return workGetInterfaceMtus(1, &intfName, mtu);
+}
+
 int workMtuSupported(int mtu, bool* supported, const char** failReason) {
 	WorkerOrder* order = newOrder(WorkerMtuSupported);
 	order->mtuSupported.mtu = mtu;
-	int err = sendOrder(order, false);
-	if (err != 0) return err;
+	WorkerResponse resp;
+	int err = queryWorkers(order, ResponseGotMtuSupported, &resp, 1);
+	if (err == 0) {
+		*supported = resp.gotMtuSupported.supported;
+		*failReason = resp.gotMtuSupported.failReason;
+	}
+	return err;
+}
 
-	g_mutex_lock(&workMain.lock);
-	err = waitForResponse(ResponseGotMtuSupported);
+int workBenchmark(uint32_t samples, workBenchmarkResult* result) {
+	WorkerOrder* order = newOrder(WorkerBenchmark);
+	order->benchmark.samples = samples;
+	WorkerResponse resp;
+	int err = queryWorkers(order, ResponseBenchmarked, &resp, 1);
 	if (err == 0) {
-		*supported = workMain.response.gotMtuSupported.supported;
-		*failReason = workMain.response.gotMtuSupported.failReason;
+		*result = resp.benchmarked;
 	}
-	g_mutex_unlock(&workMain.lock);
 	return err;
 }
 
-int workAddRoot(ip4Addr addrSelf, ip4Addr addrOther, int mtu, bool useInitNs) {
+static WorkerOrder* newRootOrder(ip4Addr addrSelf, ip4Addr addrOther, int mtu, bool useInitNs) {
 	WorkerOrder* loadOrder = newOrder(WorkerAddRoot);
 	loadOrder->addRoot.addrSelf = addrSelf;
 	loadOrder->addRoot.addrOther = addrOther;
 	loadOrder->addRoot.mtu = mtu;
 	loadOrder->addRoot.useInitNs = useInitNs;
 	loadOrder->addRoot.existing = true;
+	return loadOrder;
+}
+
+int workAddRoot(ip4Addr addrSelf, ip4Addr addrOther, int mtu, bool useInitNs) {
+	WorkerOrder* loadOrder = newRootOrder(addrSelf, addrOther, mtu, useInitNs);
 
 	WorkerOrder* createOrder = emalloc(sizeof(WorkerOrder));
 	*createOrder = *loadOrder;
@@ -925,10 +3342,11 @@ int workAddRoot(ip4Addr addrSelf, ip4Addr addrOther, int mtu, bool useInitNs) {
 
 	// First, instruct any one worker to create the root namespace
 	int err = sendOrder(createOrder, false);
-	if (err != 0) return err;
-
-	err = workJoin(false);
-	if (err != 0) return err;
+	if (err == 0) err = workJoin(false);
+	if (err != 0) {
+		free(loadOrder);
+		return err;
+	}
 
 	// Next, make sure that all workers load root namespace contexts
 	bool success = broadcastOrder(loadOrder);
@@ -936,15 +3354,42 @@ int workAddRoot(ip4Addr addrSelf, ip4Addr addrOther, int mtu, bool useInitNs) {
 	return (success ? 0 : 1);
 }
 
+int workLoadRoot(ip4Addr addrSelf, ip4Addr addrOther, int mtu, bool useInitNs) {
+	WorkerOrder* loadOrder = newRootOrder(addrSelf, addrOther, mtu, useInitNs);
+	bool success = broadcastOrder(loadOrder);
+	free(loadOrder);
+	return (success ? 0 : 1);
+}
+
 int workAddEdgeInterface(const char* intfName) {
 	WorkerOrder* order = newOrder(WorkerAddEdgeInterface);
 	strncpy(order->addEdgeInterface.intfName, intfName, INTERFACE_BUF_LEN);
 	return sendOrder(order, false);
 }
 
+int workAddHostPack(uint32_t pack) {
+	WorkerOrder* order = newOrder(WorkerAddHostPack);
+	order->addHostPack.pack = pack;
+	return sendOrder(order, false);
+}
+
+void workSetHostLocs(size_t count, const workHostLoc locs[]) {
+	free(workMain.hostLocs);
+	workMain.hostLocs = eamalloc(count, sizeof(workHostLoc), 0);
+	memcpy(workMain.hostLocs, locs, count * sizeof(workHostLoc));
+	workMain.hostLocCount = count;
+}
+
+static workHostLoc getHostLoc(nodeId id) {
+	if (id < workMain.hostLocCount) return workMain.hostLocs[id];
+	workHostLoc loc = { .pack = 0, .slot = 0 };
+	return loc;
+}
+
 int workAddHost(nodeId id, ip4Addr ip, macAddr macs[], int mtu, const TopoNode* node) {
 	WorkerOrder* order = newOrder(WorkerAddHost);
 	order->addHost.id = id;
+	order->addHost.loc = getHostLoc(id);
 	order->addHost.ip = ip;
 	if (node->client) {
 		for (int i = 0; i < NEEDED_MACS_CLIENT; ++i) {
@@ -956,6 +3401,13 @@ int workAddHost(nodeId id, ip4Addr ip, macAddr macs[], int mtu, const TopoNode*
 	return sendOrder(order, false);
 }
 
+int workSetClientShaping(nodeId id, const TopoNode* node) {
+	WorkerOrder* order = newOrder(WorkerSetClientShaping);
+	order->setClientShaping.id = id;
+	order->setClientShaping.node = *node;
+	return sendOrder(order, false);
+}
+
 int workSetSelfLink(nodeId id, const TopoLink* link) {
 	WorkerOrder* order = newOrder(WorkerSetSelfLink);
 	order->setSelfLink.id = id;
@@ -963,11 +3415,10 @@ int workSetSelfLink(nodeId id, const TopoLink* link) {
 	return sendOrder(order, false);
 }
 
-int workEnsureSystemScaling(uint64_t linkCount, nodeId nodeCount, nodeId clientNodes) {
+int workEnsureSystemScaling(const scalingCounts* counts) {
 	WorkerOrder* order = newOrder(WorkerEnsureSystemScaling);
-	order->ensureSystemScaling.linkCount = linkCount;
-	order->ensureSystemScaling.nodeCount = nodeCount;
-	order->ensureSystemScaling.clientNodes = clientNodes;
+	order->ensureSystemScaling.counts = *counts;
+	order->ensureSystemScaling.workers = workMain.workerLimit;
 	return sendOrder(order, false);
 }
 
@@ -975,6 +3426,8 @@ int workAddLink(nodeId sourceId, nodeId targetId, ip4Addr sourceIp, ip4Addr targ
 	WorkerOrder* order = newOrder(WorkerAddLink);
 	order->addLink.sourceId = sourceId;
 	order->addLink.targetId = targetId;
+	order->addLink.sourceLoc = getHostLoc(sourceId);
+	order->addLink.targetLoc = getHostLoc(targetId);
 	order->addLink.sourceIp = sourceIp;
 	order->addLink.targetIp = targetIp;
 	for (int i = 0; i < NEEDED_MACS_LINK; ++i) {
@@ -985,10 +3438,45 @@ int workAddLink(nodeId sourceId, nodeId targetId, ip4Addr sourceIp, ip4Addr targ
 	return sendOrder(order, false);
 }
 
+int workAddTunnel(nodeId localId, nodeId remoteId, ip4Addr localIp, ip4Addr remoteIp, macAddr macs[], int mtu, const TopoLink* link, uint32_t vni, ip4Addr underlayLocal, ip4Addr underlayRemote) {
+	WorkerOrder* order = newOrder(WorkerAddTunnel);
+	order->addTunnel.localId = localId;
+	order->addTunnel.remoteId = remoteId;
+	order->addTunnel.localLoc = getHostLoc(localId);
+	order->addTunnel.localIp = localIp;
+	order->addTunnel.remoteIp = remoteIp;
+	for (int i = 0; i < NEEDED_MACS_LINK; ++i) {
+		memcpy(order->addTunnel.macs[i].octets, macs[i].octets, MAC_ADDR_BYTES);
+	}
+	order->addTunnel.mtu = mtu;
+	order->addTunnel.link = *link;
+	order->addTunnel.vni = vni;
+	order->addTunnel.underlayLocal = underlayLocal;
+	order->addTunnel.underlayRemote = underlayRemote;
+	return sendOrder(order, false);
+}
+
+int workSetLinkShaping(nodeId sourceId, nodeId targetId, const TopoLink* link) {
+	WorkerOrder* order = newOrder(WorkerSetLinkShaping);
+	order->setLinkShaping.sourceId = sourceId;
+	order->setLinkShaping.targetId = targetId;
+	order->setLinkShaping.link = *link;
+	return sendOrder(order, false);
+}
+
+int workRemoveLink(nodeId sourceId, nodeId targetId) {
+	WorkerOrder* order = newOrder(WorkerRemoveLink);
+	order->removeLink.sourceId = sourceId;
+	order->removeLink.targetId = targetId;
+	return sendOrder(order, false);
+}
+
 int workAddInternalRoutes(nodeId id1, nodeId id2, ip4Addr ip1, ip4Addr ip2, const ip4Subnet* subnet1, const ip4Subnet* subnet2) {
 	WorkerOrder* order = newOrder(WorkerAddInternalRoutes);
 	order->addInternalRoutes.id1 = id1;
 	order->addInternalRoutes.id2 = id2;
+	order->addInternalRoutes.loc1 = getHostLoc(id1);
+	order->addInternalRoutes.loc2 = getHostLoc(id2);
 	order->addInternalRoutes.ip1 = ip1;
 	order->addInternalRoutes.ip2 = ip2;
 	order->addInternalRoutes.subnet1 = *subnet1;
@@ -996,6 +3484,16 @@ int workAddInternalRoutes(nodeId id1, nodeId id2, ip4Addr ip1, ip4Addr ip2, cons
 	return sendOrder(order, false);
 }
 
+int workModifyInternalRoute(nodeId id, nodeId nextId, ip4Addr nextIp, const ip4Subnet* subnet, bool remove) {
+	WorkerOrder* order = newOrder(WorkerModifyInternalRoute);
+	order->modifyInternalRoute.id = id;
+	order->modifyInternalRoute.nextId = nextId;
+	order->modifyInternalRoute.nextIp = nextIp;
+	order->modifyInternalRoute.subnet = *subnet;
+	order->modifyInternalRoute.remove = remove;
+	return sendOrder(order, false);
+}
+
 int workAddClientRoutes(nodeId clientId, macAddr clientMacs[], const ip4Subnet* subnet, uint32_t edgePort, uint32_t nextOvsPort) {
 	WorkerOrder* order = newOrder(WorkerAddClientRoutes);
 	order->addClientRoutes.clientId = clientId;
@@ -1019,6 +3517,12 @@ int workAddEdgeRoutes(const ip4Subnet* edgeSubnet, uint32_t edgePort, const macA
 	return sendOrder(order, false);
 }
 
+int workDestroyHost(nodeId id) {
+	WorkerOrder* order = newOrder(WorkerDestroyHost);
+	order->destroyHost.id = id;
+	return sendOrder(order, false);
+}
+
 int workDestroyHosts(void) {
 	return sendOrder(newOrder(WorkerDestroyHosts), false);
 }
@@ -32,16 +32,34 @@
 // expected to cease all work operations after encountering an error.
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "ip.h"
 #include "log.h"
+#include "scaling.h"
 #include "topology.h"
 
 #define NEEDED_MACS_LINK 2
 #define NEEDED_MACS_CLIENT (2 * NEEDED_MACS_LINK)
 #define NEEDED_PORTS_CLIENT 2
 
+// Largest number of hosts that can share a namespace (see workSetHostLocs).
+// Interface names in shared namespaces include the slot in hexadecimal.
+#define MAX_HOSTS_PER_PACK 4096
+
+// Location of a virtual host. Normally, every host has its own network
+// namespace. Non-client hosts may instead be packed into a shared namespace,
+// where each one is a VRF device with its own routing table. When the network
+// is partitioned among several machines, hosts constructed elsewhere have the
+// pack WORK_REMOTE_PACK; orders skip the parts that concern them.
+typedef struct {
+	uint32_t pack; // Shared namespace, numbered from 1, or 0 for a dedicated one
+	uint32_t slot; // Position of the host in the shared namespace
+} workHostLoc;
+
+#define WORK_REMOTE_PACK UINT32_MAX
+
 // Initializes the work subsystem. Free resources with workCleanup.
 // workConfigure must be called before sending any work commands.
 int workInit(void);
@@ -49,33 +67,81 @@ int workInit(void);
 // Sends configuration values to the initialized work subsystem.
 int workConfigure(LogLevel logThreshold, bool logColorize, const char* nsPrefix, const char* ovsDir, const char* ovsSchema, uint64_t softMemCap);
 
+// Limits the number of workers that execute orders to "limit" (0 means one per
+// processor, which is the number of processes started by workInit). Excess
+// processes are terminated. If threads is true, all of the processes are
+// replaced by threads of the main process. Each thread switches namespaces on
+// its own and receives orders in memory, avoiding the pipes and encoding. If
+// adaptive is true, the number of active workers is tuned while each phase (see
+// workSetPhase) runs, toward the count that executes orders at the highest
+// rate: adding workers stops helping once they contend on the same kernel
+// locks. The rate is measured periodically from the completion counters,
+// without waiting for the workers. The count only decides which workers are
+// given new namespaces and orders that are not tied to a namespace; orders for
+// an existing namespace always go to the worker that first used it. This
+// function must be called before workConfigure.
+int workSetWorkers(uint32_t limit, bool adaptive, bool threads);
+
 // Frees all resources associated with the work subsystem. This function
 // automatically joins before cleaning up.
 int workCleanup(void);
 
-// Determines the MAC address of an edge node connected to a physical interface.
-// The semantics are the same as netGetMacAddr. Since this function returns a
+// Determines the MAC addresses of "count" edge nodes connected to physical
+// interfaces. ARP requests for all of the edge nodes are sent at once (see
+// netDiscoverRemoteMacAddrs). The address for the edge node with IP ips[i]
+// behind interface intfNames[i] is stored in edgeRemoteMacs[i]. It is an error
+// if any of the addresses cannot be found. Since this function returns a
 // response, it automatically joins.
-int workGetEdgeRemoteMac(const char* intfName, ip4Addr ip, macAddr* edgeRemoteMac);
+int workGetEdgeRemoteMacs(size_t count, const char* const intfNames[], const ip4Addr ips[], macAddr edgeRemoteMacs[]);
 
 // Determines the MAC address of a physical interface connected to an edge node.
 // Assumes that the interface has already been moved into the root namespace.
 // Since this function returns a response, it automatically joins.
 int workGetEdgeLocalMac(const char* intfName, macAddr* edgeLocalMac);
 
+// Determines the MAC addresses of several physical interfaces connected to edge
+// nodes, storing the address of intfNames[i] in edgeLocalMacs[i]. The queries
+// are issued at once and answered by the workers concurrently. Assumes that the
+// interfaces have already been moved into the root namespace.
+int workGetEdgeLocalMacs(size_t count, const char* const intfNames[], macAddr edgeLocalMacs[]);
+
 // Determines the MTU of a physical interface. Assumes that the interface is in
 // the default namespace. Since this function returns a response, it
 // automatically joins.
 int workGetInterfaceMtu(const char* intfName, int* mtu);
 
+// Determines the MTUs of several physical interfaces, storing the MTU of
+// intfNames[i] in mtus[i]. The queries are issued at once and answered by the
+// workers concurrently. Assumes that the interfaces are in the default
+// namespace.
+int workGetInterfaceMtus(size_t count, const char* const intfNames[], int mtus[]);
+
 // Determines if a requested MTU size is supported by the system configuration.
 // Since this function returns a response, it automatically joins.
 int workMtuSupported(int mtu, bool* supported, const char** failReason);
 
+typedef struct {
+	double hostSecs;   // Time to create and configure a host namespace
+	double linkSecs;   // Time to create, configure, and shape a link
+	double routeSecs;  // Time to add a single static route
+	int64_t hostBytes; // Approximate kernel memory used by a host namespace
+	int64_t linkBytes; // Approximate kernel memory used by a link
+} workBenchmarkResult;
+
+// Measures the cost of the operations used to construct networks by performing
+// "samples" of each in anonymous namespaces, which are destroyed afterwards.
+// The existing network and the system configuration are not modified. Since
+// this function returns a response, it automatically joins.
+int workBenchmark(uint32_t samples, workBenchmarkResult* result);
+
 // Creates a network namespace called the "root", which provides connectivity to
 // the external world.
 int workAddRoot(ip4Addr addrSelf, ip4Addr addrOther, int mtu, bool useInitNs);
 
+// Instructs all workers to use a root namespace that was created by a previous
+// invocation of the program with workAddRoot.
+int workLoadRoot(ip4Addr addrSelf, ip4Addr addrOther, int mtu, bool useInitNs);
+
 // Adds an external interface to the root namespace. This removes it from the
 // init namespace, so it will appear to vanish from a simple "ifconfig" listing.
 // The interface is added to the switch, thereby connecting it to to virtual
@@ -84,26 +150,66 @@ int workAddRoot(ip4Addr addrSelf, ip4Addr addrOther, int mtu, bool useInitNs);
 // calls.
 int workAddEdgeInterface(const char* intfName);
 
-// Creates a new virtual host in its own network namespace. If the node is a
+// Creates a namespace that holds packed hosts. The caller must join before
+// adding hosts to it.
+int workAddHostPack(uint32_t pack);
+
+// Sets the locations of the hosts with identifiers below "count", which are
+// used by all subsequent orders that refer to the hosts. Other hosts have their
+// own namespaces. Client hosts must not be packed, and packed hosts cannot be
+// modified after they are constructed (e.g., with workSetLinkShaping). The
+// locations are copied.
+void workSetHostLocs(size_t count, const workHostLoc locs[]);
+
+// Creates a new virtual host in its own network namespace, or as a VRF device
+// in a shared namespace if it was packed by workSetHostLocs. If the node is a
 // client, then it is connected to the root. If the node is a client, then macs
 // should contain NeededMacsClient unique addresses.
 int workAddHost(nodeId id, ip4Addr ip, macAddr macs[], int mtu, const TopoNode* node);
 
+// Replaces the traffic shaping parameters for the connection between a client
+// node and the root. The root must have been created or loaded.
+int workSetClientShaping(nodeId id, const TopoNode* node);
+
 // Applies traffic shaping parameters to a client node's "self" link.
 int workSetSelfLink(nodeId id, const TopoLink* link);
 
 // Sets system parameters to ensure that the kernel allocates enough resources
-// for the network. This should be called before adding any links or routes.
-int workEnsureSystemScaling(uint64_t linkCount, nodeId nodeCount, nodeId clientNodes);
+// for a network of the given size (see scalingPlan). Limits are only raised,
+// and each change is logged along with its previous value. This should be
+// called before adding any links or routes.
+int workEnsureSystemScaling(const scalingCounts* counts);
 
 // Adds a virtual connection between two hosts. macs should contain
 // NeededMacsLink unique addresses.
 int workAddLink(nodeId sourceId, nodeId targetId, ip4Addr sourceIp, ip4Addr targetIp, macAddr macs[], int mtu, const TopoLink* link);
 
+// Adds the local end of a virtual connection to a host on another machine. The
+// connection is a VXLAN tunnel with the given identifier between the underlay
+// addresses of the two machines, which must be reachable from the namespace
+// that the program was started in. Both ends must use the same identifier and
+// swapped parameters. macs should contain the local MAC address followed by
+// the remote one.
+int workAddTunnel(nodeId localId, nodeId remoteId, ip4Addr localIp, ip4Addr remoteIp, macAddr macs[], int mtu, const TopoLink* link, uint32_t vni, ip4Addr underlayLocal, ip4Addr underlayRemote);
+
+// Replaces the traffic shaping parameters for an existing link between two
+// hosts.
+int workSetLinkShaping(nodeId sourceId, nodeId targetId, const TopoLink* link);
+
+// Removes the virtual connection between two hosts, along with any routes that
+// use it.
+int workRemoveLink(nodeId sourceId, nodeId targetId);
+
 // Adds static routing paths for internal links. Node 1 will route packets for
 // subnet2 through node 2. The reverse path is also set up.
 int workAddInternalRoutes(nodeId id1, nodeId id2, ip4Addr ip1, ip4Addr ip2, const ip4Subnet* subnet1, const ip4Subnet* subnet2);
 
+// Adds or removes a single static route in one direction. Node "id" will route
+// packets for the subnet through the link to node "nextId", whose address is
+// nextIp. Existing routes for the subnet are replaced. Removing a route that no
+// longer exists is not an error.
+int workModifyInternalRoute(nodeId id, nodeId nextId, ip4Addr nextIp, const ip4Subnet* subnet, bool remove);
+
 // Adds static routing paths between a client node and the root. The subnet is
 // the range that the client node is responsible for. This also adds the
 // associated flow rules to the switch in the root namespace. clientMacs should
@@ -120,6 +226,9 @@ int workAddClientRoutes(nodeId clientId, macAddr clientMacs[], const ip4Subnet*
 // returned by workGetEdgeMac and workGetEdgeLocalMac.
 int workAddEdgeRoutes(const ip4Subnet* edgeSubnet, uint32_t edgePort, const macAddr* edgeLocalMac, const macAddr* edgeRemoteMac);
 
+// Destroys a single non-client host and all of its links.
+int workDestroyHost(nodeId id);
+
 // Destroys all hosts created with the network prefix. If an Open vSwitch
 // instance is running for a root namespace, it is shut down and deleted. If
 // deletedHosts is not NULL, the number of deleted hosts is stored. If an error
@@ -128,5 +237,93 @@ int workDestroyHosts(void);
 
 // Waits until all submitted work has been completed. If resetError is true,
 // then all queued errors are ignored, and the error state of the subsystem is
-// reset.
+// reset. Joins are not needed between orders that modify the same host, or
+// between orders that use Open vSwitch; these are always executed in the order
+// in which they were issued.
 int workJoin(bool resetError);
+
+// Returns the number of orders that the workers have executed, recorded in a
+// plan, or skipped because they were completed by an interrupted setup. The
+// value is read from the completion counters of the workers without waiting
+// for them, and may lag slightly behind while divided orders are in flight.
+// Broadcast orders are not counted. Unlike the other functions in this module,
+// this may be called from any thread.
+uint64_t workGetCompletedOrders(void);
+
+// Begins recording a setup plan to a file. While a plan is being recorded,
+// orders that modify the system are written to the file rather than executed,
+// and joins are recorded as barriers. Queries (e.g., workGetInterfaceMtu) are
+// still executed normally. If filename is NULL, the orders are only counted
+// (see workGetPlanStats). This function automatically joins before recording.
+int workBeginPlan(const char* filename);
+
+typedef struct {
+	uint64_t orders;          // Total number of recorded orders
+	uint64_t joins;
+	uint64_t hosts;           // Network namespaces
+	uint64_t clientHosts;
+	uint64_t links;           // Virtual ethernet pairs, including client links
+	uint64_t routes;          // Route and rule modifications
+	uint64_t serialRoutes;    // Subset of routes separated by joins
+	uint64_t switchPorts;     // Open vSwitch ports
+	uint64_t switchFlows;     // Open vSwitch flow rules
+	uint32_t workers;         // Number of worker processes
+} workPlanStats;
+
+// Retrieves resource counts for the orders recorded since the last call to
+// workBeginPlan. The values remain available after workEndPlan.
+void workGetPlanStats(workPlanStats* stats);
+
+// Stops recording a setup plan. If commit is true, the plan is finalized.
+// Otherwise, the partially written file is deleted.
+int workEndPlan(bool commit);
+
+// Executes all orders and joins stored in a setup plan file created with
+// workBeginPlan, in their original order.
+int workReplayPlan(const char* filename);
+
+// Stages of network construction, as recorded in setup journals
+typedef enum {
+	PhaseStart,          // Nothing has been constructed yet
+	PhaseRoot,           // Root namespace and edge interfaces
+	PhaseHosts,
+	PhaseLinks,
+	PhaseClientRoutes,
+	PhaseInternalRoutes,
+} WorkPhase;
+
+// Begins recording a setup journal in a file. Every time a join finishes after
+// enough orders (or at the end of a phase), a checkpoint with the number of
+// completed orders is appended to the journal, and joins are added
+// automatically to long sequences of orders. The responses to queries are also
+// recorded. The fingerprint identifies the inputs for the setup; it must be
+// reproduced exactly in order to resume.
+//
+// If resume is true and the file holds a journal with the same fingerprint,
+// then the orders completed before its last checkpoint are not executed again.
+// Instead, the hosts and links that they created are verified, queries are
+// answered from the journal, and the remaining orders in the interrupted batch
+// are executed in a recovery mode that replaces partial results. The caller
+// must issue exactly the same sequence of calls as the interrupted setup.
+// resumed is set to true if a checkpoint was found. Otherwise, a new journal
+// is started.
+int workBeginJournal(const char* filename, uint64_t fingerprint, bool resume, bool* resumed);
+
+// Sets the phase recorded with subsequent checkpoints. When the number of
+// workers is adaptive (see workSetWorkers), each phase is tuned separately.
+void workSetPhase(WorkPhase phase);
+
+// Collects latency statistics for every kind of order: the time that orders
+// spend queued in the main process (including waiting for dependencies),
+// waiting in the worker behind earlier orders, and being executed, and the
+// time taken to deliver query responses. The workers keep their measurements
+// in shared memory, which is collected at every join and attributed to the
+// current phase (see workSetPhase). When workCleanup is called, a summary for
+// each phase is printed to stderr if print is true, and written to jsonFile as
+// a JSON object if it is not NULL. This must be called before workConfigure.
+void workEnableOrderStats(bool print, const char* jsonFile);
+
+// Stops recording the setup journal. If complete is true, the journal is
+// marked as finished, and it is an error if fewer orders were issued than were
+// recorded by an interrupted setup being resumed.
+int workEndJournal(bool complete);
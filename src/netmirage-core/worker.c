@@ -36,6 +36,8 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <glib.h>
+
 #include "ip.h"
 #include "log.h"
 #include "mem.h"
@@ -44,23 +46,35 @@
 #include "ovs.h"
 #include "topology.h"
 
-static char ovsDir[PATH_MAX+1] = {0};
-static char ovsSchema[PATH_MAX+1] = {0};
+// The state of each worker is thread-local, since workers may be threads of
+// the same process rather than separate processes. The active network
+// namespace is also a property of the thread.
+
+static __thread char ovsDir[PATH_MAX+1] = {0};
+static __thread char ovsSchema[PATH_MAX+1] = {0};
 
-static bool ovsSupportsJumboPackets = false;
+static __thread bool ovsSupportsJumboPackets = false;
 
-static netCache* nc = NULL;
+static __thread netCache* nc = NULL;
 
 // We keep these outside of the cache because they are used frequently:
-static netContext* defaultNet = NULL;
-static netContext* rootNet = NULL;
+static __thread netContext* defaultNet = NULL;
+static __thread netContext* rootNet = NULL;
 
 // We need to have two IP addresses for the root due to policy routing problems
 // in kernel 3 (see workerAddClientRoutes for details)
-static ip4Addr rootIpSelf;
-static ip4Addr rootIpOther;
+static __thread ip4Addr rootIpSelf;
+static __thread ip4Addr rootIpOther;
+
+static __thread ovsContext* rootSwitch = NULL;
+
+// Shared namespaces holding packed hosts, indexed by pack number. Like the
+// root, these are kept outside of the cache because they are used frequently.
+static __thread GHashTable* packNets = NULL;
 
-static ovsContext* rootSwitch = NULL;
+// True while orders from a batch that an interrupted setup may have partially
+// completed are being executed again (see workerSetRecovery)
+static __thread bool recovering = false;
 
 // Converts a node identifier into a namespace name. buffer should be large
 // enough to hold the identifier in decimal representation and the NUL
@@ -71,6 +85,26 @@ static void idToNsName(nodeId id, char* buffer) {
 
 static const char* RootName = "root";
 
+// Hosts packed into shared namespaces are VRF devices named after the host.
+// Their interfaces are named after their slot in the shared namespace and the
+// other host, both in hexadecimal, so that the names fit in INTERFACE_BUF_LEN.
+static const char* PackNsPrefix = "vrf";
+static const char* VrfDevPrefix = "vrf";
+static const char* PackLinkPrefix = "v";
+#define PACK_NS_BUFLEN (4 + MAX_NODE_ID_BUFLEN)
+
+// Converts a pack number into the name of its shared namespace
+static void packToNsName(uint32_t pack, char* buffer) {
+	sprintf(buffer, "%s-%u", PackNsPrefix, pack);
+}
+
+// Converts the location of a host into the name of the namespace holding it.
+// buffer must be at least PACK_NS_BUFLEN bytes long.
+static void hostToNsName(nodeId id, const workHostLoc* loc, char* buffer) {
+	if (loc->pack == 0) idToNsName(id, buffer);
+	else packToNsName(loc->pack, buffer);
+}
+
 // Must be at most (INTERFACE_BUF_LEN-MAX_NODE_ID_BUFLEN) characters (4)
 static const char* SelfLinkPrefix = "self";
 static const char* RootLinkPrefix = "root";
@@ -81,11 +115,18 @@ static const char* RootBridgeName = "netmirage-br0";
 // Arbitrary values, but chosen to leave the user plenty of space to customize
 static const uint8_t CustomTableId = 120;
 static const uint32_t CustomTablePriority = 9999;
+static const uint32_t VrfTableBase = 1000; // Packed hosts use VrfTableBase+slot
 static const uint32_t OvsPriorityArp = (1 << 15) - 100;
 static const uint32_t OvsPrioritySelf = 1 << 14;
 static const uint32_t OvsPriorityIn = 1 << 13;
 static const uint32_t OvsPriorityOut = 1 << 7;
 
+// Destination port for tunnels to hosts on other machines (IANA VXLAN port)
+static const uint16_t VxlanPort = 4789;
+
+// Time to wait for edge nodes to answer ARP requests
+static const int EdgeArpTimeoutMs = 3000;
+
 #define MAC_CLIENT_SELF  0
 #define MAC_ROOT_SELF    1
 #define MAC_CLIENT_OTHER 2
@@ -129,6 +170,7 @@ int workerInit(const char* nsPrefix, const char* ovsDirArg, const char* ovsSchem
 	if (ovsSchemaArg != NULL) strncpy(ovsSchema, ovsSchemaArg, PATH_MAX+1);
 
 	nc = ncNewCache(softMemCap);
+	packNets = g_hash_table_new(&g_direct_hash, &g_direct_equal);
 	int err = netInit(nsPrefix);
 	if (err != 0) return err;
 	defaultNet = netOpenNamespace(NULL, false, false, &err);
@@ -179,55 +221,33 @@ static void workerCleanupRoot(void) {
 
 int workerCleanup(void) {
 	workerCleanupRoot();
+	if (packNets != NULL) {
+		GHashTableIter it;
+		g_hash_table_iter_init(&it, packNets);
+		gpointer val;
+		while (g_hash_table_iter_next(&it, NULL, &val)) {
+			netCloseNamespace(val, false);
+		}
+		g_hash_table_destroy(packNets);
+		packNets = NULL;
+	}
 	netCloseNamespace(defaultNet, false);
 	netCleanup();
 	ncFreeCache(nc);
 	return 0;
 }
 
-int workerGetEdgeRemoteMac(const char* intfName, ip4Addr ip, macAddr* edgeRemoteMac) {
+int workerGetEdgeRemoteMacs(netArpTarget targets[], size_t count) {
 	int res = netSwitchNamespace(defaultNet);
 	if (res != 0) return res;
-
-	char ipStr[IP4_ADDR_BUFLEN];
-	ipStr[0] = '\0';
-	for (int attempt = 0; attempt < 3; ++attempt) {
-		res = netGetRemoteMacAddr(defaultNet, intfName, ip, edgeRemoteMac);
-		if (res == 0) return 0;
-		if (res != EAGAIN) return res;
-
-		// The easiest way to force the kernel to update the ARP table is to
-		// send a packet to the remote host. We'll use an ICMP echo request.
-		if (attempt == 0) {
-			ip4AddrToString(ip, ipStr);
-		} else {
-			// Don't spam
-			sleep(1);
-		}
-		errno = 0;
-		pid_t pingPid = fork();
-		if (pingPid == -1) {
-			lprintf(LogError, "Could not fork to ping: %s\n", strerror(errno));
-			return errno;
-		}
-		if (pingPid == 0) {
-			fclose(stdin);
-			fclose(stdout);
-			fclose(stderr);
-			execlp("ping", "ping", "-c", "1", "-I", intfName, ipStr, NULL);
-			exit(1);
-		}
-		int pingStatus;
-		waitpid(pingPid, &pingStatus, 0);
-		if (!WIFEXITED(pingStatus) || WEXITSTATUS(pingStatus) != 0) {
-			lprintf(LogWarning, "Failed to ping edge node with IP %s on interface '%s'. Exit code: %d\n", ipStr, intfName, WEXITSTATUS(pingStatus));
-		}
-	}
-	return 1;
+	return netDiscoverRemoteMacAddrs(defaultNet, targets, count, EdgeArpTimeoutMs);
 }
 
 int workerGetEdgeLocalMac(const char* intfName, macAddr* edgeLocalMac) {
-	return netGetLocalMacAddr(rootNet, intfName, edgeLocalMac);
+	// When a setup plan is being recorded, the root is never created and the
+	// interface is still in the default namespace. Its address is the same.
+	netContext* net = (rootNet == NULL ? defaultNet : rootNet);
+	return netGetLocalMacAddr(net, intfName, edgeLocalMac);
 }
 
 int workerGetInterfaceMtu(const char* intfName, int* mtu) {
@@ -256,11 +276,19 @@ static int applyNamespaceParams(void) {
 	return err;
 }
 
-static int applyInterfaceParams(netContext* net, const char* intfName, ip4Addr addr, int* idx) {
+// If masterIdx is not 0, the interface is enslaved to that VRF device
+static int applyInterfaceParams(netContext* net, const char* intfName, ip4Addr addr, int masterIdx, int* idx) {
 	int err;
 	*idx = netGetInterfaceIndex(net, intfName, &err);
 	if (*idx == -1) return err;
 
+	if (masterIdx != 0) {
+		// Enslaving the interface before adding its address places the
+		// connected routes in the table of the VRF
+		err = netSetInterfaceMaster(net, *idx, masterIdx, true);
+		if (err != 0) return err;
+	}
+
 	err = netSetInterfaceGro(net, intfName, false);
 	if (err != 0) return err;
 
@@ -277,15 +305,15 @@ static int buildVethPair(netContext* sourceNet, netContext* targetNet,
 		const char* sourceIntf, const char* targetIntf,
 		ip4Addr sourceIp, ip4Addr targetIp,
 		const macAddr* sourceMac, const macAddr* targetMac,
-		int mtu,
+		int mtu, int sourceMaster, int targetMaster,
 		int* sourceIntfIdx, int* targetIntfIdx) {
 
 	int err = netCreateVethPair(sourceIntf, targetIntf, sourceNet, targetNet, sourceMac, targetMac, mtu, true);
 	if (err != 0) return err;
 
-	err = applyInterfaceParams(sourceNet, sourceIntf, sourceIp, sourceIntfIdx);
+	err = applyInterfaceParams(sourceNet, sourceIntf, sourceIp, sourceMaster, sourceIntfIdx);
 	if (err != 0) return err;
-	err = applyInterfaceParams(targetNet, targetIntf, targetIp, targetIntfIdx);
+	err = applyInterfaceParams(targetNet, targetIntf, targetIp, targetMaster, targetIntfIdx);
 	if (err != 0) return err;
 
 	err = netAddStaticArp(sourceNet, sourceIntf, targetIp, targetMac);
@@ -341,21 +369,32 @@ static int addArpResponses(ip4Addr addr, void* userData) {
 	return ovsAddArpResponse(rootSwitch, RootBridgeName, addr, (const macAddr*)userData, OvsPriorityArp);
 }
 
+void workerSetRecovery(bool enabled) {
+	lprintf(LogDebug, "%s recovery mode for orders from an interrupted setup\n", (enabled ? "Entering" : "Leaving"));
+	recovering = enabled;
+}
+
 int workerAddEdgeInterface(const char* intfName) {
 	lprintf(LogDebug, "Adding external interface '%s' to the switch in the root namespace\n", intfName);
 
 	int err;
 
 	int intfIdx = netGetInterfaceIndex(defaultNet, intfName, &err);
-	if (intfIdx == -1) return err;
-
-	err = netMoveInterface(defaultNet, intfName, intfIdx, rootNet, &intfIdx);
-	if (err != 0) return err;
+	if (intfIdx == -1 && recovering && err == ENODEV) {
+		// The interface may have been moved before the setup was interrupted
+		intfIdx = netGetInterfaceIndex(rootNet, intfName, &err);
+		if (intfIdx == -1) return err;
+	} else if (intfIdx == -1) {
+		return err;
+	} else {
+		err = netMoveInterface(defaultNet, intfName, intfIdx, rootNet, &intfIdx);
+		if (err != 0) return err;
+	}
 
 	err = netSetInterfaceUp(rootNet, intfName, true);
 	if (err != 0) return err;
 
-	err = ovsAddPort(rootSwitch, RootBridgeName, intfName);
+	err = ovsAddPort(rootSwitch, RootBridgeName, intfName, recovering);
 	if (err != 0) return err;
 
 	macAddr intfMac;
@@ -368,6 +407,12 @@ int workerAddEdgeInterface(const char* intfName) {
 	return 0;
 }
 
+typedef struct {
+	int* indices;
+	size_t count;
+	size_t cap;
+} workerIntfList;
+
 static void sprintRootSelfIntf(char* buf, nodeId id) {
 	sprintf(buf, "%s-%u", SelfLinkPrefix, id);
 }
@@ -376,15 +421,149 @@ static void sprintRootUpIntf(char* buf, nodeId id) {
 	sprintf(buf, "%s-%u", NodeLinkPrefix, id);
 }
 
-int workerAddHost(nodeId id, ip4Addr ip, macAddr macs[], int mtu, const TopoNode* node) {
+static int workerListInterface(const char* name, int idx, void* userData) {
+	if (strcmp(name, "lo") == 0) return 0;
+
+	// We cannot delete the interfaces within the callback because this would
+	// result in nested netlink calls
+	workerIntfList* list = userData;
+	flexBufferGrow((void**)&list->indices, list->count, &list->cap, 1, sizeof(int));
+	flexBufferAppend(list->indices, &list->count, &idx, 1, sizeof(int));
+	return 0;
+}
+
+// Deletes every interface in a namespace except for the loopback interface. The
+// other ends of any virtual Ethernet pairs are deleted as well.
+static int workerClearInterfaces(netContext* net) {
+	workerIntfList intfs;
+	flexBufferInit((void**)&intfs.indices, &intfs.count, &intfs.cap);
+	int err = netEnumInterfaces(&workerListInterface, net, &intfs);
+	for (size_t i = 0; err == 0 && i < intfs.count; ++i) {
+		err = netDeleteInterface(net, intfs.indices[i], true);
+	}
+	flexBufferFree((void**)&intfs.indices, &intfs.count, &intfs.cap);
+	return err;
+}
+
+// Opens the shared namespace for a pack of hosts, creating it if requested
+static netContext* workerOpenPack(uint32_t pack, bool create, int* err) {
+	netContext* net = g_hash_table_lookup(packNets, GUINT_TO_POINTER(pack));
+	if (net != NULL) {
+		*err = netSwitchNamespace(net);
+		return (*err == 0 ? net : NULL);
+	}
+
+	char nsName[PACK_NS_BUFLEN];
+	packToNsName(pack, nsName);
+	net = netOpenNamespace(nsName, create, create && !recovering, err);
+	if (net == NULL) return NULL;
+	g_hash_table_insert(packNets, GUINT_TO_POINTER(pack), net);
+	return net;
+}
+
+static void sprintVrfDev(char* buf, nodeId id) {
+	sprintf(buf, "%s-%u", VrfDevPrefix, id);
+}
+
+// Names the interface of a host for its link to another host
+static void sprintLinkIntf(char* buf, const workHostLoc* loc, nodeId otherId) {
+	if (loc->pack == 0) {
+		sprintf(buf, "%s-%u", NodeLinkPrefix, otherId);
+	} else {
+		sprintf(buf, "%s%x-%x", PackLinkPrefix, loc->slot, otherId);
+	}
+}
+
+// The namespace that holds a host, along with the parameters for configuring
+// the host's interfaces and routes within it
+typedef struct {
+	netContext* net;
+	int vrfIdx;     // VRF device of a packed host, or 0
+	uint32_t table; // Routing table used by the host
+} workerHost;
+
+// Location of hosts that are only modified when they have their own namespace
+static const workHostLoc DedicatedLoc = { .pack = 0, .slot = 0 };
+
+static int workerOpenHost(nodeId id, const workHostLoc* loc, workerHost* host) {
+	int err;
+	host->vrfIdx = 0;
+	host->table = netGetTableId(TableMain);
+	if (loc->pack == 0) {
+		char nodeName[MAX_NODE_ID_BUFLEN];
+		idToNsName(id, nodeName);
+		host->net = ncOpenNamespace(nc, id, nodeName, false, false, &err);
+		if (host->net == NULL) return err;
+		return 0;
+	}
+
+	host->net = workerOpenPack(loc->pack, false, &err);
+	if (host->net == NULL) return err;
+	char vrfName[INTERFACE_BUF_LEN];
+	sprintVrfDev(vrfName, id);
+	host->vrfIdx = netGetInterfaceIndex(host->net, vrfName, &err);
+	if (host->vrfIdx == -1) return err;
+	host->table = VrfTableBase + loc->slot;
+	return 0;
+}
+
+int workerAddHostPack(uint32_t pack) {
+	lprintf(LogDebug, "Creating shared namespace %u for packed hosts\n", pack);
+
+	int err;
+	netContext* net = workerOpenPack(pack, true, &err);
+	if (net == NULL) return err;
+	return applyNamespaceParams();
+}
+
+// Creates a host as a VRF device in a shared namespace. Its interfaces are
+// added to the VRF when its links are created.
+static int workerAddPackedHost(nodeId id, const workHostLoc* loc, const TopoNode* node) {
+	if (node->client) {
+		lprintf(LogError, "BUG: client host %u cannot be packed into a shared namespace\n", id);
+		return 1;
+	}
+
+	lprintf(LogDebug, "Creating host %u as a VRF device in shared namespace %u\n", id, loc->pack);
+
+	int err;
+	netContext* net = workerOpenPack(loc->pack, false, &err);
+	if (net == NULL) return err;
+
+	char vrfName[INTERFACE_BUF_LEN];
+	sprintVrfDev(vrfName, id);
+	if (recovering) {
+		int oldIdx = netGetInterfaceIndex(net, vrfName, &err);
+		if (oldIdx != -1) {
+			err = netDeleteInterface(net, oldIdx, true);
+			if (err != 0) return err;
+		} else if (err != ENODEV) {
+			return err;
+		}
+	}
+
+	err = netCreateVrf(net, vrfName, VrfTableBase + loc->slot, true);
+	if (err != 0) return err;
+	return netSetInterfaceUp(net, vrfName, true);
+}
+
+int workerAddHost(nodeId id, const workHostLoc* loc, ip4Addr ip, macAddr macs[], int mtu, const TopoNode* node) {
+	if (loc->pack != 0) return workerAddPackedHost(id, loc, node);
+
 	char nodeName[MAX_NODE_ID_BUFLEN];
 	idToNsName(id, nodeName);
 
 	lprintf(LogDebug, "Creating host %s\n", nodeName);
 
+	// When recovering, the namespace may already exist with some of its links.
+	// We start over from an empty namespace.
 	int err;
-	netContext* net = ncOpenNamespace(nc, id, nodeName, true, true, &err);
+	netContext* net = ncOpenNamespace(nc, id, nodeName, true, !recovering, &err);
 	if (net == NULL) return err;
+	if (recovering) {
+		err = workerClearInterfaces(net);
+		if (err != 0) return err;
+	}
 
 	err = applyNamespaceParams();
 	if (err != 0) return err;
@@ -398,7 +577,7 @@ int workerAddHost(nodeId id, ip4Addr ip, macAddr macs[], int mtu, const TopoNode
 		int sourceIntfIdx, targetIntfIdx;
 
 		// Self link (used for intra-client communication)
-		err = buildVethPair(net, rootNet, SelfLinkPrefix, intfBuf, ip, rootIpSelf, &macs[MAC_CLIENT_SELF], &macs[MAC_ROOT_SELF], mtu, &sourceIntfIdx, &targetIntfIdx);
+		err = buildVethPair(net, rootNet, SelfLinkPrefix, intfBuf, ip, rootIpSelf, &macs[MAC_CLIENT_SELF], &macs[MAC_ROOT_SELF], mtu, 0, 0, &sourceIntfIdx, &targetIntfIdx);
 		if (err != 0) return err;
 		// We don't apply shaping to the self link until we read a reflexive
 		// edge from the input file (handled in workAddLink). However, we add
@@ -408,7 +587,7 @@ int workerAddHost(nodeId id, ip4Addr ip, macAddr macs[], int mtu, const TopoNode
 		sprintRootUpIntf(intfBuf, id);
 
 		// Up / down link (used for inter-client communication)
-		err = buildVethPair(net, rootNet, RootLinkPrefix, intfBuf, ip, rootIpOther, &macs[MAC_CLIENT_OTHER], &macs[MAC_ROOT_OTHER], mtu, &sourceIntfIdx, &targetIntfIdx);
+		err = buildVethPair(net, rootNet, RootLinkPrefix, intfBuf, ip, rootIpOther, &macs[MAC_CLIENT_OTHER], &macs[MAC_ROOT_OTHER], mtu, 0, 0, &sourceIntfIdx, &targetIntfIdx);
 		if (err != 0) return err;
 
 		err = netSetEgressShaping(net, sourceIntfIdx, 0, 0, node->packetLoss, node->bandwidthDown, 0, true);
@@ -437,107 +616,314 @@ int workerSetSelfLink(nodeId id, const TopoLink* link) {
 	return netSetEgressShaping(net, intfIdx, link->latency, link->jitter, link->packetLoss, 0.0, link->queueLen, true);
 }
 
-static int workGetLinkEndpoints(nodeId id1, nodeId id2, char* name1, char* name2, netContext** net1, netContext** net2, char* intf1, char* intf2) {
-	idToNsName(id1, name1);
-	idToNsName(id2, name2);
+int workerSetClientShaping(nodeId id, const TopoNode* node) {
+	char nodeName[MAX_NODE_ID_BUFLEN];
+	idToNsName(id, nodeName);
+
+	lprintf(LogDebug, "Updating traffic shaping for the connection between client host %s and the root\n", nodeName);
 
 	int err;
-	*net1 = ncOpenNamespace(nc, id1, name1, false, false, &err);
-	if (*net1 == NULL) return err;
-	*net2 = ncOpenNamespace(nc, id2, name2, false, false, &err);
-	if (*net2 == NULL) return err;
+	netContext* net = ncOpenNamespace(nc, id, nodeName, false, false, &err);
+	if (net == NULL) return err;
+	int sourceIntfIdx = netGetInterfaceIndex(net, RootLinkPrefix, &err);
+	if (sourceIntfIdx == -1) return err;
 
-	sprintf(intf1, "%s-%u", NodeLinkPrefix, id2);
-	sprintf(intf2, "%s-%u", NodeLinkPrefix, id1);
+	char intfBuf[INTERFACE_BUF_LEN];
+	sprintRootUpIntf(intfBuf, id);
+	int targetIntfIdx = netGetInterfaceIndex(rootNet, intfBuf, &err);
+	if (targetIntfIdx == -1) return err;
 
-	return 0;
+	err = netSetEgressShaping(net, sourceIntfIdx, 0, 0, node->packetLoss, node->bandwidthDown, 0, true);
+	if (err != 0) return err;
+	return netSetEgressShaping(rootNet, targetIntfIdx, 0, 0, node->packetLoss, node->bandwidthUp, 0, true);
 }
 
-int workerEnsureSystemScaling(uint64_t linkCount, nodeId nodeCount, nodeId clientNodes) {
-	lprintf(LogDebug, "Preparing system to handle %u nodes (%u clients) and %lu links\n", nodeCount, clientNodes, linkCount);
+int workerDestroyHost(nodeId id) {
+	char nodeName[MAX_NODE_ID_BUFLEN];
+	idToNsName(id, nodeName);
+
+	lprintf(LogDebug, "Destroying host %s\n", nodeName);
 
 	int err;
-	err = netSwitchNamespace(defaultNet);
+	netContext* net = ncOpenNamespace(nc, id, nodeName, false, false, &err);
+	if (net == NULL) return err;
+
+	// Other workers may still have the namespace open, which would keep it
+	// (and the virtual Ethernet pairs connecting it to its neighbors) alive
+	// after the namespace file is deleted. We explicitly delete the interfaces
+	// so that the neighbors see the change immediately.
+	err = workerClearInterfaces(net);
 	if (err != 0) return err;
 
-	// Ensure that the system-wide ARP hash table is large enough to hold static
-	// routing entries for every interface in the network.
+	// Our own cached context would also keep the namespace alive, and a later
+	// host with the same identifier must not receive it
+	ncCloseNamespace(nc, id);
+	return netDeleteNamespace(nodeName);
+}
 
-	int arpThresh1, arpThresh2, arpThresh3;
-	err = netGetArpTableSize(&arpThresh1, &arpThresh2, &arpThresh3);
+static int workGetLinkEndpoints(nodeId id1, nodeId id2, const workHostLoc* loc1, const workHostLoc* loc2, workerHost* host1, workerHost* host2, char* intf1, char* intf2) {
+	int err = workerOpenHost(id1, loc1, host1);
+	if (err != 0) return err;
+	err = workerOpenHost(id2, loc2, host2);
 	if (err != 0) return err;
 
-	uint64_t fudgeFactor = 100; // In case a few extras are needed
-	uint64_t neededArpEntries = 2LU * linkCount + 3LU * (uint64_t)clientNodes + fudgeFactor;
-	if (neededArpEntries > INT_MAX) {
-		lprintf(LogError, "The topology is too large. The kernel cannot support the required number of static ARP entries (%lu)\n", neededArpEntries);
-		return 1;
-	}
+	sprintLinkIntf(intf1, loc1, id2);
+	sprintLinkIntf(intf2, loc2, id1);
+
+	return 0;
+}
+
+int workerEnsureSystemScaling(const scalingCounts* counts, uint32_t workers) {
+	lprintf(LogDebug, "Preparing system to handle %lu nodes (%lu clients), %lu links, and %lu routes per namespace\n", counts->nodes, counts->clientNodes, counts->links, counts->maxRoutes);
 
-	lprintf(LogDebug, "Existing ARP GC thresholds were (%d, %d, %d)\n", arpThresh1, arpThresh2, arpThresh3);
+	int err;
+	err = netSwitchNamespace(defaultNet);
+	if (err != 0) return err;
 
-	if ((int)neededArpEntries > arpThresh2) {
-		lprintf(LogWarning, "The system's ARP table size (garbage collection at %d entries) is too small to support this topology (expected entries %lu).\n", arpThresh2, neededArpEntries);
+	scalingLimit limits[SCALING_MAX_LIMITS];
+	size_t limitCount = scalingPlan(counts, workers, limits);
+	for (size_t i = 0; i < limitCount; ++i) {
+		scalingLimit* limit = &limits[i];
+		if (limit->needed > limit->maximum) {
+			lprintf(LogError, "The topology is too large. The kernel cannot support the required value of %s (%lu for %s)\n", limit->sysctl, limit->needed, limit->reason);
+			return 1;
+		}
 
-		int extraSpace = (int)neededArpEntries - arpThresh2;
-		int newThresh1 = arpThresh1 + extraSpace;
-		int newThresh2 = arpThresh2 + extraSpace;
-		int newThresh3 = arpThresh3 + extraSpace;
-		err = netSetArpTableSize(newThresh1, newThresh2, newThresh3);
+		uint64_t current;
+		err = netGetSysctl(limit->sysctl, &current);
+		if (err == ENOENT && limit->optional) {
+			lprintf(LogDebug, "Kernel does not provide %s; skipping it\n", limit->sysctl);
+			continue;
+		} else if (err != 0) {
+			lprintf(LogError, "Could not read the kernel parameter %s\n", limit->sysctl);
+			return err;
+		}
+		if (current >= limit->needed) {
+			lprintf(LogDebug, "Kernel parameter %s is %lu, which is enough for %s (%lu)\n", limit->sysctl, current, limit->reason, limit->needed);
+			continue;
+		}
+
+		err = netSetSysctl(limit->sysctl, limit->needed);
 		if (err != 0) {
-			lprintln(LogError, "Could not modify the ARP table size to support the network topology.");
+			lprintf(LogError, "Could not raise the kernel parameter %s from %lu to %lu, which is needed for %s\n", limit->sysctl, current, limit->needed, limit->reason);
 			return err;
 		}
-		lprintf(LogWarning, "The system's ARP thresholds have been set to (%d, %d, %d), which may degrade the performance of the system. After finishing the experiments, we recommend setting the values back to (%d, %d, %d).\n", newThresh1, newThresh2, newThresh3, arpThresh1, arpThresh2, arpThresh3);
+		lprintf(LogWarning, "Raised the kernel parameter %s from %lu to %lu for %s. This may degrade the performance of the system; after finishing the experiments, we recommend setting it back to %lu.\n", limit->sysctl, current, limit->needed, limit->reason, current);
 	}
 
 	return 0;
 }
 
-int workerAddLink(nodeId sourceId, nodeId targetId, ip4Addr sourceIp, ip4Addr targetIp, macAddr macs[], int mtu, const TopoLink* link) {
-	char sourceName[MAX_NODE_ID_BUFLEN];
-	char targetName[MAX_NODE_ID_BUFLEN];
-	netContext* sourceNet;
-	netContext* targetNet;
+int workerAddLink(nodeId sourceId, nodeId targetId, const workHostLoc* sourceLoc, const workHostLoc* targetLoc, ip4Addr sourceIp, ip4Addr targetIp, macAddr macs[], int mtu, const TopoLink* link) {
+	int err = workerAddLinkSource(sourceId, targetId, sourceLoc, targetLoc, sourceIp, targetIp, macs, mtu, link);
+	if (err != 0) return err;
+	return workerAddLinkTarget(sourceId, targetId, sourceLoc, targetLoc, sourceIp, targetIp, macs, mtu, link);
+}
+
+int workerAddLinkSource(nodeId sourceId, nodeId targetId, const workHostLoc* sourceLoc, const workHostLoc* targetLoc, ip4Addr sourceIp, ip4Addr targetIp, macAddr macs[], int mtu, const TopoLink* link) {
+	workerHost source;
+	int err = workerOpenHost(sourceId, sourceLoc, &source);
+	if (err != 0) return err;
+
 	char sourceIntf[INTERFACE_BUF_LEN];
 	char targetIntf[INTERFACE_BUF_LEN];
+	sprintLinkIntf(sourceIntf, sourceLoc, targetId);
+	sprintLinkIntf(targetIntf, targetLoc, sourceId);
 
-	int err;
-	err = workGetLinkEndpoints(sourceId, targetId, sourceName, targetName, &sourceNet, &targetNet, sourceIntf, targetIntf);
+	lprintf(LogDebug, "Creating virtual connection from host %u to host %u\n", sourceId, targetId);
+
+	if (recovering) {
+		// Remove the connection if it was created before the interruption
+		int oldIntfIdx = netGetInterfaceIndex(source.net, sourceIntf, &err);
+		if (oldIntfIdx != -1) {
+			err = netDeleteInterface(source.net, oldIntfIdx, true);
+			if (err != 0) return err;
+		} else if (err != ENODEV) {
+			return err;
+		}
+	}
+
+	// The target's namespace is only needed to place the other end of the
+	// pair, so we avoid opening a full context for it
+	char targetNsName[PACK_NS_BUFLEN];
+	hostToNsName(targetId, targetLoc, targetNsName);
+	int targetFd = netOpenNamespaceFd(targetNsName, &err);
+	if (targetFd == -1) return err;
+	err = netCreateVethPairFd(sourceIntf, targetIntf, source.net, targetFd, &macs[0], &macs[1], mtu, true);
+	close(targetFd);
 	if (err != 0) return err;
 
-	lprintf(LogDebug, "Creating virtual connection from host %s to host %s\n", sourceName, targetName);
+	int intfIdx;
+	err = applyInterfaceParams(source.net, sourceIntf, sourceIp, source.vrfIdx, &intfIdx);
+	if (err != 0) return err;
+	err = netAddStaticArp(source.net, sourceIntf, targetIp, &macs[1]);
+	if (err != 0) return err;
+	err = netSetEgressShaping(source.net, intfIdx, link->latency, link->jitter, link->packetLoss, 0.0, link->queueLen, true);
+	if (err != 0) return err;
+	return netModifyRoute(source.net, false, source.table, ScopeLink, CreatorAdmin, targetIp, 32, 0, intfIdx, true);
+}
+
+int workerAddLinkTarget(nodeId sourceId, nodeId targetId, const workHostLoc* sourceLoc, const workHostLoc* targetLoc, ip4Addr sourceIp, ip4Addr targetIp, macAddr macs[], int mtu, const TopoLink* link) {
+	workerHost target;
+	int err = workerOpenHost(targetId, targetLoc, &target);
+	if (err != 0) return err;
+
+	char targetIntf[INTERFACE_BUF_LEN];
+	sprintLinkIntf(targetIntf, targetLoc, sourceId);
 
-	int sourceIntfIdx, targetIntfIdx;
+	int intfIdx;
+	err = applyInterfaceParams(target.net, targetIntf, targetIp, target.vrfIdx, &intfIdx);
+	if (err != 0) return err;
+	err = netAddStaticArp(target.net, targetIntf, sourceIp, &macs[0]);
+	if (err != 0) return err;
+	err = netSetEgressShaping(target.net, intfIdx, link->latency, link->jitter, link->packetLoss, 0.0, link->queueLen, true);
+	if (err != 0) return err;
+	return netModifyRoute(target.net, false, target.table, ScopeLink, CreatorAdmin, sourceIp, 32, 0, intfIdx, true);
+}
 
-	err = buildVethPair(sourceNet, targetNet, sourceIntf, targetIntf, sourceIp, targetIp, &macs[0], &macs[1], mtu, &sourceIntfIdx, &targetIntfIdx);
+// The tunnel is created from the namespace that the program was started in, so
+// that its packets use that namespace's interfaces and routes
+int workerAddTunnel(nodeId localId, nodeId remoteId, const workHostLoc* localLoc, ip4Addr localIp, ip4Addr remoteIp, macAddr macs[], int mtu, const TopoLink* link, uint32_t vni, ip4Addr underlayLocal, ip4Addr underlayRemote) {
+	workerHost host;
+	int err = workerOpenHost(localId, localLoc, &host);
 	if (err != 0) return err;
 
-	err = netSetEgressShaping(sourceNet, sourceIntfIdx, link->latency, link->jitter, link->packetLoss, 0.0, link->queueLen, true);
+	char intf[INTERFACE_BUF_LEN];
+	sprintLinkIntf(intf, localLoc, remoteId);
+
+	lprintf(LogDebug, "Creating tunnel %u from host %u to host %u on another machine\n", vni, localId, remoteId);
+
+	if (recovering) {
+		int oldIntfIdx = netGetInterfaceIndex(host.net, intf, &err);
+		if (oldIntfIdx != -1) {
+			err = netDeleteInterface(host.net, oldIntfIdx, true);
+			if (err != 0) return err;
+		} else if (err != ENODEV) {
+			return err;
+		}
+	}
+
+	err = netCreateVxlan(defaultNet, host.net, intf, &macs[0], mtu, vni, underlayLocal, underlayRemote, VxlanPort, true);
 	if (err != 0) return err;
-	err = netSetEgressShaping(targetNet, targetIntfIdx, link->latency, link->jitter, link->packetLoss, 0.0, link->queueLen, true);
+
+	int intfIdx;
+	err = applyInterfaceParams(host.net, intf, localIp, host.vrfIdx, &intfIdx);
 	if (err != 0) return err;
 
-	err = netModifyRoute(sourceNet, false, netGetTableId(TableMain), ScopeLink, CreatorAdmin, targetIp, 32, 0, sourceIntfIdx, true);
+	err = netAddStaticArp(host.net, intf, remoteIp, &macs[1]);
 	if (err != 0) return err;
-	err = netModifyRoute(targetNet, false, netGetTableId(TableMain), ScopeLink, CreatorAdmin, sourceIp, 32, 0, targetIntfIdx, true);
+
+	// The remote end shapes the traffic in the other direction
+	err = netSetEgressShaping(host.net, intfIdx, link->latency, link->jitter, link->packetLoss, 0.0, link->queueLen, true);
 	if (err != 0) return err;
 
-	return 0;
+	return netModifyRoute(host.net, false, host.table, ScopeLink, CreatorAdmin, remoteIp, 32, 0, intfIdx, true);
+}
+
+int workerSetLinkShaping(nodeId sourceId, nodeId targetId, bool sourceOnly, const TopoLink* link) {
+	workerHost source;
+	workerHost target;
+	char sourceIntf[INTERFACE_BUF_LEN];
+	char targetIntf[INTERFACE_BUF_LEN];
+
+	int err;
+	if (sourceOnly) {
+		err = workerOpenHost(sourceId, &DedicatedLoc, &source);
+		if (err != 0) return err;
+		sprintLinkIntf(sourceIntf, &DedicatedLoc, targetId);
+	} else {
+		err = workGetLinkEndpoints(sourceId, targetId, &DedicatedLoc, &DedicatedLoc, &source, &target, sourceIntf, targetIntf);
+		if (err != 0) return err;
+	}
+
+	lprintf(LogDebug, "Updating traffic shaping for the connection between host %u and host %u\n", sourceId, targetId);
+
+	int sourceIntfIdx = netGetInterfaceIndex(source.net, sourceIntf, &err);
+	if (sourceIntfIdx == -1) return err;
+	err = netSetEgressShaping(source.net, sourceIntfIdx, link->latency, link->jitter, link->packetLoss, 0.0, link->queueLen, true);
+	if (err != 0 || sourceOnly) return err;
+
+	int targetIntfIdx = netGetInterfaceIndex(target.net, targetIntf, &err);
+	if (targetIntfIdx == -1) return err;
+	return netSetEgressShaping(target.net, targetIntfIdx, link->latency, link->jitter, link->packetLoss, 0.0, link->queueLen, true);
 }
 
-int workerAddInternalRoutes(nodeId id1, nodeId id2, ip4Addr ip1, ip4Addr ip2, const ip4Subnet* subnet1, const ip4Subnet* subnet2) {
-	char name1[MAX_NODE_ID_BUFLEN];
-	char name2[MAX_NODE_ID_BUFLEN];
-	netContext* net1;
-	netContext* net2;
-	char intf1[INTERFACE_BUF_LEN];
-	char intf2[INTERFACE_BUF_LEN];
+int workerRemoveLink(nodeId sourceId, nodeId targetId) {
+	char sourceName[MAX_NODE_ID_BUFLEN];
+	idToNsName(sourceId, sourceName);
+
+	lprintf(LogDebug, "Removing virtual connection from host %s to host %u\n", sourceName, targetId);
 
 	int err;
-	err = workGetLinkEndpoints(id1, id2, name1, name2, &net1, &net2, intf1, intf2);
+	netContext* net = ncOpenNamespace(nc, sourceId, sourceName, false, false, &err);
+	if (net == NULL) return err;
+
+	char intf[INTERFACE_BUF_LEN];
+	sprintf(intf, "%s-%u", NodeLinkPrefix, targetId);
+	int intfIdx = netGetInterfaceIndex(net, intf, &err);
+	if (intfIdx == -1) return err;
+
+	// Deleting one end of the pair also deletes the other end, along with any
+	// routes that use either interface
+	return netDeleteInterface(net, intfIdx, true);
+}
+
+int workerCheckHost(nodeId id, const workHostLoc* loc) {
+	workerHost host;
+	int err = workerOpenHost(id, loc, &host);
+	if (err != 0) {
+		lprintf(LogError, "Host %u was created before the setup was interrupted, but it no longer exists\n", id);
+	}
+	return err;
+}
+
+// Checks that a host has an interface for its link to another host. Hosts on
+// other machines are checked by the instance running there.
+static int checkLinkIntf(nodeId id, nodeId otherId, const workHostLoc* loc) {
+	if (loc->pack == WORK_REMOTE_PACK) return 0;
+
+	workerHost host;
+	int err = workerOpenHost(id, loc, &host);
+	if (err != 0) return err;
+
+	char intf[INTERFACE_BUF_LEN];
+	sprintLinkIntf(intf, loc, otherId);
+	if (netGetInterfaceIndex(host.net, intf, &err) == -1) return err;
+	return 0;
+}
+
+int workerCheckLink(nodeId sourceId, nodeId targetId, const workHostLoc* sourceLoc, const workHostLoc* targetLoc) {
+	int err = checkLinkIntf(sourceId, targetId, sourceLoc);
+	if (err == 0) err = checkLinkIntf(targetId, sourceId, targetLoc);
+	if (err != 0) {
+		lprintf(LogError, "The virtual connection from host %u to host %u was created before the setup was interrupted, but it no longer exists\n", sourceId, targetId);
+	}
+	return err;
+}
+
+// Adds a route in host "id" for the subnet through its link to host "nextId".
+// Hosts on other machines are skipped, since the instance running there adds
+// their routes.
+static int addInternalRoute(nodeId id, nodeId nextId, const workHostLoc* loc, ip4Addr nextIp, const ip4Subnet* subnet) {
+	if (loc->pack == WORK_REMOTE_PACK) return 0;
+
+	workerHost host;
+	int err = workerOpenHost(id, loc, &host);
 	if (err != 0) return err;
 
+	char intf[INTERFACE_BUF_LEN];
+	sprintLinkIntf(intf, loc, nextId);
+	int intfIdx = netGetInterfaceIndex(host.net, intf, &err);
+	if (intfIdx == -1) return err;
+
+	// We allow "route exists" errors because we might try to add routes to the
+	// same internal nodes multiple times. In practice, this is rare.
+	err = netModifyRoute(host.net, false, host.table, ScopeGlobal, CreatorAdmin, subnet->addr, subnet->prefixLen, nextIp, intfIdx, true);
+	if (err != 0 && err != EEXIST) return err;
+	return 0;
+}
+
+int workerAddInternalRoutes(nodeId id1, nodeId id2, const workHostLoc* loc1, const workHostLoc* loc2, ip4Addr ip1, ip4Addr ip2, const ip4Subnet* subnet1, const ip4Subnet* subnet2) {
 	if (PASSES_LOG_THRESHOLD(LogDebug)) {
 		char ip1Str[IP4_ADDR_BUFLEN];
 		char ip2Str[IP4_ADDR_BUFLEN];
@@ -550,19 +936,31 @@ int workerAddInternalRoutes(nodeId id1, nodeId id2, ip4Addr ip1, ip4Addr ip2, co
 		lprintf(LogDebug, "Adding internal routes from %u / %s (for %s) to %u / %s (for %s)\n", id1, ip1Str, subnet1Str, id2, ip2Str, subnet2Str);
 	}
 
-	int intfIdx1 = netGetInterfaceIndex(net1, intf1, &err);
-	if (intfIdx1 == -1) return err;
-	int intfIdx2 = netGetInterfaceIndex(net2, intf2, &err);
-	if (intfIdx2 == -1) return err;
+	int err = addInternalRoute(id1, id2, loc1, ip2, subnet2);
+	if (err != 0) return err;
+	return addInternalRoute(id2, id1, loc2, ip1, subnet1);
+}
+
+int workerModifyInternalRoute(nodeId id, nodeId nextId, ip4Addr nextIp, const ip4Subnet* subnet, bool remove) {
+	char name[MAX_NODE_ID_BUFLEN];
+	idToNsName(id, name);
 
-	// We allow "route exists" errors because we might try to add routes to the
-	// same internal nodes multiple times. In practice, this is rare.
-	err = netModifyRoute(net1, false, netGetTableId(TableMain), ScopeGlobal, CreatorAdmin, subnet2->addr, subnet2->prefixLen, ip2, intfIdx1, true);
-	if (err != 0 && err != EEXIST) return err;
-	err = netModifyRoute(net2, false, netGetTableId(TableMain), ScopeGlobal, CreatorAdmin, subnet1->addr, subnet1->prefixLen, ip1, intfIdx2, true);
-	if (err != 0 && err != EEXIST) return err;
+	int err;
+	netContext* net = ncOpenNamespace(nc, id, name, false, false, &err);
+	if (net == NULL) return err;
 
-	return 0;
+	char intf[INTERFACE_BUF_LEN];
+	sprintf(intf, "%s-%u", NodeLinkPrefix, nextId);
+	int intfIdx = netGetInterfaceIndex(net, intf, &err);
+	if (intfIdx == -1) {
+		// Routes through deleted interfaces are removed by the kernel
+		if (remove && err == ENODEV) return 0;
+		return err;
+	}
+
+	err = netModifyRoute(net, remove, netGetTableId(TableMain), ScopeGlobal, CreatorAdmin, subnet->addr, subnet->prefixLen, nextIp, intfIdx, true);
+	if (remove && err == ESRCH) return 0;
+	return err;
 }
 
 int workerAddClientRoutes(nodeId clientId, macAddr clientMacs[], const ip4Subnet* subnet, uint32_t edgePort, uint32_t clientPorts[]) {
@@ -592,15 +990,17 @@ int workerAddClientRoutes(nodeId clientId, macAddr clientMacs[], const ip4Subnet
 	int selfIdx = netGetInterfaceIndex(net, SelfLinkPrefix, &err);
 	if (selfIdx == -1) return err;
 
+	// If we are recovering, some of the routes may already exist
+
 	// Default route for packets from other clients
 	err = netModifyRoute(net, false, netGetTableId(TableMain), ScopeLink, CreatorAdmin, rootIpOther, 32, 0, downIdx, true);
-	if (err != 0) return err;
+	if (err != 0 && !(recovering && err == EEXIST)) return err;
 	err = netModifyRoute(net, false, netGetTableId(TableMain), ScopeGlobal, CreatorAdmin, subnet->addr, subnet->prefixLen, rootIpOther, downIdx, true);
-	if (err != 0) return err;
+	if (err != 0 && !(recovering && err == EEXIST)) return err;
 
 	// Alternative route for packets from within the same subnet
 	err = netModifyRule(net, false, subnet, SelfLinkPrefix, CustomTableId, CreatorAdmin, CustomTablePriority, true);
-	if (err != 0) return err;
+	if (err != 0 && !(recovering && err == EEXIST)) return err;
 	// In kernel 4, we would assign the root only one IP address. We would set
 	// the link route to be through the self interface in the custom table, and
 	// the up/down interface in the main table. However, kernel 3 will not parse
@@ -608,9 +1008,9 @@ int workerAddClientRoutes(nodeId clientId, macAddr clientMacs[], const ip4Subnet
 	// adding the subnet route to the custom table. The workaround is to use two
 	// addresses and to place both link routes in the main table.
 	err = netModifyRoute(net, false, netGetTableId(TableMain), ScopeLink, CreatorAdmin, rootIpSelf, 32, 0, selfIdx, true);
-	if (err != 0) return err;
+	if (err != 0 && !(recovering && err == EEXIST)) return err;
 	err = netModifyRoute(net, false, CustomTableId, ScopeGlobal, CreatorAdmin, subnet->addr, subnet->prefixLen, rootIpSelf, selfIdx, true);
-	if (err != 0) return err;
+	if (err != 0 && !(recovering && err == EEXIST)) return err;
 
 	// At this point, the client namespace is fully set up. Now we add flow
 	// rules to the root switch
@@ -619,14 +1019,14 @@ int workerAddClientRoutes(nodeId clientId, macAddr clientMacs[], const ip4Subnet
 
 	// Incoming "self" link for intra-client communication
 	sprintRootSelfIntf(intfBuf, clientId);
-	err = ovsAddPort(rootSwitch, RootBridgeName, intfBuf);
+	err = ovsAddPort(rootSwitch, RootBridgeName, intfBuf, recovering);
 	if (err != 0) return err;
 	err = ovsAddIpFlow(rootSwitch, RootBridgeName, edgePort, subnet, subnet, &clientMacs[MAC_ROOT_SELF], &clientMacs[MAC_CLIENT_SELF], clientPorts[0], OvsPrioritySelf);
 	if (err != 0) return err;
 
 	// Incoming uplink for inter-client communication
 	sprintRootUpIntf(intfBuf, clientId);
-	err = ovsAddPort(rootSwitch, RootBridgeName, intfBuf);
+	err = ovsAddPort(rootSwitch, RootBridgeName, intfBuf, recovering);
 	if (err != 0) return err;
 	err = ovsAddIpFlow(rootSwitch, RootBridgeName, edgePort, subnet, NULL, &clientMacs[MAC_ROOT_OTHER], &clientMacs[MAC_CLIENT_OTHER], clientPorts[1], OvsPriorityIn);
 	if (err != 0) return err;
@@ -738,3 +1138,157 @@ int workerDestroyHosts(void) {
 	}
 	return res;
 }
+
+// Returns the amount of memory that the kernel reports as available for new
+// allocations, in bytes, or -1 if it cannot be determined.
+static int64_t availableMemory(void) {
+	FILE* f = fopen("/proc/meminfo", "re");
+	if (f == NULL) return -1;
+	int64_t bytes = -1;
+	char line[256];
+	while (fgets(line, sizeof(line), f) != NULL) {
+		long long kib;
+		if (sscanf(line, "MemAvailable: %lld kB", &kib) == 1) {
+			bytes = (int64_t)kib * 1024;
+			break;
+		}
+	}
+	fclose(f);
+	return bytes;
+}
+
+static int64_t memoryPerItem(int64_t before, int64_t after, uint32_t items) {
+	if (before < 0 || after < 0 || after >= before) return 0;
+	return (before - after) / (int64_t)items;
+}
+
+// Performs the benchmark from a child process. All namespaces are anonymous,
+// so everything that is created vanishes when the process exits.
+static int benchmarkChild(uint32_t samples, workBenchmarkResult* result) {
+	int err = 0;
+	netContext** nets = eacalloc(samples, sizeof(netContext*), 0);
+	ip4Iter* addrIter = NULL;
+	int* intfIdx = eamalloc(samples, sizeof(int), 0);
+
+	// Hosts: the same work as workerAddHost, minus the bind mount
+	int64_t memBefore = availableMemory();
+	gint64 start = g_get_monotonic_time();
+	for (uint32_t i = 0; i < samples; ++i) {
+		nets[i] = netOpenPrivateNamespace(&err);
+		if (nets[i] == NULL) goto cleanup;
+		err = applyNamespaceParams();
+		if (err != 0) goto cleanup;
+	}
+	gint64 end = g_get_monotonic_time();
+	result->hostSecs = (double)(end - start) / (double)G_USEC_PER_SEC / samples;
+	result->hostBytes = memoryPerItem(memBefore, availableMemory(), samples);
+
+	// Links: the same work as workerAddLink, between the first two namespaces
+	ip4Subnet linkSubnet;
+	ip4GetSubnet("10.0.0.0/8", &linkSubnet);
+	addrIter = ip4NewIter(&linkSubnet, true, NULL);
+	macAddr mac = { .octets = { 0 } };
+	ip4Addr gatewayIp = 0;
+	TopoLink link = { .latency = 1.0, .packetLoss = 0.0, .jitter = 0.0, .queueLen = 0 };
+	memBefore = availableMemory();
+	start = g_get_monotonic_time();
+	for (uint32_t i = 0; i < samples; ++i) {
+		char intfName[INTERFACE_BUF_LEN];
+		snprintf(intfName, INTERFACE_BUF_LEN, "%s-%u", NodeLinkPrefix, i);
+		macAddr macs[NEEDED_MACS_LINK];
+		ip4Addr ips[2];
+		for (int j = 0; j < 2; ++j) {
+			ip4IterNext(addrIter);
+			ips[j] = ip4IterAddr(addrIter);
+		}
+		macNextAddrs(&mac, macs, NEEDED_MACS_LINK);
+		int targetIdx;
+		err = buildVethPair(nets[0], nets[1], intfName, intfName, ips[0], ips[1], &macs[0], &macs[1], IP4_DEFAULT_MTU, 0, 0, &intfIdx[i], &targetIdx);
+		if (err != 0) goto cleanup;
+		err = netSetEgressShaping(nets[0], intfIdx[i], link.latency, link.jitter, link.packetLoss, 0.0, link.queueLen, true);
+		if (err != 0) goto cleanup;
+		err = netSetEgressShaping(nets[1], targetIdx, link.latency, link.jitter, link.packetLoss, 0.0, link.queueLen, true);
+		if (err != 0) goto cleanup;
+		err = netModifyRoute(nets[0], false, netGetTableId(TableMain), ScopeLink, CreatorAdmin, ips[1], 32, 0, intfIdx[i], true);
+		if (err != 0) goto cleanup;
+		err = netModifyRoute(nets[1], false, netGetTableId(TableMain), ScopeLink, CreatorAdmin, ips[0], 32, 0, targetIdx, true);
+		if (err != 0) goto cleanup;
+		if (i == 0) gatewayIp = ips[1];
+	}
+	end = g_get_monotonic_time();
+	result->linkSecs = (double)(end - start) / (double)G_USEC_PER_SEC / samples;
+	result->linkBytes = memoryPerItem(memBefore, availableMemory(), samples);
+
+	// Routes: the same work as one half of workerAddInternalRoutes
+	ip4Subnet routeSubnet;
+	ip4GetSubnet("172.16.0.0/12", &routeSubnet);
+	ip4FreeIter(addrIter);
+	addrIter = ip4NewIter(&routeSubnet, true, NULL);
+	start = g_get_monotonic_time();
+	for (uint32_t i = 0; i < samples; ++i) {
+		ip4IterNext(addrIter);
+		err = netModifyRoute(nets[0], false, netGetTableId(TableMain), ScopeGlobal, CreatorAdmin, ip4IterAddr(addrIter), 32, gatewayIp, intfIdx[0], true);
+		if (err != 0) goto cleanup;
+	}
+	end = g_get_monotonic_time();
+	result->routeSecs = (double)(end - start) / (double)G_USEC_PER_SEC / samples;
+
+cleanup:
+	if (addrIter != NULL) ip4FreeIter(addrIter);
+	for (uint32_t i = 0; i < samples; ++i) {
+		if (nets[i] != NULL) netCloseNamespace(nets[i], false);
+	}
+	free(intfIdx);
+	free(nets);
+	return err;
+}
+
+int workerBenchmark(uint32_t samples, workBenchmarkResult* result) {
+	if (samples < 2) samples = 2;
+	lprintf(LogDebug, "Benchmarking network construction with %u samples\n", samples);
+
+	int resultPipe[2];
+	errno = 0;
+	if (pipe(resultPipe) != 0) {
+		int err = errno;
+		lprintf(LogError, "Could not create benchmark pipe: %s\n", strerror(err));
+		return err;
+	}
+
+	// The benchmark runs in a separate process so that this worker's active
+	// namespace and contexts are not disturbed. With worker threads, the other
+	// workers may be running, and the child inherits any lock that they hold.
+	// Apart from the allocator, which the C library resets after a fork, the
+	// child only uses state guarded by the log lock, so that lock is held
+	// across the fork.
+	logHold();
+	errno = 0;
+	pid_t pid = fork();
+	int err = errno;
+	logRelease();
+	if (pid == -1) {
+		lprintf(LogError, "Could not fork to run benchmark: %s\n", strerror(err));
+		close(resultPipe[0]);
+		close(resultPipe[1]);
+		return err;
+	}
+	if (pid == 0) {
+		close(resultPipe[0]);
+		workBenchmarkResult childResult;
+		memset(&childResult, 0, sizeof(childResult));
+		err = benchmarkChild(samples, &childResult);
+		if (err == 0 && write(resultPipe[1], &childResult, sizeof(childResult)) != (ssize_t)sizeof(childResult)) err = 1;
+		_exit(err == 0 ? 0 : 1);
+	}
+	close(resultPipe[1]);
+	ssize_t got = read(resultPipe[0], result, sizeof(*result));
+	close(resultPipe[0]);
+
+	int status;
+	waitpid(pid, &status, 0);
+	if (got != (ssize_t)sizeof(*result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		lprintln(LogError, "The network construction benchmark failed");
+		return 1;
+	}
+	return 0;
+}
@@ -28,7 +28,9 @@
 #include <stdint.h>
 
 #include "ip.h"
+#include "net.h"
 #include "topology.h"
+#include "work.h"
 
 // Checks to see if the current thread has the required capabilities to be a
 // worker thread.
@@ -46,18 +48,48 @@ int workerInit(const char* nsPrefix, const char* ovsDirArg, const char* ovsSchem
 
 int workerCleanup(void);
 
+// Enables or disables recovery mode. In recovery mode, orders tolerate (and
+// replace) partial results left behind when an interrupted setup was killed
+// during the same order.
+void workerSetRecovery(bool enabled);
+
 // Actual order implementations. See work.h for documentation.
-int workerGetEdgeRemoteMac(const char* intfName, ip4Addr ip, macAddr* edgeRemoteMac);
+int workerGetEdgeRemoteMacs(netArpTarget targets[], size_t count);
 int workerGetEdgeLocalMac(const char* intfName, macAddr* edgeLocalMac);
 int workerGetInterfaceMtu(const char* intfName, int* mtu);
 int workerMtuSupported(int mtu, bool* supported, const char** failReason);
 int workerAddRoot(ip4Addr addrSelf, ip4Addr addrOther, int mtu, bool useInitNs, bool existing);
 int workerAddEdgeInterface(const char* intfName);
-int workerAddHost(nodeId id, ip4Addr ip, macAddr macs[], int mtu, const TopoNode* node);
+int workerAddHostPack(uint32_t pack);
+int workerAddHost(nodeId id, const workHostLoc* loc, ip4Addr ip, macAddr macs[], int mtu, const TopoNode* node);
 int workerSetSelfLink(nodeId id, const TopoLink* link);
-int workerEnsureSystemScaling(uint64_t linkCount, nodeId nodeCount, nodeId clientNodes);
-int workerAddLink(nodeId sourceId, nodeId targetId, ip4Addr sourceIp, ip4Addr targetIp, macAddr macs[], int mtu, const TopoLink* link);
-int workerAddInternalRoutes(nodeId id1, nodeId id2, ip4Addr ip1, ip4Addr ip2, const ip4Subnet* subnet1, const ip4Subnet* subnet2);
+int workerEnsureSystemScaling(const scalingCounts* counts, uint32_t workers);
+int workerAddLink(nodeId sourceId, nodeId targetId, const workHostLoc* sourceLoc, const workHostLoc* targetLoc, ip4Addr sourceIp, ip4Addr targetIp, macAddr macs[], int mtu, const TopoLink* link);
+
+// The two halves of workerAddLink, which may be executed by different workers.
+// workerAddLinkSource creates the virtual Ethernet pair and configures the
+// source's end. The target's end is placed in its namespace without opening a
+// context for it, and must then be configured with workerAddLinkTarget.
+int workerAddLinkSource(nodeId sourceId, nodeId targetId, const workHostLoc* sourceLoc, const workHostLoc* targetLoc, ip4Addr sourceIp, ip4Addr targetIp, macAddr macs[], int mtu, const TopoLink* link);
+int workerAddLinkTarget(nodeId sourceId, nodeId targetId, const workHostLoc* sourceLoc, const workHostLoc* targetLoc, ip4Addr sourceIp, ip4Addr targetIp, macAddr macs[], int mtu, const TopoLink* link);
+
+int workerAddTunnel(nodeId localId, nodeId remoteId, const workHostLoc* localLoc, ip4Addr localIp, ip4Addr remoteIp, macAddr macs[], int mtu, const TopoLink* link, uint32_t vni, ip4Addr underlayLocal, ip4Addr underlayRemote);
+
+// Sets the shaping of both ends of a link, or only of the source's end if
+// sourceOnly is true. Links are shaped symmetrically, so the target's end can
+// be shaped separately by swapping the hosts.
+int workerSetLinkShaping(nodeId sourceId, nodeId targetId, bool sourceOnly, const TopoLink* link);
+
+int workerRemoveLink(nodeId sourceId, nodeId targetId);
+int workerSetClientShaping(nodeId id, const TopoNode* node);
+int workerDestroyHost(nodeId id);
+int workerModifyInternalRoute(nodeId id, nodeId nextId, ip4Addr nextIp, const ip4Subnet* subnet, bool remove);
+int workerAddInternalRoutes(nodeId id1, nodeId id2, const workHostLoc* loc1, const workHostLoc* loc2, ip4Addr ip1, ip4Addr ip2, const ip4Subnet* subnet1, const ip4Subnet* subnet2);
 int workerAddClientRoutes(nodeId clientId, macAddr clientMacs[], const ip4Subnet* subnet, uint32_t edgePort, uint32_t clientPorts[]);
 int workerAddEdgeRoutes(const ip4Subnet* edgeSubnet, uint32_t edgePort, const macAddr* edgeLocalMac, const macAddr* edgeRemoteMac);
 int workerDestroyHosts(void);
+
+// Ensure that a host or link created by an interrupted setup still exists.
+int workerCheckHost(nodeId id, const workHostLoc* loc);
+int workerCheckLink(nodeId sourceId, nodeId targetId, const workHostLoc* sourceLoc, const workHostLoc* targetLoc);
+int workerBenchmark(uint32_t samples, workBenchmarkResult* result);